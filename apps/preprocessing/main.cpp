@@ -8,6 +8,7 @@
 #include <omp.h>
 #include <iostream>
 #include <chrono>
+#include <thread>
 
 #include <lamure/pre/builder.h>
 #include <boost/program_options.hpp>
@@ -96,7 +97,8 @@ int main(int argc, const char *argv[])
           po::value<float>()->default_value(0.0f),
           "the application will remove (<outlier-ratio> * total_num_surfels) points "
           " with the max avg-distance to it's k-nearest neighbors from the input point "
-          "cloud before computing the LODs")
+          "cloud before computing the LODs. Outliers are removed from the leaves during "
+          "the downsweep, the count is approximate")
 
         ("num-outlier-neighbours",
           po::value<int>()->default_value(24),
@@ -110,6 +112,38 @@ int main(int argc, const char *argv[])
         ("keep-interm,k",
          "prevents deletion of intermediate files")
 
+        ("shards",
+         po::value<int>()->default_value(0),
+         "split the input into at least this many spatial shards. Every shard "
+         "is built by a separate process and the shards are merged into one "
+         "tree afterwards")
+
+        ("shard-jobs",
+         po::value<int>()->default_value(1),
+         "maximum number of shard processes running at the same time. The "
+         "memory budget and the OpenMP threads are split between them, the "
+         "other worker threads of every process still use all cores")
+
+        ("update",
+         po::value<std::string>()->default_value(""),
+         "insert the surfels of INPUT into an existing tree (.bvh with its .lod "
+         "next to it). Only the affected nodes are rebuilt, both files are "
+         "replaced in place")
+
+        ("mmap",
+         "access intermediate files through memory mappings instead of "
+         "file streams (not available on Windows)")
+
+        ("direct-io",
+         "write the .lod with O_DIRECT during upsweep, bypassing the page "
+         "cache (Linux only, falls back to buffered writes)")
+
+        ("checkpoint-upsweep",
+         "write a checkpoint after every level of the upsweep. If a checkpoint "
+         "of an interrupted run is found, the upsweep resumes at the last "
+         "completed level. Per-level timings and memory of every upsweep are "
+         "logged to <output>.upsweep_stats")
+
         ("resample",
          "resample to replace huge surfels by collection of smaller one")
 
@@ -128,6 +162,14 @@ int main(int argc, const char *argv[])
          "  .prov for single float value per line\n"
          "  .xyz_prov for xyzrgb +p per line")
 
+        ("prov-aggregation",
+         po::value<std::string>()->default_value("weighted_mean"),
+         "How provenance values of merged surfels are combined by reduction\n"
+         "strategies other than ndc_prov. Possible values:\n"
+         "  mean - arithmetic mean\n"
+         "  weighted_mean - mean weighted by surfel area\n"
+         "  max - component-wise maximum")
+
         ("reduction-algo",
          po::value<std::string>()->default_value("ndc"),
          "Reduction strategy for the LOD construction. Possible values:\n"
@@ -172,7 +214,11 @@ int main(int argc, const char *argv[])
     od_hidden.add_options()
         ("files,i",
          po::value<std::vector<std::string>>()->composing()->required(),
-         "files");
+         "files")
+
+        ("shard-manifest",
+         po::value<std::string>()->default_value(""),
+         "build a single shard of a sharded construction (set by the parent process)");
 
     od_cmd.add(od_hidden).add(od);
 
@@ -371,6 +417,34 @@ int main(int argc, const char *argv[])
         desc.recompute_leaf_radii         = vm.count("recompute_radii");
 
         desc.keep_intermediate_files      = vm.count("keep-interm");
+        desc.checkpoint_upsweep           = vm.count("checkpoint-upsweep");
+        desc.use_mmap                     = vm.count("mmap");
+        desc.direct_io                    = vm.count("direct-io");
+        desc.num_shards                   = std::max(vm["shards"].as<int>(), 0);
+        desc.num_shard_jobs               = std::max(vm["shard-jobs"].as<int>(), 1);
+        desc.shard_manifest               = vm["shard-manifest"].as<std::string>();
+        desc.update_tree                  = vm["update"].as<std::string>();
+
+        // shard workers are started with the same options, except for input and sharding
+        const fs::path executable(argv[0]);
+        desc.shard_command                = "\"" + (executable.has_parent_path() ? fs::absolute(executable) : executable).string() + "\"";
+        for (int arg_index = 1; arg_index < argc; ++arg_index) {
+            const std::string arg = argv[arg_index];
+            if (arg == files[0]) {
+                continue;
+            }
+            // the memory budget is split between the shard jobs
+            if (arg == "-i" || arg == "--files" || arg == "--shards" || arg == "--shard-jobs"
+                || arg == "-m" || arg == "--memory-budget") {
+                ++arg_index;
+                continue;
+            }
+            if (arg.find("--shards=") == 0 || arg.find("--shard-jobs=") == 0
+                || arg.find("--memory-budget=") == 0 || arg.find("-m") == 0) {
+                continue;
+            }
+            desc.shard_command += " \"" + arg + "\"";
+        }
         desc.resample                     = vm.count("resample");
         // manual check because typed_value doenst support check whether default is used
 
@@ -386,7 +460,20 @@ int main(int argc, const char *argv[])
         //optional prov file
         desc.prov_file                    = vm["prov-file"].as<std::string>();
 
-        if (desc.prov_file != "") {
+        const std::string prov_aggregation = vm["prov-aggregation"].as<std::string>();
+        if (prov_aggregation == "mean")
+            desc.prov_aggregation         = lamure::pre::attribute_aggregation::mean;
+        else if (prov_aggregation == "weighted_mean")
+            desc.prov_aggregation         = lamure::pre::attribute_aggregation::weighted_mean;
+        else if (prov_aggregation == "max")
+            desc.prov_aggregation         = lamure::pre::attribute_aggregation::max;
+        else {
+            std::cerr << "Unknown provenance aggregation" << details_msg;
+            return EXIT_FAILURE;
+        }
+
+        // every reduction strategy carries provenance, ndc_prov stays the default for it
+        if (desc.prov_file != "" && vm["reduction-algo"].defaulted()) {
             std::cout << "Provenance data found -> using --reduction-algo ndc_prov" << std::endl;
             desc.reduction_algo           = lamure::pre::reduction_algorithm::ndc_prov;
         }
@@ -5,10 +5,14 @@
 // Faculty of Media, Bauhaus-Universitaet Weimar
 // http://www.uni-weimar.de/medien/vr
 
+#include <algorithm>
 #include <chrono>
+#include <sys/resource.h>
+#include <lamure/prov/auxi.h>
 #include <lamure/prov/common.h>
 #include <lamure/prov/dense_cache.h>
 #include <lamure/prov/dense_stream.h>
+#include <lamure/prov/octree.h>
 #include <lamure/prov/sparse_cache.h>
 #include <lamure/prov/sparse_octree.h>
 
@@ -34,14 +38,96 @@ bool check_file_extensions(string name_file, const char *pext)
     return false;
 }
 
+void benchmark_aux_octree(const string &name_file_aux)
+{
+    lamure::prov::auxi aux;
+    aux.load_aux_file(name_file_aux);
+
+    lamure::prov::octree tree;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    tree.create(aux.get_sparse_points());
+    auto end = std::chrono::high_resolution_clock::now();
+    printf("\nAux octree creation from %lu sparse points took: %f ms\n", (unsigned long)aux.get_num_sparse_points(), std::chrono::duration<double, std::milli>(end - start).count());
+
+    uint64_t num_fotos = 0;
+    for(uint64_t i = 0; i < tree.get_num_nodes(); ++i)
+    {
+        num_fotos += tree.get_node(i).get_fotos().size();
+    }
+
+    uint64_t node_bytes = tree.get_num_nodes() * sizeof(lamure::prov::octree_node) + num_fotos * sizeof(uint32_t);
+    printf("Aux octree nodes: %lu, depth: %u, camera ids: %lu, node memory: %f MB\n", (unsigned long)tree.get_num_nodes(), tree.get_depth(), (unsigned long)num_fotos,
+           node_bytes / (1024.0 * 1024.0));
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("Peak resident memory: %f MB\n", usage.ru_maxrss / 1024.0);
+
+    std::vector<scm::math::vec3f> positions;
+    positions.reserve(aux.get_num_sparse_points());
+    for(const auto &point : aux.get_sparse_points())
+    {
+        positions.push_back(point.pos_);
+    }
+    std::random_shuffle(positions.begin(), positions.end());
+
+    std::vector<uint64_t> single_node_ids(positions.size());
+
+    start = std::chrono::high_resolution_clock::now();
+    for(uint64_t i = 0; i < positions.size(); ++i)
+    {
+        single_node_ids[i] = tree.query(positions[i]);
+    }
+    end = std::chrono::high_resolution_clock::now();
+    printf("\nAux octree single queries: %f queries/s\n", positions.size() / std::chrono::duration<double>(end - start).count());
+
+    std::vector<uint64_t> batched_node_ids;
+
+    start = std::chrono::high_resolution_clock::now();
+    tree.query(positions, batched_node_ids);
+    end = std::chrono::high_resolution_clock::now();
+    printf("Aux octree batched queries: %f queries/s\n", positions.size() / std::chrono::duration<double>(end - start).count());
+
+    uint64_t num_mismatches = 0;
+    for(uint64_t i = 0; i < positions.size(); ++i)
+    {
+        if(single_node_ids[i] != batched_node_ids[i])
+        {
+            ++num_mismatches;
+        }
+    }
+    printf("Aux octree batched query mismatches: %lu of %lu\n", (unsigned long)num_mismatches, (unsigned long)positions.size());
+}
+
 int main(int argc, char *argv[])
 {
-    if(argc == 1 || !cmd_option_exists(argv, argv + argc, "-s") || !cmd_option_exists(argv, argv + argc, "-d"))
+    bool has_aux = cmd_option_exists(argv, argv + argc, "-a");
+
+    if(argc == 1 || ((!cmd_option_exists(argv, argv + argc, "-s") || !cmd_option_exists(argv, argv + argc, "-d")) && !has_aux))
     {
-        cout << "Usage: " << argv[0] << " <flags> -s <project>.sparse.prov  -d <project>.dense.prov" << endl << endl;
+        cout << "Usage: " << argv[0] << " <flags> -s <project>.sparse.prov  -d <project>.dense.prov" << endl;
+        cout << "       " << argv[0] << " -a <project>.aux" << endl << endl;
         return -1;
     }
 
+    if(has_aux)
+    {
+        string name_file_aux = string(get_cmd_option(argv, argv + argc, "-a"));
+
+        if(check_file_extensions(name_file_aux, ".aux"))
+        {
+            throw std::runtime_error("File format is incompatible");
+        }
+
+        benchmark_aux_octree(name_file_aux);
+
+        if(!cmd_option_exists(argv, argv + argc, "-s") || !cmd_option_exists(argv, argv + argc, "-d"))
+        {
+            return 0;
+        }
+    }
+
     string name_file_sparse = string(get_cmd_option(argv, argv + argc, "-s"));
     string name_file_dense = string(get_cmd_option(argv, argv + argc, "-d"));
     string name_file_bvh = string(get_cmd_option(argv, argv + argc, "-l"));
@@ -136,5 +222,40 @@ int main(int argc, char *argv[])
     printf("\nSparse octree randomized lookup debug took: %f ms\n", std::chrono::duration<double, std::milli>(end - start));
     printf("\nTime elapsed per lookup: %f ms\n", std::chrono::duration<double, std::milli>(end - start) / 1000000);
 
+    std::vector<lamure::prov::vec3f> positions;
+    positions.reserve(cache_dense.get_points().size());
+    for(uint64_t i = 0; i < cache_dense.get_points().size(); i++)
+    {
+        positions.push_back(cache_dense.get_points().at(i).get_position());
+    }
+    std::random_shuffle(positions.begin(), positions.end());
+
+    std::vector<lamure::prov::OctreeNode *> single_nodes(positions.size());
+
+    start = std::chrono::high_resolution_clock::now();
+    for(uint64_t i = 0; i < positions.size(); i++)
+    {
+        single_nodes.at(i) = recovered_sparse_octree.lookup_node_at_position(positions.at(i));
+    }
+    end = std::chrono::high_resolution_clock::now();
+    printf("\nSparse octree single lookups: %f queries/s\n", positions.size() / std::chrono::duration<double>(end - start).count());
+
+    std::vector<uint64_t> node_ids;
+
+    start = std::chrono::high_resolution_clock::now();
+    recovered_sparse_octree.lookup_nodes_at_positions(positions, node_ids);
+    end = std::chrono::high_resolution_clock::now();
+    printf("\nSparse octree batched lookups: %f queries/s\n", positions.size() / std::chrono::duration<double>(end - start).count());
+
+    uint64_t num_mismatches = 0;
+    for(uint64_t i = 0; i < positions.size(); i++)
+    {
+        if(single_nodes.at(i) != recovered_sparse_octree.get_node_by_id(node_ids.at(i)))
+        {
+            num_mismatches++;
+        }
+    }
+    printf("Sparse octree batched lookup mismatches: %lu of %lu\n", (unsigned long)num_mismatches, (unsigned long)positions.size());
+
     return 0;
 }
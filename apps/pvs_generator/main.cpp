@@ -10,13 +10,16 @@
 #include <vector>
 #include <chrono>
 #include <fstream>
+#include <memory>
 
 #include <lamure/pvs/visibility_test.h>
 #include <lamure/pvs/visibility_test_id_histogram_renderer.h>
 #include <lamure/pvs/visibility_test_id_histogram_renderer_corners.h>
 #include <lamure/pvs/visibility_test_simple_randomized_id_histogram_renderer.h>
+#include <lamure/pvs/visibility_test_id_histogram_rasterizer.h>
 
 #include <lamure/pvs/grid.h>
+#include <lamure/pvs/grid_regular_compressed.h>
 #include <lamure/pvs/grid_octree.h>
 #include <lamure/pvs/grid_octree_compressed.h>
 #include <lamure/pvs/grid_octree_hierarchical.h>
@@ -31,6 +34,7 @@
 #include <lamure/pvs/pvs_bounds_extrapolator_from_outer_cells.h>
 
 #include <lamure/pvs/pvs_database.h>
+#include <lamure/pvs/pvs_stream_writer.h>
 #include <lamure/pvs/pvs_utils.h>
 
 #include <lamure/ren/model_database.h>
@@ -40,6 +44,33 @@
 #define PVS_MAIN_MEASURE_PERFORMANCE
 #define PVS_MAIN_MEASURE_VISIBILITY           // Will output some info on the calculated visibility into a special file.
 
+// Only the cells at the border of the grid are required to extrapolate the bounding visibility,
+// so a grid written by streaming does not have to be loaded completely.
+void load_outer_cell_visibility(lamure::pvs::grid* input_grid, const std::string& pvs_file_path)
+{
+    scm::math::vec3d grid_min = input_grid->get_position_center() - input_grid->get_size() * 0.5;
+    scm::math::vec3d grid_max = input_grid->get_position_center() + input_grid->get_size() * 0.5;
+
+    for(size_t cell_index = 0; cell_index < input_grid->get_cell_count(); ++cell_index)
+    {
+        const lamure::pvs::view_cell* current_cell = input_grid->get_cell_at_index(cell_index);
+        scm::math::vec3d cell_min = current_cell->get_position_center() - current_cell->get_size() * 0.5;
+        scm::math::vec3d cell_max = current_cell->get_position_center() + current_cell->get_size() * 0.5;
+
+        // Cell bounds are computed the same way as the grid bounds, still allow for rounding.
+        double epsilon = std::min(current_cell->get_size().x, std::min(current_cell->get_size().y, current_cell->get_size().z)) * 0.01;
+
+        bool is_outer_cell = cell_min.x - grid_min.x < epsilon || grid_max.x - cell_max.x < epsilon ||
+                             cell_min.y - grid_min.y < epsilon || grid_max.y - cell_max.y < epsilon ||
+                             cell_min.z - grid_min.z < epsilon || grid_max.z - cell_max.z < epsilon;
+
+        if(is_outer_cell)
+        {
+            input_grid->load_cell_visibility_from_file(pvs_file_path, cell_index);
+        }
+    }
+}
+
 int main(int argc, char** argv)
 {
 #ifdef PVS_MAIN_MEASURE_PERFORMANCE
@@ -55,6 +86,8 @@ int main(int argc, char** argv)
     unsigned int num_steps = 11;
     double oversize_factor = 1.5;
     float optimization_threshold = 1.0f;
+    bool stream_visibility = false;
+    unsigned int stream_memory_budget = 1024;
 
     namespace po = boost::program_options;
     namespace fs = boost::filesystem;
@@ -70,12 +103,14 @@ int main(int argc, char** argv)
                                "Allowed Options");
     desc.add_options()
       ("pvs-file,p", po::value<std::string>(&pvs_output_file_path), "specify output file of calculated pvs data (.pvs)")
-      ("vistest", po::value<std::string>(&visibility_test_type)->default_value("hrc"), "specify type of visibility test to be used. Default is histogram renderer with corners. (histogram renderer 'hr', histogram renderer with corners 'hrc', simple randomized histogram renderer 'srhr')")
+      ("vistest", po::value<std::string>(&visibility_test_type)->default_value("hrc"), "specify type of visibility test to be used. Default is histogram renderer with corners. (histogram renderer 'hr', histogram renderer with corners 'hrc', simple randomized histogram renderer 'srhr', headless CPU histogram rasterizer 'cpu')")
       ("gridtype", po::value<std::string>(&grid_type)->default_value("irregular_compressed"), "specify type of grid to store visibility data. Default is irregular compressed grid. ('regular', 'regular_compressed', 'irregular', 'irregular_compressed', octree', 'octree_compressed', octree_hierarchical', 'octree_hierarchical_v2', 'octree_hierarchical_v3')")
       ("gridsize", po::value<unsigned int>(&grid_size)->default_value(1), "specify size/depth of the grid used for the visibility test (depends on chosen grid type)")
       ("oversize", po::value<double>(&oversize_factor)->default_value(1.5), "factor the grid bounds will be scaled by. Default is 1.5 (so grid bounds will exceed scene bounds by factor of 1.5)")
       ("optithresh", po::value<float>(&optimization_threshold)->default_value(-1.0f), "specify the threshold at which common data are converged (percent value between 0 and 1). Negative values will deactivate optimization process. Default value is -1.0, so grid optimization is deactivated.")
-      ("numsteps,n", po::value<unsigned int>(&num_steps)->default_value(11), "specify the number of intervals the occlusion values will be split into (visibility analysis only). Default value is 11.");
+      ("numsteps,n", po::value<unsigned int>(&num_steps)->default_value(11), "specify the number of intervals the occlusion values will be split into (visibility analysis only). Default value is 11.")
+      ("stream", po::bool_switch(&stream_visibility), "write finished view cells directly into the pvs file instead of keeping the whole grid in memory (compressed grid types and vistest 'cpu' only). An interrupted run continues from the checkpoint next to the pvs file. Grid optimization and visibility analysis are skipped.")
+      ("streammem", po::value<unsigned int>(&stream_memory_budget)->default_value(1024), "specify the main memory in MB finished view cells may occupy before they are written (streaming only). Default value is 1024.");
       ;
 
     // Parse additonal passed parameters.
@@ -106,6 +141,10 @@ int main(int argc, char** argv)
     {
         vt = new lamure::pvs::visibility_test_simple_randomized_id_histogram_renderer();
     }
+    else if(visibility_test_type == "cpu")
+    {
+        vt = new lamure::pvs::visibility_test_id_histogram_rasterizer();
+    }
     else
     {
         std::cout << "Invalid visibility test: " << visibility_test_type << ".\n" << desc;
@@ -157,6 +196,15 @@ int main(int argc, char** argv)
         return 0;
     }
 
+    if(stream_visibility &&
+        grid_type != lamure::pvs::grid_regular_compressed::get_grid_identifier() &&
+        grid_type != lamure::pvs::grid_irregular_compressed::get_grid_identifier() &&
+        grid_type != lamure::pvs::grid_octree_compressed::get_grid_identifier())
+    {
+        std::cout << "Streaming requires a compressed grid type, not " << grid_type << std::endl << desc;
+        return 0;
+    }
+
     // Make sure optimization threshold is within certain bounds (0-100% or disabled).
     if(optimization_threshold > 1.0f)
     {
@@ -182,15 +230,6 @@ int main(int argc, char** argv)
     start_time = std::chrono::system_clock::now();
 #endif
 
-    // Run visibility test on given scene and grid.
-    vt->test_visibility(test_grid);
-
-#ifdef PVS_MAIN_MEASURE_PERFORMANCE
-    end_time = std::chrono::system_clock::now();
-    std::chrono::duration<double> elapsed_seconds = end_time - start_time;
-    double visibility_test_time = elapsed_seconds.count();
-#endif
-
     // Save grid containing visibility information to file.
     std::string pvs_grid_output_file_path = pvs_output_file_path;
     if(pvs_grid_output_file_path != "")
@@ -199,6 +238,39 @@ int main(int argc, char** argv)
         pvs_grid_output_file_path = pvs_grid_output_file_path + "grid";
     }
 
+    // Run visibility test on given scene and grid.
+    std::unique_ptr<lamure::pvs::pvs_stream_writer> stream_writer;
+
+    if(stream_visibility)
+    {
+        // Merging cells requires the visibility of all cells at once.
+        optimization_threshold = -1.0f;
+
+        stream_writer.reset(new lamure::pvs::pvs_stream_writer(test_grid, size_t(stream_memory_budget) * 1024 * 1024));
+
+        if(!stream_writer->open(pvs_output_file_path))
+        {
+            std::cout << "Unable to create checkpoint " << lamure::pvs::pvs_stream_writer::get_checkpoint_file_path(pvs_output_file_path) << std::endl;
+            return 0;
+        }
+
+        if(!vt->test_visibility_streamed(test_grid, stream_writer.get()))
+        {
+            std::cout << "Visibility test " << visibility_test_type << " does not support streaming." << std::endl << desc;
+            return 0;
+        }
+    }
+    else
+    {
+        vt->test_visibility(test_grid);
+    }
+
+#ifdef PVS_MAIN_MEASURE_PERFORMANCE
+    end_time = std::chrono::system_clock::now();
+    std::chrono::duration<double> elapsed_seconds = end_time - start_time;
+    double visibility_test_time = elapsed_seconds.count();
+#endif
+
 #ifdef PVS_MAIN_MEASURE_PERFORMANCE
     start_time = std::chrono::system_clock::now();
 #endif
@@ -247,7 +319,10 @@ int main(int argc, char** argv)
     visibility_file_path.resize(visibility_file_path.size() - 4);
     visibility_file_path += "_visibility.txt";
 
-    lamure::pvs::analyze_grid_visibility(test_grid, num_steps, visibility_file_path);
+    if(!stream_visibility)
+    {
+        lamure::pvs::analyze_grid_visibility(test_grid, num_steps, visibility_file_path);
+    }
 #endif
 
 #ifdef PVS_MAIN_MEASURE_PERFORMANCE
@@ -261,7 +336,20 @@ int main(int argc, char** argv)
     std::cout << "Start writing grid file..." << std::endl;
     test_grid->save_grid_to_file(pvs_grid_output_file_path);
     std::cout << "Finished writing grid file.\nStart writing pvs file..." << std::endl;
-    test_grid->save_visibility_to_file(pvs_output_file_path);
+    if(stream_visibility)
+    {
+        if(!stream_writer->finish())
+        {
+            std::cout << "Failed to write pvs file, view cells are kept in " << lamure::pvs::pvs_stream_writer::get_checkpoint_file_path(pvs_output_file_path) << std::endl;
+            return 0;
+        }
+
+        load_outer_cell_visibility(test_grid, pvs_output_file_path);
+    }
+    else
+    {
+        test_grid->save_visibility_to_file(pvs_output_file_path);
+    }
     std::cout << "Finished writing pvs file." << std::endl;
 
     std::cout << "Creating and saving bounding visibility data..." << std::endl;
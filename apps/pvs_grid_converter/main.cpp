@@ -6,11 +6,14 @@
 // http://www.uni-weimar.de/medien/vr
 
 #include <algorithm>
+#include <chrono>
+#include <random>
 #include <string>
 #include <vector>
 #include <iostream>
 
 #include <lamure/pvs/pvs_database.h>
+#include <lamure/pvs/pvs_file.h>
 #include <lamure/pvs/pvs_utils.h>
 
 #include <lamure/pvs/grid_regular.h>
@@ -30,6 +33,44 @@
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
 
+// Decodes all blocks of a visibility file in sequential and in random order, returns cells per second of both runs.
+std::pair<double, double> measure_decode_throughput(const std::string& file_path, const size_t& num_cells)
+{
+    lamure::pvs::pvs_file visibility_file;
+    if(!visibility_file.open(file_path, num_cells))
+    {
+        return std::make_pair(0.0, 0.0);
+    }
+
+    std::vector<size_t> cell_order(num_cells);
+    for(size_t cell_index = 0; cell_index < num_cells; ++cell_index)
+    {
+        cell_order[cell_index] = cell_index;
+    }
+
+    double throughput[2] = {0.0, 0.0};
+    for(size_t run_index = 0; run_index < 2; ++run_index)
+    {
+        if(run_index == 1)
+        {
+            std::shuffle(cell_order.begin(), cell_order.end(), std::mt19937(42));
+        }
+
+        std::chrono::time_point<std::chrono::system_clock> start_time = std::chrono::system_clock::now();
+        size_t decoded_bytes = 0;
+
+        for(size_t cell_index : cell_order)
+        {
+            decoded_bytes += visibility_file.read_block(cell_index).size();
+        }
+
+        std::chrono::duration<double> elapsed_seconds = std::chrono::system_clock::now() - start_time;
+        throughput[run_index] = elapsed_seconds.count() > 0.0 ? num_cells / elapsed_seconds.count() : 0.0;
+    }
+
+    return std::make_pair(throughput[0], throughput[1]);
+}
+
 int main(int argc, char** argv)
 {
     // Read additional data from input parameters.
@@ -38,6 +79,8 @@ int main(int argc, char** argv)
     std::string pvs_output_file_path = "";
     std::string output_grid_type = "";
     float optimization_threshold = 1.0f;
+    bool upgrade_file_format = false;
+    bool compare_encodings = false;
 
     namespace po = boost::program_options;
     namespace fs = boost::filesystem;
@@ -55,7 +98,9 @@ int main(int argc, char** argv)
       ("2nd-pvs-file", po::value<std::string>(&second_pvs_input_file_path), "(optional) specify second input file of calculated pvs data (.pvs) to join visibility with first pvs file")
       ("output-file", po::value<std::string>(&pvs_output_file_path), "specify output file of converted visibility data (.pvs)")
       ("gridtype", po::value<std::string>(&output_grid_type), "specify type of grid to store visibility data. If no grid type is given, the input grid type will be used. ('regular', 'regular_compressed', 'irregular', 'irregular_compressed', octree', 'octree_compressed', octree_hierarchical', 'octree_hierarchical_v2', 'octree_hierarchical_v3')")
-      ("optithresh", po::value<float>(&optimization_threshold)->default_value(-1.0f), "specify the threshold at which common data are converged (percent value between 0 and 1). Negative values will deactivate optimization process. Default value is -1.0, so grid optimization is deactivated.");
+      ("optithresh", po::value<float>(&optimization_threshold)->default_value(-1.0f), "specify the threshold at which common data are converged (percent value between 0 and 1). Negative values will deactivate optimization process. Default value is -1.0, so grid optimization is deactivated.")
+      ("upgrade", po::bool_switch(&upgrade_file_format), "rewrite the visibility data of a compressed grid ('regular_compressed', 'irregular_compressed', 'octree_compressed') in the current pvs file format without converting the grid. Version 2 files store a block offset table, so single view cells are loaded without scanning the file. Regular compressed grids are written as version 3, which stores most view cells as delta to a neighbouring cell.")
+      ("compare-encodings", po::bool_switch(&compare_encodings), "write the visibility data of a regular compressed grid delta coded to the output file and gzip compressed per view cell next to it, then print file sizes and decode throughput of both.");
       ;
 
     po::variables_map vm;
@@ -101,6 +146,94 @@ int main(int argc, char** argv)
         return 0;
     }
 
+    // Compare the delta coded visibility file against independently compressed view cells.
+    if(compare_encodings)
+    {
+        if(input_grid->get_grid_type() != lamure::pvs::grid_regular_compressed::get_grid_identifier())
+        {
+            std::cout << "Only regular compressed grids use delta coding, detected '" << input_grid->get_grid_type() << "'." << std::endl;
+            return 0;
+        }
+
+        if(!input_grid->load_visibility_from_file(pvs_input_file_path))
+        {
+            std::cout << "Error loading input visibility: " << pvs_input_file_path << std::endl;
+            return 0;
+        }
+
+        // Written next to the output file, whatever extension the output file has.
+        fs::path gzip_output_path(pvs_output_file_path);
+        gzip_output_path.replace_extension();
+        std::string gzip_output_file_path = gzip_output_path.string() + "_gzip.pvs";
+
+        std::vector<lamure::node_t> ids;
+        for(size_t model_index = 0; model_index < input_grid->get_num_models(); ++model_index)
+        {
+            ids.push_back(input_grid->get_num_nodes(model_index));
+        }
+
+        size_t num_cells = input_grid->get_cell_count();
+
+        std::chrono::time_point<std::chrono::system_clock> start_time = std::chrono::system_clock::now();
+        input_grid->save_visibility_to_file(pvs_output_file_path);
+        std::chrono::duration<double> delta_encode_seconds = std::chrono::system_clock::now() - start_time;
+
+        start_time = std::chrono::system_clock::now();
+        std::vector<std::string> compressed_blocks;
+        compressed_blocks.reserve(num_cells);
+        for(size_t cell_index = 0; cell_index < num_cells; ++cell_index)
+        {
+            compressed_blocks.push_back(lamure::pvs::pvs_file::compress_block(lamure::pvs::pvs_file::encode_cell_visibility(input_grid->get_cell_at_index(cell_index), ids)));
+        }
+        lamure::pvs::pvs_file::write(gzip_output_file_path, compressed_blocks);
+        std::chrono::duration<double> gzip_encode_seconds = std::chrono::system_clock::now() - start_time;
+
+        std::pair<double, double> delta_decode = measure_decode_throughput(pvs_output_file_path, num_cells);
+        std::pair<double, double> gzip_decode = measure_decode_throughput(gzip_output_file_path, num_cells);
+
+        std::cout << "---------- gzip per view cell ----------" << std::endl;
+        std::cout << "file size in bytes: " << fs::file_size(gzip_output_file_path) << std::endl;
+        std::cout << "encoding: " << num_cells / gzip_encode_seconds.count() << " cells/s" << std::endl;
+        std::cout << "decoding: " << gzip_decode.first << " cells/s sequential, " << gzip_decode.second << " cells/s random" << std::endl;
+
+        std::cout << "---------- delta coded ----------" << std::endl;
+        std::cout << "file size in bytes: " << fs::file_size(pvs_output_file_path) << std::endl;
+        std::cout << "encoding: " << num_cells / delta_encode_seconds.count() << " cells/s" << std::endl;
+        std::cout << "decoding: " << delta_decode.first << " cells/s sequential, " << delta_decode.second << " cells/s random" << std::endl;
+
+        return 0;
+    }
+
+    // Only rewrite the visibility file, the grid stays untouched.
+    if(upgrade_file_format)
+    {
+        if(input_grid->get_grid_type() != lamure::pvs::grid_regular_compressed::get_grid_identifier() &&
+            input_grid->get_grid_type() != lamure::pvs::grid_irregular_compressed::get_grid_identifier() &&
+            input_grid->get_grid_type() != lamure::pvs::grid_octree_compressed::get_grid_identifier())
+        {
+            std::cout << "Only compressed grid types can be upgraded, detected '" << input_grid->get_grid_type() << "'." << std::endl;
+            return 0;
+        }
+
+        std::cout << "Input pvs file format version " << lamure::pvs::pvs_file::read_version(pvs_input_file_path) << "." << std::endl;
+
+        if(!input_grid->load_visibility_from_file(pvs_input_file_path))
+        {
+            std::cout << "Error loading input visibility: " << pvs_input_file_path << std::endl;
+            return 0;
+        }
+
+        std::string grid_output_file_path = pvs_output_file_path;
+        grid_output_file_path.resize(grid_output_file_path.length() - 3);
+        grid_output_file_path += "grid";
+
+        input_grid->save_grid_to_file(grid_output_file_path);
+        input_grid->save_visibility_to_file(pvs_output_file_path);
+
+        std::cout << "Upgraded pvs file to format version " << lamure::pvs::pvs_file::read_version(pvs_output_file_path) << "." << std::endl;
+        return 0;
+    }
+
     if(input_grid->get_grid_type() != lamure::pvs::grid_regular::get_grid_identifier() && 
         input_grid->get_grid_type() != lamure::pvs::grid_regular_compressed::get_grid_identifier() && 
         input_grid->get_grid_type() != lamure::pvs::grid_octree_hierarchical_v3::get_grid_identifier() &&
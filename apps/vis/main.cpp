@@ -1752,7 +1752,7 @@ void brush() {
         if (settings_.octrees_[selection_.selected_model_]) {
           uint64_t selected_node_id = settings_.octrees_[selection_.selected_model_]->query(intersection.position_);
           if (selected_node_id > 0) {
-            const std::set<uint32_t>& imgs = settings_.octrees_[selection_.selected_model_]->get_node(selected_node_id).get_fotos();
+            const std::vector<uint32_t>& imgs = settings_.octrees_[selection_.selected_model_]->get_node(selected_node_id).get_fotos();
 
             selection_.selected_views_.insert(imgs.begin(), imgs.end());
 
@@ -196,7 +196,13 @@ int main(int argc, const char *argv[])
         desc.surfels_per_node             = 1024;
         desc.translate_to_origin          = !vm.count("no-translate-to-origin");
         desc.resample                     = true;
+        desc.checkpoint_upsweep           = false;
+        desc.use_mmap                     = false;
+        desc.direct_io                    = false;
+        desc.num_shards                   = 0;
+        desc.num_shard_jobs               = 1;
         desc.outlier_ratio                = 0.0f;
+        desc.prov_aggregation             = lamure::pre::attribute_aggregation::weighted_mean;
         // preprocess
         lamure::pre::builder builder(desc);
         if (!builder.resample())
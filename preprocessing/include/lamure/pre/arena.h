@@ -0,0 +1,161 @@
+// Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
+// This Software is distributed under the Modified BSD License, see license.txt.
+//
+// Virtual Reality and Visualization Research Group 
+// Faculty of Media, Bauhaus-Universitaet Weimar
+// http://www.uni-weimar.de/medien/vr
+
+#ifndef PRE_ARENA_H_
+#define PRE_ARENA_H_
+
+#include <lamure/pre/platform.h>
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <new>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace lamure
+{
+namespace pre
+{
+
+/**
+* Bump allocator for per-node temporaries. Every thread owns one arena,
+* memory is handed out while an arena_scope is open and given back in one
+* step when the outermost scope closes.
+*/
+class PREPROCESSING_DLL monotonic_arena
+{
+public:
+
+    explicit monotonic_arena(const size_t block_size = size_t(1) << 20);
+    ~monotonic_arena();
+
+    monotonic_arena(const monotonic_arena &) = delete;
+    monotonic_arena &operator=(const monotonic_arena &) = delete;
+
+    // arena of the calling thread
+    static monotonic_arena &local();
+
+    void *allocate(const size_t bytes, const size_t alignment);
+
+    const bool in_scope() const { return num_scopes_ > 0; }
+    size_t capacity() const;
+
+private:
+    friend class arena_scope;
+
+    struct marker
+    {
+        size_t block;
+        size_t offset;
+    };
+
+    struct block
+    {
+        char *data;
+        size_t size;
+    };
+
+    marker enter_scope();
+    void leave_scope(const marker &m);
+
+    std::vector<block> blocks_;
+    size_t current_block_;
+    size_t offset_;
+    size_t block_size_;
+    uint32_t num_scopes_;
+};
+
+/**
+* Opens a scope on an arena. Everything allocated from the arena inside
+* the scope is released when it closes, so no arena backed container may
+* outlive it. Scopes nest; a container created in an outer scope must not
+* grow while an inner one is open.
+*/
+class PREPROCESSING_DLL arena_scope
+{
+public:
+    explicit arena_scope(monotonic_arena &arena = monotonic_arena::local());
+    ~arena_scope();
+
+    arena_scope(const arena_scope &) = delete;
+    arena_scope &operator=(const arena_scope &) = delete;
+
+private:
+    monotonic_arena &arena_;
+    monotonic_arena::marker marker_;
+};
+
+/**
+* Standard allocator on the arena of the allocating thread. Outside of an
+* arena_scope, and on threads without one (e.g. OpenMP workers), it falls
+* back to the heap. A small header records where each allocation came from,
+* so containers may be freed on any thread.
+*/
+template<typename T>
+class arena_allocator
+{
+public:
+    using value_type = T;
+
+    arena_allocator() noexcept {}
+    template<typename U>
+    arena_allocator(const arena_allocator<U> &) noexcept {}
+
+    T *allocate(const size_t n)
+    {
+        static_assert(alignof(T) <= header_size, "over-aligned types are not supported");
+        const size_t bytes = n * sizeof(T) + header_size;
+        monotonic_arena &arena = monotonic_arena::local();
+        const bool from_arena = arena.in_scope();
+        char *raw = from_arena ? static_cast<char *>(arena.allocate(bytes, header_size))
+                               : static_cast<char *>(::operator new(bytes));
+        raw[header_size - 1] = from_arena ? 1 : 0;
+        return reinterpret_cast<T *>(raw + header_size);
+    }
+
+    void deallocate(T *ptr, const size_t) noexcept
+    {
+        char *raw = reinterpret_cast<char *>(ptr) - header_size;
+        if (raw[header_size - 1] == 0)
+            ::operator delete(raw);
+    }
+
+    template<typename U>
+    bool operator==(const arena_allocator<U> &) const noexcept { return true; }
+    template<typename U>
+    bool operator!=(const arena_allocator<U> &) const noexcept { return false; }
+
+private:
+    static const size_t header_size = 16;
+};
+
+template<typename T>
+using arena_vector = std::vector<T, arena_allocator<T>>;
+
+template<typename T>
+using arena_list = std::list<T, arena_allocator<T>>;
+
+template<typename T>
+using arena_unordered_set = std::unordered_set<T, std::hash<T>, std::equal_to<T>, arena_allocator<T>>;
+
+template<typename K, typename V>
+using arena_unordered_map = std::unordered_map<K, V, std::hash<K>, std::equal_to<K>, arena_allocator<std::pair<const K, V>>>;
+
+// shared_ptr with object and control block on the arena
+template<typename T, typename... Args>
+std::shared_ptr<T> make_arena_shared(Args &&... args)
+{
+    return std::allocate_shared<T>(arena_allocator<T>(), std::forward<Args>(args)...);
+}
+
+}
+} // namespace lamure
+
+#endif // PRE_ARENA_H_
@@ -0,0 +1,93 @@
+// Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
+// This Software is distributed under the Modified BSD License, see license.txt.
+//
+// Virtual Reality and Visualization Research Group
+// Faculty of Media, Bauhaus-Universitaet Weimar
+// http://www.uni-weimar.de/medien/vr
+
+#ifndef PRE_ATTRIBUTE_CHANNEL_H_
+#define PRE_ATTRIBUTE_CHANNEL_H_
+
+#include <lamure/pre/common.h>
+#include <lamure/pre/platform.h>
+#include <lamure/pre/prov.h>
+#include <lamure/pre/surfel.h>
+#include <lamure/pre/surfel_mem_array.h>
+
+#include <vector>
+
+namespace lamure
+{
+namespace pre
+{
+
+/**
+ * Provenance payload of a single surfel while it is being reduced.
+ *
+ * A reduction strategy keeps one accumulator next to each surfel it works
+ * on and merges the accumulators whenever it merges surfels. The payload is
+ * only resolved once the representative surfel is final.
+ */
+class PREPROCESSING_DLL attribute_accumulator
+{
+public:
+
+    void add(const prov_data &value, const vec3f &normal, const real weight);
+
+    // moves all samples of other into this accumulator
+    void merge(attribute_accumulator &other);
+
+    bool empty() const { return samples_.empty(); }
+    size_t num_samples() const { return samples_.size(); }
+
+    prov_data resolve(const surfel &representative,
+                      const attribute_aggregation aggregation) const;
+
+private:
+
+    struct sample
+    {
+        prov_data value;
+        vec3f normal;
+        real weight;
+    };
+
+    std::vector<sample> samples_;
+
+};
+
+/**
+ * Carries the provenance data of the input nodes through create_lod.
+ */
+class PREPROCESSING_DLL attribute_channel
+{
+public:
+
+    explicit attribute_channel(const attribute_aggregation aggregation)
+        : aggregation_(aggregation) {}
+
+    attribute_aggregation aggregation() const { return aggregation_; }
+
+    // accumulator holding a single input surfel, weighted by its area
+    attribute_accumulator source(const surfel_mem_array &array,
+                                 const size_t index) const;
+
+    // copy of output with one resolved prov_data per surfel
+    surfel_mem_array attach(const surfel_mem_array &output,
+                            const std::vector<attribute_accumulator> &accumulators) const;
+
+    // for strategies that do not track their merges, every input surfel is
+    // accounted to the output surfel with the closest centre
+    surfel_mem_array transfer(const std::vector<surfel_mem_array *> &input,
+                              const surfel_mem_array &output) const;
+
+private:
+
+    attribute_aggregation aggregation_;
+
+};
+
+} // namespace pre
+} // namespace lamure
+
+#endif // PRE_ATTRIBUTE_CHANNEL_H_
@@ -9,9 +9,11 @@
 #define PRE_BUILDER_H_
 
 #include <string>
+#include <vector>
 
 #include <lamure/pre/platform.h>
 #include <lamure/pre/common.h>
+#include <lamure/types.h>
 
 #include <boost/filesystem.hpp>
 
@@ -41,6 +43,23 @@ public:
         bool recompute_leaf_normals;
         bool recompute_leaf_radii;
         bool keep_intermediate_files;
+        bool checkpoint_upsweep;
+        // intermediate files are memory mapped instead of accessed through streams
+        bool use_mmap;
+        // the .lod written during upsweep bypasses the page cache (O_DIRECT)
+        bool direct_io;
+
+        // sharded construction: the input is split into num_shards spatial
+        // shards, each is built by running shard_command with the shard file
+        // and "--shard-manifest <file>" appended, at most num_shard_jobs at once
+        uint32_t num_shards;
+        uint32_t num_shard_jobs;
+        std::string shard_command;
+        // set for shard workers only, see builder::construct_sharded
+        std::string shard_manifest;
+
+        // if set, the input surfels are inserted into this existing .bvh/.lod
+        std::string update_tree;
         bool resample;
         float memory_budget;
         float radius_multiplier;
@@ -52,6 +71,8 @@ public:
 
         rep_radius_algorithm rep_radius_algo;
         reduction_algorithm reduction_algo;
+        // how provenance values are combined when surfels are merged
+        attribute_aggregation prov_aggregation;
         radius_computation_algorithm radius_computation_algo;
         normal_computation_algorithm normal_computation_algo;
     };
@@ -75,9 +96,35 @@ private:
                                     uint16_t start_stage,
                                     reduction_strategy const *reduction_strategy,
                                     normal_computation_strategy const *normal_comp_strategy,
-                                    radius_computation_strategy const *radius_comp_strategy) const;
+                                    radius_computation_strategy const *radius_comp_strategy,
+                                    bool write_lod) const;
     bool resample_surfels(boost::filesystem::path const &input_file) const;
-    bool reserialize(boost::filesystem::path const &input_file, uint16_t start_stage) const;
+    bool reserialize(boost::filesystem::path const &input_file, uint16_t start_stage, bool lod_written) const;
+    bool update(boost::filesystem::path const &input_file,
+                uint16_t start_stage,
+                reduction_strategy const *reduction_strategy,
+                normal_computation_strategy const *normal_comp_strategy,
+                radius_computation_strategy const *radius_comp_strategy) const;
+
+    // tree properties shared by all shards of a sharded construction
+    struct shard_layout
+    {
+        uint32_t fan_factor;
+        uint32_t depth;
+        size_t max_surfels_per_node;
+        uint32_t shard_level;
+        vec3r translation;
+    };
+
+    bool construct_sharded(boost::filesystem::path input_file,
+                           uint16_t start_stage,
+                           reduction_strategy const *reduction_strategy,
+                           normal_computation_strategy const *normal_comp_strategy,
+                           radius_computation_strategy const *radius_comp_strategy) const;
+    bool run_shard_jobs(std::vector<std::string> const &shard_files,
+                        boost::filesystem::path const &manifest_file) const;
+    void write_shard_layout(boost::filesystem::path const &manifest_file, shard_layout const &layout) const;
+    shard_layout read_shard_layout(boost::filesystem::path const &manifest_file) const;
 
     size_t calculate_memory_limit() const;
 
@@ -9,13 +9,17 @@
 #define PRE_BVH_H_
 
 #include <lamure/atomic_counter.h>
+#include <lamure/config.h>
+#include <lamure/pre/arena.h>
 #include <lamure/pre/bvh_node.h>
 #include <lamure/pre/common.h>
 #include <lamure/pre/io/file.h>
 #include <lamure/pre/logger.h>
+#include <lamure/pre/memory_governor.h>
 #include <lamure/pre/node_serializer.h>
 #include <lamure/pre/normal_computation_strategy.h>
 #include <lamure/pre/platform.h>
+#include <lamure/pre/quantile_sketch.h>
 #include <lamure/pre/radius_computation_strategy.h>
 #include <lamure/pre/reduction_strategy.h>
 
@@ -23,6 +27,7 @@
 
 #include <atomic>
 #include <boost/filesystem.hpp>
+#include <future>
 #include <unordered_set>
 
 namespace lamure
@@ -61,6 +66,12 @@ class PREPROCESSING_DLL bvh
 
     void init_tree(const std::string &surfels_input_file, const uint32_t max_fan_factor, const size_t desired_surfels_per_node, const boost::filesystem::path &base_path);
 
+    /**
+     * Initializes a tree with given properties instead of deriving them from
+     * the input size. Used for shards, which must fit into a common tree.
+     */
+    void init_tree(const uint8_t fan_factor, const uint32_t depth, const size_t max_surfels_per_node, const boost::filesystem::path &base_path);
+
     bool load_tree(const std::string &kdn_input_file);
 
     state_type state() const { return state_; }
@@ -95,32 +106,143 @@ class PREPROCESSING_DLL bvh
 
     std::vector<std::pair<surfel_id_t, real>> get_nearest_neighbours(const surfel_id_t target_surfel, const uint32_t num_neighbours, const bool do_local_search = false) const;
 
+    /**
+     * Same as above, but writes into a caller provided vector so its capacity
+     * can be reused between queries. Traversal state lives on the arena of
+     * the calling thread.
+     */
+    void get_nearest_neighbours(const surfel_id_t target_surfel, const uint32_t num_neighbours, std::vector<std::pair<surfel_id_t, real>> &candidates,
+                                const bool do_local_search = false) const;
+
     std::vector<std::pair<surfel_id_t, real>> get_nearest_neighbours_in_nodes(const surfel_id_t target_surfel, const std::vector<node_id_type> &target_nodes, const uint32_t num_neighbours) const;
 
     std::vector<std::pair<surfel_id_t, real>> get_natural_neighbours(const surfel_id_t &target_surfel, std::vector<std::pair<surfel_id_t, real>> const &nearest_neighbours) const;
 
     std::vector<std::pair<surfel, real>> get_locally_natural_neighbours(std::vector<surfel> const &potential_neighbour_vec, vec3r const &poi, uint32_t num_nearest_neighbours) const;
 
+    // natural neighbours in the best fit plane of the neighbours, see natural_neighbours::compute
     std::vector<std::pair<uint32_t, real>> extract_approximate_natural_neighbours(vec3r const &target_surfel, std::vector<vec3r> const &all_nearest_neighbours) const;
 
+#ifdef LAMURE_USE_CGAL_FOR_NNI
+    // reference implementation with a Delaunay triangulation and Sibson coordinates
+    std::vector<std::pair<uint32_t, real>> extract_natural_neighbours_delaunay(vec3r const &target_surfel, std::vector<vec3r> const &all_nearest_neighbours) const;
+#endif
+
     void print_tree_properties() const;
     const node_id_type first_leaf() const { return first_leaf_; }
 
     // processing functions
     void downsweep(bool adjust_translation, const std::string &surfels_input_file, const std::string &prov_input_file);
 
+    /**
+     * Splits the input into spatial shards, one per node of the given tree level.
+     * The top levels are built with sort_and_split exactly as in downsweep, the
+     * surfels of every node at shard_level are written to a separate file.
+     *
+     * \param[in] surfels_input_file  Binary surfel file
+     * \param[in] shard_level         Tree level whose nodes become shards
+     * \param[in] adjust_translation  Translate surfels by the root AABB center
+     * \return                        Shard files in node order
+     */
+    std::vector<std::string> split_into_shards(const std::string &surfels_input_file, const uint32_t shard_level, const bool adjust_translation);
+
+    /**
+     * Assembles the tree from shard trees after their upsweep. Shard nodes are
+     * referenced in place, a following upsweep() only builds the top levels
+     * above shard_level.
+     */
+    void merge_shards(const std::vector<std::string> &shard_tree_files, const uint32_t shard_level, const vec3r &translation);
+
     void compute_normals_and_radii(const uint16_t number_of_neighbours);
 
-    void compute_normal_and_radius(const bvh_node *source_node, const normal_computation_strategy &normal_computation_strategy, const radius_computation_strategy &radius_computation_strategy, bool compute_normals, bool compute_radii);
+    void compute_normal_and_radius(const bvh_node *source_node, const normal_computation_strategy &normal_computation_strategy, const radius_computation_strategy &radius_computation_strategy, bool compute_normals, bool compute_radii,
+                                   const size_t first_surfel = 0);
 
     void upsweep(const reduction_strategy &reduction_strategy, const normal_computation_strategy &normal_comp_strategy, const radius_computation_strategy &radius_comp_strategy,
                  bool resample = false, bool recompute_leaf_normals = true, bool recompute_leaf_radii = true);
     void resample();
 
-    surfel_vector remove_outliers_statistically(uint32_t num_outliers, uint16_t num_neighbours);
+    /**
+     * Enables per-level checkpoints during upsweep. After every completed level
+     * the tree is serialized next to the level temp files and a manifest is
+     * updated, so that an interrupted upsweep can be resumed. The manifest
+     * records size and modification time of the source tree file.
+     *
+     * \param[in] source_tree_file  .bvhd file the upsweep started from
+     */
+    void enable_upsweep_checkpoints(const bool enable, const std::string &source_tree_file);
+
+    /**
+     * Writes the LOD file during upsweep. Every completed level is handed to
+     * a write-behind node_serializer and written while the next level is
+     * computed, so serialize_surfels_to_file() is not needed afterwards.
+     * Levels completed before a resume are written at the start of upsweep.
+     */
+    void enable_lod_write_behind(const std::string &lod_file, const bool direct_io = false)
+    {
+        write_behind_lod_file_ = lod_file;
+        write_behind_direct_io_ = direct_io;
+    }
+
+    /**
+     * Restores the tree from the checkpoint referenced by an upsweep manifest.
+     * A following call to upsweep() continues above the last completed level.
+     * Checkpoints written for another version of the source tree are ignored.
+     *
+     * \param[in] manifest_file     Manifest written by a checkpointed upsweep
+     * \param[in] source_tree_file  .bvhd file the upsweep starts from
+     * \return                      false if there is no usable checkpoint
+     */
+    bool load_upsweep_checkpoint(const std::string &manifest_file, const std::string &source_tree_file);
+
+    /* removes the manifest and the checkpoint tree of the last upsweep,
+     * or of the checkpoint an earlier run left behind
+     */
+    void remove_upsweep_checkpoint() const;
+
+    boost::filesystem::path upsweep_manifest_path() const;
+    boost::filesystem::path upsweep_stats_path() const;
+
+    /**
+     * Enables statistical outlier removal during downsweep. Once the leaves
+     * are split, every surfel is scored by the mean squared distance to its
+     * nearest neighbours. Surfels scoring above the (1 - outlier_ratio)
+     * quantile of all scores are dropped from their leaf before it is
+     * written, so no second downsweep is required.
+     */
+    void enable_outlier_removal(const float outlier_ratio, const uint16_t num_neighbours)
+    {
+        outlier_ratio_ = outlier_ratio;
+        num_outlier_neighbours_ = num_neighbours;
+    }
+
+    size_t num_removed_outliers() const { return num_removed_outliers_; }
+
+    /**
+     * Inserts new surfels into a serialized tree. Each surfel goes to the leaf
+     * closest to it, only these leaves and their ancestors are rebuilt. Nodes
+     * are read from the LOD file on demand: the dirty nodes and the siblings
+     * needed as reduction input.
+     * Leaves exceeding the node capacity are reduced to it.
+     *
+     * \param[in] lod_input_file  LOD file belonging to the loaded tree
+     * \param[in] new_surfels     Surfels in input coordinates
+     * \return                    Ids of all rebuilt nodes in ascending order
+     */
+    std::vector<node_id_type> insert_surfels(const std::string &lod_input_file, const surfel_vector &new_surfels, const reduction_strategy &reduction_strgy,
+                                             const normal_computation_strategy &normal_strategy, const radius_computation_strategy &radius_strategy,
+                                             bool compute_normals, bool compute_radii);
+
+    /**
+     * Writes a LOD file in which the given nodes are taken from memory and all
+     * other node ranges are block-copied from the previous LOD file.
+     */
+    void serialize_updated_surfels_to_file(const std::string &lod_input_file, const std::string &lod_output_file, const std::vector<node_id_type> &updated_nodes,
+                                           const size_t buffer_size) const;
 
     void serialize_tree_to_file(const std::string &output_file, bool write_intermediate_data);
 
+    // an empty lod_output_file only writes the provenance, e.g. after a write-behind upsweep
     void serialize_surfels_to_file(const std::string &lod_output_file, const std::string &prov_output_file, const size_t buffer_size) const;
 
     /* resets all nodes and deletes temp files
@@ -151,8 +273,20 @@ class PREPROCESSING_DLL bvh
     void spawn_compute_bounding_boxes_upsweep_jobs(const uint32_t first_node_of_level, const uint32_t last_node_of_level, const int32_t level);
     void spawn_split_node_jobs(size_t &slice_left, size_t &slice_right, size_t &new_slice_left, size_t &new_slice_right, const uint32_t level);
 
-    void thread_remove_outlier_jobs(const uint32_t start_marker, const uint32_t end_marker, const uint32_t num_outliers, const uint16_t num_neighbours,
-                                    std::vector<std::pair<surfel_id_t, real>> &intermediate_outliers_for_thread);
+    void remove_outliers_in_leaves(const size_t slice_left, const size_t slice_right);
+    void thread_compute_outlier_scores(const uint32_t start_marker, const uint32_t end_marker, std::vector<std::vector<float>> &scores, quantile_sketch &sketch_for_thread);
+    /* neighbourhoods and normals of the surfels of a node, a worker thread
+     * keeps them for all of its nodes and accounts them as resident memory */
+    struct attribute_buffers
+    {
+        std::vector<std::vector<std::pair<surfel_id_t, real>>> neighbourhoods;
+        std::vector<vec3f> normals;
+        memory_reservation memory{0, memory_reservation::kind::resident};
+    };
+
+    void compute_normal_and_radius(const bvh_node *source_node, const normal_computation_strategy &normal_computation_strategy, const radius_computation_strategy &radius_computation_strategy, bool compute_normals, bool compute_radii,
+                                   const size_t first_surfel, attribute_buffers &buffers);
+
     void thread_compute_attributes(const uint32_t start_marker, const uint32_t end_marker, const bool update_percentage, const normal_computation_strategy &normal_strategy,
                                    const radius_computation_strategy &radius_strategy, const bool is_leaf_level, bool compute_normals, bool compute_radii);
     void thread_create_lod(const uint32_t start_marker, const uint32_t end_marker, const bool update_percentage, const reduction_strategy &reduction_strgy, const bool resample);
@@ -162,6 +296,11 @@ class PREPROCESSING_DLL bvh
                                 const uint32_t num_threads);
     void thread_resample(const uint32_t start_marker, const uint32_t end_marker, const bool update_percentage);
 
+    std::future<void> write_upsweep_checkpoint_async(const int32_t completed_level, const shared_surfel_file &level_file, const shared_prov_file &prov_level_file);
+
+    /* size and modification time of a tree file, empty if it cannot be read */
+    static std::string get_upsweep_source_identity(const std::string &source_tree_file);
+
   private:
     surfel_vector resampled_leaf_level_;
     std::mutex resample_mutex_;
@@ -189,11 +328,23 @@ class PREPROCESSING_DLL bvh
 
     vec3r translation_ = vec3r(0.0); ///< translation of surfels
 
+    bool write_upsweep_checkpoints_ = false;
+    int32_t upsweep_resume_level_ = -1;      ///< last level completed before a resume, -1 if none
+    std::string upsweep_checkpoint_tree_;    ///< tree file referenced by the current manifest
+    std::string upsweep_source_identity_;    ///< size and modification time of the source tree file
+
+    std::string write_behind_lod_file_;      ///< LOD file written during upsweep, empty if disabled
+    bool write_behind_direct_io_ = false;
+
+    float outlier_ratio_ = 0.0f;             ///< share of surfels removed during downsweep, 0 disables
+    uint16_t num_outlier_neighbours_ = 0;
+    size_t num_removed_outliers_ = 0;
+
     void downsweep_subtree_in_core(const bvh_node &node, size_t &disk_leaf_destination, uint32_t &processed_nodes, uint8_t &percent_processed, 
         shared_surfel_file leaf_level_access, shared_prov_file prov_leaf_level_access);
 
-    void get_descendant_leaves(const node_id_type node, std::vector<node_id_type> &result, const node_id_type first_leaf, const std::unordered_set<size_t> &excluded_leaves) const;
-    void get_descendant_nodes(const node_id_type node, std::vector<node_id_type> &result, const node_id_type desired_depth, const std::unordered_set<size_t> &excluded_nodes) const;
+    void get_descendant_leaves(const node_id_type node, arena_vector<node_id_type> &result, const node_id_type first_leaf, const arena_unordered_set<size_t> &excluded_leaves) const;
+    void get_descendant_nodes(const node_id_type node, arena_vector<node_id_type> &result, const node_id_type desired_depth, const arena_unordered_set<size_t> &excluded_nodes) const;
 
     surfel_mem_array resample_node(uint32_t node_id) const;
 };
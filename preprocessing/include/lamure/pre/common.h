@@ -47,6 +47,14 @@ enum class reduction_algorithm
     ndc_prov = 11
 };
 
+// how the provenance values of merged surfels are combined
+enum class attribute_aggregation
+{
+    mean = 0,
+    weighted_mean = 1,
+    max = 2
+};
+
 }
 }
 
@@ -0,0 +1,195 @@
+// Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
+// This Software is distributed under the Modified BSD License, see license.txt.
+//
+// Virtual Reality and Visualization Research Group
+// Faculty of Media, Bauhaus-Universitaet Weimar
+// http://www.uni-weimar.de/medien/vr
+
+#ifndef PRE_INDEXED_MIN_HEAP_H_
+#define PRE_INDEXED_MIN_HEAP_H_
+
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace lamure
+{
+namespace pre
+{
+
+/**
+ * Addressable binary min-heap over dense integer ids.
+ *
+ * Every id is stored at most once together with its key. The position of
+ * each id inside the heap is tracked, so keys can be changed in both
+ * directions and entries removed in O(log n) without rebuilding the heap.
+ */
+template<typename key_t, typename compare_t = std::less<key_t>>
+class indexed_min_heap
+{
+public:
+
+    explicit indexed_min_heap(const size_t capacity = 0,
+                              const compare_t &compare = compare_t())
+        : compare_(compare)
+    { reserve(capacity); }
+
+    void reserve(const size_t capacity)
+    {
+        if (capacity > positions_.size()) {
+            positions_.resize(capacity, invalid_position);
+            keys_.resize(capacity);
+        }
+        heap_.reserve(capacity);
+    }
+
+    bool empty() const { return heap_.empty(); }
+    size_t size() const { return heap_.size(); }
+
+    bool contains(const size_t id) const
+    { return id < positions_.size() && positions_[id] != invalid_position; }
+
+    const key_t &key(const size_t id) const
+    {
+        assert(contains(id));
+        return keys_[id];
+    }
+
+    size_t top() const
+    {
+        assert(!empty());
+        return heap_.front();
+    }
+
+    const key_t &top_key() const { return keys_[top()]; }
+
+    void push(const size_t id, const key_t &key)
+    {
+        if (contains(id)) {
+            update(id, key);
+            return;
+        }
+        reserve(id + 1);
+        keys_[id] = key;
+        positions_[id] = heap_.size();
+        heap_.push_back(id);
+        sift_up(heap_.size() - 1);
+    }
+
+    void pop()
+    {
+        assert(!empty());
+        erase(heap_.front());
+    }
+
+    /**
+     * Changes the key of an id already in the heap; acts as decrease-key
+     * as well as increase-key.
+     */
+    void update(const size_t id, const key_t &key)
+    {
+        assert(contains(id));
+        const size_t pos = positions_[id];
+        const bool decreased = compare_(key, keys_[id]);
+        keys_[id] = key;
+        if (decreased) {
+            sift_up(pos);
+        }
+        else {
+            sift_down(pos);
+        }
+    }
+
+    void erase(const size_t id)
+    {
+        if (!contains(id)) {
+            return;
+        }
+        const size_t pos = positions_[id];
+        const size_t last = heap_.size() - 1;
+        if (pos != last) {
+            swap_entries(pos, last);
+        }
+        heap_.pop_back();
+        positions_[id] = invalid_position;
+
+        if (pos < heap_.size()) {
+            // the former last entry may have to move in either direction
+            const size_t moved_id = heap_[pos];
+            sift_up(pos);
+            sift_down(positions_[moved_id]);
+        }
+    }
+
+    void clear()
+    {
+        for (const size_t id : heap_) {
+            positions_[id] = invalid_position;
+        }
+        heap_.clear();
+    }
+
+private:
+
+    static const size_t invalid_position = std::numeric_limits<size_t>::max();
+
+    bool less(const size_t left_pos, const size_t right_pos) const
+    { return compare_(keys_[heap_[left_pos]], keys_[heap_[right_pos]]); }
+
+    void swap_entries(const size_t left_pos, const size_t right_pos)
+    {
+        std::swap(heap_[left_pos], heap_[right_pos]);
+        positions_[heap_[left_pos]] = left_pos;
+        positions_[heap_[right_pos]] = right_pos;
+    }
+
+    void sift_up(size_t pos)
+    {
+        while (pos > 0) {
+            const size_t parent = (pos - 1) / 2;
+            if (!less(pos, parent)) {
+                break;
+            }
+            swap_entries(pos, parent);
+            pos = parent;
+        }
+    }
+
+    void sift_down(size_t pos)
+    {
+        const size_t num_entries = heap_.size();
+        while (true) {
+            const size_t left = 2 * pos + 1;
+            const size_t right = left + 1;
+            size_t smallest = pos;
+            if (left < num_entries && less(left, smallest)) {
+                smallest = left;
+            }
+            if (right < num_entries && less(right, smallest)) {
+                smallest = right;
+            }
+            if (smallest == pos) {
+                break;
+            }
+            swap_entries(pos, smallest);
+            pos = smallest;
+        }
+    }
+
+    compare_t compare_;
+    std::vector<size_t> heap_;
+    std::vector<size_t> positions_;
+    std::vector<key_t> keys_;
+
+};
+
+template<typename key_t, typename compare_t>
+const size_t indexed_min_heap<key_t, compare_t>::invalid_position;
+
+} // namespace pre
+} // namespace lamure
+
+#endif // PRE_INDEXED_MIN_HEAP_H_
@@ -8,22 +8,30 @@
 #ifndef PRE_CONVERTER_H_
 #define PRE_CONVERTER_H_
 
-#include <mutex>
-#include <condition_variable>
-
 #include <lamure/pre/platform.h>
 #include <lamure/pre/io/format_abstract.h>
 
 #include <lamure/pre/logger.h>
 
+#include <algorithm>
+#include <thread>
+
 namespace lamure
 {
 namespace pre
 {
 
+/**
+ * Converts between point cloud formats in three stages: the input format is
+ * parsed on the calling thread, batches of surfels are filtered and
+ * transformed by a set of worker threads, and a writer thread hands them to
+ * the output format in input order. All queues between the stages are
+ * bounded, so the memory use stays in the range of buffer_size.
+ */
 class PREPROCESSING_DLL converter
 {
 public:
+    // called from the worker threads concurrently, must not modify shared state
     typedef std::function<void(surfel &, bool &)> surfel_modifier_function;
 
     explicit converter(format_abstract &in_format,
@@ -39,6 +47,7 @@ public:
           discarded_(0)
     {
         surfels_in_buffer_ = buffer_size / sizeof(surfel);
+        num_workers_ = std::max(std::thread::hardware_concurrency(), 3u) - 2;
     }
 
     virtual             ~converter()
@@ -74,16 +83,19 @@ public:
     void set_surfel_callback(const surfel_modifier_function &callback)
     { surfel_callback_ = callback; }
 
+    // number of threads transforming surfels between reader and writer
+    void set_num_workers(const size_t num_workers)
+    { num_workers_ = std::max(num_workers, size_t(1)); }
+
 private:
 
-    bool flush_ready_ = false;
-    bool flush_done_ = false;
+    typedef std::function<void(const format_abstract::surfel_callback_funtion &)> surfel_source_function;
 
-    std::mutex mtx_;
-    std::condition_variable cv_;
+    void run_pipeline(const surfel_source_function &source,
+                      const std::string &output_filename);
 
-    void append_surfel(const surfel &surfel);
-    void flush_buffer();
+    // applies filter and modifications in place, returns false if the surfel is dropped
+    bool transform_surfel(surfel &s) const;
     const bool is_degenerate(const surfel &s) const;
 
     format_abstract &in_format_;
@@ -91,13 +103,12 @@ private:
 
     vec3r translation_;
     size_t surfels_in_buffer_;
+    size_t num_workers_;
     bool override_radius_;
     bool override_color_;
     real scale_factor_;
     surfel_modifier_function surfel_callback_;
 
-    surfel_vector buffer_;
-
     real new_radius_;
     vec3b new_color_;
     size_t discarded_;
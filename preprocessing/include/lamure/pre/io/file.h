@@ -21,6 +21,33 @@
 namespace lamure {
 namespace pre {
 
+// stream: seek + read/write per access
+// mapped: the file is mapped in windows, accesses are plain copies (POSIX only)
+enum class file_access
+{
+    stream = 0,
+    mapped = 1
+};
+
+inline file_access &default_file_access_ref()
+{
+    static file_access access = file_access::stream;
+    return access;
+}
+
+// backend of all files opened afterwards
+inline void set_default_file_access(const file_access access)
+{
+#ifdef _WIN32
+    default_file_access_ref() = file_access::stream;
+#else
+    default_file_access_ref() = access;
+#endif
+}
+
+inline file_access default_file_access()
+{ return default_file_access_ref(); }
+
 template<typename T>
 class PREPROCESSING_DLL file
 {
@@ -33,6 +60,7 @@ public:
     void open(const std::string &file_name,
               const bool truncate = false);
     void close(const bool remove = false);
+    void flush();
     const bool is_open() const;
     const size_t get_size() const;
     const std::string &file_name() const
@@ -55,6 +83,12 @@ public:
               const size_t length) const;
     const T read(const size_t pos_in_file) const;
 
+    const file_access access() const
+    { return access_; }
+
+    // madvise hint for mapped files, sequential is the default
+    void set_sequential_access(const bool sequential);
+
 private:
 
     mutable std::mutex read_write_mutex_;
@@ -64,6 +98,27 @@ private:
     void write_data(char *data, const size_t offset_in_file, const size_t length);
     void read_data(char *data, const size_t offset_in_file, const size_t length) const;
 
+    // mapped backend, all helpers expect read_write_mutex_ to be held
+    static size_t mapped_window_size()
+    { return sizeof(void *) == 4 ? (size_t(64) << 20) : (size_t(1) << 30); }
+    static size_t max_mapped_windows()
+    { return sizeof(void *) == 4 ? 8 : 64; }
+
+    char *map_window(const size_t window_index) const;
+    void unmap_windows() const;
+    void reserve_mapped(const size_t num_bytes);
+    void copy_mapped(char *data, const size_t byte_offset, const size_t num_bytes, const bool to_file) const;
+
+    file_access access_ = file_access::stream;
+    int fd_ = -1;
+    bool sequential_ = true;
+    size_t size_bytes_ = 0;
+    size_t capacity_bytes_ = 0;
+    mutable std::vector<char *> windows_;
+    mutable std::vector<uint64_t> window_last_use_;
+    mutable uint64_t window_use_counter_ = 0;
+    mutable size_t num_mapped_windows_ = 0;
+
 };
 
 } // namespace pre
@@ -5,10 +5,18 @@
 // Faculty of Media, Bauhaus-Universitaet Weimar
 // http://www.uni-weimar.de/medien/vr
 
+#include <algorithm>
 #include <stdexcept>
 #include <cstdio>
 #include <cstring>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include <lamure/pre/logger.h>
 
 namespace lamure {
@@ -75,6 +83,21 @@ close(const bool remove)
     }
 }
 
+template<typename T>
+void file<T>::
+flush()
+{
+    std::lock_guard<std::mutex> lock(read_write_mutex_);
+
+    if (is_open()) {
+        stream_.flush();
+        if (stream_.fail() || stream_.bad()) {
+            LOGGER_ERROR("Flush failed. file: \"" << file_name_ <<
+                                               "\". " << strerror(errno));
+        }
+    }
+}
+
 template<typename T>
 const bool file<T>::
 is_open() const
@@ -178,6 +201,14 @@ read(const size_t pos_in_file) const
     return s;
 }
 
+template<typename T>
+void file<T>::
+set_sequential_access(const bool sequential)
+{
+    // streams only, there is no mapping to advise
+    sequential_ = sequential;
+}
+
 template<typename T>
 void file<T>::
 write_data(char *data, const size_t offset_in_file, const size_t length)
@@ -237,6 +268,27 @@ open(const std::string &file_name, const bool truncate)
     }
 
     file_name_ = file_name;
+    access_ = default_file_access();
+
+    if (access_ == file_access::mapped) {
+        int flags = O_RDWR;
+        if (truncate)
+            flags |= O_CREAT | O_TRUNC;
+
+        fd_ = ::open(file_name_.c_str(), flags, 0644);
+        if (fd_ < 0) {
+            LOGGER_ERROR("Failed to open file: \"" << file_name_ <<
+                                                   "\". " << strerror(errno));
+            return;
+        }
+
+        struct stat file_stat;
+        fstat(fd_, &file_stat);
+        size_bytes_ = size_t(file_stat.st_size);
+        capacity_bytes_ = size_bytes_;
+        return;
+    }
+
     std::ios::openmode mode = std::ios::in |
         std::ios::out |
         std::ios::binary;
@@ -257,7 +309,31 @@ template<typename T>
 void file<T>::
 close(const bool remove)
 {
-    if (is_open()) {
+    if (fd_ >= 0) {
+        std::lock_guard<std::mutex> lock(read_write_mutex_);
+        unmap_windows();
+        // the file grows in steps, cut it back to the data actually written
+        if (capacity_bytes_ != size_bytes_ && ftruncate(fd_, off_t(size_bytes_))) {
+            LOGGER_ERROR("Failed to truncate file: \"" << file_name_ <<
+                                                       "\". " << strerror(errno));
+        }
+        if (::close(fd_)) {
+            LOGGER_ERROR("Failed to close file: \"" << file_name_ <<
+                                                    "\". " << strerror(errno));
+        }
+        fd_ = -1;
+        size_bytes_ = 0;
+        capacity_bytes_ = 0;
+
+        if (remove)
+            if (std::remove(file_name_.c_str())) {
+                LOGGER_WARN("Unable to delete file: \"" << file_name_ <<
+                                                        "\". " << strerror(errno));
+            }
+        file_name_ = "";
+    }
+
+    if (stream_.is_open()) {
         stream_.flush();
         stream_.close();
         if (stream_.fail()) {
@@ -275,11 +351,40 @@ close(const bool remove)
     }
 }
 
+template<typename T>
+void file<T>::
+flush()
+{
+    std::lock_guard<std::mutex> lock(read_write_mutex_);
+
+    if (fd_ >= 0) {
+        for (char *window : windows_) {
+            if (window != nullptr && msync(window, mapped_window_size(), MS_ASYNC)) {
+                LOGGER_ERROR("Flush failed. file: \"" << file_name_ <<
+                                                   "\". " << strerror(errno));
+            }
+        }
+        // other readers of the file must not see the reserved tail
+        if (capacity_bytes_ != size_bytes_ && ftruncate(fd_, off_t(size_bytes_)) == 0) {
+            capacity_bytes_ = size_bytes_;
+        }
+        return;
+    }
+
+    if (is_open()) {
+        stream_.flush();
+        if (stream_.fail() || stream_.bad()) {
+            LOGGER_ERROR("Flush failed. file: \"" << file_name_ <<
+                                               "\". " << strerror(errno));
+        }
+    }
+}
+
 template<typename T>
 const bool file<T>::
 is_open() const
 {
-    return stream_.is_open();
+    return fd_ >= 0 || stream_.is_open();
 }
 
 template<typename T>
@@ -289,6 +394,10 @@ get_size() const
     std::lock_guard<std::mutex> lock(read_write_mutex_);
 
     assert(is_open());
+    if (fd_ >= 0) {
+        return size_bytes_ / sizeof(T);
+    }
+
     stream_.seekg(0, stream_.end);
     size_t len = stream_.tellg();
     stream_.seekg(0, stream_.beg);
@@ -312,6 +421,14 @@ append(const std::vector<T> *data,
     assert(length > 0);
     assert(offset_in_mem + length <= data->size());
 
+    if (fd_ >= 0) {
+        const size_t byte_offset = size_bytes_;
+        reserve_mapped(byte_offset + length * sizeof(T));
+        copy_mapped(reinterpret_cast<char *>(const_cast<T *>(&(*data)[offset_in_mem])),
+                    byte_offset, length * sizeof(T), true);
+        return;
+    }
+
     stream_.seekp(0, stream_.end);
     stream_.write(reinterpret_cast<char *>(
                       const_cast<T *>(&(*data)[offset_in_mem])),
@@ -378,6 +495,20 @@ read(const size_t pos_in_file) const
     return s;
 }
 
+template<typename T>
+void file<T>::
+set_sequential_access(const bool sequential)
+{
+    std::lock_guard<std::mutex> lock(read_write_mutex_);
+
+    sequential_ = sequential;
+    for (char *window : windows_) {
+        if (window != nullptr) {
+            madvise(window, mapped_window_size(), sequential_ ? MADV_SEQUENTIAL : MADV_RANDOM);
+        }
+    }
+}
+
 template<typename T>
 void file<T>::
 write_data(char *data, const size_t offset_in_file, const size_t length)
@@ -385,6 +516,13 @@ write_data(char *data, const size_t offset_in_file, const size_t length)
     assert(is_open());
 
     std::lock_guard<std::mutex> lock(read_write_mutex_);
+
+    if (fd_ >= 0) {
+        reserve_mapped((offset_in_file + length) * sizeof(T));
+        copy_mapped(data, offset_in_file * sizeof(T), length * sizeof(T), true);
+        return;
+    }
+
     stream_.seekp(offset_in_file * sizeof(T));
     stream_.write(data, length * sizeof(T));
 
@@ -403,6 +541,18 @@ read_data(char *data, const size_t offset_in_file, const size_t length) const
     assert(is_open());
 
     std::lock_guard<std::mutex> lock(read_write_mutex_);
+
+    if (fd_ >= 0) {
+        if ((offset_in_file + length) * sizeof(T) > size_bytes_) {
+            LOGGER_ERROR("read failed. file: \"" << file_name_ <<
+                                                 "\". (offset: " << offset_in_file <<
+                                                 ", len: " << length << "). Out of range");
+            throw std::out_of_range("read beyond end of file: " + file_name_);
+        }
+        copy_mapped(data, offset_in_file * sizeof(T), length * sizeof(T), false);
+        return;
+    }
+
     stream_.seekg(offset_in_file * sizeof(T));
     stream_.read(data, length * sizeof(T));
 
@@ -413,6 +563,104 @@ read_data(char *data, const size_t offset_in_file, const size_t length) const
     }
     stream_.exceptions(std::ifstream::failbit | std::ifstream::badbit);
 }
+
+template<typename T>
+char *file<T>::
+map_window(const size_t window_index) const
+{
+    if (window_index >= windows_.size()) {
+        windows_.resize(window_index + 1, nullptr);
+        window_last_use_.resize(window_index + 1, 0);
+    }
+
+    if (windows_[window_index] == nullptr) {
+        // keep the address space bounded, drop the least recently used window
+        if (num_mapped_windows_ >= max_mapped_windows()) {
+            size_t oldest = windows_.size();
+            for (size_t i = 0; i < windows_.size(); ++i) {
+                if (windows_[i] != nullptr && (oldest == windows_.size() || window_last_use_[i] < window_last_use_[oldest])) {
+                    oldest = i;
+                }
+            }
+            munmap(windows_[oldest], mapped_window_size());
+            windows_[oldest] = nullptr;
+            --num_mapped_windows_;
+        }
+
+        // windows start at multiples of the window size, which are huge page aligned
+        void *window = mmap(nullptr, mapped_window_size(), PROT_READ | PROT_WRITE, MAP_SHARED,
+                            fd_, off_t(window_index * mapped_window_size()));
+        if (window == MAP_FAILED) {
+            LOGGER_ERROR("mmap failed. file: \"" << file_name_ <<
+                                                 "\". (window: " << window_index << "). " << strerror(errno));
+            throw std::runtime_error("mmap failed: " + file_name_);
+        }
+        madvise(window, mapped_window_size(), sequential_ ? MADV_SEQUENTIAL : MADV_RANDOM);
+#ifdef MADV_HUGEPAGE
+        madvise(window, mapped_window_size(), MADV_HUGEPAGE);
+#endif
+        windows_[window_index] = static_cast<char *>(window);
+        ++num_mapped_windows_;
+    }
+
+    window_last_use_[window_index] = ++window_use_counter_;
+    return windows_[window_index];
+}
+
+template<typename T>
+void file<T>::
+unmap_windows() const
+{
+    for (char *&window : windows_) {
+        if (window != nullptr) {
+            munmap(window, mapped_window_size());
+            window = nullptr;
+        }
+    }
+    windows_.clear();
+    window_last_use_.clear();
+    num_mapped_windows_ = 0;
+}
+
+template<typename T>
+void file<T>::
+reserve_mapped(const size_t num_bytes)
+{
+    if (num_bytes > capacity_bytes_) {
+        // grow geometrically, pages beyond the end of the file must not be touched
+        const size_t huge_page_size = size_t(2) << 20;
+        size_t new_capacity = std::max(num_bytes, 2 * capacity_bytes_);
+        new_capacity = (new_capacity + huge_page_size - 1) / huge_page_size * huge_page_size;
+        if (ftruncate(fd_, off_t(new_capacity))) {
+            LOGGER_ERROR("Failed to grow file: \"" << file_name_ <<
+                                                   "\". " << strerror(errno));
+            throw std::runtime_error("Failed to grow file: " + file_name_);
+        }
+        capacity_bytes_ = new_capacity;
+    }
+    size_bytes_ = std::max(size_bytes_, num_bytes);
+}
+
+template<typename T>
+void file<T>::
+copy_mapped(char *data, const size_t byte_offset, const size_t num_bytes, const bool to_file) const
+{
+    size_t num_copied = 0;
+    while (num_copied < num_bytes) {
+        const size_t offset = byte_offset + num_copied;
+        const size_t offset_in_window = offset % mapped_window_size();
+        const size_t chunk = std::min(num_bytes - num_copied, mapped_window_size() - offset_in_window);
+        char *window = map_window(offset / mapped_window_size());
+
+        if (to_file) {
+            std::memcpy(window + offset_in_window, data + num_copied, chunk);
+        }
+        else {
+            std::memcpy(data + num_copied, window + offset_in_window, chunk);
+        }
+        num_copied += chunk;
+    }
+}
 #endif
 }
 } // namespace lamure
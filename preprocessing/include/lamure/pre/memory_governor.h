@@ -0,0 +1,109 @@
+// Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
+// This Software is distributed under the Modified BSD License, see license.txt.
+//
+// Virtual Reality and Visualization Research Group 
+// Faculty of Media, Bauhaus-Universitaet Weimar
+// http://www.uni-weimar.de/medien/vr
+
+#ifndef PRE_MEMORY_GOVERNOR_H_
+#define PRE_MEMORY_GOVERNOR_H_
+
+#include <lamure/pre/platform.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+namespace lamure
+{
+namespace pre
+{
+
+/**
+* Process wide memory budget that all preprocessing stages reserve against.
+*
+* Resident memory (loaded nodes, I/O buffers) is accounted without blocking.
+* Temporary memory (per node work of a thread) is reserved before the work
+* starts and blocks until it fits into what the resident memory leaves of
+* the budget, so the number of nodes processed at the same time shrinks when
+* the budget is tight. Temporaries always get at least the thread floor for
+* every hardware thread, so resident memory beyond the budget does not
+* serialize the workers. A temporary reservation is granted regardless of
+* the budget if no other one is held, so at least one thread always makes
+* progress.
+*/
+class PREPROCESSING_DLL memory_governor
+{
+public:
+
+    memory_governor(const memory_governor &) = delete;
+    memory_governor &operator=(const memory_governor &) = delete;
+
+    static memory_governor &get_instance();
+
+    void set_budget(const size_t budget);   // in bytes, 0 disables the limit
+    size_t budget() const;
+    void set_thread_floor(const size_t thread_floor);  // temporary bytes granted per hardware thread in any case
+    size_t reserved() const;
+    size_t resident() const;
+    size_t peak() const;
+    double wait_seconds() const;            // total time spent blocked in reserve()
+    void reset_statistics();
+
+    void account(const size_t bytes);
+    void unaccount(const size_t bytes);
+
+    void reserve(const size_t bytes);
+    void release(const size_t bytes);
+
+private:
+    memory_governor();
+
+    size_t temporary_budget() const;
+
+    mutable std::mutex mutex_;
+    std::condition_variable released_;
+
+    size_t budget_ = 0;
+    size_t thread_floor_;
+    size_t num_threads_;
+    size_t resident_ = 0;
+    size_t temporary_ = 0;
+    size_t peak_ = 0;
+    size_t num_temporary_ = 0;
+    double wait_seconds_ = 0.0;
+    bool overshoot_logged_ = false;
+};
+
+/**
+* Scoped reservation against the memory_governor.
+*/
+class PREPROCESSING_DLL memory_reservation
+{
+public:
+
+    enum class kind
+    {
+        temporary,  // blocks until the budget allows it
+        resident    // accounted immediately
+    };
+
+    explicit memory_reservation(const size_t bytes = 0, const kind type = kind::temporary);
+    ~memory_reservation();
+
+    memory_reservation(const memory_reservation &) = delete;
+    memory_reservation &operator=(const memory_reservation &) = delete;
+
+    // changes the accounted size of a resident reservation
+    void resize(const size_t bytes);
+    size_t size() const { return bytes_; }
+
+private:
+    size_t bytes_;
+    kind type_;
+};
+
+}
+} // namespace lamure
+
+#endif // PRE_MEMORY_GOVERNOR_H_
@@ -0,0 +1,55 @@
+// Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
+// This Software is distributed under the Modified BSD License, see license.txt.
+//
+// Virtual Reality and Visualization Research Group 
+// Faculty of Media, Bauhaus-Universitaet Weimar
+// http://www.uni-weimar.de/medien/vr
+
+#ifndef PRE_NATURAL_NEIGHBOURS_H_
+#define PRE_NATURAL_NEIGHBOURS_H_
+
+#include <lamure/pre/platform.h>
+#include <lamure/types.h>
+
+#include <vector>
+
+namespace lamure
+{
+namespace pre
+{
+
+/**
+* Natural neighbours of a point among its nearest neighbours, projected to
+* a plane, without building a Delaunay triangulation.
+*/
+class PREPROCESSING_DLL natural_neighbours
+{
+public:
+
+    natural_neighbours() = delete;
+
+    /**
+     * Builds the Voronoi cell of poi by clipping a bounding square with the
+     * bisectors of all neighbours. Every neighbour that contributes an edge
+     * is a natural neighbour, it is weighted with its Laplace coordinate
+     * (edge length over distance, normalized).
+     *
+     * \param[in] poi         Projected point of interest
+     * \param[in] neighbours  Projected neighbour positions
+     * \return                Pairs of neighbour index and weight, empty if
+     *                        poi is outside the convex hull of the neighbours
+     */
+    static std::vector<std::pair<uint32_t, real>>
+    compute(const vec2r &poi, const std::vector<vec2r> &neighbours);
+
+    /**
+     * Angular gap criterion: poi is inside the convex hull of the neighbours
+     * if no gap between the sorted directions to them reaches pi.
+     */
+    static bool is_enclosed(const vec2r &poi, const std::vector<vec2r> &neighbours);
+};
+
+}
+} // namespace lamure
+
+#endif // PRE_NATURAL_NEIGHBOURS_H_
@@ -12,10 +12,16 @@
 #include <lamure/pre/surfel.h>
 #include <lamure/pre/bvh_node.h>
 #include <lamure/pre/logger.h>
+#include <lamure/pre/memory_governor.h>
 
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <fstream>
+#include <memory>
+#include <mutex>
 #include <string>
-#include <deque>
+#include <thread>
 
 
 namespace lamure
@@ -43,22 +49,83 @@ public:
     void serialize_nodes(const std::vector<bvh_node> &nodes);
     void serialize_prov(const std::vector<bvh_node> &nodes);
 
+    /**
+     * Starts a writer thread for the open LOD file. Nodes handed to
+     * serialize_nodes_async() are converted and written at their final
+     * offset while the caller continues, close() waits for all of them.
+     *
+     * \param[in] direct_io  Write the block aligned part of every buffer
+     *                       with O_DIRECT, bypassing the page cache
+     *                       (ignored where O_DIRECT is not available)
+     */
+    void start_write_behind(const bool direct_io = false);
+
+    /**
+     * Queues the nodes [first_node, last_node) for the writer thread. Surfels
+     * of in-core nodes are referenced without a copy and kept alive until
+     * converted, they stay accounted as resident memory until then, even if
+     * the nodes are unloaded in the meantime. Out-of-core nodes are read on
+     * the writer thread. Blocks while a previously queued range has not been
+     * picked up yet.
+     */
+    void serialize_nodes_async(const std::vector<bvh_node> &nodes,
+                               const size_t first_node,
+                               const size_t last_node);
+
+    // waits until all queued nodes are written, rethrows writer errors
+    void wait_for_writes();
+
     void read_node_immediate(surfel_vector &surfels,
                              const size_t offset);
     void write_node_immediate(const surfel_vector &surfels,
                               const size_t offset);
 
+    // copies a range of nodes from another LOD file with the same node size,
+    // throws std::runtime_error if a node cannot be read or written
+    void copy_nodes(std::istream &source,
+                    const size_t first_node,
+                    const size_t num_nodes);
+
 private:
 
-    void write_node_streamed(const bvh_node &node);
-    void flush_surfel_buffer();
+    struct queued_node
+    {
+        size_t node_id;
+        surfel_mem_array mem_array;    // empty if the node is on disk only
+        surfel_disk_array disk_array;
+    };
+
+    struct queued_range
+    {
+        std::vector<queued_node> nodes;
+        std::unique_ptr<memory_reservation> memory;  // surfels of the in-core nodes not converted yet
+    };
+
+    void stop_write_behind();
+    void write_behind_loop();
+    void write_range(queued_range &range);
+    void write_block(const char *data, const size_t offset, const size_t length);
 
     mutable std::fstream stream_;
     std::string file_name_;
     size_t surfels_per_node_;
-
-    std::deque<surfel_vector *> surfel_buffer_;
     size_t max_nodes_in_buffer_;
+
+    // write-behind state, the queue holds node ranges in submission order
+    std::thread writer_;
+    std::mutex queue_mtx_;
+    std::condition_variable queue_cv_;
+    std::deque<queued_range> write_queue_;
+    size_t num_pending_ranges_ = 0;
+    bool stop_writer_ = false;
+    std::exception_ptr writer_error_;
+
+    int fd_ = -1;
+    int direct_fd_ = -1;
+    std::vector<char> write_buffers_[2];   // over-allocated for alignment
+    memory_reservation buffer_memory_{0, memory_reservation::kind::resident};
+    size_t num_written_nodes_ = 0;
+    double write_seconds_ = 0.0;
 };
 
 }
@@ -38,9 +38,30 @@ public:
                          double *eigenvalues,
                          double **eigenvectors) const;
 
+    /**
+     * Closed-form eigenvector of the smallest eigenvalue of a symmetric 3x3
+     * matrix. The eigenvalues are obtained analytically from the characteristic
+     * polynomial, the eigenvector as the longest cross product of two rows of
+     * (A - lambda * I). Returns a unit vector.
+     */
+    static vec3r smallest_eigenvector(const scm::math::mat3d &_matrix);
+
+    // reference implementation based on Jacobi rotations
     vec3f compute_normal(const bvh &tree,
                          const surfel_id_t surfel,
                          std::vector<std::pair<surfel_id_t, real>> const &nearest_neighbours) const override;
+
+    /**
+     * Batched normal estimation for a range of surfels of one node.
+     * Neighbour positions are gathered into coordinate streams first, the
+     * centroid and covariance are then accumulated with vectorized loops and
+     * solved with smallest_eigenvector(). Debug builds compare every result
+     * against compute_normal().
+     */
+    void compute_normals(const bvh &tree,
+                         const surfel_id_t first_surfel,
+                         std::vector<std::vector<std::pair<surfel_id_t, real>>> const &neighbourhoods,
+                         std::vector<vec3f> &normals) const override;
 };
 
 }// namespace pre
@@ -12,6 +12,8 @@
 // #include <lamure/pre/bvh.h>
 #include <lamure/pre/surfel.h>
 
+#include <vector>
+
 namespace lamure
 {
 namespace pre
@@ -27,6 +29,25 @@ public:
     virtual vec3f compute_normal(const bvh &tree,
                                  const surfel_id_t surfel,
                                  std::vector<std::pair<surfel_id_t, real>> const &nearest_neighbours) const = 0;
+
+    /**
+     * Computes the normals of a consecutive range of surfels of one node.
+     * neighbourhoods[i] holds the nearest neighbours of the surfel
+     * (first_surfel.node_idx, first_surfel.surfel_idx + i). Strategies that
+     * can share work across a node override this, the default falls back
+     * to compute_normal per surfel.
+     */
+    virtual void compute_normals(const bvh &tree,
+                                 const surfel_id_t first_surfel,
+                                 std::vector<std::vector<std::pair<surfel_id_t, real>>> const &neighbourhoods,
+                                 std::vector<vec3f> &normals) const
+    {
+        normals.resize(neighbourhoods.size());
+        for (size_t i = 0; i < neighbourhoods.size(); ++i) {
+            normals[i] = compute_normal(tree, surfel_id_t(first_surfel.node_idx, first_surfel.surfel_idx + i), neighbourhoods[i]);
+        }
+    }
+
     uint16_t const number_of_neighbours() const
     { return number_of_neighbours_; }
 
@@ -0,0 +1,66 @@
+// Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
+// This Software is distributed under the Modified BSD License, see license.txt.
+//
+// Virtual Reality and Visualization Research Group
+// Faculty of Media, Bauhaus-Universitaet Weimar
+// http://www.uni-weimar.de/medien/vr
+
+#ifndef PRE_QUANTILE_SKETCH_H_
+#define PRE_QUANTILE_SKETCH_H_
+
+#include <lamure/pre/platform.h>
+
+#include <cstdint>
+#include <map>
+
+namespace lamure
+{
+namespace pre
+{
+
+/**
+ * Streaming quantile estimator for non-negative values.
+ *
+ * Values are counted in logarithmically spaced buckets, so every quantile
+ * is returned with a bounded relative error while memory only grows with
+ * the logarithm of the value range. Sketches filled by different threads
+ * can be merged.
+ */
+class PREPROCESSING_DLL quantile_sketch
+{
+public:
+
+    explicit quantile_sketch(const double relative_accuracy = 0.01);
+
+    void insert(const double value);
+    void merge(const quantile_sketch &other);
+
+    /**
+     * Returns an estimate of the q-quantile, q in [0, 1].
+     * The estimate deviates by at most relative_accuracy from the
+     * value of that rank.
+     */
+    double quantile(const double q) const;
+
+    uint64_t count() const { return count_; }
+    bool empty() const { return count_ == 0; }
+
+private:
+
+    int32_t bucket_index(const double value) const;
+    double bucket_value(const int32_t index) const;
+
+    double relative_accuracy_;
+    double gamma_;
+    double log_gamma_;
+
+    uint64_t zero_count_;
+    uint64_t count_;
+    std::map<int32_t, uint64_t> buckets_;
+
+};
+
+} // namespace pre
+} // namespace lamure
+
+#endif // PRE_QUANTILE_SKETCH_H_
@@ -10,6 +10,7 @@
 #ifndef PRE_REDUCTION_ENTROPY_H_
 #define PRE_REDUCTION_ENTROPY_H_
 
+#include <lamure/pre/arena.h>
 #include <lamure/pre/reduction_strategy.h>
 #include <lamure/pre/bvh.h>
 #include <lamure/pre/surfel.h>
@@ -25,6 +26,8 @@ namespace pre
 
 class bvh;
 
+// entropy surfels, their neighbour lists and surfels live on the arena of the
+// thread running create_lod and are released in one step after the node
 struct entropy_surfel
 {
     uint32_t surfel_id;
@@ -32,7 +35,7 @@ struct entropy_surfel
     bool validity;
     double entropy;
     uint16_t level;
-    std::vector<std::shared_ptr<entropy_surfel> > neighbours;
+    arena_vector<std::shared_ptr<entropy_surfel> > neighbours;
     std::shared_ptr<surfel> contained_surfel;
 
     entropy_surfel(surfel const &in_surfel,
@@ -47,7 +50,7 @@ struct entropy_surfel
         entropy(in_entropy),
         level(0)
     {
-        contained_surfel = std::make_shared<surfel>(in_surfel);
+        contained_surfel = make_arena_shared<surfel>(in_surfel);
     }
 };
 
@@ -87,7 +90,7 @@ struct min_entropy_order
 
 
 using shared_entropy_surfel = std::shared_ptr<entropy_surfel>;
-using shared_entropy_surfel_vector = std::vector<shared_entropy_surfel>;
+using shared_entropy_surfel_vector = arena_vector<shared_entropy_surfel>;
 
 class PREPROCESSING_DLL reduction_entropy: public reduction_strategy
 {
@@ -110,11 +113,7 @@ private:
                                  shared_entropy_surfel_vector const &neighbour_ptrs) const;
     real compute_enclosing_sphere_radius(vec3r const &center_of_mass,
                                          shared_surfel current_surfel,
-                                         shared_entropy_surfel_vector const neighbour_ptrs) const;
-
-    shared_entropy_surfel_vector const
-    get_locally_overlapping_neighbours(shared_entropy_surfel target_entropy_surfel_ptr,
-                                       shared_entropy_surfel_vector &entropy_surfel_ptr_array) const;
+                                         shared_entropy_surfel_vector const &neighbour_ptrs) const;
 
     bool
     merge(shared_entropy_surfel current_entropy_surfel,
@@ -124,18 +123,18 @@ private:
     void update_color(shared_surfel current_surfel_ptr, shared_entropy_surfel_vector const &neighbour_ptrs) const;
 
     void update_entropy(shared_entropy_surfel current_en_surfel,
-                        shared_entropy_surfel_vector const neighbour_ptrs) const;
+                        shared_entropy_surfel_vector const &neighbour_ptrs) const;
     void update_entropy_surfel_level(shared_entropy_surfel target_surfel_ptr,
                                      shared_entropy_surfel_vector const &invalidated_neighbours) const;
     void update_normal(shared_surfel current_surfel_ptr,
-                       shared_entropy_surfel_vector const neighbour_ptrs) const;
+                       shared_entropy_surfel_vector const &neighbour_ptrs) const;
     void update_position(shared_surfel current_surfel_ptr,
-                         shared_entropy_surfel_vector const neighbour_ptrs) const;
+                         shared_entropy_surfel_vector const &neighbour_ptrs) const;
     void update_radius(shared_surfel current_surfel_ptr,
-                       shared_entropy_surfel_vector const neighbour_ptrs) const;
+                       shared_entropy_surfel_vector const &neighbour_ptrs) const;
 
     void update_surfel_attributes(shared_surfel target_surfel_ptr,
-                                  shared_entropy_surfel_vector const invalidated_neighbours) const;
+                                  shared_entropy_surfel_vector const &invalidated_neighbours) const;
 
 };
 
@@ -78,13 +78,15 @@ private:
 
     real calculate_variation(const scm::math::mat3d &covariance_matrix, vec3f &normal) const;
 
-    scm::math::mat3d calculate_covariance_matrix(const std::vector<surfel *> &surfels_to_sample, vec3r &centroid) const;
-
-    scm::math::mat3d calculate_covariance_matrix_color(const std::vector<surfel *> &surfels_to_sample, vec3r &centroid) const;
-
-    vec3r calculate_centroid(const std::vector<surfel *> &surfels_to_sample) const;
-
-    vec3r calculate_centroid_color(const std::vector<surfel *> &surfels_to_sample) const;
+    // team size used for a cluster, large clusters are processed by all threads of the node
+    int num_threads_for_cluster(const size_t cluster_size) const;
+
+    // centroids and covariance matrices of positions and transformed colors in one pass
+    void calculate_covariance_matrices(const std::vector<surfel *> &surfels_to_sample,
+                                       vec3r &centroid_pos,
+                                       vec3r &centroid_color,
+                                       scm::math::mat3d &covariance_pos,
+                                       scm::math::mat3d &covariance_color) const;
 
     surfel create_surfel_from_cluster(const std::vector<surfel *> &surfels_to_sample) const;
 
@@ -8,6 +8,7 @@
 #ifndef PRE_REDUCTION_NORMAL_DEVIATON_CLUSTERING_H_
 #define PRE_REDUCTION_NORMAL_DEVIATON_CLUSTERING_H_
 
+#include <lamure/pre/arena.h>
 #include <lamure/pre/reduction_strategy.h>
 #include <lamure/pre/logger.h>
 
@@ -35,7 +36,7 @@ private:
     using value_index_pair = std::pair<real, uint16_t>;
 
     struct surfel_cluster_with_error {
-        std::list<surfel>* cluster;
+        arena_list<surfel>* cluster;
         float merge_treshold;
     };
 
@@ -46,7 +47,7 @@ private:
         }
     };
 
-    static surfel create_representative(const std::vector<surfel>& input);
+    static surfel create_representative(const arena_list<surfel>& input);
     
     std::pair<vec3ui, vec3b> compute_grid_dimensions(const std::vector<surfel_mem_array*>& input,
                                                      const bounding_box& bounding_box,
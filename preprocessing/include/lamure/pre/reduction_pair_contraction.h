@@ -31,6 +31,8 @@ public:
                                 const bvh &tree,
                                 const size_t start_node_id) const override;
 
+    size_t estimate_temporary_memory(const size_t num_input_surfels, const uint32_t surfels_per_node) const override;
+
 private:
     uint16_t number_of_neighbours_;
 };
@@ -9,8 +9,11 @@
 #define PRE_REDUCTION_STRATEGY_H_
 
 #include <lamure/pre/bvh_node.h>
+#include <lamure/pre/common.h>
 #include <lamure/pre/surfel_mem_array.h>
 
+#include <algorithm>
+
 namespace lamure
 {
 namespace pre
@@ -22,9 +25,42 @@ class reduction_strategy
   public:
     virtual ~reduction_strategy() {}
 
+    /**
+     * The tree calls create_lod inside an arena_scope per node, per-node
+     * temporaries may use arena_vector and friends (see arena.h).
+     */
     virtual surfel_mem_array create_lod(real &reduction_error, const std::vector<surfel_mem_array *> &input, const uint32_t surfels_per_node, const bvh &tree, const size_t start_node_id) const = 0;
 
+    /**
+     * create_lod for input nodes that carry provenance. Strategies that track
+     * their merges return the provenance themselves; for all others every
+     * input surfel is accounted to the closest output surfel.
+     */
+    surfel_mem_array create_lod_with_provenance(real &reduction_error, const std::vector<surfel_mem_array *> &input, const uint32_t surfels_per_node, const bvh &tree, const size_t start_node_id) const;
+
     void interpolate_approx_natural_neighbours(surfel &surfel_to_update, std::vector<surfel> const &input_surfels, const bvh &tree, size_t const num_nearest_neighbours = 24) const;
+
+    /**
+     * Upper estimate of the temporary memory create_lod needs for a node,
+     * reserved against the memory_governor before the node is reduced.
+     */
+    virtual size_t estimate_temporary_memory(const size_t num_input_surfels, const uint32_t surfels_per_node) const
+    { return (4 * num_input_surfels + surfels_per_node) * sizeof(surfel); }
+
+    void set_prov_aggregation(const attribute_aggregation aggregation) { prov_aggregation_ = aggregation; }
+    attribute_aggregation prov_aggregation() const { return prov_aggregation_; }
+
+    /**
+     * Number of threads a single create_lod call may use. The tree raises it
+     * for levels with fewer nodes than hardware threads; strategies that can
+     * split the work of one node use it as their team size.
+     */
+    void set_num_threads_per_node(const uint32_t num_threads) const { num_threads_per_node_ = std::max(num_threads, uint32_t(1)); }
+    uint32_t num_threads_per_node() const { return num_threads_per_node_; }
+
+  protected:
+    mutable uint32_t num_threads_per_node_ = 1;
+    attribute_aggregation prov_aggregation_ = attribute_aggregation::weighted_mean;
 };
 
 } // namespace pre
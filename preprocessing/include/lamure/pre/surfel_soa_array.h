@@ -0,0 +1,121 @@
+// Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
+// This Software is distributed under the Modified BSD License, see license.txt.
+//
+// Virtual Reality and Visualization Research Group
+// Faculty of Media, Bauhaus-Universitaet Weimar
+// http://www.uni-weimar.de/medien/vr
+
+#ifndef PRE_SURFEL_SOA_ARRAY_H_
+#define PRE_SURFEL_SOA_ARRAY_H_
+
+#include <lamure/pre/arena.h>
+#include <lamure/pre/surfel.h>
+#include <lamure/pre/surfel_mem_array.h>
+
+#include <memory>
+#include <vector>
+
+namespace lamure
+{
+namespace pre
+{
+
+/**
+ * Position and radius streams of the surfels of a node, used as a
+ * prefilter by the local neighbourhood queries of reduction kernels.
+ *
+ * This is a read-only working copy gathered from the input arrays per
+ * call, surfel_mem_array stays the storage of the tree. Positions are
+ * either stored in double precision or as single precision offsets
+ * relative to the centre of the input bounding box.
+ */
+struct surfel_soa_data
+{
+    bool relative_positions = false;
+    vec3r centre = vec3r(0.0);
+
+    std::vector<real> pos_x;
+    std::vector<real> pos_y;
+    std::vector<real> pos_z;
+
+    std::vector<float> rel_pos_x;
+    std::vector<float> rel_pos_y;
+    std::vector<float> rel_pos_z;
+
+    std::vector<real> radius;
+
+    size_t size() const { return radius.size(); }
+    void reserve(const size_t num_surfels);
+    void clear();
+};
+
+class PREPROCESSING_DLL surfel_soa_array
+{
+public:
+
+    explicit surfel_soa_array() {}
+
+    /**
+     * Gathers positions and radii of all input arrays.
+     *
+     * \param[in] input               Input arrays, e.g. the children of a node.
+     * \param[in] relative_positions  If true, positions are stored as float
+     *                                offsets relative to the centroid of the
+     *                                input bounding box.
+     */
+    explicit surfel_soa_array(const std::vector<surfel_mem_array *> &input,
+                              const bool relative_positions = false)
+    { reset(input, relative_positions); }
+
+    size_t length() const { return soa_data_.size(); }
+
+    vec3r pos(const size_t index) const;
+    real radius(const size_t index) const { return soa_data_.radius[index]; }
+
+    // maps a local index back to the input array it was gathered from
+    surfel_id_t local_id(const size_t index) const;
+
+    /**
+     * Computes squared distances from a point to all surfels of the array.
+     * The loop runs over the position streams only and is vectorized.
+     */
+    void compute_distances_sqr(const vec3r &point, std::vector<real> &distances) const;
+
+    /**
+     * Brute-force k nearest neighbours of one surfel within the array.
+     * Returns pairs of local index and squared distance sorted by distance.
+     */
+    std::vector<std::pair<size_t, real>> nearest_neighbours(const size_t index,
+                                                            const size_t num_neighbours) const;
+
+    /**
+     * Returns local indices of all surfels whose bounding spheres overlap
+     * the bounding sphere of the given surfel, excluding the surfel itself.
+     * Callers still have to test the candidates exactly.
+     */
+    std::vector<size_t> overlapping_candidates(const size_t index) const;
+
+    /**
+     * Same as above, but fills a caller provided arena vector. Inside an
+     * arena_scope this does not touch the heap.
+     */
+    void overlapping_candidates(const size_t index, arena_vector<size_t> &candidates) const;
+
+    void reset(const std::vector<surfel_mem_array *> &input,
+               const bool relative_positions);
+
+    bool relative_positions() const { return soa_data_.relative_positions; }
+
+protected:
+
+    void compute_distances_sqr(const vec3r &point, real *distances) const;
+
+    surfel_soa_data soa_data_;
+    std::vector<size_t> input_offsets_;
+
+};
+
+} // namespace pre
+} // namespace lamure
+
+#endif // PRE_SURFEL_SOA_ARRAY_H_
@@ -0,0 +1,118 @@
+// Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
+// This Software is distributed under the Modified BSD License, see license.txt.
+//
+// Virtual Reality and Visualization Research Group 
+// Faculty of Media, Bauhaus-Universitaet Weimar
+// http://www.uni-weimar.de/medien/vr
+
+#include <lamure/pre/arena.h>
+
+#include <algorithm>
+#include <cassert>
+
+namespace lamure
+{
+namespace pre
+{
+
+monotonic_arena::
+monotonic_arena(const size_t block_size)
+    : current_block_(0),
+      offset_(0),
+      block_size_(block_size),
+      num_scopes_(0)
+{
+}
+
+monotonic_arena::
+~monotonic_arena()
+{
+    for (auto &b : blocks_) {
+        ::operator delete(b.data);
+    }
+}
+
+monotonic_arena &monotonic_arena::
+local()
+{
+    static thread_local monotonic_arena arena;
+    return arena;
+}
+
+void *monotonic_arena::
+allocate(const size_t bytes, const size_t alignment)
+{
+    assert(in_scope());
+
+    while (current_block_ < blocks_.size()) {
+        const block &b = blocks_[current_block_];
+        const size_t address = reinterpret_cast<size_t>(b.data) + offset_;
+        const size_t padding = (alignment - address % alignment) % alignment;
+        if (offset_ + padding + bytes <= b.size) {
+            offset_ += padding + bytes;
+            return b.data + offset_ - bytes;
+        }
+        ++current_block_;
+        offset_ = 0;
+    }
+
+    // blocks from ::operator new are aligned for every fundamental type
+    const size_t size = std::max(block_size_, bytes + alignment);
+    blocks_.push_back(block{static_cast<char *>(::operator new(size)), size});
+    current_block_ = blocks_.size() - 1;
+    offset_ = bytes;
+    return blocks_.back().data;
+}
+
+size_t monotonic_arena::
+capacity() const
+{
+    size_t total = 0;
+    for (const auto &b : blocks_) {
+        total += b.size;
+    }
+    return total;
+}
+
+monotonic_arena::marker monotonic_arena::
+enter_scope()
+{
+    ++num_scopes_;
+    return marker{current_block_, offset_};
+}
+
+void monotonic_arena::
+leave_scope(const marker &m)
+{
+    assert(num_scopes_ > 0);
+    current_block_ = m.block;
+    offset_ = m.offset;
+
+    // a node that spilled into several blocks gets one large block next time
+    if (--num_scopes_ == 0 && blocks_.size() > 1) {
+        const size_t total = capacity();
+        for (auto &b : blocks_) {
+            ::operator delete(b.data);
+        }
+        blocks_.clear();
+        blocks_.push_back(block{static_cast<char *>(::operator new(total)), total});
+        current_block_ = 0;
+        offset_ = 0;
+    }
+}
+
+arena_scope::
+arena_scope(monotonic_arena &arena)
+    : arena_(arena),
+      marker_(arena.enter_scope())
+{
+}
+
+arena_scope::
+~arena_scope()
+{
+    arena_.leave_scope(marker_);
+}
+
+}
+} // namespace lamure
@@ -0,0 +1,231 @@
+// Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
+// This Software is distributed under the Modified BSD License, see license.txt.
+//
+// Virtual Reality and Visualization Research Group
+// Faculty of Media, Bauhaus-Universitaet Weimar
+// http://www.uni-weimar.de/medien/vr
+
+#include <lamure/pre/attribute_channel.h>
+
+#include <lamure/bounding_box.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+
+namespace lamure
+{
+namespace pre
+{
+
+void attribute_accumulator::
+add(const prov_data &value, const vec3f &normal, const real weight)
+{
+    samples_.push_back(sample{value, normal, weight});
+}
+
+void attribute_accumulator::
+merge(attribute_accumulator &other)
+{
+    // append the smaller set, repeated merges of one cluster stay O(n log n)
+    if (other.samples_.size() > samples_.size()) {
+        std::swap(samples_, other.samples_);
+    }
+    samples_.insert(samples_.end(), other.samples_.begin(), other.samples_.end());
+    other.samples_.clear();
+}
+
+prov_data attribute_accumulator::
+resolve(const surfel &representative,
+        const attribute_aggregation aggregation) const
+{
+    if (samples_.empty()) {
+        return prov_data();
+    }
+    if (samples_.size() == 1) {
+        return samples_.front().value;
+    }
+
+    prov_data result;
+
+    if (aggregation == attribute_aggregation::max) {
+        for (uint32_t i = 0; i < num_prov_values_; ++i) {
+            result.values_[i] = std::numeric_limits<float>::lowest();
+        }
+        for (const auto &current_sample : samples_) {
+            for (uint32_t i = 0; i < num_prov_values_; ++i) {
+                result.values_[i] = std::max(result.values_[i], current_sample.value.values_[i]);
+            }
+        }
+    }
+    else {
+        real weight_sum = 0.0;
+        for (const auto &current_sample : samples_) {
+            weight_sum += current_sample.weight;
+        }
+        // surfels without radius fall back to the plain mean
+        const bool weighted = aggregation == attribute_aggregation::weighted_mean && weight_sum > 0.0;
+        if (!weighted) {
+            weight_sum = real(samples_.size());
+        }
+
+        double values[num_prov_values_] = {};
+        for (const auto &current_sample : samples_) {
+            const real weight = weighted ? current_sample.weight : 1.0;
+            for (uint32_t i = 0; i < num_prov_values_; ++i) {
+                values[i] += weight * current_sample.value.values_[i];
+            }
+        }
+        for (uint32_t i = 0; i < num_prov_values_; ++i) {
+            result.values_[i] = float(values[i] / weight_sum);
+        }
+    }
+
+    // deviation of the merged normals from the representative, same measure as ndc_prov
+    const vec3f representative_normal = representative.normal();
+    double absolute_deviation_sum = 0.0;
+    double squared_deviation_sum = 0.0;
+    for (const auto &current_sample : samples_) {
+        const double cos_angle = std::max(-1.0, std::min(1.0, double(scm::math::dot(representative_normal, current_sample.normal))));
+        const double absolute_deviation = std::fabs(std::acos(cos_angle) / (0.5 * M_PI));
+        absolute_deviation_sum += absolute_deviation;
+        squared_deviation_sum += absolute_deviation * absolute_deviation;
+    }
+
+    const double num_samples = double(samples_.size());
+    result.mean_absolute_deviation_ = float(absolute_deviation_sum / num_samples);
+    result.standard_deviation_ = float(std::sqrt(squared_deviation_sum / num_samples));
+    result.coefficient_of_variation_ = result.mean_absolute_deviation_ != 0.f
+                                     ? result.standard_deviation_ / result.mean_absolute_deviation_
+                                     : -1.f;
+    return result;
+}
+
+attribute_accumulator attribute_channel::
+source(const surfel_mem_array &array, const size_t index) const
+{
+    const surfel &current_surfel = array.read_surfel_ref(index);
+
+    attribute_accumulator accumulator;
+    accumulator.add(array.read_prov_ref(index), current_surfel.normal(),
+                    current_surfel.radius() * current_surfel.radius());
+    return accumulator;
+}
+
+surfel_mem_array attribute_channel::
+attach(const surfel_mem_array &output,
+       const std::vector<attribute_accumulator> &accumulators) const
+{
+    assert(accumulators.size() == output.length());
+
+    auto surfels = std::make_shared<surfel_vector>(surfel_vector());
+    auto provs = std::make_shared<prov_vector>(prov_vector());
+    surfels->reserve(output.length());
+    provs->reserve(output.length());
+
+    for (size_t i = 0; i < output.length(); ++i) {
+        const surfel &current_surfel = output.read_surfel_ref(i);
+        surfels->push_back(current_surfel);
+        provs->push_back(accumulators[i].resolve(current_surfel, aggregation_));
+    }
+
+    return surfel_mem_array(surfels, provs, 0, surfels->size());
+}
+
+surfel_mem_array attribute_channel::
+transfer(const std::vector<surfel_mem_array *> &input,
+         const surfel_mem_array &output) const
+{
+    const size_t num_output_surfels = output.length();
+    std::vector<attribute_accumulator> accumulators(num_output_surfels);
+    if (num_output_surfels == 0) {
+        return attach(output, accumulators);
+    }
+
+    // uniform grid over the output surfels, cells are about one output surfel wide
+    bounding_box output_bb;
+    real radius_sum = 0.0;
+    for (size_t i = 0; i < num_output_surfels; ++i) {
+        output_bb.expand(output.read_surfel_ref(i).pos());
+        radius_sum += output.read_surfel_ref(i).radius();
+    }
+    const vec3r dimensions = output_bb.get_dimensions();
+    const real max_extent = std::max(dimensions.x, std::max(dimensions.y, dimensions.z));
+    const real min_cell_size = std::max(max_extent, real(1.0)) * 1e-6;
+    const real cell_size = std::max(2.0 * radius_sum / num_output_surfels, min_cell_size);
+
+    using grid_cell = std::array<int32_t, 3>;
+    auto cell_of = [&](const vec3r &pos) {
+        const vec3r rel = (pos - output_bb.min()) / cell_size;
+        return grid_cell{{int32_t(std::floor(rel.x)), int32_t(std::floor(rel.y)), int32_t(std::floor(rel.z))}};
+    };
+    auto cell_key = [](const grid_cell &cell) {
+        return (uint64_t(uint32_t(cell[0]) & 0x1FFFFF) << 42) |
+               (uint64_t(uint32_t(cell[1]) & 0x1FFFFF) << 21) |
+                uint64_t(uint32_t(cell[2]) & 0x1FFFFF);
+    };
+
+    std::unordered_map<uint64_t, std::vector<uint32_t>> grid;
+    for (size_t i = 0; i < num_output_surfels; ++i) {
+        grid[cell_key(cell_of(output.read_surfel_ref(i).pos()))].push_back(uint32_t(i));
+    }
+    const grid_cell max_cell = cell_of(output_bb.max());
+
+    for (const auto *array : input) {
+        for (size_t surfel_idx = 0; surfel_idx < array->length(); ++surfel_idx) {
+            const vec3r pos = array->read_surfel_ref(surfel_idx).pos();
+            const grid_cell centre_cell = cell_of(pos);
+
+            // rings of cells around the query, every output cell is reached eventually
+            int32_t max_ring = 0;
+            for (int axis = 0; axis < 3; ++axis) {
+                max_ring = std::max(max_ring, std::max(std::abs(centre_cell[axis]), std::abs(centre_cell[axis] - max_cell[axis])));
+            }
+
+            size_t nearest = 0;
+            real nearest_distance_sqr = std::numeric_limits<real>::max();
+            for (int32_t ring = 0; ring <= max_ring; ++ring) {
+                // cells of the next ring are at least ring * cell_size away
+                const real ring_distance = (ring - 1) * cell_size;
+                if (ring > 0 && nearest_distance_sqr <= ring_distance * ring_distance) {
+                    break;
+                }
+                for (int32_t dx = -ring; dx <= ring; ++dx) {
+                    for (int32_t dy = -ring; dy <= ring; ++dy) {
+                        for (int32_t dz = -ring; dz <= ring; ++dz) {
+                            if (std::max(std::abs(dx), std::max(std::abs(dy), std::abs(dz))) != ring) {
+                                continue;
+                            }
+                            const grid_cell cell{{centre_cell[0] + dx, centre_cell[1] + dy, centre_cell[2] + dz}};
+                            if (cell[0] < 0 || cell[1] < 0 || cell[2] < 0 ||
+                                cell[0] > max_cell[0] || cell[1] > max_cell[1] || cell[2] > max_cell[2]) {
+                                continue;
+                            }
+                            auto it = grid.find(cell_key(cell));
+                            if (it == grid.end()) {
+                                continue;
+                            }
+                            for (const uint32_t output_idx : it->second) {
+                                const real distance_sqr = scm::math::length_sqr(output.read_surfel_ref(output_idx).pos() - pos);
+                                if (distance_sqr < nearest_distance_sqr) {
+                                    nearest_distance_sqr = distance_sqr;
+                                    nearest = output_idx;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+
+            attribute_accumulator contribution = source(*array, surfel_idx);
+            accumulators[nearest].merge(contribution);
+        }
+    }
+
+    return attach(output, accumulators);
+}
+
+} // namespace pre
+} // namespace lamure
@@ -10,6 +10,7 @@
 #include <lamure/utils.h>
 #include <lamure/memory.h>
 #include <lamure/pre/bvh.h>
+#include <lamure/pre/memory_governor.h>
 #include <lamure/pre/io/format_abstract.h>
 #include <lamure/pre/io/format_xyz.h>
 #include <lamure/pre/io/format_xyz_all.h>
@@ -38,8 +39,14 @@
 #include <lamure/pre/reduction_pair_contraction.h>
 #include <lamure/pre/reduction_hierarchical_clustering_mk5.h>
 #endif
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
+#include <cstdlib>
 #include <fstream>
+#include <limits>
+#include <mutex>
+#include <thread>
 
 
 #define CPU_TIMER auto_timer timer("CPU time: %ws wall, usr+sys = %ts CPU (%p%)\n")
@@ -57,6 +64,9 @@ builder(const descriptor &desc)
       memory_limit_(0)
 {
     memory_limit_ = calculate_memory_limit();
+    memory_governor::get_instance().set_budget(memory_limit_);
+
+    set_default_file_access(desc_.use_mmap ? file_access::mapped : file_access::stream);
 
     base_path_ = fs::path(desc_.working_directory)
         / fs::path(desc_.input_file).stem().string();
@@ -185,111 +195,77 @@ boost::filesystem::path builder::convert_to_binary(std::string const& input_file
 
 boost::filesystem::path builder::downsweep(boost::filesystem::path input_file, uint16_t start_stage) const
 {
-    bool performed_outlier_removal = false;
-    do {
-        std::string status_suffix = "";
-        if (true == performed_outlier_removal) {
-            status_suffix = " (after outlier removal)";
-        }
-
-        std::cout << std::endl;
-        std::cout << "--------------------------------" << std::endl;
-        std::cout << "bvh properties" << status_suffix << std::endl;
-        std::cout << "--------------------------------" << std::endl;
+    std::cout << std::endl;
+    std::cout << "--------------------------------" << std::endl;
+    std::cout << "bvh properties" << std::endl;
+    std::cout << "--------------------------------" << std::endl;
 
-        lamure::pre::bvh bvh(memory_limit_, desc_.buffer_size, desc_.rep_radius_algo);
+    lamure::pre::bvh bvh(memory_limit_, desc_.buffer_size, desc_.rep_radius_algo);
 
+    const bool is_shard = !desc_.shard_manifest.empty();
+    if (is_shard) {
+        // a shard becomes a subtree of the merged tree and has to match its properties
+        shard_layout layout = read_shard_layout(desc_.shard_manifest);
+        bvh.init_tree(layout.fan_factor,
+                      layout.depth - layout.shard_level,
+                      layout.max_surfels_per_node,
+                      base_path_);
+    }
+    else {
         bvh.init_tree(input_file.string(),
                       desc_.max_fan_factor,
                       desc_.surfels_per_node,
                       base_path_);
+    }
 
-        bvh.print_tree_properties();
-        std::cout << std::endl;
-
-        std::cout << "--------------------------------" << std::endl;
-        std::cout << "downsweep" << status_suffix << std::endl;
-        std::cout << "--------------------------------" << std::endl;
-        LOGGER_TRACE("downsweep stage");
-
-        CPU_TIMER;
-        bvh.downsweep(desc_.translate_to_origin, input_file.string(), desc_.prov_file);
-
-        auto bvhd_file = add_to_path(base_path_, ".bvhd");
-
-        bvh.serialize_tree_to_file(bvhd_file.string(), true);
-
-        if ((!desc_.keep_intermediate_files) && (start_stage < 1)) {
-            // do not remove input file
-            std::remove(input_file.string().c_str());
-        }
-
-        input_file = bvhd_file;
-
-        // LOGGER_DEBUG("Used memory: " << GetProcessUsedMemory() / 1024 / 1024 << " MiB");
-
-        if (3 <= start_stage) {
-            break;
-        }
-
-        if (performed_outlier_removal) {
-            break;
-        }
-
-        if (start_stage <= 2) {
-
-            if (desc_.outlier_ratio != 0.0) {
-
-                size_t num_outliers = desc_.outlier_ratio * (bvh.nodes().size() - bvh.first_leaf()) * bvh.max_surfels_per_node();
-
-                size_t num_all_surfels = std::max(size_t((bvh.nodes().size() - bvh.first_leaf()) * bvh.max_surfels_per_node()), size_t(1));
-                num_outliers = std::min(std::max(num_outliers, size_t(1)), num_all_surfels); // remove at least 1 surfel, for any given ratio != 0.0
-
-
-                std::cout << std::endl;
-                std::cout << "--------------------------------" << std::endl;
-                std::cout << "outlier removal ( " << int(desc_.outlier_ratio * 100) << " percent = " << num_outliers << " surfels)" << std::endl;
-                std::cout << "--------------------------------" << std::endl;
-                LOGGER_TRACE("outlier removal stage");
-
-                surfel_vector kept_surfels = bvh.remove_outliers_statistically(num_outliers, desc_.number_of_outlier_neighbours);
-
-                format_bin format_out;
-
-                std::unique_ptr<format_abstract> dummy_format_in{new format_xyz()};
-
-                converter conv(*dummy_format_in, format_out, desc_.buffer_size);
-
-                conv.set_surfel_callback([](surfel &s, bool &keep)
-                                         { if (s.pos() == vec3r(0.0, 0.0, 0.0)) keep = false; });
+    bvh.print_tree_properties();
+    std::cout << std::endl;
 
-                auto binary_outlier_removed_file = add_to_path(base_path_, ".bin_wo_outlier");
+    // outliers are dropped from the leaves while they are built, no second downsweep is needed
+    const bool remove_outliers = (start_stage <= 2) && (desc_.outlier_ratio != 0.0);
+    if (remove_outliers) {
+        bvh.enable_outlier_removal(std::min(desc_.outlier_ratio, 1.0f), desc_.number_of_outlier_neighbours);
+    }
 
-                conv.write_in_core_surfels_out(kept_surfels, binary_outlier_removed_file.string());
+    std::cout << "--------------------------------" << std::endl;
+    std::cout << "downsweep";
+    if (remove_outliers) {
+        std::cout << " with outlier removal (" << int(desc_.outlier_ratio * 100) << " percent)";
+    }
+    std::cout << std::endl;
+    std::cout << "--------------------------------" << std::endl;
+    LOGGER_TRACE("downsweep stage");
 
-                bvh.reset_nodes();
+    CPU_TIMER;
+    // shards were translated as a whole before splitting
+    bvh.downsweep(desc_.translate_to_origin && !is_shard, input_file.string(), desc_.prov_file);
 
-                input_file = fs::canonical(binary_outlier_removed_file);
+    if (remove_outliers) {
+        std::cout << "removed outliers: " << bvh.num_removed_outliers() << " surfels" << std::endl;
+    }
 
-                performed_outlier_removal = true;
-            }
-            else {
-                break;
-            }
+    auto bvhd_file = add_to_path(base_path_, ".bvhd");
 
-        }
+    // checkpoints of an earlier upsweep refer to the tree that is replaced now
+    bvh.remove_upsweep_checkpoint();
+    bvh.serialize_tree_to_file(bvhd_file.string(), true);
 
+    if ((!desc_.keep_intermediate_files) && (start_stage < 1)) {
+        // do not remove input file
+        std::remove(input_file.string().c_str());
     }
-    while (true);
 
-    return input_file;
+    // LOGGER_DEBUG("Used memory: " << GetProcessUsedMemory() / 1024 / 1024 << " MiB");
+
+    return bvhd_file;
 }
 
 boost::filesystem::path builder::upsweep(boost::filesystem::path input_file,
                                          uint16_t start_stage,
                                          reduction_strategy const *reduction_strategy,
                                          normal_computation_strategy const *normal_comp_strategy,
-                                         radius_computation_strategy const *radius_comp_strategy) const
+                                         radius_computation_strategy const *radius_comp_strategy,
+                                         bool write_lod) const
 {
     std::cout << std::endl;
     std::cout << "--------------------------------" << std::endl;
@@ -299,7 +275,11 @@ boost::filesystem::path builder::upsweep(boost::filesystem::path input_file,
 
     lamure::pre::bvh bvh(memory_limit_, desc_.buffer_size, desc_.rep_radius_algo);
 
-    if (!bvh.load_tree(input_file.string())) {
+    // continue an interrupted upsweep if a checkpoint was left behind
+    auto manifest_file = add_to_path(base_path_, ".upsweep_manifest");
+    bool resumed = desc_.checkpoint_upsweep && bvh.load_upsweep_checkpoint(manifest_file.string(), input_file.string());
+
+    if (!resumed && !bvh.load_tree(input_file.string())) {
         return boost::filesystem::path{};
     }
 
@@ -308,6 +288,11 @@ boost::filesystem::path builder::upsweep(boost::filesystem::path input_file,
         return boost::filesystem::path{};
     }
 
+    bvh.enable_upsweep_checkpoints(desc_.checkpoint_upsweep, input_file.string());
+    if (write_lod) {
+        bvh.enable_lod_write_behind(add_to_path(base_path_, ".lod").string(), desc_.direct_io);
+    }
+
     CPU_TIMER;
     // perform upsweep
     bvh.upsweep(*reduction_strategy,
@@ -320,6 +305,10 @@ boost::filesystem::path builder::upsweep(boost::filesystem::path input_file,
     auto bvhu_file = add_to_path(base_path_, ".bvhu");
     bvh.serialize_tree_to_file(bvhu_file.string(), true);
 
+    if (desc_.checkpoint_upsweep) {
+        bvh.remove_upsweep_checkpoint();
+    }
+
     if ((!desc_.keep_intermediate_files) && (start_stage < 2)) {
         std::remove(input_file.string().c_str());
     }
@@ -366,7 +355,7 @@ bool builder::resample_surfels(boost::filesystem::path const &input_file) const
     return true;
 }
 
-bool builder::reserialize(boost::filesystem::path const &input_file, uint16_t start_stage) const
+bool builder::reserialize(boost::filesystem::path const &input_file, uint16_t start_stage, bool lod_written) const
 {
     std::cout << std::endl;
     std::cout << "--------------------------------" << std::endl;
@@ -393,8 +382,14 @@ bool builder::reserialize(boost::filesystem::path const &input_file, uint16_t st
       prov_data::write_json(json_file.string());
     }
 
-    std::cout << "serialize surfels to file" << std::endl;
-    bvh.serialize_surfels_to_file(lod_file.string(), prov_file.string(), desc_.buffer_size);
+    if (lod_written) {
+        // the upsweep already wrote the .lod, only provenance is left
+        bvh.serialize_surfels_to_file("", prov_file.string(), desc_.buffer_size);
+    }
+    else {
+        std::cout << "serialize surfels to file" << std::endl;
+        bvh.serialize_surfels_to_file(lod_file.string(), prov_file.string(), desc_.buffer_size);
+    }
 
     std::cout << "serialize bvh to file" << std::endl << std::endl;
     bvh.serialize_tree_to_file(kdn_file.string(), false);
@@ -408,6 +403,318 @@ bool builder::reserialize(boost::filesystem::path const &input_file, uint16_t st
     return true;
 }
 
+bool builder::update(boost::filesystem::path const &input_file,
+                     uint16_t start_stage,
+                     reduction_strategy const *reduction_strategy,
+                     normal_computation_strategy const *normal_comp_strategy,
+                     radius_computation_strategy const *radius_comp_strategy) const
+{
+    std::cout << std::endl;
+    std::cout << "--------------------------------" << std::endl;
+    std::cout << "update" << std::endl;
+    std::cout << "--------------------------------" << std::endl;
+    LOGGER_TRACE("update stage");
+
+    if (start_stage > 1) {
+        LOGGER_ERROR("Update needs a point cloud or a binary surfel file as input");
+        return false;
+    }
+
+    auto bvh_file = fs::absolute(fs::path(desc_.update_tree));
+    auto lod_file = fs::path(bvh_file).replace_extension(".lod");
+    if (!fs::exists(bvh_file) || !fs::exists(lod_file)) {
+        LOGGER_ERROR("Tree to update not found: \"" << bvh_file.string() << "\"");
+        return false;
+    }
+    if (fs::exists(fs::path(bvh_file).replace_extension(".prov"))) {
+        LOGGER_ERROR("Updating trees with provenance data is not supported");
+        return false;
+    }
+
+    lamure::pre::bvh bvh(memory_limit_, desc_.buffer_size, desc_.rep_radius_algo);
+    if (!bvh.load_tree(bvh_file.string())) {
+        return false;
+    }
+    if (bvh.state() != bvh::state_type::serialized) {
+        LOGGER_ERROR("Wrong processing state!");
+        return false;
+    }
+
+    surfel_file input;
+    input.open(input_file.string());
+    surfel_vector new_surfels(input.get_size());
+    input.read(&new_surfels, 0, 0, new_surfels.size());
+    input.close();
+
+    CPU_TIMER;
+    // the previous files are only replaced after the update was written completely
+    auto updated_lod_file = add_to_path(lod_file, ".tmp");
+    auto updated_bvh_file = add_to_path(bvh_file, ".tmp");
+    try {
+        std::vector<node_id_type> updated_nodes = bvh.insert_surfels(lod_file.string(),
+                                                                     new_surfels,
+                                                                     *reduction_strategy,
+                                                                     *normal_comp_strategy,
+                                                                     *radius_comp_strategy,
+                                                                     desc_.recompute_leaf_normals,
+                                                                     desc_.recompute_leaf_radii);
+
+        LOGGER_INFO("Rebuilt " << updated_nodes.size() << " of " << bvh.nodes().size() << " nodes");
+
+        bvh.serialize_updated_surfels_to_file(lod_file.string(), updated_lod_file.string(), updated_nodes, desc_.buffer_size);
+        bvh.serialize_tree_to_file(updated_bvh_file.string(), false);
+    }
+    catch (const std::exception &e) {
+        // a partially written update must never replace the existing tree
+        LOGGER_ERROR("Update failed, the existing tree is left unchanged: " << e.what());
+        boost::system::error_code ec;
+        fs::remove(updated_lod_file, ec);
+        fs::remove(updated_bvh_file, ec);
+        return false;
+    }
+
+    fs::rename(updated_lod_file, lod_file);
+    fs::rename(updated_bvh_file, bvh_file);
+
+    if ((!desc_.keep_intermediate_files) && (start_stage < 1)) {
+        std::remove(input_file.string().c_str());
+    }
+    return true;
+}
+
+bool builder::construct_sharded(boost::filesystem::path input_file,
+                                uint16_t start_stage,
+                                reduction_strategy const *reduction_strategy,
+                                normal_computation_strategy const *normal_comp_strategy,
+                                radius_computation_strategy const *radius_comp_strategy) const
+{
+    if (start_stage > 1) {
+        LOGGER_ERROR("Sharded construction needs a point cloud or a binary surfel file as input");
+        return false;
+    }
+    if (desc_.prov_file != "") {
+        LOGGER_ERROR("Sharded construction does not support provenance data");
+        return false;
+    }
+    if (desc_.final_stage < 4) {
+        LOGGER_ERROR("Sharded construction needs a final stage of 4 or 5");
+        return false;
+    }
+    if (desc_.shard_command.empty()) {
+        LOGGER_ERROR("No command given to launch shard workers");
+        return false;
+    }
+
+    std::cout << std::endl;
+    std::cout << "--------------------------------" << std::endl;
+    std::cout << "split into shards" << std::endl;
+    std::cout << "--------------------------------" << std::endl;
+    LOGGER_TRACE("shard split stage");
+
+    shard_layout layout;
+    std::vector<std::string> shard_files;
+    {
+        lamure::pre::bvh bvh(memory_limit_, desc_.buffer_size, desc_.rep_radius_algo);
+        bvh.init_tree(input_file.string(),
+                      desc_.max_fan_factor,
+                      desc_.surfels_per_node,
+                      base_path_);
+        bvh.print_tree_properties();
+
+        if (bvh.depth() < 2) {
+            LOGGER_ERROR("The input is too small to be split into shards");
+            return false;
+        }
+
+        // use the first level with enough nodes, every shard keeps at least one level below its root
+        uint32_t shard_level = 1;
+        while (bvh.get_length_of_depth(shard_level) < desc_.num_shards && shard_level + 1 < bvh.depth()) {
+            ++shard_level;
+        }
+
+        CPU_TIMER;
+        shard_files = bvh.split_into_shards(input_file.string(), shard_level, desc_.translate_to_origin);
+
+        layout.fan_factor = bvh.fan_factor();
+        layout.depth = bvh.depth();
+        layout.max_surfels_per_node = bvh.max_surfels_per_node();
+        layout.shard_level = shard_level;
+        layout.translation = bvh.translation();
+    }
+
+    auto manifest_file = add_to_path(base_path_, ".shards");
+    write_shard_layout(manifest_file, layout);
+
+    if ((!desc_.keep_intermediate_files) && (start_stage < 1)) {
+        std::remove(input_file.string().c_str());
+    }
+
+    std::cout << std::endl;
+    std::cout << "--------------------------------" << std::endl;
+    std::cout << "build " << shard_files.size() << " shards" << std::endl;
+    std::cout << "--------------------------------" << std::endl;
+    LOGGER_TRACE("shard build stage");
+
+    {
+        CPU_TIMER;
+        if (!run_shard_jobs(shard_files, manifest_file)) {
+            return false;
+        }
+    }
+
+    std::cout << std::endl;
+    std::cout << "--------------------------------" << std::endl;
+    std::cout << "merge shards" << std::endl;
+    std::cout << "--------------------------------" << std::endl;
+    LOGGER_TRACE("shard merge stage");
+
+    std::vector<std::string> shard_trees;
+    for (uint32_t shard_index = 0; shard_index < shard_files.size(); ++shard_index) {
+        shard_trees.push_back(add_to_path(base_path_, ".shard" + std::to_string(shard_index) + ".bvhu").string());
+    }
+
+    auto bvhu_file = add_to_path(base_path_, ".bvhu");
+    {
+        lamure::pre::bvh bvh(memory_limit_, desc_.buffer_size, desc_.rep_radius_algo);
+        bvh.init_tree(layout.fan_factor, layout.depth, layout.max_surfels_per_node, base_path_);
+        bvh.merge_shards(shard_trees, layout.shard_level, layout.translation);
+        if (desc_.final_stage >= 5) {
+            bvh.enable_lod_write_behind(add_to_path(base_path_, ".lod").string(), desc_.direct_io);
+        }
+
+        CPU_TIMER;
+        // only the levels above the shard roots are computed here
+        bvh.upsweep(*reduction_strategy,
+                    *normal_comp_strategy,
+                    *radius_comp_strategy,
+                    desc_.resample,
+                    false,
+                    false);
+
+        bvh.serialize_tree_to_file(bvhu_file.string(), true);
+    }
+
+    if (!desc_.keep_intermediate_files) {
+        for (uint32_t shard_index = 0; shard_index < shard_files.size(); ++shard_index) {
+            std::remove(shard_files[shard_index].c_str());
+            std::remove(shard_trees[shard_index].c_str());
+        }
+        std::remove(manifest_file.string().c_str());
+    }
+
+    if (desc_.final_stage < 5) {
+        return true;
+    }
+    return reserialize(bvhu_file, start_stage, true);
+}
+
+bool builder::run_shard_jobs(std::vector<std::string> const &shard_files,
+                             boost::filesystem::path const &manifest_file) const
+{
+    // the memory budget is split between the workers running at the same time,
+    // budgets are whole GiB so there are never more workers than GiB
+    const uint32_t memory_budget = std::max(uint32_t(1), uint32_t(desc_.memory_budget));
+    const uint32_t num_jobs = std::max(uint32_t(1), std::min({desc_.num_shard_jobs, uint32_t(shard_files.size()), memory_budget}));
+    const uint32_t job_memory_budget = memory_budget / num_jobs;
+    if (num_jobs < desc_.num_shard_jobs && num_jobs < shard_files.size()) {
+        LOGGER_WARN("Memory budget of " << memory_budget << " GiB allows only " << num_jobs << " shard jobs");
+    }
+
+    // OpenMP sections of the workers share the cores as well
+    const std::string job_threads = std::to_string(std::max(1u, std::thread::hardware_concurrency() / num_jobs));
+#ifndef _WIN32
+    setenv("OMP_NUM_THREADS", job_threads.c_str(), 1);
+#else
+    _putenv_s("OMP_NUM_THREADS", job_threads.c_str());
+#endif
+    LOGGER_INFO("Running " << num_jobs << " shard jobs with " << job_memory_budget << " GiB and "
+                << job_threads << " OpenMP threads each");
+
+    std::atomic<uint32_t> next_shard(0);
+    std::atomic<bool> failed(false);
+    std::mutex log_mutex;
+
+    // every worker is a separate process, the threads only wait for them
+    auto run_jobs = [&]() {
+        uint32_t shard_index;
+        while (!failed && (shard_index = next_shard++) < shard_files.size()) {
+            auto log_file = add_to_path(base_path_, ".shard" + std::to_string(shard_index) + ".log");
+            std::string command = desc_.shard_command
+                + " \"" + shard_files[shard_index] + "\""
+                + " --shard-manifest \"" + manifest_file.string() + "\""
+                + " --memory-budget " + std::to_string(job_memory_budget)
+                + " > \"" + log_file.string() + "\" 2>&1";
+
+            {
+                std::lock_guard<std::mutex> lock(log_mutex);
+                LOGGER_INFO("Build shard " << shard_index << ", log: \"" << log_file.string() << "\"");
+            }
+
+            if (std::system(command.c_str()) != 0) {
+                std::lock_guard<std::mutex> lock(log_mutex);
+                LOGGER_ERROR("Shard " << shard_index << " failed, see \"" << log_file.string() << "\"");
+                failed = true;
+            }
+            else if (!desc_.keep_intermediate_files) {
+                std::remove(log_file.string().c_str());
+            }
+        }
+    };
+
+    std::vector<std::thread> jobs;
+    for (uint32_t job_index = 0; job_index < num_jobs; ++job_index) {
+        jobs.push_back(std::thread(run_jobs));
+    }
+    for (auto &job : jobs) {
+        job.join();
+    }
+
+    return !failed;
+}
+
+void builder::write_shard_layout(boost::filesystem::path const &manifest_file, shard_layout const &layout) const
+{
+    std::ofstream manifest(manifest_file.string(), std::ios::out | std::ios::trunc);
+    if (!manifest.is_open()) {
+        throw std::runtime_error("Unable to write shard manifest: " + manifest_file.string());
+    }
+
+    manifest.precision(std::numeric_limits<real>::max_digits10);
+    manifest << "fan_factor " << layout.fan_factor << "\n";
+    manifest << "depth " << layout.depth << "\n";
+    manifest << "max_surfels_per_node " << layout.max_surfels_per_node << "\n";
+    manifest << "shard_level " << layout.shard_level << "\n";
+    manifest << "translation " << layout.translation.x << " " << layout.translation.y << " " << layout.translation.z << "\n";
+}
+
+builder::shard_layout builder::read_shard_layout(boost::filesystem::path const &manifest_file) const
+{
+    std::ifstream manifest(manifest_file.string());
+    if (!manifest.is_open()) {
+        throw std::runtime_error("Unable to read shard manifest: " + manifest_file.string());
+    }
+
+    shard_layout layout{0, 0, 0, 0, vec3r(0.0)};
+    std::string key;
+    while (manifest >> key) {
+        if (key == "fan_factor")
+            manifest >> layout.fan_factor;
+        else if (key == "depth")
+            manifest >> layout.depth;
+        else if (key == "max_surfels_per_node")
+            manifest >> layout.max_surfels_per_node;
+        else if (key == "shard_level")
+            manifest >> layout.shard_level;
+        else if (key == "translation")
+            manifest >> layout.translation.x >> layout.translation.y >> layout.translation.z;
+    }
+
+    if (layout.fan_factor < 2 || layout.shard_level == 0 || layout.shard_level >= layout.depth) {
+        throw std::runtime_error("Invalid shard manifest: " + manifest_file.string());
+    }
+    return layout;
+}
+
 size_t builder::calculate_memory_limit() const
 {
 
@@ -506,6 +813,7 @@ construct()
 
     // init algorithms
     std::unique_ptr<reduction_strategy> reduction_strategy{get_reduction_strategy(desc_.reduction_algo)};
+    reduction_strategy->set_prov_aggregation(desc_.prov_aggregation);
     std::unique_ptr<normal_computation_strategy> normal_comp_strategy{get_normal_strategy(desc_.normal_computation_algo)};
     std::unique_ptr<radius_computation_strategy> radius_comp_strategy{get_radius_strategy(desc_.radius_computation_algo)};
 
@@ -538,21 +846,38 @@ construct()
         }
     }
 
+    if (!desc_.update_tree.empty()) {
+        return update(input_file, start_stage, reduction_strategy.get(), normal_comp_strategy.get(), radius_comp_strategy.get());
+    }
+
+    if (desc_.num_shards > 1 && desc_.shard_manifest.empty()) {
+        return construct_sharded(input_file, start_stage, reduction_strategy.get(), normal_comp_strategy.get(), radius_comp_strategy.get());
+    }
+
+    // shard workers stop after the upsweep, the merge serializes the tree
+    if (!desc_.shard_manifest.empty()) {
+        final_stage = std::min(final_stage, uint16_t(4));
+    }
+
     // downsweep (create bvh)
     if ((3 >= start_stage) && (3 <= final_stage)) {
         input_file = downsweep(input_file, start_stage);
         if (input_file.empty()) return false;
     }
 
+    // the .lod is written during upsweep if serialization follows in this run
+    const bool lod_written_in_upsweep = (4 >= start_stage) && (5 <= final_stage);
+
     // upsweep (create LOD)
     if ((4 >= start_stage) && (4 <= final_stage)) {
-        input_file = upsweep(input_file, start_stage, reduction_strategy.get(), normal_comp_strategy.get(), radius_comp_strategy.get());
+        input_file = upsweep(input_file, start_stage, reduction_strategy.get(), normal_comp_strategy.get(), radius_comp_strategy.get(),
+                             lod_written_in_upsweep);
         if (input_file.empty()) return false;
     }
 
     // serialize to file
     if ((5 >= start_stage) && (5 <= final_stage)) {
-        bool reserialize_success = reserialize(input_file, start_stage);
+        bool reserialize_success = reserialize(input_file, start_stage, lod_written_in_upsweep);
         if (!reserialize_success) return false;
     }
     return true;
@@ -17,6 +17,7 @@
 #include <lamure/pre/basic_algorithms.h>
 #include <lamure/pre/bvh.h>
 #include <lamure/pre/bvh_stream.h>
+#include <lamure/pre/natural_neighbours.h>
 #include <lamure/pre/plane.h>
 #include <lamure/pre/serialized_surfel.h>
 #include <lamure/sphere.h>
@@ -24,8 +25,11 @@
 
 #include <lamure/pre/normal_computation_plane_fitting.h>
 #include <lamure/pre/radius_computation_average_distance.h>
+#include <lamure/pre/reduction_constant.h>
 
+#include <chrono>
 #include <fstream>
+#include <future>
 #include <iostream>
 #include <limits>
 #include <map>
@@ -76,8 +80,6 @@ void bvh::init_tree(const std::string &surfels_input_file, const uint32_t max_fa
     assert(max_fan_factor >= 2);
     assert(desired_surfels_per_node >= 5);
 
-    base_path_ = base_path;
-
     // get number of surfels
     surfel_file input;
     input.open(surfels_input_file);
@@ -85,6 +87,9 @@ void bvh::init_tree(const std::string &surfels_input_file, const uint32_t max_fa
     input.close();
 
     // compute bvh properties
+    uint8_t best_fan_factor = 0;
+    uint32_t best_depth = 0;
+    size_t best_max_surfels_per_node = 0;
     size_t best = std::numeric_limits<size_t>::max();
     for(size_t i = 2; i <= max_fan_factor; ++i)
     {
@@ -97,12 +102,25 @@ void bvh::init_tree(const std::string &surfels_input_file, const uint32_t max_fa
         if(diff < best)
         {
             best = diff;
-            fan_factor_ = i;
-            depth_ = depth;
-            max_surfels_per_node_ = temp_max_surfels_per_node;
+            best_fan_factor = i;
+            best_depth = depth;
+            best_max_surfels_per_node = temp_max_surfels_per_node;
         }
     }
 
+    init_tree(best_fan_factor, best_depth, best_max_surfels_per_node, base_path);
+}
+
+void bvh::init_tree(const uint8_t fan_factor, const uint32_t depth, const size_t max_surfels_per_node, const boost::filesystem::path &base_path)
+{
+    assert(state_ == state_type::null);
+    assert(fan_factor >= 2);
+
+    base_path_ = base_path;
+    fan_factor_ = fan_factor;
+    depth_ = depth;
+    max_surfels_per_node_ = max_surfels_per_node;
+
     // compute number of nodes
     size_t num_nodes = 1, count = 1;
     for(uint32_t i = 1; i <= depth_; ++i)
@@ -393,6 +411,12 @@ void bvh::downsweep_subtree_in_core(const bvh_node &node, size_t &disk_leaf_dest
         slice_right = new_slice_right;
     }
 
+    if(outlier_ratio_ > 0.0f)
+    {
+        LOGGER_TRACE("Remove outliers from leaves");
+        remove_outliers_in_leaves(slice_left, slice_right);
+    }
+
     LOGGER_TRACE("Compute node properties for leaves");
 
     spawn_compute_bounding_boxes_downsweep_jobs(slice_left, slice_right);
@@ -420,38 +444,198 @@ void bvh::downsweep_subtree_in_core(const bvh_node &node, size_t &disk_leaf_dest
     }
 }
 
-void bvh::compute_normal_and_radius(const bvh_node *source_node, const normal_computation_strategy &normal_computation_strategy, const radius_computation_strategy &radius_computation_strategy, bool compute_normals, bool compute_radii)
+std::vector<std::string> bvh::split_into_shards(const std::string &surfels_input_file, const uint32_t shard_level, const bool adjust_translation)
+{
+    assert(state_ == state_type::empty);
+    assert(shard_level > 0 && shard_level < depth_);
+
+    LOGGER_INFO("Split \"" << surfels_input_file << "\" into " << get_length_of_depth(shard_level) << " shards");
+
+    shared_surfel_file input_file_disk_access = std::make_shared<surfel_file>();
+    input_file_disk_access->open(surfels_input_file);
+
+    // the shards are split in-core, like the top levels of the downsweep
+    nodes_[0] = bvh_node(0, 0, bounding_box(), surfel_disk_array(input_file_disk_access, 0, input_file_disk_access->get_size()));
+    nodes_[0].load_from_disk();
+    input_file_disk_access->close();
+
+    surfel_mem_array root_array = nodes_[0].mem_array();
+    nodes_[0].reset(root_array);
+
+    bounding_box input_bb = basic_algorithms::compute_aabb(nodes_[0].mem_array());
+
+    translation_ = vec3r(0.0);
+    if(adjust_translation)
+    {
+        vec3r translation = (input_bb.min() + input_bb.max()) * vec3r(0.5);
+        translation.x = std::floor(translation.x);
+        translation.y = std::floor(translation.y);
+        translation.z = std::floor(translation.z);
+        translation_ = translation;
+
+        LOGGER_INFO("The surfels will be translated by: " << translation);
+
+        input_bb.min() -= translation;
+        input_bb.max() -= translation;
+        basic_algorithms::translate_surfels(nodes_[0].mem_array(), -translation);
+    }
+    nodes_[0].set_bounding_box(input_bb);
+
+    size_t slice_left = 0, slice_right = 0;
+    for(uint32_t level = 0; level < shard_level; ++level)
+    {
+        size_t new_slice_left = 0, new_slice_right = 0;
+
+        spawn_split_node_jobs(slice_left, slice_right, new_slice_left, new_slice_right, level);
+
+        slice_left = new_slice_left;
+        slice_right = new_slice_right;
+    }
+
+    std::vector<std::string> shard_files;
+    const std::string extension = boost::filesystem::path(surfels_input_file).extension().string();
+    for(size_t nid = slice_left; nid <= slice_right; ++nid)
+    {
+        bvh_node &current_node = nodes_[nid];
+        const std::string shard_file = add_to_path(base_path_, ".shard" + std::to_string(nid - slice_left) + extension).string();
+
+        surfel_file shard;
+        shard.open(shard_file, true);
+        shard.append(current_node.mem_array().surfel_mem_data().get(), current_node.mem_array().offset(), current_node.mem_array().length());
+        shard.close();
+
+        LOGGER_TRACE("Shard " << nid - slice_left << ": " << current_node.mem_array().length() << " surfels");
+
+        current_node.reset();
+        shard_files.push_back(shard_file);
+    }
+
+    return shard_files;
+}
+
+void bvh::merge_shards(const std::vector<std::string> &shard_tree_files, const uint32_t shard_level, const vec3r &translation)
 {
-    for(size_t k = 0; k < max_surfels_per_node_; ++k)
+    assert(state_ == state_type::empty);
+
+    if(shard_tree_files.size() != get_length_of_depth(shard_level))
+    {
+        throw std::runtime_error("Number of shard trees does not match the shard level");
+    }
+
+    // top levels are rebuilt by the upsweep
+    for(uint32_t level = 0; level < shard_level; ++level)
     {
-        if(k < source_node->mem_array().length())
+        const node_id_type first_node_of_level = get_first_node_id_of_depth(level);
+        for(uint32_t i = 0; i < get_length_of_depth(level); ++i)
         {
-            // read surfel
-            surfel surf = source_node->mem_array().read_surfel(k);
+            nodes_[first_node_of_level + i] = bvh_node(first_node_of_level + i, level, bounding_box());
+        }
+    }
 
-            uint16_t num_nearest_neighbours_to_search = std::max(radius_computation_strategy.number_of_neighbours(), normal_computation_strategy.number_of_neighbours());
+    for(uint32_t shard_index = 0; shard_index < shard_tree_files.size(); ++shard_index)
+    {
+        bvh shard(memory_limit_, buffer_size_, rep_radius_algo_);
+        shard.load_tree(shard_tree_files[shard_index]);
 
-            auto const &max_nearest_neighbours = get_nearest_neighbours(surfel_id_t(source_node->node_id(), k), num_nearest_neighbours_to_search);
-            
-            // compute radius
-            if (compute_radii) {
-                real radius = radius_computation_strategy.compute_radius(*this, surfel_id_t(source_node->node_id(), k), max_nearest_neighbours);
-                surf.radius() = radius;
-            }
+        if(shard.state() != state_type::after_upsweep || shard.fan_factor() != fan_factor_ || shard.depth() + shard_level != depth_ ||
+           shard.max_surfels_per_node() != max_surfels_per_node_)
+        {
+            throw std::runtime_error("Shard tree does not fit into the merged tree: " + shard_tree_files[shard_index]);
+        }
+
+        // the subtree of shard k covers the k-th range of every level below shard_level
+        for(uint32_t local_depth = 0; local_depth <= shard.depth(); ++local_depth)
+        {
+            const uint32_t length = shard.get_length_of_depth(local_depth);
+            const node_id_type first_local = shard.get_first_node_id_of_depth(local_depth);
+            const node_id_type first_global = get_first_node_id_of_depth(shard_level + local_depth) + shard_index * length;
 
-            // compute normal
-            if (compute_normals) {
-                vec3f normal = normal_computation_strategy.compute_normal(*this, surfel_id_t(source_node->node_id(), k), max_nearest_neighbours);
-                surf.normal() = normal;
+            for(uint32_t i = 0; i < length; ++i)
+            {
+                const bvh_node &shard_node = shard.nodes()[first_local + i];
+                bvh_node &node = nodes_[first_global + i];
+
+                node = bvh_node(first_global + i, shard_level + local_depth, shard_node.get_bounding_box(), shard_node.disk_array());
+                node.set_reduction_error(shard_node.reduction_error());
+                node.set_centroid(shard_node.centroid());
+                node.set_avg_surfel_radius(shard_node.avg_surfel_radius());
+                node.set_visibility(shard_node.visibility());
+                node.set_max_surfel_radius_deviation(shard_node.max_surfel_radius_deviation());
             }
+        }
+    }
+
+    translation_ = translation;
+    upsweep_resume_level_ = shard_level;
+    state_ = state_type::after_downsweep;
+}
+
+void bvh::compute_normal_and_radius(const bvh_node *source_node, const normal_computation_strategy &normal_computation_strategy, const radius_computation_strategy &radius_computation_strategy, bool compute_normals, bool compute_radii,
+                                    const size_t first_surfel)
+{
+    attribute_buffers buffers;
+    compute_normal_and_radius(source_node, normal_computation_strategy, radius_computation_strategy, compute_normals, compute_radii, first_surfel, buffers);
+}
+
+void bvh::compute_normal_and_radius(const bvh_node *source_node, const normal_computation_strategy &normal_computation_strategy, const radius_computation_strategy &radius_computation_strategy, bool compute_normals, bool compute_radii,
+                                    const size_t first_surfel, attribute_buffers &buffers)
+{
+    const size_t num_surfels = source_node->mem_array().length() > first_surfel ? source_node->mem_array().length() - first_surfel : 0;
+    if(num_surfels == 0)
+    {
+        return;
+    }
 
-            // write surfel           
-            source_node->mem_array().write_surfel(surf, k);
+    uint16_t num_nearest_neighbours_to_search = std::max(radius_computation_strategy.number_of_neighbours(), normal_computation_strategy.number_of_neighbours());
+
+    // gather the neighbourhoods of the whole node first, normals are then estimated in one batch;
+    // nodes after the first reuse the capacity of the buffers
+    auto &neighbourhoods = buffers.neighbourhoods;
+    auto &normals = buffers.normals;
+    neighbourhoods.resize(num_surfels);
+    for(size_t k = 0; k < num_surfels; ++k)
+    {
+        get_nearest_neighbours(surfel_id_t(source_node->node_id(), first_surfel + k), num_nearest_neighbours_to_search, neighbourhoods[k]);
+    }
+
+    if(compute_normals)
+    {
+        auto start = std::chrono::steady_clock::now();
+        normal_computation_strategy.compute_normals(*this, surfel_id_t(source_node->node_id(), first_surfel), neighbourhoods, normals);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        LOGGER_TRACE("Node " << source_node->node_id() << ": " << num_surfels << " normals in " << seconds << " s ("
+                             << (seconds > 0.0 ? num_surfels / seconds : 0.0) << " surfels/s)");
+    }
+
+    for(size_t k = 0; k < num_surfels; ++k)
+    {
+        // read surfel
+        surfel surf = source_node->mem_array().read_surfel(first_surfel + k);
+
+        // compute radius
+        if (compute_radii) {
+            real radius = radius_computation_strategy.compute_radius(*this, surfel_id_t(source_node->node_id(), first_surfel + k), neighbourhoods[k]);
+            surf.radius() = radius;
+        }
+
+        // compute normal
+        if (compute_normals) {
+            surf.normal() = normals[k];
         }
+
+        // write surfel           
+        source_node->mem_array().write_surfel(surf, first_surfel + k);
+    }
+
+    size_t buffer_bytes = neighbourhoods.capacity() * sizeof(neighbourhoods[0]) + normals.capacity() * sizeof(vec3f);
+    for(const auto &neighbourhood : neighbourhoods)
+    {
+        buffer_bytes += neighbourhood.capacity() * sizeof(std::pair<surfel_id_t, real>);
     }
+    buffers.memory.resize(buffer_bytes);
 }
 
-void bvh::get_descendant_leaves(const node_id_type node, std::vector<node_id_type> &result, const node_id_type first_leaf, const std::unordered_set<size_t> &excluded_leaves) const
+void bvh::get_descendant_leaves(const node_id_type node, arena_vector<node_id_type> &result, const node_id_type first_leaf, const arena_unordered_set<size_t> &excluded_leaves) const
 {
     if(node < first_leaf) // inner node
     {
@@ -469,7 +653,7 @@ void bvh::get_descendant_leaves(const node_id_type node, std::vector<node_id_typ
     }
 }
 
-void bvh::get_descendant_nodes(const node_id_type node, std::vector<node_id_type> &result, const node_id_type desired_depth, const std::unordered_set<size_t> &excluded_nodes) const
+void bvh::get_descendant_nodes(const node_id_type node, arena_vector<node_id_type> &result, const node_id_type desired_depth, const arena_unordered_set<size_t> &excluded_nodes) const
 {
     size_t node_depth = std::log((node + 1) * (fan_factor_ - 1)) / std::log(fan_factor_);
     if(node_depth == desired_depth)
@@ -491,11 +675,24 @@ void bvh::get_descendant_nodes(const node_id_type node, std::vector<node_id_type
 
 std::vector<std::pair<surfel_id_t, real>> bvh::get_nearest_neighbours(surfel_id_t const target_surfel, uint32_t const number_of_neighbours, bool const do_local_search) const
 {
+    std::vector<std::pair<surfel_id_t, real>> candidates;
+    get_nearest_neighbours(target_surfel, number_of_neighbours, candidates, do_local_search);
+    return candidates;
+}
+
+void bvh::get_nearest_neighbours(surfel_id_t const target_surfel, uint32_t const number_of_neighbours, std::vector<std::pair<surfel_id_t, real>> &candidates,
+                                 bool const do_local_search) const
+{
+    // traversal state of this query is released when it returns
+    arena_scope scope;
+
     node_id_type current_node = target_surfel.node_idx;
-    std::unordered_set<size_t> processed_nodes;
+    arena_unordered_set<size_t> processed_nodes;
+    arena_vector<node_id_type> unvisited_descendant_nodes;
     vec3r center = nodes_[target_surfel.node_idx].mem_array().read_surfel_ref(target_surfel.surfel_idx).pos();
 
-    std::vector<std::pair<surfel_id_t, real>> candidates;
+    candidates.clear();
+    candidates.reserve(number_of_neighbours + 1);
     real max_candidate_distance = std::numeric_limits<real>::max();
 
     // check own node
@@ -532,7 +729,7 @@ std::vector<std::pair<surfel_id_t, real>> bvh::get_nearest_neighbours(surfel_id_
 
     if(do_local_search)
     {
-        return candidates;
+        return;
     }
 
     processed_nodes.insert(current_node);
@@ -544,8 +741,7 @@ std::vector<std::pair<surfel_id_t, real>> bvh::get_nearest_neighbours(surfel_id_
     {
         current_node = get_parent_id(current_node);
 
-        std::vector<node_id_type> unvisited_descendant_nodes;
-
+        unvisited_descendant_nodes.clear();
         get_descendant_nodes(current_node, unvisited_descendant_nodes, nodes_[target_surfel.node_idx].depth(), processed_nodes);
 
         for(auto adjacent_node : unvisited_descendant_nodes)
@@ -590,8 +786,6 @@ std::vector<std::pair<surfel_id_t, real>> bvh::get_nearest_neighbours(surfel_id_
             }
         }
     }
-
-    return candidates;
 }
 
 std::vector<std::pair<surfel_id_t, real>> bvh::get_nearest_neighbours_in_nodes(const surfel_id_t target_surfel, const std::vector<node_id_type> &target_nodes,
@@ -684,10 +878,9 @@ std::vector<std::pair<surfel_id_t, real>> bvh::get_natural_neighbours(surfel_id_
     // limit to 24 closest neighbours
     const uint32_t NUM_NATURAL_NEIGHBOURS = 24;
     auto nearest_neighbours = all_nearest_neighbours;
-    nearest_neighbours.resize(NUM_NATURAL_NEIGHBOURS);
-    std::random_shuffle(nearest_neighbours.begin(), nearest_neighbours.end());
+    nearest_neighbours.resize(std::min(size_t(NUM_NATURAL_NEIGHBOURS), nearest_neighbours.size()));
 
-    std::vector<vec3r> nn_positions(NUM_NATURAL_NEIGHBOURS);
+    std::vector<vec3r> nn_positions(nearest_neighbours.size());
 
     std::size_t point_num = 0;
     for(auto const &near_neighbour : nearest_neighbours)
@@ -709,11 +902,44 @@ std::vector<std::pair<surfel_id_t, real>> bvh::get_natural_neighbours(surfel_id_
     return natural_neighbours;
 }
 
-#ifdef LAMURE_USE_CGAL_FOR_NNI
 std::vector<std::pair<uint32_t, real>> bvh::extract_approximate_natural_neighbours(vec3r const &point_of_interest, std::vector<vec3r> const &nn_positions) const
+{
+    if(nn_positions.size() < 3)
+    {
+        return std::vector<std::pair<uint32_t, real>>{};
+    }
+
+    // compute best fit plane
+    plane_t plane;
+    plane_t::fit_plane(nn_positions, plane);
+    const vec3r plane_right = plane.get_right();
+    const vec3r plane_up = plane.get_up();
+
+    // project all points to the plane
+    std::vector<vec2r> projected_neighbours(nn_positions.size());
+    for(size_t i = 0; i < nn_positions.size(); ++i)
+    {
+        projected_neighbours[i] = plane_t::project(plane, plane_right, plane_up, nn_positions[i]);
+        // projection invalid
+        if(!std::isfinite(projected_neighbours[i].x) || !std::isfinite(projected_neighbours[i].y))
+        {
+            return std::vector<std::pair<uint32_t, real>>{};
+        }
+    }
+
+    const vec2r projected_poi = plane_t::project(plane, plane_right, plane_up, point_of_interest);
+    return natural_neighbours::compute(projected_poi, projected_neighbours);
+}
+
+#ifdef LAMURE_USE_CGAL_FOR_NNI
+std::vector<std::pair<uint32_t, real>> bvh::extract_natural_neighbours_delaunay(vec3r const &point_of_interest, std::vector<vec3r> const &nn_positions) const
 {
     std::vector<std::pair<uint32_t, real>> natural_neighbour_ids;
     uint32_t num_input_neighbours = nn_positions.size();
+    if(num_input_neighbours < 3)
+    {
+        return natural_neighbour_ids;
+    }
     // compute best fit plane
     plane_t plane;
     plane_t::fit_plane(nn_positions, plane);
@@ -775,11 +1001,6 @@ std::vector<std::pair<uint32_t, real>> bvh::extract_approximate_natural_neighbou
 
     return natural_neighbour_ids;
 }
-#else
-std::vector<std::pair<uint32_t, real>> bvh::extract_approximate_natural_neighbours(vec3r const &point_of_interest, std::vector<vec3r> const &nn_positions) const
-{
-    throw std::runtime_error("to implement without CGAL.");
-}
 #endif
 
 std::vector<std::pair<surfel, real>> bvh::get_locally_natural_neighbours(std::vector<surfel> const &potential_neighbour_vec, vec3r const &poi, uint32_t num_nearest_neighbours) const
@@ -841,7 +1062,12 @@ std::vector<std::pair<surfel, real>> bvh::get_locally_natural_neighbours(std::ve
 
 void bvh::spawn_create_lod_jobs(const uint32_t first_node_of_level, const uint32_t last_node_of_level, const reduction_strategy &reduction_strgy, const bool resample)
 {
-    uint32_t const num_threads = std::thread::hardware_concurrency();
+    uint32_t const num_hardware_threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    // levels with fewer nodes than threads hand the spare threads to the reduction of each node
+    uint32_t const num_nodes_of_level = std::max(last_node_of_level - first_node_of_level, 1u);
+    uint32_t const num_threads = std::min(num_hardware_threads, num_nodes_of_level);
+    reduction_strgy.set_num_threads_per_node(num_hardware_threads / num_threads);
 
     working_queue_head_counter_.initialize(first_node_of_level); // let the threads fetch a node idx
     std::vector<std::thread> threads;
@@ -856,6 +1082,8 @@ void bvh::spawn_create_lod_jobs(const uint32_t first_node_of_level, const uint32
     {
         thread.join();
     }
+
+    reduction_strgy.set_num_threads_per_node(1);
 }
 
 void bvh::spawn_compute_attribute_jobs(const uint32_t first_node_of_level, const uint32_t last_node_of_level, const normal_computation_strategy &normal_strategy,
@@ -1065,14 +1293,23 @@ void bvh::thread_create_lod(const uint32_t start_marker, const uint32_t end_mark
 {
     uint32_t node_index = working_queue_head_counter_.increment_head();
 
+    // reused by all nodes of this thread
+    std::vector<surfel_mem_array> resampled_arrays;
+    std::vector<surfel_mem_array *> input_mem_arrays;
+    resampled_arrays.reserve(fan_factor_);
+    input_mem_arrays.reserve(fan_factor_);
+
     while(node_index < end_marker)
     {
         bvh_node *current_node = &nodes_.at(node_index);
         // If a node has no data yet, calculate it based on child nodes.
         if(!current_node->is_in_core() && !current_node->is_out_of_core())
         {
-            std::vector<surfel_mem_array> resampled_arrays;
-            std::vector<surfel_mem_array *> input_mem_arrays;
+            // per-node temporaries of the strategy go to the arena of this thread
+            arena_scope node_scope;
+
+            resampled_arrays.clear();
+            input_mem_arrays.clear();
 
             // simplified data will be stored here
             surfel_mem_array reduction_result = surfel_mem_array(std::make_shared<surfel_vector>(surfel_vector()), 0, 0);
@@ -1110,6 +1347,14 @@ void bvh::thread_create_lod(const uint32_t start_marker, const uint32_t end_mark
                 }
             }
 
+            // blocks while the other nodes in flight use up the memory budget
+            size_t num_input_surfels = 0;
+            for(const auto *input_mem_array : input_mem_arrays)
+            {
+                num_input_surfels += input_mem_array->length();
+            }
+            memory_reservation temporaries(reduction_strgy.estimate_temporary_memory(num_input_surfels, max_surfels_per_node_));
+
             real reduction_error;
 
             reduction_strategy *p_reduction_strgy = (reduction_strategy *)&reduction_strgy;
@@ -1119,12 +1364,12 @@ void bvh::thread_create_lod(const uint32_t start_marker, const uint32_t end_mark
                 reduction_result = cast->create_lod(reduction_error, input_mem_arrays, deviations, max_surfels_per_node_, (*this), get_child_id(current_node->node_id(), 0));
                 //cast->output_lod(deviations, node_index);
             }
+            else if(reduction_result.has_provenance())
+            {
+                reduction_result = reduction_strgy.create_lod_with_provenance(reduction_error, input_mem_arrays, max_surfels_per_node_, (*this), get_child_id(current_node->node_id(), 0));
+            }
             else
             {
-                if (reduction_result.has_provenance()) {
-                    std::cout << "ERROR: Only reduction_strategy_provenance supported for PROVENANCE" << std::endl;
-                    throw std::runtime_error("Only reduction_strategy_provenance supported for PROVENANCE");
-                }
                 reduction_result = reduction_strgy.create_lod(reduction_error, input_mem_arrays, max_surfels_per_node_, (*this), get_child_id(current_node->node_id(), 0));
             }
 
@@ -1202,9 +1447,13 @@ void bvh::thread_compute_attributes(const uint32_t start_marker, const uint32_t
     uint16_t percentage = 0;
     uint32_t length_of_level = (end_marker - start_marker) + 1;
 
+    // released when the thread has processed its nodes
+    attribute_buffers buffers;
+
     while(node_index < end_marker)
     {
         bvh_node *current_node = &nodes_.at(node_index);
+        arena_scope node_scope;
 
         // Calculate and set node properties.
         if(is_leaf_level)
@@ -1212,11 +1461,11 @@ void bvh::thread_compute_attributes(const uint32_t start_marker, const uint32_t
             uint16_t number_of_neighbours = 100;
             auto normal_comp_algo = normal_computation_plane_fitting(number_of_neighbours);
             auto radius_comp_algo = radius_computation_average_distance(number_of_neighbours, 1.0f);
-            compute_normal_and_radius(current_node, normal_comp_algo, radius_comp_algo, compute_normals, compute_radii);
+            compute_normal_and_radius(current_node, normal_comp_algo, radius_comp_algo, compute_normals, compute_radii, 0, buffers);
         }
         else
         {
-            compute_normal_and_radius(current_node, normal_strategy, radius_strategy, compute_normals, compute_radii);
+            compute_normal_and_radius(current_node, normal_strategy, radius_strategy, compute_normals, compute_radii, 0, buffers);
         }
 
         if(update_percentage)
@@ -1310,18 +1559,19 @@ void bvh::thread_compute_bounding_boxes_upsweep(const uint32_t start_marker, con
     }
 }
 
-void bvh::thread_remove_outlier_jobs(const uint32_t start_marker, const uint32_t end_marker, const uint32_t num_outliers, const uint16_t num_neighbours,
-                                     std::vector<std::pair<surfel_id_t, real>> &intermediate_outliers_for_thread)
+void bvh::thread_compute_outlier_scores(const uint32_t start_marker, const uint32_t end_marker, std::vector<std::vector<float>> &scores, quantile_sketch &sketch_for_thread)
 {
     uint32_t node_idx = working_queue_head_counter_.increment_head();
 
     while(node_idx < end_marker)
     {
-        bvh_node *current_node = &nodes_.at(node_idx);
+        const bvh_node &current_node = nodes_.at(node_idx);
+        std::vector<float> &node_scores = scores[node_idx - start_marker];
+        node_scores.resize(current_node.mem_array().length());
 
-        for(size_t surfel_idx = 0; surfel_idx < current_node->mem_array().length(); ++surfel_idx)
+        for(size_t surfel_idx = 0; surfel_idx < current_node.mem_array().length(); ++surfel_idx)
         {
-            std::vector<std::pair<surfel_id_t, real>> const nearest_neighbour_vector = get_nearest_neighbours(surfel_id_t(node_idx, surfel_idx), num_neighbours);
+            std::vector<std::pair<surfel_id_t, real>> const nearest_neighbour_vector = get_nearest_neighbours(surfel_id_t(node_idx, surfel_idx), num_outlier_neighbours_);
 
             double avg_dist = 0.0;
 
@@ -1335,31 +1585,8 @@ void bvh::thread_remove_outlier_jobs(const uint32_t start_marker, const uint32_t
                 avg_dist /= nearest_neighbour_vector.size();
             }
 
-            bool insert_element = false;
-            if(intermediate_outliers_for_thread.size() < num_outliers)
-            {
-                insert_element = true;
-            }
-            else if(avg_dist > intermediate_outliers_for_thread.back().second)
-            {
-                intermediate_outliers_for_thread.pop_back();
-                insert_element = true;
-            }
-
-            if(insert_element)
-            {
-                intermediate_outliers_for_thread.emplace_back(surfel_id_t{node_idx, surfel_idx}, avg_dist);
-
-                for(uint32_t k = intermediate_outliers_for_thread.size() - 1; k > 0; --k)
-                {
-                    if(intermediate_outliers_for_thread[k].second > intermediate_outliers_for_thread[k - 1].second)
-                    {
-                        std::swap(intermediate_outliers_for_thread[k], intermediate_outliers_for_thread[k - 1]);
-                    }
-                    else
-                        break;
-                }
-            }
+            node_scores[surfel_idx] = float(avg_dist);
+            sketch_for_thread.insert(avg_dist);
         }
 
         node_idx = working_queue_head_counter_.increment_head();
@@ -1430,29 +1657,83 @@ void bvh::upsweep(const reduction_strategy &reduction_strgy, const normal_comput
     std::cout << "num_nodes: " << nodes_.size() << std::endl;
     std::cout << "num_nodes_with_provenance: " << num_nodes_with_provenance << std::endl;
 
-    // Create level temp files
-    std::vector<shared_surfel_file> level_temp_files;
+    // A resumed upsweep continues right above the last completed level.
+    const int32_t start_level = upsweep_resume_level_ >= 0 ? upsweep_resume_level_ - 1 : int32_t(depth_);
+    if(upsweep_resume_level_ >= 0)
+    {
+        LOGGER_INFO("Upsweep continues at level " << start_level);
+    }
+
+    // Create level temp files. Levels completed before a resume are not written again.
+    std::vector<shared_surfel_file> level_temp_files(depth_ + 1);
     std::vector<shared_prov_file> prov_temp_files;
-    for(uint32_t level = 0; level <= depth_; ++level)
+    if (num_nodes_with_provenance > 0) {
+        prov_temp_files.resize(depth_ + 1);
+    }
+    for(int32_t level = 0; level <= start_level; ++level)
     {
-        level_temp_files.push_back(std::make_shared<surfel_file>());
+        level_temp_files[level] = std::make_shared<surfel_file>();
         std::string ext = ".lv" + std::to_string(level);
-        level_temp_files.back()->open(add_to_path(base_path_, ext).string(), level != depth_);
+        level_temp_files[level]->open(add_to_path(base_path_, ext).string(), level != int32_t(depth_));
 
         if (num_nodes_with_provenance > 0) {
-            prov_temp_files.push_back(std::make_shared<prov_file>());
+            prov_temp_files[level] = std::make_shared<prov_file>();
             std::string prov_ext = ".plv" + std::to_string(level);
-            prov_temp_files.back()->open(add_to_path(base_path_, prov_ext).string(), level != depth_);
-            LOGGER_INFO("Input WITH PROVENANCE: " << prov_temp_files.back()->file_name());
+            prov_temp_files[level]->open(add_to_path(base_path_, prov_ext).string(), level != int32_t(depth_));
+            LOGGER_INFO("Input WITH PROVENANCE: " << prov_temp_files[level]->file_name());
         }
     }
 
+    // The children of the first level to process were unloaded by the interrupted run.
+    if(start_level < int32_t(depth_))
+    {
+        const uint32_t first_child = get_first_node_id_of_depth(start_level + 1);
+        const uint32_t last_child = first_child + get_length_of_depth(start_level + 1);
+        for(uint32_t node_index = first_child; node_index < last_child; ++node_index)
+        {
+            bvh_node *child_node = &nodes_.at(node_index);
+            if(child_node->is_out_of_core() && !child_node->is_in_core())
+            {
+                child_node->load_from_disk();
+            }
+        }
+    }
+
+    // Levels are written to the LOD file while the next one is computed.
+    std::unique_ptr<node_serializer> lod_writer;
+    if(!write_behind_lod_file_.empty())
+    {
+        lod_writer.reset(new node_serializer(max_surfels_per_node_, buffer_size_));
+        lod_writer->open(write_behind_lod_file_);
+        lod_writer->start_write_behind(write_behind_direct_io_);
+        if(start_level < int32_t(depth_))
+        {
+            const uint32_t first_completed_node = get_first_node_id_of_depth(start_level + 1);
+            lod_writer->serialize_nodes_async(nodes_, first_completed_node, nodes_.size());
+        }
+    }
+
+    // Level statistics are written on every upsweep, a resumed upsweep continues the rows of the interrupted run.
+    std::ofstream stats_log(upsweep_stats_path().string(), std::ios::out | (upsweep_resume_level_ >= 0 ? std::ios::app : std::ios::trunc));
+    if(!stats_log.is_open())
+    {
+        LOGGER_WARN("Unable to open upsweep stats log: \"" << upsweep_stats_path().string() << "\"");
+    }
+
+    std::future<void> pending_checkpoint;
+
+    // surfels of the last completed level, the parents are built from them
+    memory_governor &governor = memory_governor::get_instance();
+    memory_reservation resident_memory(0, memory_reservation::kind::resident);
 
     // Start at bottom level and move up towards root.
-    for(int32_t level = depth_; level >= 0; --level)
+    for(int32_t level = start_level; level >= 0; --level)
     {
         LOGGER_TRACE("Entering level: " << level);
 
+        auto level_start_time = std::chrono::steady_clock::now();
+        governor.reset_statistics();
+
         uint32_t first_node_of_level = get_first_node_id_of_depth(level);
         uint32_t last_node_of_level = get_first_node_id_of_depth(level) + get_length_of_depth(level);
 
@@ -1468,6 +1749,18 @@ void bvh::upsweep(const reduction_strategy &reduction_strgy, const normal_comput
             }
         }
 
+        if(level == start_level)
+        {
+            size_t num_resident_surfels = 0;
+            const uint32_t first_resident_node = level == int32_t(depth_) ? first_node_of_level : get_first_node_id_of_depth(level + 1);
+            const uint32_t last_resident_node = level == int32_t(depth_) ? last_node_of_level : first_resident_node + get_length_of_depth(level + 1);
+            for(uint32_t node_index = first_resident_node; node_index < last_resident_node; ++node_index)
+            {
+                num_resident_surfels += nodes_[node_index].mem_array().length();
+            }
+            resident_memory.resize(num_resident_surfels * sizeof(surfel));
+        }
+
         // Iterate over nodes of current tree level.
         // First apply reduction strategy, since calculation of attributes might depend on surfel data of nodes in same level.
         if(level != int32_t(depth_))
@@ -1489,12 +1782,14 @@ void bvh::upsweep(const reduction_strategy &reduction_strgy, const normal_comput
 
         real mean_radius_sd = 0.0;
         unsigned counter = 1;
+        size_t num_surfels_of_level = 0;
         for(uint32_t node_index = first_node_of_level; node_index < last_node_of_level; ++node_index)
         {
             bvh_node *current_node = &nodes_.at(node_index);
 
             mean_radius_sd = mean_radius_sd + (*current_node).node_stats().radius_sd();
             counter++;
+            num_surfels_of_level += current_node->mem_array().length();
 
             // compute node offset in file
             int32_t nid = current_node->node_id();
@@ -1512,8 +1807,69 @@ void bvh::upsweep(const reduction_strategy &reduction_strgy, const normal_comput
         }
         mean_radius_sd = mean_radius_sd / counter;
         std::cout << "average radius deviation pro level: " << mean_radius_sd << "\n";
+
+        // the children were unloaded by create_lod, this level stays in memory for its parents,
+        // children still queued for the LOD file are accounted by the writer until they are converted
+        // a level larger than the budget is reported once by the governor, the peak is logged to the stats
+        resident_memory.resize(num_surfels_of_level * sizeof(surfel));
+
+        const double compute_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - level_start_time).count();
+
+        double lod_wait_seconds = 0.0;
+        if(lod_writer)
+        {
+            auto wait_start_time = std::chrono::steady_clock::now();
+            lod_writer->serialize_nodes_async(nodes_, first_node_of_level, last_node_of_level);
+            lod_wait_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wait_start_time).count();
+        }
+
+        // Only one checkpoint is in flight; it is serialized while the next level is computed.
+        double checkpoint_wait_seconds = 0.0;
+        if(write_upsweep_checkpoints_)
+        {
+            auto wait_start_time = std::chrono::steady_clock::now();
+            if(pending_checkpoint.valid())
+            {
+                pending_checkpoint.get();
+            }
+            checkpoint_wait_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wait_start_time).count();
+
+            pending_checkpoint = write_upsweep_checkpoint_async(level, level_temp_files[level],
+                                                                prov_temp_files.empty() ? shared_prov_file() : prov_temp_files[level]);
+        }
+
+        if(stats_log.is_open())
+        {
+            const uint32_t num_nodes_of_level = last_node_of_level - first_node_of_level;
+            const double seconds = std::max(compute_seconds, std::numeric_limits<double>::epsilon());
+            stats_log << "{\"level\": " << level
+                      << ", \"depth\": " << depth_
+                      << ", \"nodes\": " << num_nodes_of_level
+                      << ", \"surfels\": " << num_surfels_of_level
+                      << ", \"seconds\": " << compute_seconds
+                      << ", \"nodes_per_second\": " << num_nodes_of_level / seconds
+                      << ", \"surfels_per_second\": " << num_surfels_of_level / seconds
+                      << ", \"checkpoint_wait_seconds\": " << checkpoint_wait_seconds
+                      << ", \"lod_wait_seconds\": " << lod_wait_seconds
+                      << ", \"memory_peak_bytes\": " << governor.peak()
+                      << ", \"memory_wait_seconds\": " << governor.wait_seconds()
+                      << ", \"mean_radius_sd\": " << mean_radius_sd
+                      << "}" << std::endl;
+        }
+    }
+
+    if(pending_checkpoint.valid())
+    {
+        pending_checkpoint.get();
+    }
+    upsweep_resume_level_ = -1;
+
+    if(lod_writer)
+    {
+        lod_writer->close();
     }
 
+
     // TODO: Inject a call to provenance method, collecting level data into one file
     /*
     reduction_strategy *p_reduction_strgy = (reduction_strategy *)&reduction_strgy;
@@ -1564,6 +1920,179 @@ void bvh::upsweep(const reduction_strategy &reduction_strgy, const normal_comput
     state_ = state_type::after_upsweep;
 }
 
+boost::filesystem::path bvh::upsweep_manifest_path() const { return add_to_path(base_path_, ".upsweep_manifest"); }
+
+boost::filesystem::path bvh::upsweep_stats_path() const { return add_to_path(base_path_, ".upsweep_stats"); }
+
+std::future<void> bvh::write_upsweep_checkpoint_async(const int32_t completed_level, const shared_surfel_file &level_file, const shared_prov_file &prov_level_file)
+{
+    // The node metadata is copied here, so the next level may modify nodes_ while the copy is written.
+    // Surfel data is already in the level temp files and is referenced through the disk arrays.
+    auto snapshot = std::make_shared<bvh>(memory_limit_, buffer_size_, rep_radius_algo_);
+    snapshot->set_depth(depth_);
+    snapshot->set_fan_factor(fan_factor_);
+    snapshot->set_max_surfels_per_node(max_surfels_per_node_);
+    snapshot->set_translation(translation_);
+    snapshot->set_base_path(base_path_);
+    snapshot->set_first_leaf(first_leaf_);
+    snapshot->set_state(state_type::after_downsweep);
+    snapshot->set_nodes(nodes_);
+    for(auto &node : snapshot->nodes_)
+    {
+        node.mem_array().reset();
+    }
+
+    const std::string tree_file = add_to_path(base_path_, ".lv" + std::to_string(completed_level) + ".bvhc").string();
+    const std::string manifest_file = upsweep_manifest_path().string();
+    const std::string previous_tree_file = upsweep_checkpoint_tree_;
+    const std::string source_identity = upsweep_source_identity_;
+    upsweep_checkpoint_tree_ = tree_file;
+
+    return std::async(std::launch::async, [=]() {
+        level_file->flush();
+        if(prov_level_file)
+        {
+            prov_level_file->flush();
+        }
+
+        bvh_stream bvh_strm;
+        bvh_strm.write_bvh(tree_file, *snapshot, true);
+
+        // the manifest is replaced atomically, so it always references a complete tree
+        const std::string temp_manifest_file = manifest_file + ".tmp";
+        std::ofstream manifest(temp_manifest_file, std::ios::out | std::ios::trunc);
+        if(!manifest.is_open())
+        {
+            throw std::runtime_error("Unable to write upsweep manifest: " + temp_manifest_file);
+        }
+        manifest << "tree " << tree_file << "\n";
+        manifest << "completed_level " << completed_level << "\n";
+        manifest << "depth " << snapshot->depth() << "\n";
+        manifest << "fan_factor " << uint32_t(snapshot->fan_factor()) << "\n";
+        manifest << "max_surfels_per_node " << snapshot->max_surfels_per_node() << "\n";
+        manifest << "num_nodes " << snapshot->nodes().size() << "\n";
+        manifest << "source " << source_identity << "\n";
+        manifest.close();
+        boost::filesystem::rename(temp_manifest_file, manifest_file);
+
+        if(!previous_tree_file.empty() && previous_tree_file != tree_file)
+        {
+            boost::system::error_code error;
+            boost::filesystem::remove(previous_tree_file, error);
+        }
+
+        LOGGER_TRACE("Upsweep checkpoint written for level " << completed_level);
+    });
+}
+
+std::string bvh::get_upsweep_source_identity(const std::string &source_tree_file)
+{
+    boost::system::error_code error;
+    const uintmax_t size = boost::filesystem::file_size(source_tree_file, error);
+    if(error)
+    {
+        return std::string();
+    }
+    const std::time_t write_time = boost::filesystem::last_write_time(source_tree_file, error);
+    if(error)
+    {
+        return std::string();
+    }
+    return std::to_string(size) + " " + std::to_string(write_time);
+}
+
+void bvh::enable_upsweep_checkpoints(const bool enable, const std::string &source_tree_file)
+{
+    write_upsweep_checkpoints_ = enable;
+    upsweep_source_identity_ = get_upsweep_source_identity(source_tree_file);
+}
+
+namespace
+{
+
+// key value pairs of an upsweep manifest, empty if the file cannot be read
+std::map<std::string, std::string> read_upsweep_manifest(const std::string &manifest_file)
+{
+    std::map<std::string, std::string> entries;
+    std::ifstream manifest(manifest_file);
+
+    std::string line;
+    while(std::getline(manifest, line))
+    {
+        const size_t separator = line.find(' ');
+        if(separator != std::string::npos)
+        {
+            entries[line.substr(0, separator)] = line.substr(separator + 1);
+        }
+    }
+    return entries;
+}
+
+}
+
+bool bvh::load_upsweep_checkpoint(const std::string &manifest_file, const std::string &source_tree_file)
+{
+    if(!boost::filesystem::exists(manifest_file))
+    {
+        return false;
+    }
+    std::map<std::string, std::string> manifest = read_upsweep_manifest(manifest_file);
+
+    const std::string tree_file = manifest["tree"];
+    const int32_t completed_level = manifest["completed_level"].empty() ? -1 : std::stoi(manifest["completed_level"]);
+    const uint32_t depth = manifest["depth"].empty() ? 0 : std::stoul(manifest["depth"]);
+    const size_t num_nodes = manifest["num_nodes"].empty() ? 0 : std::stoull(manifest["num_nodes"]);
+
+    if(tree_file.empty() || completed_level < 0 || !boost::filesystem::exists(tree_file))
+    {
+        LOGGER_WARN("Ignoring incomplete upsweep manifest: \"" << manifest_file << "\"");
+        return false;
+    }
+
+    // a rebuild with the same parameters passes the structural checks below, the levels of
+    // the checkpoint must however come from the very tree the upsweep starts from
+    const std::string source_identity = get_upsweep_source_identity(source_tree_file);
+    if(source_identity.empty() || manifest["source"] != source_identity)
+    {
+        LOGGER_WARN("Ignoring upsweep manifest of a different tree: \"" << manifest_file << "\". \""
+                    << source_tree_file << "\" changed since the checkpoint was written");
+        return false;
+    }
+
+    if(!load_tree(tree_file))
+    {
+        return false;
+    }
+
+    if(state_ != state_type::after_downsweep || depth_ != depth || nodes_.size() != num_nodes || completed_level > int32_t(depth_))
+    {
+        throw std::runtime_error("Upsweep checkpoint does not match manifest: " + manifest_file);
+    }
+
+    upsweep_resume_level_ = completed_level;
+    upsweep_checkpoint_tree_ = tree_file;
+    upsweep_source_identity_ = source_identity;
+
+    LOGGER_INFO("Loaded upsweep checkpoint: \"" << tree_file << "\". completed level: " << completed_level);
+    return true;
+}
+
+void bvh::remove_upsweep_checkpoint() const
+{
+    boost::system::error_code error;
+    std::string checkpoint_tree = upsweep_checkpoint_tree_;
+    if(checkpoint_tree.empty())
+    {
+        // left behind by an earlier run
+        checkpoint_tree = read_upsweep_manifest(upsweep_manifest_path().string())["tree"];
+    }
+    if(!checkpoint_tree.empty())
+    {
+        boost::filesystem::remove(checkpoint_tree, error);
+    }
+    boost::filesystem::remove(upsweep_manifest_path(), error);
+}
+
 void bvh::resample()
 {
     uint32_t first_node_of_level = get_first_node_id_of_depth(depth_);
@@ -1617,105 +2146,84 @@ void bvh::resample()
     state_ = state_type::after_upsweep;
 }
 
-surfel_vector bvh::remove_outliers_statistically(uint32_t num_outliers, uint16_t num_neighbours)
+void bvh::remove_outliers_in_leaves(const size_t slice_left, const size_t slice_right)
 {
-    std::vector<std::vector<std::pair<surfel_id_t, real>>> intermediate_outliers;
-
     uint32_t const num_threads = std::thread::hardware_concurrency();
-    intermediate_outliers.resize(num_threads);
-    // already_resized.resize(omp_get_max_threads())
 
-    for(uint32_t node_idx = first_leaf_; node_idx < nodes_.size(); ++node_idx)
-    {
-        bvh_node *current_node = &nodes_.at(node_idx);
-
-        if(current_node->is_out_of_core())
-        {
-            current_node->load_from_disk();
-        }
-    }
+    // scores are kept per leaf, the global threshold is only known after all leaves were scored
+    std::vector<std::vector<float>> scores(slice_right - slice_left + 1);
+    std::vector<quantile_sketch> sketches(num_threads);
 
-    working_queue_head_counter_.initialize(first_leaf_);
+    working_queue_head_counter_.initialize(slice_left);
     std::vector<std::thread> threads;
 
     for(uint32_t thread_idx = 0; thread_idx < num_threads; ++thread_idx)
     {
-        //start thread to remove outliers on subset of surfels
-        threads.push_back(std::thread(&bvh::thread_remove_outlier_jobs, this, 
-                                       first_leaf_, nodes_.size(), num_outliers, num_neighbours, 
-                                       std::ref(intermediate_outliers[thread_idx])));
+        threads.push_back(std::thread(&bvh::thread_compute_outlier_scores, this, slice_left, slice_right + 1, std::ref(scores), std::ref(sketches[thread_idx])));
     }
 
-    for(auto& thread : threads)
+    for(auto &thread : threads)
     {
         thread.join();
     }
 
-    std::vector<std::pair<surfel_id_t, real>> final_outliers;
-
-    for(auto const& ve : intermediate_outliers)
+    quantile_sketch sketch;
+    for(auto const &sketch_for_thread : sketches)
     {
-        for(auto const& element : ve)
-        {
-            bool insert_element = false;
-            if(final_outliers.size() < num_outliers)
-            {
-                insert_element = true;
-            }
-            else if(element.second > final_outliers.back().second)
-            {
-                final_outliers.pop_back();
-                insert_element = true;
-            }
-
-            if(insert_element)
-            {
-                final_outliers.push_back(element);
-
-                for(uint32_t k = final_outliers.size() - 1; k > 0; --k)
-                {
-                    if(final_outliers[k].second > final_outliers[k - 1].second)
-                    {
-                        std::swap(final_outliers[k], final_outliers[k - 1]);
-                    }
-                    else
-                        break;
-                }
-            }
-        }
+        sketch.merge(sketch_for_thread);
     }
 
-    intermediate_outliers.clear();
-
-    std::set<surfel_id_t> outlier_ids;
-    for(auto const &el : final_outliers)
+    if(sketch.empty())
     {
-        outlier_ids.insert(el.first);
+        return;
     }
 
-    surfel_vector cleaned_surfels;
+    const double threshold = sketch.quantile(1.0 - outlier_ratio_);
 
-    for(uint32_t node_idx = first_leaf_; node_idx < nodes_.size(); ++node_idx)
+    size_t num_removed = 0;
+    for(size_t nid = slice_left; nid <= slice_right; ++nid)
     {
-        bvh_node *current_node = &nodes_.at(node_idx);
+        surfel_mem_array &mem_array = nodes_[nid].mem_array();
+        std::vector<float> const &node_scores = scores[nid - slice_left];
+        const size_t num_surfels = mem_array.length();
 
-        if(current_node->is_out_of_core())
+        // compact the kept surfels to the front of the leaf
+        size_t num_kept = 0;
+        for(size_t surfel_idx = 0; surfel_idx < num_surfels; ++surfel_idx)
         {
-            current_node->load_from_disk();
+            if(node_scores[surfel_idx] > threshold)
+            {
+                continue;
+            }
+            if(num_kept != surfel_idx)
+            {
+                mem_array.write_surfel(mem_array.read_surfel(surfel_idx), num_kept);
+                if(mem_array.has_provenance())
+                {
+                    mem_array.write_prov(mem_array.read_prov(surfel_idx), num_kept);
+                }
+            }
+            ++num_kept;
         }
 
-        for(uint32_t surfel_idx = 0; surfel_idx < current_node->mem_array().length(); ++surfel_idx)
+        // a leaf is never emptied, its best surfel survives
+        if(num_kept == 0 && num_surfels > 0)
         {
-            if(outlier_ids.end() == outlier_ids.find(surfel_id_t(node_idx, surfel_idx)))
+            size_t best_idx = std::min_element(node_scores.begin(), node_scores.end()) - node_scores.begin();
+            mem_array.write_surfel(mem_array.read_surfel(best_idx), 0);
+            if(mem_array.has_provenance())
             {
-                auto current_untranslated_surfel = current_node->mem_array().read_surfel(surfel_idx);
-                current_untranslated_surfel.pos() = current_untranslated_surfel.pos() + translation_;
-                cleaned_surfels.emplace_back(current_untranslated_surfel);
+                mem_array.write_prov(mem_array.read_prov(best_idx), 0);
             }
+            num_kept = 1;
         }
+
+        num_removed += num_surfels - num_kept;
+        mem_array.set_length(num_kept);
     }
 
-    return cleaned_surfels;
+    num_removed_outliers_ += num_removed;
+    LOGGER_INFO("Removed " << num_removed << " of " << sketch.count() << " surfels as outliers (score threshold " << threshold << ")");
 }
 
 void bvh::serialize_tree_to_file(const std::string &output_file, bool write_intermediate_data)
@@ -1736,9 +2244,11 @@ void bvh::serialize_surfels_to_file(const std::string &lod_output_file, const st
 {
     LOGGER_TRACE("Serialize surfels to file: \"" << lod_output_file << "\"");
     node_serializer serializer(max_surfels_per_node_, buffer_size);
-    serializer.open(lod_output_file);
-    serializer.serialize_nodes(nodes_);
-    serializer.close();
+    if (!lod_output_file.empty()) {
+      serializer.open(lod_output_file);
+      serializer.serialize_nodes(nodes_);
+      serializer.close();
+    }
     if (nodes_[0].has_provenance()) {
       serializer.open(prov_output_file);
       serializer.serialize_prov(nodes_);
@@ -1746,6 +2256,321 @@ void bvh::serialize_surfels_to_file(const std::string &lod_output_file, const st
     }
 }
 
+std::vector<node_id_type> bvh::insert_surfels(const std::string &lod_input_file, const surfel_vector &new_surfels, const reduction_strategy &reduction_strgy,
+                                              const normal_computation_strategy &normal_strategy, const radius_computation_strategy &radius_strategy,
+                                              bool compute_normals, bool compute_radii)
+{
+    assert(state_ == state_type::serialized);
+
+    // squared distance of a point to a box, zero inside
+    auto distance_sqr = [](const bounding_box &box, const vec3r &point) {
+        real distance = 0.0;
+        for(uint8_t axis = 0; axis < 3; ++axis)
+        {
+            const real d = std::max(std::max(box.min()[axis] - point[axis], point[axis] - box.max()[axis]), real(0.0));
+            distance += d * d;
+        }
+        return distance;
+    };
+
+    // distribute the new surfels to the leaves
+    std::map<node_id_type, surfel_vector> inserts;
+    for(surfel new_surfel : new_surfels)
+    {
+        new_surfel.pos() -= translation_;
+
+        node_id_type node_id = 0;
+        while(node_id < first_leaf_)
+        {
+            node_id_type best_child = get_child_id(node_id, 0);
+            real best_distance = std::numeric_limits<real>::max();
+            for(uint32_t child_index = 0; child_index < fan_factor_; ++child_index)
+            {
+                const node_id_type child_id = get_child_id(node_id, child_index);
+                const real distance = distance_sqr(nodes_[child_id].get_bounding_box(), new_surfel.pos());
+                if(distance < best_distance)
+                {
+                    best_distance = distance;
+                    best_child = child_id;
+                }
+            }
+            node_id = best_child;
+        }
+        inserts[node_id].push_back(new_surfel);
+    }
+
+    // dirty nodes per level, from the touched leaves up to the root
+    std::vector<std::set<node_id_type>> dirty_nodes(depth_ + 1);
+    for(const auto &insert : inserts)
+    {
+        node_id_type node_id = insert.first;
+        for(int32_t level = depth_; level >= 0; --level)
+        {
+            dirty_nodes[level].insert(node_id);
+            node_id = get_parent_id(node_id);
+        }
+    }
+
+    LOGGER_INFO("Insert " << new_surfels.size() << " surfels into " << inserts.size() << " leaves");
+
+    // load dirty nodes and all siblings that serve as reduction input
+    node_serializer serializer(max_surfels_per_node_, buffer_size_);
+    serializer.open(lod_input_file, true);
+    const serialized_surfel padding;
+
+    std::set<node_id_type> nodes_to_load;
+    for(uint32_t level = 1; level <= depth_; ++level)
+    {
+        for(const node_id_type node_id : dirty_nodes[level])
+        {
+            const node_id_type parent_id = get_parent_id(node_id);
+            for(uint32_t child_index = 0; child_index < fan_factor_; ++child_index)
+            {
+                nodes_to_load.insert(get_child_id(parent_id, child_index));
+            }
+        }
+    }
+    auto load_node = [&](const node_id_type node_id) {
+        surfel_vector surfels;
+        serializer.read_node_immediate(surfels, node_id);
+
+        // nodes are padded with zeroed surfels up to the node size
+        while(!surfels.empty() && serialized_surfel(surfels.back()) == padding)
+        {
+            surfels.pop_back();
+        }
+        const size_t num_surfels = surfels.size();
+        nodes_[node_id].reset(surfel_mem_array(std::make_shared<surfel_vector>(std::move(surfels)), 0, num_surfels));
+    };
+    for(const node_id_type node_id : nodes_to_load)
+    {
+        load_node(node_id);
+    }
+
+    // the neighbour search of a surfel visits nodes of its own depth inside the sphere around the
+    // nearest neighbours within its own node. every node that may intersect one of these spheres
+    // is loaded before the attributes of a level are computed, the returned nodes are only
+    // loaded for the search
+    std::set<node_id_type> loaded_nodes(nodes_to_load.begin(), nodes_to_load.end());
+    const uint32_t num_neighbours = std::max(normal_strategy.number_of_neighbours(), radius_strategy.number_of_neighbours());
+    auto load_search_neighbourhood = [&](const std::vector<node_id_type> &search_nodes, const std::vector<size_t> &first_surfels) {
+        std::vector<bounding_box> search_boxes(search_nodes.size());
+        std::vector<uint8_t> search_unbounded(search_nodes.size(), 0);
+
+#pragma omp parallel for schedule(dynamic)
+        for(size_t i = 0; i < search_nodes.size(); ++i)
+        {
+            const surfel_mem_array &node_array = nodes_[search_nodes[i]].mem_array();
+            std::vector<std::pair<surfel_id_t, real>> candidates;
+            for(size_t surfel_idx = first_surfels[i]; surfel_idx < node_array.length(); ++surfel_idx)
+            {
+                get_nearest_neighbours(surfel_id_t(search_nodes[i], surfel_idx), num_neighbours, candidates, true);
+                if(candidates.size() < num_neighbours)
+                {
+                    // the search continues until enough neighbours are found, anywhere on the level
+                    search_unbounded[i] = 1;
+                    break;
+                }
+                const vec3r center = node_array.read_surfel_ref(surfel_idx).pos();
+                const real radius = std::sqrt(candidates.back().second);
+                search_boxes[i].expand(bounding_box(center - vec3r(radius), center + vec3r(radius)));
+            }
+        }
+
+        std::vector<node_id_type> search_only_nodes;
+        for(size_t i = 0; i < search_nodes.size(); ++i)
+        {
+            if(!search_unbounded[i] && !search_boxes[i].is_valid())
+            {
+                continue;
+            }
+            const uint32_t depth = get_depth_of_node(search_nodes[i]);
+            const node_id_type first_node_id = get_first_node_id_of_depth(depth);
+            for(node_id_type node_id = first_node_id; node_id < first_node_id + get_length_of_depth(depth); ++node_id)
+            {
+                const bounding_box &node_box = nodes_[node_id].get_bounding_box();
+                if(loaded_nodes.count(node_id) == 0 && node_box.is_valid() && (search_unbounded[i] || search_boxes[i].intersects(node_box)))
+                {
+                    load_node(node_id);
+                    loaded_nodes.insert(node_id);
+                    search_only_nodes.push_back(node_id);
+                }
+            }
+        }
+        return search_only_nodes;
+    };
+    auto release_search_neighbourhood = [&](const std::vector<node_id_type> &search_only_nodes) {
+        for(const node_id_type node_id : search_only_nodes)
+        {
+            nodes_[node_id].reset();
+            loaded_nodes.erase(node_id);
+        }
+    };
+
+    // insert into the leaves
+    std::vector<node_id_type> dirty_leaves(dirty_nodes[depth_].begin(), dirty_nodes[depth_].end());
+    std::vector<size_t> first_new_surfel(dirty_leaves.size());
+    for(size_t i = 0; i < dirty_leaves.size(); ++i)
+    {
+        surfel_mem_array &leaf_array = nodes_[dirty_leaves[i]].mem_array();
+        const surfel_vector &leaf_inserts = inserts[dirty_leaves[i]];
+
+        first_new_surfel[i] = leaf_array.length();
+        leaf_array.surfel_mem_data()->insert(leaf_array.surfel_mem_data()->end(), leaf_inserts.begin(), leaf_inserts.end());
+        leaf_array.set_length(leaf_array.surfel_mem_data()->size());
+    }
+
+    if(compute_normals || compute_radii)
+    {
+        const std::vector<node_id_type> search_only_nodes = load_search_neighbourhood(dirty_leaves, first_new_surfel);
+#pragma omp parallel for schedule(dynamic)
+        for(size_t i = 0; i < dirty_leaves.size(); ++i)
+        {
+            compute_normal_and_radius(&nodes_[dirty_leaves[i]], normal_strategy, radius_strategy, compute_normals, compute_radii, first_new_surfel[i]);
+        }
+        release_search_neighbourhood(search_only_nodes);
+    }
+
+    // the node size is fixed by the LOD layout, full leaves are simplified.
+    // the configured strategy expects the fan_factor children of a node and the id
+    // of the first child, a leaf is reduced on its own by the grid clustering of
+    // reduction_constant, which needs neither the tree nor neighbouring nodes
+    const reduction_constant leaf_reduction;
+    std::atomic<uint32_t> num_reduced_leaves(0);
+#pragma omp parallel for schedule(dynamic)
+    for(size_t i = 0; i < dirty_leaves.size(); ++i)
+    {
+        bvh_node &leaf = nodes_[dirty_leaves[i]];
+        if(leaf.mem_array().length() > max_surfels_per_node_)
+        {
+            real reduction_error = 0.0;
+            std::vector<surfel_mem_array *> input_mem_arrays{&leaf.mem_array()};
+            surfel_mem_array reduction_result = leaf_reduction.create_lod(reduction_error, input_mem_arrays, max_surfels_per_node_, (*this), leaf.node_id());
+            leaf.reset(reduction_result);
+            leaf.set_reduction_error(reduction_error);
+            ++num_reduced_leaves;
+        }
+    }
+    if(num_reduced_leaves > 0)
+    {
+        LOGGER_WARN(num_reduced_leaves << " leaves exceeded the node size and were simplified. Rebuild the tree if many leaves are affected.");
+    }
+
+    // rebuild dirty nodes bottom-up
+    for(int32_t level = depth_; level >= 0; --level)
+    {
+        std::vector<node_id_type> level_nodes(dirty_nodes[level].begin(), dirty_nodes[level].end());
+
+        if(level != int32_t(depth_))
+        {
+#pragma omp parallel for schedule(dynamic)
+            for(size_t i = 0; i < level_nodes.size(); ++i)
+            {
+                bvh_node &current_node = nodes_[level_nodes[i]];
+
+                std::vector<surfel_mem_array *> input_mem_arrays;
+                for(uint32_t child_index = 0; child_index < fan_factor_; ++child_index)
+                {
+                    input_mem_arrays.push_back(&nodes_[get_child_id(current_node.node_id(), child_index)].mem_array());
+                }
+
+                real reduction_error = 0.0;
+                surfel_mem_array reduction_result = reduction_strgy.create_lod(reduction_error, input_mem_arrays, max_surfels_per_node_, (*this), get_child_id(current_node.node_id(), 0));
+                current_node.reset(reduction_result);
+                current_node.set_reduction_error(reduction_error);
+            }
+
+            // attributes may depend on other nodes of the same level, so they are computed afterwards
+            const std::vector<node_id_type> search_only_nodes = load_search_neighbourhood(level_nodes, std::vector<size_t>(level_nodes.size(), 0));
+#pragma omp parallel for schedule(dynamic)
+            for(size_t i = 0; i < level_nodes.size(); ++i)
+            {
+                compute_normal_and_radius(&nodes_[level_nodes[i]], normal_strategy, radius_strategy, true, true);
+            }
+            release_search_neighbourhood(search_only_nodes);
+        }
+
+#pragma omp parallel for
+        for(size_t i = 0; i < level_nodes.size(); ++i)
+        {
+            bvh_node &current_node = nodes_[level_nodes[i]];
+
+            basic_algorithms::surfel_group_properties props = basic_algorithms::compute_properties(current_node.mem_array(), rep_radius_algo_);
+
+            bounding_box node_bounding_box;
+            node_bounding_box.expand(props.bbox);
+            if(level < int32_t(depth_))
+            {
+                for(uint32_t child_index = 0; child_index < fan_factor_; ++child_index)
+                {
+                    node_bounding_box.expand(nodes_[get_child_id(current_node.node_id(), child_index)].get_bounding_box());
+                }
+            }
+
+            current_node.set_max_surfel_radius_deviation(props.max_radius_deviation);
+            current_node.set_avg_surfel_radius(props.rep_radius);
+            current_node.set_centroid(props.centroid);
+            current_node.set_bounding_box(node_bounding_box);
+        }
+
+        // clean siblings are no longer needed once their parents are rebuilt
+        if(level < int32_t(depth_))
+        {
+            for(const node_id_type node_id : nodes_to_load)
+            {
+                if(get_depth_of_node(node_id) == uint32_t(level) + 1 && dirty_nodes[level + 1].count(node_id) == 0)
+                {
+                    nodes_[node_id].reset();
+                }
+            }
+        }
+    }
+
+    serializer.close();
+
+    std::vector<node_id_type> updated_nodes;
+    for(const auto &level_nodes : dirty_nodes)
+    {
+        updated_nodes.insert(updated_nodes.end(), level_nodes.begin(), level_nodes.end());
+    }
+    std::sort(updated_nodes.begin(), updated_nodes.end());
+
+    state_ = state_type::after_upsweep;
+    return updated_nodes;
+}
+
+void bvh::serialize_updated_surfels_to_file(const std::string &lod_input_file, const std::string &lod_output_file, const std::vector<node_id_type> &updated_nodes,
+                                            const size_t buffer_size) const
+{
+    LOGGER_TRACE("Serialize updated surfels to file: \"" << lod_output_file << "\"");
+
+    std::ifstream source(lod_input_file, std::ios::in | std::ios::binary);
+    if(!source.is_open())
+    {
+        throw std::runtime_error("Unable to open LOD file: " + lod_input_file);
+    }
+
+    node_serializer serializer(max_surfels_per_node_, buffer_size);
+    serializer.open(lod_output_file);
+
+    // unchanged ranges between updated nodes are copied block-wise
+    node_id_type next_node = 0;
+    for(const node_id_type node_id : updated_nodes)
+    {
+        serializer.copy_nodes(source, next_node, node_id - next_node);
+
+        surfel_vector surfels(max_surfels_per_node_);
+        const surfel_mem_array &node_array = nodes_[node_id].mem_array();
+        std::copy(node_array.surfel_mem_data()->begin() + node_array.offset(),
+                  node_array.surfel_mem_data()->begin() + node_array.offset() + std::min(node_array.length(), max_surfels_per_node_), surfels.begin());
+        serializer.write_node_immediate(surfels, node_id);
+
+        next_node = node_id + 1;
+    }
+    serializer.copy_nodes(source, next_node, nodes_.size() - next_node);
+    serializer.close();
+}
+
 void bvh::reset_nodes()
 {
     for(auto &n : nodes_)
@@ -6,6 +6,7 @@
 // http://www.uni-weimar.de/medien/vr
 
 #include <lamure/pre/external_sort.h>
+#include <lamure/pre/memory_governor.h>
 
 #if WIN32
 #include <ppl.h>
@@ -46,6 +47,8 @@ sort(surfel_disk_array &array,
         return;
 
     external_sort es(memory_limit, compare);
+    memory_reservation sort_memory(std::min(memory_limit, array.length() * sizeof(surfel)),
+                                   memory_reservation::kind::resident);
 
     // compute sort parameters
     const size_t run_length = memory_limit / sizeof(surfel) / 3u;
@@ -76,6 +79,8 @@ sort(surfel_disk_array &array,
         LOGGER_TRACE("create runs");
         es.create_runs(array, run_length, runs_count);
         LOGGER_TRACE("merge");
+        // the merge reads all runs interleaved, read-ahead of one run would evict the buffers of the others
+        es.runs_file_->set_sequential_access(false);
         es.merge(array, merge_buffer_size);
         es.runs_file_->close(true);
         es.runs_.clear();
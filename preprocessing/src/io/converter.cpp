@@ -1,181 +1,344 @@
 // Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
 // This Software is distributed under the Modified BSD License, see license.txt.
 //
-// Virtual Reality and Visualization Research Group 
+// Virtual Reality and Visualization Research Group
 // Faculty of Media, Bauhaus-Universitaet Weimar
 // http://www.uni-weimar.de/medien/vr
 
 #include <lamure/pre/io/converter.h>
-#include <thread>
+#include <lamure/pre/memory_governor.h>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <thread>
 
 namespace lamure
 {
 namespace pre
 {
 
-void converter::
-convert(const std::string &input_filename,
-        const std::string &output_filename)
+namespace
 {
-    discarded_ = 0;
-    flush_ready_ = false;
-    flush_done_ = false;
 
-    auto buf_callback = [&](surfel_vector &surfels)
+struct surfel_batch
+{
+    size_t sequence;
+    surfel_vector surfels;
+};
+
+// FIFO with a fixed capacity between the reader and the workers
+class batch_queue
+{
+public:
+    explicit batch_queue(const size_t capacity)
+        : capacity_(capacity), closed_(false) {}
+
+    void push(surfel_batch &&batch)
     {
         std::unique_lock<std::mutex> lk(mtx_);
-        cv_.wait(lk, [this]
-        { return flush_ready_; });
-
-        surfels = buffer_;
-        flush_ready_ = false;
-        bool has_data = !buffer_.empty();
+        not_full_.wait(lk, [this] { return batches_.size() < capacity_; });
+        batches_.push_back(std::move(batch));
+        lk.unlock();
+        not_empty_.notify_one();
+    }
 
-        // notify main thread
-        flush_done_ = true;
+    // returns false once the queue is closed and drained
+    bool pop(surfel_batch &batch)
+    {
+        std::unique_lock<std::mutex> lk(mtx_);
+        not_empty_.wait(lk, [this] { return !batches_.empty() || closed_; });
+        if (batches_.empty()) {
+            return false;
+        }
+        batch = std::move(batches_.front());
+        batches_.pop_front();
         lk.unlock();
-        cv_.notify_one();
-        return has_data;
-    };
+        not_full_.notify_one();
+        return true;
+    }
 
-    // output thread
-    std::thread tr([&]
-                   {
-                       out_format_.write(output_filename, buf_callback);
-                   });
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            closed_ = true;
+        }
+        not_empty_.notify_all();
+    }
 
-    // read input
-    in_format_.read(input_filename,
-                    [&](const surfel &s)
-                    { this->append_surfel(s); });
+private:
+    const size_t capacity_;
+    bool closed_;
+    std::deque<surfel_batch> batches_;
+    std::mutex mtx_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+};
+
+// restores the input order between the workers and the writer; a worker
+// blocks while its batch is more than capacity batches ahead of the writer
+class ordered_batch_queue
+{
+public:
+    explicit ordered_batch_queue(const size_t capacity)
+        : capacity_(capacity), next_sequence_(0), closed_(false) {}
 
-    flush_buffer();
+    void push(surfel_batch &&batch)
     {
-        std::lock_guard<std::mutex> lk(mtx_);
-        flush_ready_ = true;
+        std::unique_lock<std::mutex> lk(mtx_);
+        can_push_.wait(lk, [&] { return batch.sequence < next_sequence_ + capacity_; });
+        pending_.emplace(batch.sequence, std::move(batch.surfels));
+        lk.unlock();
+        can_pop_.notify_one();
     }
-    cv_.notify_one();
-    tr.join();
 
-    if (discarded_ > 0) {
-        LOGGER_WARN("Discarded degenerate surfels: " <<
-                                                     discarded_);
+    // returns false once the queue is closed and all batches were handed out
+    bool pop(surfel_vector &surfels)
+    {
+        std::unique_lock<std::mutex> lk(mtx_);
+        can_pop_.wait(lk, [this] { return pending_.count(next_sequence_) || closed_; });
+        auto it = pending_.find(next_sequence_);
+        if (it == pending_.end()) {
+            return false;
+        }
+        surfels = std::move(it->second);
+        pending_.erase(it);
+        ++next_sequence_;
+        lk.unlock();
+        can_push_.notify_all();
+        return true;
     }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            closed_ = true;
+        }
+        can_pop_.notify_all();
+    }
+
+private:
+    const size_t capacity_;
+    size_t next_sequence_;
+    bool closed_;
+    std::map<size_t, surfel_vector> pending_;
+    std::mutex mtx_;
+    std::condition_variable can_push_;
+    std::condition_variable can_pop_;
+};
+
+double seconds_since(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+double surfels_per_second(const size_t num_surfels, const double seconds)
+{
+    return seconds > 0.0 ? num_surfels / seconds : 0.0;
+}
+
+}
+
+void converter::
+convert(const std::string &input_filename,
+        const std::string &output_filename)
+{
+    run_pipeline([&](const format_abstract::surfel_callback_funtion &callback)
+                 { in_format_.read(input_filename, callback); },
+                 output_filename);
 }
 
 void converter::
 write_in_core_surfels_out(const surfel_vector &surf_vec,
                           const std::string &output_filename)
 {
-    discarded_ = 0;
-    flush_ready_ = false;
-    flush_done_ = false;
+    run_pipeline([&](const format_abstract::surfel_callback_funtion &callback)
+                 {
+                     for (auto const &surf : surf_vec) {
+                         callback(surfel(surf.pos(), surf.color()));
+                     }
+                 },
+                 output_filename);
+}
 
-    std::string extended_output_filename = output_filename;
+void converter::
+run_pipeline(const surfel_source_function &source,
+             const std::string &output_filename)
+{
+    // a few batches per worker in flight, about buffer_size surfels in total
+    const size_t batch_size = std::max(surfels_in_buffer_ / (4 * num_workers_), size_t(4096));
+    const size_t queue_capacity = 2 * num_workers_;
 
-    auto buf_callback = [&](surfel_vector &surfels)
-    {
-        std::unique_lock<std::mutex> lk(mtx_);
-        cv_.wait(lk, [this]
-        { return flush_ready_; });
+    batch_queue read_batches(queue_capacity);
+    ordered_batch_queue transformed_batches(queue_capacity);
 
-        surfels = buffer_;
-        flush_ready_ = false;
-        bool has_data = !buffer_.empty();
+    // both queues full, one batch in every worker, the reader and the writer
+    memory_reservation batch_memory((2 * queue_capacity + num_workers_ + 2) * batch_size * sizeof(surfel),
+                                    memory_reservation::kind::resident);
 
-        // notify main thread
-        flush_done_ = true;
-        lk.unlock();
-        cv_.notify_one();
-        return has_data;
-    };
+    std::mutex stats_mtx;
+    size_t num_transformed = 0;
+    double transform_seconds = 0.0;
+    discarded_ = 0;
 
-    // output thread
-    std::thread tr([&]
-                   {
-                       out_format_.write(extended_output_filename, buf_callback);
-                   });
+    const auto start_time = std::chrono::steady_clock::now();
 
-    // read input
-    for (auto const &surf : surf_vec) {
-        this->append_surfel(surfel(surf.pos(), surf.color()));
+    // transform stage
+    std::vector<std::thread> workers;
+    for (size_t worker = 0; worker < num_workers_; ++worker) {
+        workers.emplace_back([&]
+        {
+            size_t local_transformed = 0;
+            size_t local_discarded = 0;
+            double local_seconds = 0.0;
+
+            surfel_batch batch;
+            while (read_batches.pop(batch)) {
+                const auto batch_start = std::chrono::steady_clock::now();
+                surfel_vector &surfels = batch.surfels;
+                size_t num_kept = 0;
+                for (size_t i = 0; i < surfels.size(); ++i) {
+                    if (is_degenerate(surfels[i])) {
+                        ++local_discarded;
+                        continue;
+                    }
+                    if (transform_surfel(surfels[i])) {
+                        surfels[num_kept++] = surfels[i];
+                    }
+                }
+                local_transformed += surfels.size();
+                surfels.resize(num_kept);
+                local_seconds += seconds_since(batch_start);
+
+                transformed_batches.push(std::move(batch));
+            }
+
+            std::lock_guard<std::mutex> lk(stats_mtx);
+            num_transformed += local_transformed;
+            discarded_ += local_discarded;
+            transform_seconds += local_seconds;
+        });
     }
 
-
-    flush_buffer();
+    // write stage, batches arrive in input order
+    size_t num_written = 0;
+    double writer_wait_seconds = 0.0;
+    double writer_seconds = 0.0;
+    std::thread writer([&]
+    {
+        const auto writer_start = std::chrono::steady_clock::now();
+        auto buf_callback = [&](surfel_vector &surfels)
+        {
+            const auto wait_start = std::chrono::steady_clock::now();
+            bool has_data = false;
+            // fully discarded batches are skipped, an empty buffer ends the output
+            while ((has_data = transformed_batches.pop(surfels)) && surfels.empty()) {}
+            writer_wait_seconds += seconds_since(wait_start);
+            if (has_data) {
+                num_written += surfels.size();
+            }
+            return has_data;
+        };
+        out_format_.write(output_filename, buf_callback);
+        writer_seconds = seconds_since(writer_start);
+    });
+
+    // read stage on the calling thread
+    size_t num_read = 0;
+    size_t num_batches = 0;
+    double reader_wait_seconds = 0.0;
+    std::exception_ptr read_error;
+
+    surfel_batch batch{0, surfel_vector()};
+    batch.surfels.reserve(batch_size);
+    auto push_batch = [&]
     {
-        std::lock_guard<std::mutex> lk(mtx_);
-        flush_ready_ = true;
+        const auto wait_start = std::chrono::steady_clock::now();
+        batch.sequence = num_batches++;
+        read_batches.push(std::move(batch));
+        reader_wait_seconds += seconds_since(wait_start);
+        batch = surfel_batch{0, surfel_vector()};
+        batch.surfels.reserve(batch_size);
+    };
+
+    try {
+        source([&](const surfel &s)
+               {
+                   batch.surfels.push_back(s);
+                   ++num_read;
+                   if (batch.surfels.size() >= batch_size) {
+                       push_batch();
+                   }
+               });
+    }
+    catch (...) {
+        read_error = std::current_exception();
+    }
+    if (!batch.surfels.empty()) {
+        push_batch();
+    }
+    const double reader_seconds = seconds_since(start_time);
+
+    read_batches.close();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    transformed_batches.close();
+    writer.join();
+
+    if (read_error) {
+        std::rethrow_exception(read_error);
     }
-    cv_.notify_one();
-    tr.join();
 
     if (discarded_ > 0) {
         LOGGER_WARN("Discarded degenerate surfels: " <<
                                                      discarded_);
     }
+
+    const double total_seconds = seconds_since(start_time);
+    LOGGER_INFO("Converted " << num_read << " surfels in " << total_seconds << " s ("
+                << surfels_per_second(num_read, total_seconds) << " surfels/s, "
+                << num_workers_ << " workers, " << num_batches << " batches)");
+    LOGGER_INFO("Read stage: " << surfels_per_second(num_read, reader_seconds - reader_wait_seconds)
+                << " surfels/s, blocked " << reader_wait_seconds << " s");
+    LOGGER_INFO("Transform stage: " << surfels_per_second(num_transformed, transform_seconds / num_workers_)
+                << " surfels/s");
+    LOGGER_INFO("Write stage: " << surfels_per_second(num_written, writer_seconds - writer_wait_seconds)
+                << " surfels/s, waited " << writer_wait_seconds << " s");
 }
 
-void converter::
-append_surfel(const surfel &surf)
+bool converter::
+transform_surfel(surfel &s) const
 {
-    if (is_degenerate(surf)) {
-        ++discarded_;
-        return;
-    }
-
-    surfel s(surf);
     bool keep = true;
 
     if (surfel_callback_)
         surfel_callback_(s, keep);
 
-    if (keep) {
-        if (scale_factor_ != 1.0) {
-            s.pos() *= scale_factor_;
-            s.radius() *= scale_factor_;
-        }
-
-        if (translation_ != vec3r(0.0)) {
-            s.pos() += translation_;
-        }
-
-        if (override_radius_)
-            s.radius() = new_radius_;
+    if (!keep)
+        return false;
 
-        if (override_color_)
-            s.color() = new_color_;
+    if (scale_factor_ != 1.0) {
+        s.pos() *= scale_factor_;
+        s.radius() *= scale_factor_;
+    }
 
-        //LOGGER_DEBUG("Pos: " << s.pos());
+    if (translation_ != vec3r(0.0)) {
+        s.pos() += translation_;
+    }
 
-        buffer_.push_back(s);
+    if (override_radius_)
+        s.radius() = new_radius_;
 
-        if (buffer_.size() > surfels_in_buffer_)
-            flush_buffer();
-    }
-}
+    if (override_color_)
+        s.color() = new_color_;
 
-void converter::
-flush_buffer()
-{
-    if (!buffer_.empty()) {
-        LOGGER_TRACE("Flush buffer to disk. buffer size: " <<
-                                                           buffer_.size() << " surfels");
-        {
-            std::lock_guard<std::mutex> lk(mtx_);
-            flush_ready_ = true;
-        }
-        cv_.notify_one();
-        {
-            std::unique_lock<std::mutex> lk(mtx_);
-            // get back result
-            cv_.wait(lk, [this]
-            { return flush_done_; });
-            flush_done_ = false;
-            buffer_.clear();
-        }
-    }
+    return true;
 }
 
 const bool converter::
@@ -0,0 +1,199 @@
+// Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
+// This Software is distributed under the Modified BSD License, see license.txt.
+//
+// Virtual Reality and Visualization Research Group 
+// Faculty of Media, Bauhaus-Universitaet Weimar
+// http://www.uni-weimar.de/medien/vr
+
+#include <lamure/pre/memory_governor.h>
+#include <lamure/pre/logger.h>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <thread>
+
+namespace lamure
+{
+namespace pre
+{
+
+memory_governor::
+memory_governor()
+    : thread_floor_(64 * 1024 * 1024), num_threads_(std::max(std::thread::hardware_concurrency(), 1u))
+{
+}
+
+memory_governor &memory_governor::
+get_instance()
+{
+    static memory_governor instance;
+    return instance;
+}
+
+void memory_governor::
+set_budget(const size_t budget)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        budget_ = budget;
+        overshoot_logged_ = false;
+    }
+    released_.notify_all();
+}
+
+void memory_governor::
+set_thread_floor(const size_t thread_floor)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        thread_floor_ = thread_floor;
+    }
+    released_.notify_all();
+}
+
+size_t memory_governor::
+budget() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return budget_;
+}
+
+size_t memory_governor::
+reserved() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return resident_ + temporary_;
+}
+
+size_t memory_governor::
+resident() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return resident_;
+}
+
+size_t memory_governor::
+peak() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return peak_;
+}
+
+double memory_governor::
+wait_seconds() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return wait_seconds_;
+}
+
+void memory_governor::
+reset_statistics()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    peak_ = resident_ + temporary_;
+    wait_seconds_ = 0.0;
+}
+
+size_t memory_governor::
+temporary_budget() const
+{
+    const size_t available = budget_ > resident_ ? budget_ - resident_ : 0;
+    return std::max(available, num_threads_ * thread_floor_);
+}
+
+void memory_governor::
+account(const size_t bytes)
+{
+    bool overshoot = false;
+    size_t resident = 0;
+    size_t budget = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        resident_ += bytes;
+        peak_ = std::max(peak_, resident_ + temporary_);
+
+        if (budget_ > 0 && resident_ > budget_ && !overshoot_logged_) {
+            overshoot_logged_ = true;
+            overshoot = true;
+            resident = resident_;
+            budget = budget_;
+        }
+    }
+
+    if (overshoot) {
+        LOGGER_ERROR("Resident memory exceeds the memory budget: " << resident / 1024 / 1024 << " MiB of "
+                     << budget / 1024 / 1024 << " MiB, temporaries are limited to the thread floor");
+    }
+}
+
+void memory_governor::
+unaccount(const size_t bytes)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        assert(bytes <= resident_);
+        resident_ -= std::min(bytes, resident_);
+    }
+    released_.notify_all();
+}
+
+void memory_governor::
+reserve(const size_t bytes)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto fits = [&] { return budget_ == 0 || num_temporary_ == 0 || temporary_ + bytes <= temporary_budget(); };
+    if (!fits()) {
+        const auto wait_start = std::chrono::steady_clock::now();
+        released_.wait(lock, fits);
+        wait_seconds_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - wait_start).count();
+    }
+    temporary_ += bytes;
+    ++num_temporary_;
+    peak_ = std::max(peak_, resident_ + temporary_);
+}
+
+void memory_governor::
+release(const size_t bytes)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        assert(bytes <= temporary_ && num_temporary_ > 0);
+        temporary_ -= std::min(bytes, temporary_);
+        --num_temporary_;
+    }
+    released_.notify_all();
+}
+
+memory_reservation::
+memory_reservation(const size_t bytes, const kind type)
+    : bytes_(bytes), type_(type)
+{
+    if (type_ == kind::temporary)
+        memory_governor::get_instance().reserve(bytes_);
+    else
+        memory_governor::get_instance().account(bytes_);
+}
+
+memory_reservation::
+~memory_reservation()
+{
+    if (type_ == kind::temporary)
+        memory_governor::get_instance().release(bytes_);
+    else
+        memory_governor::get_instance().unaccount(bytes_);
+}
+
+void memory_reservation::
+resize(const size_t bytes)
+{
+    assert(type_ == kind::resident);
+    if (bytes > bytes_)
+        memory_governor::get_instance().account(bytes - bytes_);
+    else
+        memory_governor::get_instance().unaccount(bytes_ - bytes);
+    bytes_ = bytes;
+}
+
+}
+} // namespace lamure
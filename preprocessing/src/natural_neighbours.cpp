@@ -0,0 +1,137 @@
+// Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
+// This Software is distributed under the Modified BSD License, see license.txt.
+//
+// Virtual Reality and Visualization Research Group 
+// Faculty of Media, Bauhaus-Universitaet Weimar
+// http://www.uni-weimar.de/medien/vr
+
+#include <lamure/pre/natural_neighbours.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace lamure
+{
+namespace pre
+{
+
+namespace
+{
+
+struct cell_vertex
+{
+    vec2r pos;
+    int32_t edge;  // neighbour whose bisector carries the edge to the next vertex, -1 for the bounding square
+};
+
+}
+
+bool natural_neighbours::
+is_enclosed(const vec2r &poi, const std::vector<vec2r> &neighbours)
+{
+    std::vector<real> angles;
+    angles.reserve(neighbours.size());
+    for (const auto &neighbour : neighbours) {
+        const vec2r d = neighbour - poi;
+        if (d.x != 0.0 || d.y != 0.0) {
+            angles.push_back(std::atan2(d.y, d.x));
+        }
+    }
+    if (angles.size() < 3) {
+        return false;
+    }
+
+    std::sort(angles.begin(), angles.end());
+    real max_gap = angles.front() + 2.0 * M_PI - angles.back();
+    for (size_t i = 1; i < angles.size(); ++i) {
+        max_gap = std::max(max_gap, angles[i] - angles[i - 1]);
+    }
+    return max_gap < M_PI;
+}
+
+std::vector<std::pair<uint32_t, real>> natural_neighbours::
+compute(const vec2r &poi, const std::vector<vec2r> &neighbours)
+{
+    std::vector<std::pair<uint32_t, real>> result;
+
+    if (!is_enclosed(poi, neighbours)) {
+        return result;
+    }
+
+    // everything is relative to poi, the cell of a point inside the hull is bounded
+    std::vector<vec2r> offsets(neighbours.size());
+    real extent = 0.0;
+    for (size_t i = 0; i < neighbours.size(); ++i) {
+        offsets[i] = neighbours[i] - poi;
+        extent = std::max(extent, std::max(std::abs(offsets[i].x), std::abs(offsets[i].y)));
+    }
+
+    // far enough out to contain the cell unless the hull is nearly degenerate
+    const real half_size = 1024.0 * extent;
+    std::vector<cell_vertex> cell{
+        {vec2r(-half_size, -half_size), -1},
+        {vec2r(half_size, -half_size), -1},
+        {vec2r(half_size, half_size), -1},
+        {vec2r(-half_size, half_size), -1}};
+    std::vector<cell_vertex> clipped;
+    clipped.reserve(2 * neighbours.size() + 4);
+
+    // keep x with dot(x, d) <= |d|^2 / 2, Sutherland-Hodgman against each bisector
+    for (size_t i = 0; i < offsets.size(); ++i) {
+        const vec2r &d = offsets[i];
+        const real limit = 0.5 * (d.x * d.x + d.y * d.y);
+        if (limit <= 0.0) {
+            continue;
+        }
+
+        clipped.clear();
+        for (size_t v = 0; v < cell.size(); ++v) {
+            const cell_vertex &current = cell[v];
+            const cell_vertex &next = cell[(v + 1) % cell.size()];
+            const real current_side = current.pos.x * d.x + current.pos.y * d.y - limit;
+            const real next_side = next.pos.x * d.x + next.pos.y * d.y - limit;
+
+            if (current_side <= 0.0) {
+                clipped.push_back(current);
+            }
+            if ((current_side <= 0.0) != (next_side <= 0.0)) {
+                const real t = current_side / (current_side - next_side);
+                const vec2r crossing = current.pos + (next.pos - current.pos) * t;
+                // leaving the half plane starts an edge on the bisector
+                clipped.push_back(cell_vertex{crossing, current_side <= 0.0 ? int32_t(i) : current.edge});
+            }
+        }
+        cell.swap(clipped);
+        if (cell.size() < 3) {
+            return result;
+        }
+    }
+
+    const real min_edge_length = 1e-9 * extent;
+    real weight_sum = 0.0;
+    for (size_t v = 0; v < cell.size(); ++v) {
+        const int32_t edge = cell[v].edge;
+        if (edge < 0) {
+            continue;
+        }
+        const real edge_length = scm::math::length(cell[(v + 1) % cell.size()].pos - cell[v].pos);
+        if (edge_length <= min_edge_length) {
+            continue;
+        }
+        const real weight = edge_length / scm::math::length(offsets[edge]);
+        result.emplace_back(uint32_t(edge), weight);
+        weight_sum += weight;
+    }
+
+    if (weight_sum <= 0.0) {
+        result.clear();
+        return result;
+    }
+    for (auto &entry : result) {
+        entry.second /= weight_sum;
+    }
+    return result;
+}
+
+}
+} // namespace lamure
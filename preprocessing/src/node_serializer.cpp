@@ -8,13 +8,56 @@
 #include <lamure/pre/node_serializer.h>
 
 #include <lamure/pre/serialized_surfel.h>
+#include <algorithm>
+#include <chrono>
 #include <cstring>
+#include <future>
+#include <stdexcept>
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 namespace lamure
 {
 namespace pre
 {
 
+namespace
+{
+
+// granularity of O_DIRECT transfers, covers the logical block size of common devices
+const size_t io_alignment = 4096;
+
+char *aligned_begin(std::vector<char> &buffer)
+{
+    const size_t address = reinterpret_cast<size_t>(buffer.data());
+    return buffer.data() + (io_alignment - address % io_alignment) % io_alignment;
+}
+
+#ifndef _WIN32
+// returns false with errno set if a write fails
+bool write_fully(const int fd, const char *data, size_t offset, size_t length)
+{
+    while (length > 0) {
+        const ssize_t written = ::pwrite(fd, data, length, off_t(offset));
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += written;
+        offset += size_t(written);
+        length -= size_t(written);
+    }
+    return true;
+}
+#endif
+
+}
+
 node_serializer::
 node_serializer(const size_t surfels_per_node,
                 const size_t buffer_size)
@@ -36,7 +79,6 @@ void node_serializer::
 open(const std::string &file_name, const bool read_write_mode)
 {
     file_name_ = file_name;
-    surfel_buffer_.clear();
 
     if (read_write_mode)
         stream_.open(file_name, std::ios::in | std::ios::out | std::ios::binary);
@@ -55,8 +97,13 @@ void node_serializer::
 close()
 {
     if (is_open()) {
-        flush_surfel_buffer();
-        surfel_buffer_.clear();
+        std::exception_ptr error;
+        try {
+            stop_write_behind();
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
         stream_.close();
         if (stream_.fail()) {
             LOGGER_ERROR("Failed to close file: \"" << file_name_ <<
@@ -64,6 +111,9 @@ close()
         }
         stream_.exceptions(std::ifstream::failbit);
         file_name_ = "";
+        if (error) {
+            std::rethrow_exception(error);
+        }
     }
 }
 
@@ -119,13 +169,311 @@ write_node_immediate(const surfel_vector &surfels,
 
 }
 
+void node_serializer::
+copy_nodes(std::istream &source,
+           const size_t first_node,
+           const size_t num_nodes)
+{
+    assert(is_open());
+
+    if (num_nodes == 0)
+        return;
+
+    const size_t node_size = serialized_surfel::get_size() * surfels_per_node_;
+    const size_t nodes_per_block = std::max(max_nodes_in_buffer_, size_t(1));
+    std::vector<char> block(node_size * std::min(nodes_per_block, num_nodes));
+
+    source.seekg(node_size * first_node);
+    stream_.seekp(node_size * first_node);
+
+    size_t remaining = num_nodes;
+    while (remaining > 0) {
+        const size_t block_nodes = std::min(nodes_per_block, remaining);
+        source.read(block.data(), node_size * block_nodes);
+        if (source.fail() || source.bad()) {
+            throw std::runtime_error("Copy failed. Reading node " + std::to_string(first_node + num_nodes - remaining) +
+                                     " for file: \"" + file_name_ + "\". " + strerror(errno));
+        }
+        stream_.write(block.data(), node_size * block_nodes);
+        if (stream_.fail() || stream_.bad()) {
+            throw std::runtime_error("Copy failed. Writing node " + std::to_string(first_node + num_nodes - remaining) +
+                                     " to file: \"" + file_name_ + "\". " + strerror(errno));
+        }
+        remaining -= block_nodes;
+    }
+}
+
 void node_serializer::
 serialize_nodes(const std::vector<bvh_node> &nodes)
 {
-    for (const auto &n: nodes)
-        write_node_streamed(n);
+    if (!writer_.joinable())
+        start_write_behind();
+    serialize_nodes_async(nodes, 0, nodes.size());
+    wait_for_writes();
+}
+
+void node_serializer::
+start_write_behind(const bool direct_io)
+{
+    assert(is_open());
+    assert(max_nodes_in_buffer_ != 0);
+    if (writer_.joinable())
+        return;
+
+#ifndef _WIN32
+    fd_ = ::open(file_name_.c_str(), O_WRONLY);
+    if (fd_ < 0) {
+        throw std::runtime_error("Failed to open file for writing: \"" + file_name_ + "\". " + strerror(errno));
+    }
+    if (direct_io) {
+#ifdef O_DIRECT
+        direct_fd_ = ::open(file_name_.c_str(), O_WRONLY | O_DIRECT);
+        if (direct_fd_ < 0) {
+            LOGGER_WARN("O_DIRECT not supported for \"" << file_name_ << "\", using buffered writes. " << strerror(errno));
+        }
+#else
+        LOGGER_WARN("O_DIRECT not available, using buffered writes");
+#endif
+    }
+#endif
+
+    // two buffers, one is converted while the other one is written
+    const size_t block_size = serialized_surfel::get_size() * surfels_per_node_ * max_nodes_in_buffer_;
+    for (auto &buffer : write_buffers_) {
+        buffer.resize(block_size + 2 * io_alignment);
+    }
+    buffer_memory_.resize(2 * (block_size + 2 * io_alignment));
+
+    stop_writer_ = false;
+    writer_error_ = nullptr;
+    num_pending_ranges_ = 0;
+    num_written_nodes_ = 0;
+    write_seconds_ = 0.0;
+    writer_ = std::thread(&node_serializer::write_behind_loop, this);
 }
 
+void node_serializer::
+serialize_nodes_async(const std::vector<bvh_node> &nodes,
+                      const size_t first_node,
+                      const size_t last_node)
+{
+    assert(writer_.joinable());
+
+    queued_range range;
+    range.nodes.reserve(last_node - first_node);
+    size_t num_in_core_surfels = 0;
+    for (size_t node_id = first_node; node_id < last_node; ++node_id) {
+        const bvh_node &node = nodes[node_id];
+        range.nodes.push_back(queued_node{node_id,
+                                          node.is_in_core() ? node.mem_array() : surfel_mem_array(),
+                                          node.disk_array()});
+        num_in_core_surfels += range.nodes.back().mem_array.length();
+    }
+    // the caller may unload the nodes before the writer got to them
+    range.memory.reset(new memory_reservation(num_in_core_surfels * sizeof(surfel), memory_reservation::kind::resident));
+
+    std::unique_lock<std::mutex> lk(queue_mtx_);
+    queue_cv_.wait(lk, [this] { return write_queue_.empty() || writer_error_; });
+    write_queue_.push_back(std::move(range));
+    ++num_pending_ranges_;
+    lk.unlock();
+    queue_cv_.notify_all();
+}
+
+void node_serializer::
+wait_for_writes()
+{
+    std::unique_lock<std::mutex> lk(queue_mtx_);
+    queue_cv_.wait(lk, [this] { return num_pending_ranges_ == 0 || writer_error_; });
+    if (writer_error_) {
+        std::exception_ptr error = writer_error_;
+        writer_error_ = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+void node_serializer::
+stop_write_behind()
+{
+    if (!writer_.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lk(queue_mtx_);
+        stop_writer_ = true;
+    }
+    queue_cv_.notify_all();
+    writer_.join();
+
+#ifndef _WIN32
+    if (direct_fd_ >= 0)
+        ::close(direct_fd_);
+    if (fd_ >= 0 && ::close(fd_) != 0 && !writer_error_) {
+        writer_error_ = std::make_exception_ptr(std::runtime_error(
+            "Failed to close file: \"" + file_name_ + "\". " + strerror(errno)));
+    }
+    fd_ = -1;
+    direct_fd_ = -1;
+#endif
+    for (auto &buffer : write_buffers_) {
+        std::vector<char>().swap(buffer);
+    }
+    buffer_memory_.resize(0);
+
+    const size_t num_bytes = num_written_nodes_ * serialized_surfel::get_size() * surfels_per_node_;
+    LOGGER_INFO("Wrote " << num_written_nodes_ << " nodes (" << num_bytes / 1024 / 1024 << " MiB) in "
+                << write_seconds_ << " s on the writer thread");
+
+    wait_for_writes();
+}
+
+void node_serializer::
+write_behind_loop()
+{
+    for (;;) {
+        queued_range range;
+        {
+            std::unique_lock<std::mutex> lk(queue_mtx_);
+            queue_cv_.wait(lk, [this] { return !write_queue_.empty() || stop_writer_; });
+            if (write_queue_.empty())
+                return;
+            range = std::move(write_queue_.front());
+            write_queue_.pop_front();
+        }
+        queue_cv_.notify_all();
+
+        std::exception_ptr error;
+        try {
+            write_range(range);
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lk(queue_mtx_);
+            --num_pending_ranges_;
+            if (error && !writer_error_)
+                writer_error_ = error;
+        }
+        queue_cv_.notify_all();
+    }
+}
+
+void node_serializer::
+write_range(queued_range &range)
+{
+    std::vector<queued_node> &nodes = range.nodes;
+    const auto start_time = std::chrono::steady_clock::now();
+    const size_t node_size = serialized_surfel::get_size() * surfels_per_node_;
+
+    std::future<void> pending_write;
+    size_t current_buffer = 0;
+
+    size_t block_begin = 0;
+    while (block_begin < nodes.size()) {
+        // a block holds consecutive nodes, so it is a single write
+        size_t block_end = block_begin + 1;
+        while (block_end < nodes.size() &&
+               block_end - block_begin < max_nodes_in_buffer_ &&
+               nodes[block_end].node_id == nodes[block_end - 1].node_id + 1) {
+            ++block_end;
+        }
+
+        const size_t offset = nodes[block_begin].node_id * node_size;
+        const size_t length = (block_end - block_begin) * node_size;
+
+        // the data starts at offset modulo the alignment, so file blocks map to aligned memory
+        char *data = aligned_begin(write_buffers_[current_buffer]) + offset % io_alignment;
+
+        // file access is not thread-safe, out-of-core nodes are read up front
+        std::vector<surfel_vector> loaded(block_end - block_begin);
+        size_t num_converted_surfels = 0;
+        for (size_t k = block_begin; k < block_end; ++k) {
+            const queued_node &node = nodes[k];
+            num_converted_surfels += node.mem_array.length();
+            if (node.mem_array.is_empty() && !node.disk_array.is_empty()) {
+                const size_t read_length = std::min(node.disk_array.length(), surfels_per_node_);
+                loaded[k - block_begin].resize(read_length);
+                node.disk_array.get_file()->read(&loaded[k - block_begin], 0, node.disk_array.offset(), read_length);
+            }
+        }
+
+#pragma omp parallel for schedule(dynamic, 16)
+        for (int64_t k = 0; k < int64_t(block_end - block_begin); ++k) {
+            queued_node &node = nodes[block_begin + k];
+            const bool in_core = !node.mem_array.is_empty();
+            const size_t num_surfels = in_core ? std::min(node.mem_array.length(), surfels_per_node_) : loaded[k].size();
+
+            char *node_data = data + k * node_size;
+            for (size_t i = 0; i < surfels_per_node_; ++i) {
+                char *buf = node_data + i * serialized_surfel::get_size();
+                if (i >= num_surfels)
+                    serialized_surfel().serialize(buf);
+                else if (in_core)
+                    serialized_surfel(node.mem_array.read_surfel_ref(i)).serialize(buf);
+                else
+                    serialized_surfel(loaded[k][i]).serialize(buf);
+            }
+            // the surfels are no longer needed once they are in the buffer
+            node.mem_array.reset();
+        }
+
+        range.memory->resize(range.memory->size() - num_converted_surfels * sizeof(surfel));
+
+        // the other buffer is free again once its write is done
+        if (pending_write.valid())
+            pending_write.get();
+        pending_write = std::async(std::launch::async, [this, data, offset, length] {
+            write_block(data, offset, length);
+        });
+
+        current_buffer = 1 - current_buffer;
+        block_begin = block_end;
+    }
+
+    if (pending_write.valid())
+        pending_write.get();
+
+    num_written_nodes_ += nodes.size();
+    write_seconds_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+void node_serializer::
+write_block(const char *data, const size_t offset, const size_t length)
+{
+#ifndef _WIN32
+    size_t head_end = offset + length;
+    size_t tail_begin = offset + length;
+    if (direct_fd_ >= 0) {
+        // only whole aligned blocks bypass the cache, head and tail go through fd_
+        const size_t direct_begin = (offset + io_alignment - 1) / io_alignment * io_alignment;
+        const size_t direct_end = (offset + length) / io_alignment * io_alignment;
+        if (direct_begin < direct_end) {
+            if (write_fully(direct_fd_, data + (direct_begin - offset), direct_begin, direct_end - direct_begin)) {
+                head_end = direct_begin;
+                tail_begin = direct_end;
+            }
+            else {
+                LOGGER_WARN("O_DIRECT write failed for \"" << file_name_ << "\", using buffered writes. " << strerror(errno));
+                ::close(direct_fd_);
+                direct_fd_ = -1;
+            }
+        }
+    }
+
+    if (!write_fully(fd_, data, offset, head_end - offset) ||
+        !write_fully(fd_, data + (tail_begin - offset), tail_begin, offset + length - tail_begin)) {
+        throw std::runtime_error("write failed. file: \"" + file_name_ + "\". " + strerror(errno));
+    }
+#else
+    stream_.seekp(offset);
+    stream_.write(data, length);
+    if (stream_.fail() || stream_.bad()) {
+        throw std::runtime_error("write failed. file: \"" + file_name_ + "\". " + strerror(errno));
+    }
+#endif
+}
 
 void node_serializer::
 serialize_prov(const std::vector<bvh_node> &nodes) {
@@ -159,63 +507,6 @@ serialize_prov(const std::vector<bvh_node> &nodes) {
     
 }
 
-void node_serializer::
-write_node_streamed(const bvh_node &node)
-{
-    assert(max_nodes_in_buffer_ != 0);
-    assert(is_open());
-    assert(node.is_out_of_core());
-
-    const size_t read_length = (node.disk_array().length() > surfels_per_node_) ?
-                               surfels_per_node_ :
-                               node.disk_array().length();
-
-    surfel_vector *surfel_buffer = new surfel_vector(read_length);
-    node.disk_array().get_file()->read(surfel_buffer, 0,
-                                   node.disk_array().offset(),
-                                   read_length);
-    surfel_buffer_.push_back(surfel_buffer);
-
-    if (surfel_buffer_.size() >= max_nodes_in_buffer_)
-        flush_surfel_buffer();
-}
-
-void node_serializer::
-flush_surfel_buffer()
-{
-    if (surfel_buffer_.size()) {
-        const size_t output_buffer_size = serialized_surfel::get_size() * surfels_per_node_ * surfel_buffer_.size();
-        char *output_buffer = new char[output_buffer_size];
-
-        LOGGER_INFO("Flush buffer to disk. buffer size: " <<
-                                                           surfel_buffer_.size() << " nodes (" <<
-                                                           output_buffer_size / 1024 / 1024 << " MiB)");
-
-#pragma omp parallel for
-        for (size_t k = 0; k < surfel_buffer_.size(); ++k) {
-            for (size_t i = 0; i < surfels_per_node_; ++i) {
-                char *buf = output_buffer + k * serialized_surfel::get_size() * surfels_per_node_ +
-                    i * serialized_surfel::get_size();
-                if (i < surfel_buffer_[k]->size())
-                    serialized_surfel(surfel_buffer_[k]->at(i)).serialize(buf);
-                else
-                    serialized_surfel().serialize(buf);
-            }
-            delete surfel_buffer_[k];
-        }
-
-        stream_.seekp(0, stream_.end);
-        stream_.write(output_buffer, output_buffer_size);
-        if (stream_.fail() || stream_.bad()) {
-            LOGGER_ERROR("write failed. file: \"" << file_name_ <<
-                                                  "\". " << strerror(errno));
-        }
-        surfel_buffer_.clear();
-        delete[] output_buffer;
-        stream_.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-    }
-}
-
 
 }
 } // namespace lamure
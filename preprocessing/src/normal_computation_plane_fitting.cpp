@@ -5,6 +5,8 @@
 // Faculty of Media, Bauhaus-Universitaet Weimar
 // http://www.uni-weimar.de/medien/vr
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
 #include <lamure/pre/bvh.h>
@@ -249,6 +251,158 @@ compute_normal(const bvh &tree,
     return normal;
 }
 
+vec3r normal_computation_plane_fitting::
+smallest_eigenvector(const scm::math::mat3d &_matrix)
+{
+    // scale the matrix to avoid over- and underflows in the cubic
+    double scale = 0.0;
+    for (int i = 0; i < 9; ++i) {
+        scale = std::max(scale, std::abs(_matrix[i]));
+    }
+    if (scale <= 0.0) {
+        return vec3r(0.0, 0.0, 1.0);
+    }
+
+    const double a00 = _matrix[0] / scale, a01 = _matrix[1] / scale, a02 = _matrix[2] / scale;
+    const double a11 = _matrix[4] / scale, a12 = _matrix[5] / scale;
+    const double a22 = _matrix[8] / scale;
+
+    // eigenvalues of a symmetric 3x3 matrix via the trigonometric solution
+    const double off_diagonal = a01 * a01 + a02 * a02 + a12 * a12;
+    const double q = (a00 + a11 + a22) / 3.0;
+    const double b00 = a00 - q, b11 = a11 - q, b22 = a22 - q;
+    const double p = std::sqrt((b00 * b00 + b11 * b11 + b22 * b22 + 2.0 * off_diagonal) / 6.0);
+
+    if (p < 1e-12) {
+        // multiple of the identity, every direction is an eigenvector
+        return vec3r(0.0, 0.0, 1.0);
+    }
+
+    const double det_b = b00 * (b11 * b22 - a12 * a12)
+                       - a01 * (a01 * b22 - a12 * a02)
+                       + a02 * (a01 * a12 - b11 * a02);
+    const double r = std::min(1.0, std::max(-1.0, det_b / (2.0 * p * p * p)));
+    const double phi = std::acos(r) / 3.0;
+
+    // lambda_min <= lambda_mid <= lambda_max
+    const double lambda_max = q + 2.0 * p * std::cos(phi);
+    const double lambda_min = q + 2.0 * p * std::cos(phi + (2.0 * M_PI / 3.0));
+
+    auto null_vector = [&](const double lambda, vec3r &result) -> bool {
+        const vec3r row0(a00 - lambda, a01, a02);
+        const vec3r row1(a01, a11 - lambda, a12);
+        const vec3r row2(a02, a12, a22 - lambda);
+
+        const vec3r c01 = scm::math::cross(row0, row1);
+        const vec3r c02 = scm::math::cross(row0, row2);
+        const vec3r c12 = scm::math::cross(row1, row2);
+        const double d01 = scm::math::dot(c01, c01);
+        const double d02 = scm::math::dot(c02, c02);
+        const double d12 = scm::math::dot(c12, c12);
+
+        const double d_max = std::max(d01, std::max(d02, d12));
+        if (d_max < 1e-24) {
+            return false;
+        }
+        const vec3r &c = (d_max == d01) ? c01 : (d_max == d02) ? c02 : c12;
+        result = c / std::sqrt(d_max);
+        return true;
+    };
+
+    vec3r normal;
+    if (null_vector(lambda_min, normal)) {
+        return normal;
+    }
+
+    // the smallest eigenvalue is a double root: any direction orthogonal
+    // to the eigenvector of the largest eigenvalue spans the eigenspace
+    vec3r major;
+    if (!null_vector(lambda_max, major)) {
+        return vec3r(0.0, 0.0, 1.0);
+    }
+    const vec3r axis = std::abs(major.x) < 0.9 ? vec3r(1.0, 0.0, 0.0) : vec3r(0.0, 1.0, 0.0);
+    return scm::math::normalize(scm::math::cross(major, axis));
+}
+
+void normal_computation_plane_fitting::
+compute_normals(const bvh &tree,
+                const surfel_id_t first_surfel,
+                std::vector<std::vector<std::pair<surfel_id_t, real>>> const &neighbourhoods,
+                std::vector<vec3f> &normals) const
+{
+    const size_t num_surfels = neighbourhoods.size();
+    const size_t stride = number_of_neighbours_;
+    auto &bvh_nodes = tree.nodes();
+    const surfel_mem_array &target_array = bvh_nodes[first_surfel.node_idx].mem_array();
+
+    normals.assign(num_surfels, vec3f(0.0f, 0.0f, 0.0f));
+
+    // gather the neighbourhoods of all surfels into coordinate streams on the arena of this thread
+    arena_scope scope;
+    arena_vector<double> pos_x(num_surfels * stride);
+    arena_vector<double> pos_y(num_surfels * stride);
+    arena_vector<double> pos_z(num_surfels * stride);
+    arena_vector<uint32_t> counts(num_surfels, 0);
+
+    for (size_t i = 0; i < num_surfels; ++i) {
+        const vec3r poi = target_array.read_surfel_ref(first_surfel.surfel_idx + i).pos();
+        const size_t num_candidates = std::min(stride, neighbourhoods[i].size());
+        uint32_t count = 0;
+        for (size_t n = 0; n < num_candidates; ++n) {
+            const surfel_id_t &neighbour_id = neighbourhoods[i][n].first;
+            const vec3r neighbour_pos = bvh_nodes[neighbour_id.node_idx].mem_array().read_surfel_ref(neighbour_id.surfel_idx).pos();
+            if (neighbour_pos == poi) {
+                continue;
+            }
+            pos_x[i * stride + count] = neighbour_pos.x;
+            pos_y[i * stride + count] = neighbour_pos.y;
+            pos_z[i * stride + count] = neighbour_pos.z;
+            ++count;
+        }
+        counts[i] = count;
+    }
+
+    for (size_t i = 0; i < num_surfels; ++i) {
+        const size_t count = counts[i];
+        if (count < 3) {
+            continue;
+        }
+
+        const double *x = pos_x.data() + i * stride;
+        const double *y = pos_y.data() + i * stride;
+        const double *z = pos_z.data() + i * stride;
+
+        double sum_x = 0.0, sum_y = 0.0, sum_z = 0.0;
+        #pragma omp simd reduction(+:sum_x, sum_y, sum_z)
+        for (size_t n = 0; n < count; ++n) {
+            sum_x += x[n];
+            sum_y += y[n];
+            sum_z += z[n];
+        }
+        const double cx = sum_x / count, cy = sum_y / count, cz = sum_z / count;
+
+        double c00 = 0.0, c01 = 0.0, c02 = 0.0, c11 = 0.0, c12 = 0.0, c22 = 0.0;
+        #pragma omp simd reduction(+:c00, c01, c02, c11, c12, c22)
+        for (size_t n = 0; n < count; ++n) {
+            const double dx = x[n] - cx;
+            const double dy = y[n] - cy;
+            const double dz = z[n] - cz;
+            c00 += dx * dx;
+            c01 += dx * dy;
+            c02 += dx * dz;
+            c11 += dy * dy;
+            c12 += dy * dz;
+            c22 += dz * dz;
+        }
+
+        scm::math::mat3d covariance_mat = scm::math::mat3d::zero();
+        covariance_mat.m00 = c00; covariance_mat.m01 = c01; covariance_mat.m02 = c02;
+        covariance_mat.m03 = c01; covariance_mat.m04 = c11; covariance_mat.m05 = c12;
+        covariance_mat.m06 = c02; covariance_mat.m07 = c12; covariance_mat.m08 = c22;
+        normals[i] = vec3f(smallest_eigenvector(covariance_mat));
+    }
+}
+
 }// namespace pre
 }// namespace lamure
 
@@ -0,0 +1,91 @@
+// Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
+// This Software is distributed under the Modified BSD License, see license.txt.
+//
+// Virtual Reality and Visualization Research Group
+// Faculty of Media, Bauhaus-Universitaet Weimar
+// http://www.uni-weimar.de/medien/vr
+
+#include <lamure/pre/quantile_sketch.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+namespace lamure
+{
+namespace pre
+{
+
+quantile_sketch::
+quantile_sketch(const double relative_accuracy)
+    : relative_accuracy_(relative_accuracy),
+      zero_count_(0),
+      count_(0)
+{
+    assert(relative_accuracy > 0.0 && relative_accuracy < 1.0);
+    gamma_ = (1.0 + relative_accuracy) / (1.0 - relative_accuracy);
+    log_gamma_ = std::log(gamma_);
+}
+
+int32_t quantile_sketch::
+bucket_index(const double value) const
+{
+    // bucket i covers (gamma^(i-1), gamma^i]
+    return int32_t(std::ceil(std::log(value) / log_gamma_));
+}
+
+double quantile_sketch::
+bucket_value(const int32_t index) const
+{
+    // midpoint in relative terms, off by at most relative_accuracy_ for every value of the bucket
+    return 2.0 * std::pow(gamma_, double(index)) / (gamma_ + 1.0);
+}
+
+void quantile_sketch::
+insert(const double value)
+{
+    assert(value >= 0.0);
+    ++count_;
+    if (value <= std::numeric_limits<double>::min()) {
+        ++zero_count_;
+        return;
+    }
+    ++buckets_[bucket_index(value)];
+}
+
+void quantile_sketch::
+merge(const quantile_sketch &other)
+{
+    assert(other.gamma_ == gamma_);
+    zero_count_ += other.zero_count_;
+    count_ += other.count_;
+    for (const auto &bucket : other.buckets_) {
+        buckets_[bucket.first] += bucket.second;
+    }
+}
+
+double quantile_sketch::
+quantile(const double q) const
+{
+    if (count_ == 0) {
+        return 0.0;
+    }
+
+    const uint64_t rank = uint64_t(std::max(0.0, std::min(1.0, q)) * double(count_ - 1));
+
+    uint64_t seen = zero_count_;
+    if (rank < seen) {
+        return 0.0;
+    }
+    for (const auto &bucket : buckets_) {
+        seen += bucket.second;
+        if (rank < seen) {
+            return bucket_value(bucket.first);
+        }
+    }
+    return bucket_value(buckets_.rbegin()->first);
+}
+
+} // namespace pre
+} // namespace lamure
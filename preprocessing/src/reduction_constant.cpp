@@ -295,10 +295,6 @@ create_lod(real &reduction_error,
            const bvh &tree,
            const size_t start_node_id) const
 {
-    if (input[0]->has_provenance()) {
-      throw std::runtime_error("reduction_constant not supported for PROVENANCE");
-    }
-
     // compute bounding box for actual surfels
     bounding_box bbox = basic_algorithms::compute_aabb(*input[0], true);
 
@@ -7,10 +7,14 @@
 
 #ifdef CMAKE_OPTION_ENABLE_ALTERNATIVE_STRATEGIES
 
+#include <lamure/pre/indexed_min_heap.h>
 #include <lamure/pre/reduction_entropy.h>
+#include <lamure/pre/surfel_soa_array.h>
 
 //#include <math.h>
 #include <functional>
+#include <limits>
+#include <unordered_map>
 #include <numeric>
 #include <vector>
 #include <queue>
@@ -22,6 +26,18 @@ namespace lamure
 namespace pre
 {
 
+namespace
+{
+
+// heap key equivalent to min_entropy_order for valid surfels:
+// lower entropy first, smaller radius first among equal entropies
+std::pair<double, real> entropy_key(shared_entropy_surfel const &en_surfel)
+{
+    return std::make_pair(en_surfel->entropy, en_surfel->contained_surfel->radius());
+}
+
+}
+
 surfel_mem_array reduction_entropy::
 create_lod(real &reduction_error,
            const std::vector<surfel_mem_array *> &input,
@@ -29,29 +45,42 @@ create_lod(real &reduction_error,
            const bvh &tree,
            const size_t start_node_id) const
 {
-    if (input[0]->has_provenance()) {
-      throw std::runtime_error("reduction_entropy not supported for PROVENANCE");
-    }
+    // every temporary below is released when the scope closes
+    arena_scope scope;
 
     //create output array
     surfel_mem_array mem_array(std::make_shared<surfel_vector>(surfel_vector()), 0, 0);
 
     //container for all input surfels including entropy (entropy_surfel_array = ESA)
     shared_entropy_surfel_vector entropy_surfel_array;
-    //priority queue as vector with min entropy surfels at the back
-    shared_entropy_surfel_vector min_entropy_surfel_ptr_queue;
+    //priority queue over indices into the ESA, ordered by entropy and radius (see min_entropy_order)
+    indexed_min_heap<std::pair<double, real>> min_entropy_surfel_queue;
 
     //final surfels
     shared_entropy_surfel_vector finalized_surfels;
 
+    // positions and radii of all input surfels as separate streams for the bounding sphere prefilter
+    surfel_soa_array soa_surfels(input);
+
+    // local index in soa_surfels of every entropy surfel and vice versa, skipped surfels map to none
+    const size_t no_entropy_surfel = std::numeric_limits<size_t>::max();
+    arena_vector<size_t> local_indices;
+    arena_vector<size_t> entropy_surfel_indices_by_local(soa_surfels.length(), no_entropy_surfel);
+    local_indices.reserve(soa_surfels.length());
+
     // wrap all surfels of the input array to entropy_surfels and push them in the ESA
+    size_t first_local_idx = 0;
     for (size_t node_id = 0; node_id < input.size(); ++node_id) {
-        for (size_t surfel_id = input[node_id]->offset();
-             surfel_id < input[node_id]->offset() + input[node_id]->length();
+        // soa_surfels holds the surfels of every input array from its offset on, one after another
+        const size_t first_surfel_id = input[node_id]->offset();
+        for (size_t surfel_id = first_surfel_id;
+             surfel_id < first_surfel_id + input[node_id]->length();
              ++surfel_id) {
 
+            const size_t local_idx = first_local_idx + (surfel_id - first_surfel_id);
+
             //this surfel will be referenced in the entropy surfel
-            auto current_surfel = input[node_id]->surfel_mem_data()->at(input[node_id]->offset() + surfel_id);
+            auto current_surfel = input[node_id]->surfel_mem_data()->at(surfel_id);
 
             // ignore outlier radii of any kind
             if (current_surfel.radius() == 0.0) {
@@ -60,96 +89,95 @@ create_lod(real &reduction_error,
             //create new entropy surfel
             entropy_surfel current_entropy_surfel(current_surfel, surfel_id, node_id);
 
+            entropy_surfel_indices_by_local[local_idx] = entropy_surfel_array.size();
+            local_indices.push_back(local_idx);
+
             // only place where shared pointers should be created
-            entropy_surfel_array.push_back(std::make_shared<entropy_surfel>(current_entropy_surfel));
+            entropy_surfel_array.push_back(make_arena_shared<entropy_surfel>(current_entropy_surfel));
         }
+        first_local_idx += input[node_id]->length();
     }
 
     // iterate all wrapped surfels 
-    for (auto &current_entropy_surfel_ptr : entropy_surfel_array) {
-
-        shared_entropy_surfel_vector overlapping_neighbour_ptrs
-            = get_locally_overlapping_neighbours(current_entropy_surfel_ptr, entropy_surfel_array);
+    arena_vector<size_t> candidates;
+    for (size_t entropy_surfel_idx = 0; entropy_surfel_idx < entropy_surfel_array.size(); ++entropy_surfel_idx) {
+        auto &current_entropy_surfel_ptr = entropy_surfel_array[entropy_surfel_idx];
+
+        // only surfels with overlapping bounding spheres can intersect
+        soa_surfels.overlapping_candidates(local_indices[entropy_surfel_idx], candidates);
+        for (size_t candidate_local_idx : candidates) {
+            const size_t candidate_idx = entropy_surfel_indices_by_local[candidate_local_idx];
+            if (candidate_idx == no_entropy_surfel) {
+                continue;
+            }
+            auto const &candidate_ptr = entropy_surfel_array[candidate_idx];
+            if (surfel::intersect(*(current_entropy_surfel_ptr->contained_surfel), *(candidate_ptr->contained_surfel))) {
+                current_entropy_surfel_ptr->neighbours.push_back(candidate_ptr);
+            }
+        }
 
         //assign/compute missing attributes
-        current_entropy_surfel_ptr->neighbours = overlapping_neighbour_ptrs;
-        update_entropy(current_entropy_surfel_ptr, overlapping_neighbour_ptrs);
+        update_entropy(current_entropy_surfel_ptr, current_entropy_surfel_ptr->neighbours);
 
         //if overlapping neighbours were found, put the entropy surfel back into the priority_queue
-        if (!overlapping_neighbour_ptrs.empty()) {
-            min_entropy_surfel_ptr_queue.push_back(current_entropy_surfel_ptr);
+        if (!current_entropy_surfel_ptr->neighbours.empty()) {
+            min_entropy_surfel_queue.push(entropy_surfel_idx, entropy_key(current_entropy_surfel_ptr));
         }
         else { //otherwise, consider this surfel to be finalized
-            //std::cout << "**Pushing into finalized surfels (size so far: "<<finalized_surfels.size() << "): " << (int)current_entropy_surfel_ptr->contained_surfel->color()[0] << "\n";
             finalized_surfels.push_back(current_entropy_surfel_ptr);
-            //std::cout << "did not find any Neighbours!!!!\n";
-            //std::cout << current_entropy_surfel_ptr->contained_surfel->pos() << " -- " << current_entropy_surfel_ptr->contained_surfel->radius() << " ------\n";
         }
     }
 
-    // the queue was modified, therefore it is resorted
-    std::sort(min_entropy_surfel_ptr_queue.begin(), min_entropy_surfel_ptr_queue.end(), min_entropy_order());
-
-    size_t num_valid_surfels = min_entropy_surfel_ptr_queue.size() + finalized_surfels.size();
-
-
-    while (true) {
-
-        if (!min_entropy_surfel_ptr_queue.empty()) {
-            shared_entropy_surfel current_entropy_surfel = min_entropy_surfel_ptr_queue.back();
-
-            min_entropy_surfel_ptr_queue.pop_back();
-
-            //the back element is still valid, so we still got something to do
-            if (current_entropy_surfel->validity) {
-                //std::cout << "Working on the surfel\n";
-                // if merge returns true, the surfel still has neighbours
+    // merges only touch the merged surfel and its neighbours, those are looked up by address
+    arena_unordered_map<entropy_surfel const *, size_t> entropy_surfel_indices;
+    entropy_surfel_indices.reserve(entropy_surfel_array.size());
+    for (size_t entropy_surfel_idx = 0; entropy_surfel_idx < entropy_surfel_array.size(); ++entropy_surfel_idx) {
+        entropy_surfel_indices[entropy_surfel_array[entropy_surfel_idx].get()] = entropy_surfel_idx;
+    }
 
+    size_t num_valid_surfels = min_entropy_surfel_queue.size() + finalized_surfels.size();
 
-                if (merge(current_entropy_surfel, entropy_surfel_array, num_valid_surfels, surfels_per_node)) {
-                    min_entropy_surfel_ptr_queue.push_back(current_entropy_surfel);
-                    /*min_entropy_surfel_ptr_queue.insert(min_entropy_surfel_ptr_queue.end(),
-                                                        finalized_surfels.begin(),
-                                                        finalized_surfels.end());
-                    */
-                    //finalized_surfels.clear();
+    while (!min_entropy_surfel_queue.empty()) {
+        const size_t current_idx = min_entropy_surfel_queue.top();
+        min_entropy_surfel_queue.pop();
+        shared_entropy_surfel current_entropy_surfel = entropy_surfel_array[current_idx];
 
-                }
-                else { //otherwise we can push it directly into the finalized surfel list
-                    finalized_surfels.push_back(current_entropy_surfel);
-                }
-
-
-                std::sort(min_entropy_surfel_ptr_queue.begin(), min_entropy_surfel_ptr_queue.end(), min_entropy_order());
+        // invalidated surfels are removed lazily when they surface
+        if (!current_entropy_surfel->validity) {
+            continue;
+        }
 
+        // if merge returns true, the surfel still has neighbours
+        if (merge(current_entropy_surfel, entropy_surfel_array, num_valid_surfels, surfels_per_node)) {
+            min_entropy_surfel_queue.push(current_idx, entropy_key(current_entropy_surfel));
+        }
+        else { //otherwise we can push it directly into the finalized surfel list
+            finalized_surfels.push_back(current_entropy_surfel);
+        }
 
-                if (num_valid_surfels <= surfels_per_node) {
-                    break;
-                }
-                else {
-                    //break
-                }
+        // neighbours swallowed by the merge leave the queue right away
+        for (auto const &neighbour_ptr : current_entropy_surfel->neighbours) {
+            if (!neighbour_ptr->validity) {
+                min_entropy_surfel_queue.erase(entropy_surfel_indices[neighbour_ptr.get()]);
             }
-
         }
-        else {
+
+        if (num_valid_surfels <= surfels_per_node) {
             break;
         }
-
     }
 
-
     // put valid surfels into final array
 
     //end of entropy simplification
-    while ((!min_entropy_surfel_ptr_queue.empty())) {
-        shared_entropy_surfel en_surfel_to_push = min_entropy_surfel_ptr_queue.back();
+    while (!min_entropy_surfel_queue.empty()) {
+        shared_entropy_surfel en_surfel_to_push = entropy_surfel_array[min_entropy_surfel_queue.top()];
 
         if (en_surfel_to_push->validity == true) {
             finalized_surfels.push_back(en_surfel_to_push);
         }
 
-        min_entropy_surfel_ptr_queue.pop_back();
+        min_entropy_surfel_queue.pop();
     }
 
 
@@ -218,7 +246,7 @@ update_color(shared_surfel target_surfel,
 
 void reduction_entropy::
 update_normal(shared_surfel target_surfel_ptr,
-              shared_entropy_surfel_vector const neighbour_ptrs) const
+              shared_entropy_surfel_vector const &neighbour_ptrs) const
 {
     vec3f new_normal(0.0, 0.0, 0.0);
 
@@ -281,7 +309,7 @@ compute_center_of_mass(shared_surfel target_surfel_ptr,
 real reduction_entropy::
 compute_enclosing_sphere_radius(vec3r const &center_of_mass,
                                 shared_surfel target_surfel_ptr,
-                                std::vector<shared_entropy_surfel> const neighbour_ptrs) const
+                                shared_entropy_surfel_vector const &neighbour_ptrs) const
 {
 
     real enclosing_radius = 0.0;
@@ -301,37 +329,9 @@ compute_enclosing_sphere_radius(vec3r const &center_of_mass,
     return enclosing_radius;
 }
 
-shared_entropy_surfel_vector const reduction_entropy::
-get_locally_overlapping_neighbours(shared_entropy_surfel target_entropy_surfel_ptr,
-                                   shared_entropy_surfel_vector &entropy_surfel_ptr_array
-) const
-{
-    shared_surfel target_surfel = target_entropy_surfel_ptr->contained_surfel;
-
-    std::vector<shared_entropy_surfel> overlapping_neighbour_ptrs;
-
-    for (auto const array_entr_surfel_ptr : entropy_surfel_ptr_array) {
-
-        // avoid overlaps with the surfel itself
-        if (target_entropy_surfel_ptr->surfel_id != array_entr_surfel_ptr->surfel_id ||
-            target_entropy_surfel_ptr->node_id != array_entr_surfel_ptr->node_id) {
-
-            shared_surfel contained_surfel_ptr = array_entr_surfel_ptr->contained_surfel;
-
-            if (surfel::intersect(*target_surfel, *contained_surfel_ptr)) {
-                overlapping_neighbour_ptrs.push_back(array_entr_surfel_ptr);
-            }
-
-        }
-
-    }
-
-    return overlapping_neighbour_ptrs;
-}
-
 void reduction_entropy::
 update_entropy(shared_entropy_surfel target_en_surfel,
-               shared_entropy_surfel_vector const neighbour_ptrs) const
+               shared_entropy_surfel_vector const &neighbour_ptrs) const
 {
     // base entropy for surfel
     //double entropy = target_en_surfel->contained_surfel->radius();
@@ -379,7 +379,7 @@ update_entropy_surfel_level(shared_entropy_surfel target_en_surfel_ptr,
 
 void reduction_entropy::
 update_position(shared_surfel target_surfel_ptr,
-                shared_entropy_surfel_vector const neighbour_ptrs) const
+                shared_entropy_surfel_vector const &neighbour_ptrs) const
 {
     target_surfel_ptr->pos() = compute_center_of_mass(target_surfel_ptr,
                                                       neighbour_ptrs);
@@ -387,7 +387,7 @@ update_position(shared_surfel target_surfel_ptr,
 
 void reduction_entropy::
 update_radius(shared_surfel target_surfel_ptr,
-              shared_entropy_surfel_vector const neighbour_ptrs) const
+              shared_entropy_surfel_vector const &neighbour_ptrs) const
 {
     target_surfel_ptr->radius()
         = compute_enclosing_sphere_radius(target_surfel_ptr->pos(),
@@ -397,7 +397,7 @@ update_radius(shared_surfel target_surfel_ptr,
 
 void reduction_entropy::
 update_surfel_attributes(shared_surfel target_surfel_ptr,
-                         shared_entropy_surfel_vector const invalidated_neighbours) const
+                         shared_entropy_surfel_vector const &invalidated_neighbours) const
 {
 
     update_normal(target_surfel_ptr, invalidated_neighbours);
@@ -419,7 +419,12 @@ merge(shared_entropy_surfel target_entropy_surfel,
     shared_entropy_surfel_vector neighbours_to_merge;
 
     //**replace own invalid neighbours by valid neighbours of invalid neighbours**
-    std::map<size_t, std::set<size_t> > added_neighbours_during_merge;
+    // keyed by node id in the upper and surfel id in the lower half
+    arena_unordered_set<uint64_t> added_neighbours_during_merge;
+    auto neighbour_key = [](shared_entropy_surfel const &en_surfel)
+    {
+        return (uint64_t(en_surfel->node_id) << 32) | en_surfel->surfel_id;
+    };
 
     auto min_distance_ordering = [&target_entropy_surfel](shared_entropy_surfel const &left_entropy_surfel,
                                                           shared_entropy_surfel const &right_entropy_surfel)
@@ -488,8 +493,7 @@ merge(shared_entropy_surfel target_entropy_surfel,
                 if (n_id != target_entropy_surfel->node_id ||
                     s_id != target_entropy_surfel->surfel_id) {
                     //ignore 2nd neighbours which we found already at another neighbour
-                    if ((added_neighbours_during_merge[n_id]).find(s_id) == added_neighbours_during_merge[n_id].end()) {
-                        (added_neighbours_during_merge[n_id]).insert(s_id);
+                    if (added_neighbours_during_merge.insert(neighbour_key(second_neighbour_ptr)).second) {
                         neighbours_to_merge.push_back(second_neighbour_ptr);
                     }
                 }
@@ -507,30 +511,24 @@ merge(shared_entropy_surfel target_entropy_surfel,
 
 
     // now that we , we also have to look for neighbours that we suddenly overlap due to the higher radius
-    shared_entropy_surfel_vector additional_surfels_to_test_for_overlap;
+    shared_entropy_surfel_vector additional_overlapping_neighbours;
 
-
-    for (auto const surfel_ptr : complete_entropy_surfel_array) {
+    for (auto const &surfel_ptr : complete_entropy_surfel_array) {
 
         if (surfel_ptr->validity) {
             if (surfel_ptr->node_id != target_entropy_surfel->node_id ||
                 surfel_ptr->surfel_id != target_entropy_surfel->surfel_id) {
 
-                if (added_neighbours_during_merge[surfel_ptr->node_id].find(surfel_ptr->surfel_id) ==
-                    added_neighbours_during_merge[surfel_ptr->node_id].end()) {
-                    // we did not consider this surfel, we can check for an overlap.
-                    additional_surfels_to_test_for_overlap.push_back(surfel_ptr);
-
+                // surfels we did not consider yet are checked for an overlap right away
+                if (added_neighbours_during_merge.count(neighbour_key(surfel_ptr)) == 0 &&
+                    surfel::intersect(*(target_entropy_surfel->contained_surfel), *(surfel_ptr->contained_surfel))) {
+                    additional_overlapping_neighbours.push_back(surfel_ptr);
                 }
 
             }
         }
     }
 
-    auto const additional_overlapping_neighbours
-        = get_locally_overlapping_neighbours(target_entropy_surfel,
-                                             additional_surfels_to_test_for_overlap);
-
     //if(additional_overlapping_neighbours.size() != 0)
     //    std::cout << "Found something!\n";
 
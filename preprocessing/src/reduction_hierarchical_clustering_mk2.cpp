@@ -28,10 +28,6 @@ create_lod(real &reduction_error,
            const bvh &tree,
            const size_t start_node_id) const
 {
-    if (input[0]->has_provenance()) {
-      throw std::runtime_error("reduction_hierarchical_clustering_mk2 not supported for PROVENANCE");
-    }
-
     // Create a single surfel vector to sample from.
     std::vector<surfel *> surfels_to_sample;
     for (uint32_t child_mem_array_index = 0; child_mem_array_index < input.size(); ++child_mem_array_index) {
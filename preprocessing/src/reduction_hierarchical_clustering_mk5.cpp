@@ -15,6 +15,41 @@ namespace lamure
 namespace pre
 {
 
+namespace
+{
+
+// smaller clusters are not worth waking up a thread team
+const size_t min_parallel_cluster_size = 2048;
+
+// splits surfels into the ones on the positive and on the negative side of a plane,
+// the side tests run in parallel while the output keeps the input order
+template<typename side_function_t>
+void partition_surfels(const std::vector<surfel *> &input_surfels,
+                       const side_function_t &side_function,
+                       const int num_threads,
+                       std::vector<surfel *> &surfels_one,
+                       std::vector<surfel *> &surfels_two)
+{
+    const int64_t num_surfels = input_surfels.size();
+    std::vector<uint8_t> is_positive(num_surfels);
+
+    #pragma omp parallel for num_threads(num_threads) if(num_threads > 1)
+    for (int64_t surfel_index = 0; surfel_index < num_surfels; ++surfel_index) {
+        is_positive[surfel_index] = side_function(input_surfels[surfel_index]) >= 0;
+    }
+
+    for (int64_t surfel_index = 0; surfel_index < num_surfels; ++surfel_index) {
+        if (is_positive[surfel_index]) {
+            surfels_one.push_back(input_surfels[surfel_index]);
+        }
+        else {
+            surfels_two.push_back(input_surfels[surfel_index]);
+        }
+    }
+}
+
+}
+
 reduction_hierarchical_clustering_mk5::
 reduction_hierarchical_clustering_mk5()
 {
@@ -28,10 +63,6 @@ create_lod(real &reduction_error,
            const bvh &tree,
            const size_t start_node_id) const
 {
-    if (input[0]->has_provenance()) {
-      throw std::runtime_error("reduction_hierarchical_clustering_mk5 not supported for PROVENANCE");
-    }
-
     // Create a single surfel vector to sample from.
     std::vector<surfel *> surfels_to_sample;
     for (uint32_t child_mem_array_index = 0; child_mem_array_index < input.size(); ++child_mem_array_index) {
@@ -94,19 +125,12 @@ split_point_cloud(const std::vector<surfel *> &input_surfels,
             std::vector<surfel *> new_surfels_two;
 
             // Split the surfels into two sub-groups along splitting plane defined by eigenvector.
-            for (uint32_t surfel_index = 0; surfel_index < current_cluster.surfels.size(); ++surfel_index) {
-                surfel *current_surfel = current_cluster.surfels.at(surfel_index);
-
+            auto color_side = [&](const surfel *current_surfel) {
                 vec3r color_trans = transform_color(current_surfel->color());
-                real surfel_side = point_plane_distance(current_cluster.centroid_color, current_cluster.normal_color, color_trans);
-
-                if (surfel_side >= 0) {
-                    new_surfels_one.push_back(current_surfel);
-                }
-                else {
-                    new_surfels_two.push_back(current_surfel);
-                }
-            }
+                return point_plane_distance(current_cluster.centroid_color, current_cluster.normal_color, color_trans);
+            };
+            partition_surfels(current_cluster.surfels, color_side, num_threads_for_cluster(current_cluster.surfels.size()),
+                              new_surfels_one, new_surfels_two);
 
             if (new_surfels_one.size() > 0) {
                 split_cluster_by_position(calculate_cluster_data(new_surfels_one), max_cluster_size, max_variation_position, cluster_queue);
@@ -146,17 +170,11 @@ split_cluster_by_position(const hierarchical_cluster_mk5 &input_cluster,
         std::vector<surfel *> new_surfels_two;
 
         // Split the surfels into two sub-groups along splitting plane defined by eigenvector.
-        for (uint32_t surfel_index = 0; surfel_index < input_cluster.surfels.size(); ++surfel_index) {
-            surfel *current_surfel = input_cluster.surfels.at(surfel_index);
-            real surfel_side = point_plane_distance(input_cluster.centroid_pos, input_cluster.normal_pos, current_surfel->pos());
-
-            if (surfel_side >= 0) {
-                new_surfels_one.push_back(current_surfel);
-            }
-            else {
-                new_surfels_two.push_back(current_surfel);
-            }
-        }
+        auto position_side = [&](const surfel *current_surfel) {
+            return point_plane_distance(input_cluster.centroid_pos, input_cluster.normal_pos, current_surfel->pos());
+        };
+        partition_surfels(input_cluster.surfels, position_side, num_threads_for_cluster(input_cluster.surfels.size()),
+                          new_surfels_one, new_surfels_two);
 
         if (new_surfels_one.size() > 0) {
             cluster_queue.push(calculate_cluster_data(new_surfels_one));
@@ -175,9 +193,10 @@ calculate_cluster_data(const std::vector<surfel *> &input_surfels) const
 {
     vec3r centroid_pos;
     vec3r centroid_color;
+    scm::math::mat3d covariance_matrix_pos;
+    scm::math::mat3d covariance_matrix_color;
 
-    scm::math::mat3d covariance_matrix_pos = calculate_covariance_matrix(input_surfels, centroid_pos);
-    scm::math::mat3d covariance_matrix_color = calculate_covariance_matrix_color(input_surfels, centroid_color);
+    calculate_covariance_matrices(input_surfels, centroid_pos, centroid_color, covariance_matrix_pos, covariance_matrix_color);
 
     vec3f normal_pos;
     vec3f normal_color;
@@ -200,70 +219,80 @@ calculate_cluster_data(const std::vector<surfel *> &input_surfels) const
     return new_cluster;
 }
 
-scm::math::mat3d reduction_hierarchical_clustering_mk5::
-calculate_covariance_matrix(const std::vector<surfel *> &surfels_to_sample, vec3r &centroid) const
+int reduction_hierarchical_clustering_mk5::
+num_threads_for_cluster(const size_t cluster_size) const
 {
-    scm::math::mat3d covariance_mat = scm::math::mat3d::zero();
-    centroid = calculate_centroid(surfels_to_sample);
-
-    // TODO: The rounding is only necessary for some models (infinite loop otherwise), it would be good to get rid of it completely though.
-    bool roundingNecessary = true;
-
-    for (uint32_t surfel_index = 0; surfel_index < surfels_to_sample.size(); ++surfel_index) {
-        surfel *current_surfel = surfels_to_sample.at(surfel_index);
-
-        covariance_mat.m00 += std::pow(current_surfel->pos().x - centroid.x, 2);
-        covariance_mat.m01 += (current_surfel->pos().x - centroid.x) * (current_surfel->pos().y - centroid.y);
-        covariance_mat.m02 += (current_surfel->pos().x - centroid.x) * (current_surfel->pos().z - centroid.z);
-
-        covariance_mat.m03 += (current_surfel->pos().y - centroid.y) * (current_surfel->pos().x - centroid.x);
-        covariance_mat.m04 += std::pow(current_surfel->pos().y - centroid.y, 2);
-        covariance_mat.m05 += (current_surfel->pos().y - centroid.y) * (current_surfel->pos().z - centroid.z);
-
-        covariance_mat.m06 += (current_surfel->pos().z - centroid.z) * (current_surfel->pos().x - centroid.x);
-        covariance_mat.m07 += (current_surfel->pos().z - centroid.z) * (current_surfel->pos().y - centroid.y);
-        covariance_mat.m08 += std::pow(current_surfel->pos().z - centroid.z, 2);
-    }
-
-    if (roundingNecessary) {
-        // Precision limitation because of rounding errors otherwise.
-        for (int index = 0; index < 9; ++index) {
-            covariance_mat[index] = round(covariance_mat[index] * std::pow(10.0, 9.0)) / std::pow(10.0, 9.0);
-        }
-    }
-
-    return covariance_mat;
+    return cluster_size >= min_parallel_cluster_size ? int(num_threads_per_node()) : 1;
 }
 
-scm::math::mat3d reduction_hierarchical_clustering_mk5::
-calculate_covariance_matrix_color(const std::vector<surfel *> &surfels_to_sample, vec3r &centroid) const
+void reduction_hierarchical_clustering_mk5::
+calculate_covariance_matrices(const std::vector<surfel *> &surfels_to_sample,
+                              vec3r &centroid_pos,
+                              vec3r &centroid_color,
+                              scm::math::mat3d &covariance_pos,
+                              scm::math::mat3d &covariance_color) const
 {
-    scm::math::mat3d covariance_mat = scm::math::mat3d::zero();
-    centroid = calculate_centroid_color(surfels_to_sample);
-
-    for (uint32_t surfel_index = 0; surfel_index < surfels_to_sample.size(); ++surfel_index) {
-        surfel *current_surfel = surfels_to_sample.at(surfel_index);
-        vec3r color_trans = transform_color(current_surfel->color());
-
-        covariance_mat.m00 += std::pow(color_trans.x - centroid.x, 2);
-        covariance_mat.m01 += (color_trans.x - centroid.x) * (color_trans.y - centroid.y);
-        covariance_mat.m02 += (color_trans.x - centroid.x) * (color_trans.z - centroid.z);
-
-        covariance_mat.m03 += (color_trans.y - centroid.y) * (color_trans.x - centroid.x);
-        covariance_mat.m04 += std::pow(color_trans.y - centroid.y, 2);
-        covariance_mat.m05 += (color_trans.y - centroid.y) * (color_trans.z - centroid.z);
-
-        covariance_mat.m06 += (color_trans.z - centroid.z) * (color_trans.x - centroid.x);
-        covariance_mat.m07 += (color_trans.z - centroid.z) * (color_trans.y - centroid.y);
-        covariance_mat.m08 += std::pow(color_trans.z - centroid.z, 2);
+    const int64_t num_surfels = surfels_to_sample.size();
+    const int num_threads = num_threads_for_cluster(surfels_to_sample.size());
+
+    // colors are transformed once and reused for the covariance
+    std::vector<vec3r> colors_trans(num_surfels);
+
+    real pos_x = 0, pos_y = 0, pos_z = 0;
+    real color_x = 0, color_y = 0, color_z = 0;
+
+    #pragma omp parallel for num_threads(num_threads) if(num_threads > 1) reduction(+:pos_x, pos_y, pos_z, color_x, color_y, color_z)
+    for (int64_t surfel_index = 0; surfel_index < num_surfels; ++surfel_index) {
+        const surfel *current_surfel = surfels_to_sample[surfel_index];
+        colors_trans[surfel_index] = transform_color(current_surfel->color());
+
+        pos_x += current_surfel->pos().x;
+        pos_y += current_surfel->pos().y;
+        pos_z += current_surfel->pos().z;
+        color_x += colors_trans[surfel_index].x;
+        color_y += colors_trans[surfel_index].y;
+        color_z += colors_trans[surfel_index].z;
     }
 
-    // Precision limitation because of rounding errors otherwise.
-    for (int index = 0; index < 9; ++index) {
-        covariance_mat[index] = round(covariance_mat[index] * std::pow(10.0, 9.0)) / std::pow(10.0, 9.0);
+    centroid_pos = vec3r(pos_x, pos_y, pos_z) / num_surfels;
+    centroid_color = vec3r(color_x, color_y, color_z) / num_surfels;
+
+    real p00 = 0, p01 = 0, p02 = 0, p11 = 0, p12 = 0, p22 = 0;
+    real c00 = 0, c01 = 0, c02 = 0, c11 = 0, c12 = 0, c22 = 0;
+
+    #pragma omp parallel for num_threads(num_threads) if(num_threads > 1) reduction(+:p00, p01, p02, p11, p12, p22, c00, c01, c02, c11, c12, c22)
+    for (int64_t surfel_index = 0; surfel_index < num_surfels; ++surfel_index) {
+        const vec3r d_pos = surfels_to_sample[surfel_index]->pos() - centroid_pos;
+        const vec3r d_color = colors_trans[surfel_index] - centroid_color;
+
+        p00 += d_pos.x * d_pos.x;
+        p01 += d_pos.x * d_pos.y;
+        p02 += d_pos.x * d_pos.z;
+        p11 += d_pos.y * d_pos.y;
+        p12 += d_pos.y * d_pos.z;
+        p22 += d_pos.z * d_pos.z;
+
+        c00 += d_color.x * d_color.x;
+        c01 += d_color.x * d_color.y;
+        c02 += d_color.x * d_color.z;
+        c11 += d_color.y * d_color.y;
+        c12 += d_color.y * d_color.z;
+        c22 += d_color.z * d_color.z;
     }
 
-    return covariance_mat;
+    // TODO: The rounding is only necessary for some models (infinite loop otherwise), it would be good to get rid of it completely though.
+    // Precision limitation because of rounding errors otherwise. This also hides the summation order of the thread team.
+    auto fill_rounded = [](scm::math::mat3d &matrix, real m00, real m01, real m02, real m11, real m12, real m22) {
+        const real values[9] = {m00, m01, m02, m01, m11, m12, m02, m12, m22};
+        for (int index = 0; index < 9; ++index) {
+            matrix[index] = round(values[index] * std::pow(10.0, 9.0)) / std::pow(10.0, 9.0);
+        }
+    };
+
+    covariance_pos = scm::math::mat3d::zero();
+    covariance_color = scm::math::mat3d::zero();
+    fill_rounded(covariance_pos, p00, p01, p02, p11, p12, p22);
+    fill_rounded(covariance_color, c00, c01, c02, c11, c12, c22);
 }
 
 real reduction_hierarchical_clustering_mk5::
@@ -292,33 +321,6 @@ calculate_variation(const scm::math::mat3d &covariance_matrix, vec3f &normal) co
     return variation;
 }
 
-vec3r reduction_hierarchical_clustering_mk5::
-calculate_centroid(const std::vector<surfel *> &surfels_to_sample) const
-{
-    vec3r centroid = vec3r(0, 0, 0);
-
-    for (uint32_t surfel_index = 0; surfel_index < surfels_to_sample.size(); ++surfel_index) {
-        surfel *current_surfel = surfels_to_sample.at(surfel_index);
-        centroid = centroid + current_surfel->pos();
-    }
-
-    return centroid / surfels_to_sample.size();
-}
-
-vec3r reduction_hierarchical_clustering_mk5::
-calculate_centroid_color(const std::vector<surfel *> &surfels_to_sample) const
-{
-    vec3r centroid = vec3r(0, 0, 0);
-
-    for (uint32_t surfel_index = 0; surfel_index < surfels_to_sample.size(); ++surfel_index) {
-        surfel *current_surfel = surfels_to_sample.at(surfel_index);
-        vec3r color_trans = transform_color(current_surfel->color());
-        centroid = centroid + color_trans;
-    }
-
-    return centroid / surfels_to_sample.size();
-}
-
 surfel reduction_hierarchical_clustering_mk5::
 create_surfel_from_cluster(const std::vector<surfel *> &surfels_to_sample) const
 {
@@ -287,8 +287,11 @@ add_surfel(shared_cluster_surfel_vector &surfel_ptr_set_M,
     }
 
     //sum up total overlap of a compelement-member surfel with set-M-member neigbours
-    for (auto const &complement_set_current_cluster_surfel : complement_set) {
-        compute_overlap(complement_set_current_cluster_surfel, true);
+    //every surfel only writes its own overlap, membership is not changed in here
+    const int64_t complement_set_size = complement_set.size();
+    #pragma omp parallel for num_threads(num_threads_per_node()) if(num_threads_per_node() > 1) schedule(dynamic, 64)
+    for (int64_t complement_index = 0; complement_index < complement_set_size; ++complement_index) {
+        compute_overlap(complement_set[complement_index], true);
     }
 
     //creat new surfel to add to set M
@@ -415,10 +418,6 @@ create_lod(real &reduction_error,
            const bvh &tree,
            const size_t start_node_id) const
 {
-    if (input[0]->has_provenance()) {
-      throw std::runtime_error("reduction_k_clustering not supported for PROVENANCE");
-    }
-
     //create output array
     surfel_mem_array mem_array(std::make_shared<surfel_vector>(surfel_vector()), 0, 0);
 
@@ -491,8 +490,11 @@ create_lod(real &reduction_error,
         }
     }
 
-    //define basic features for every cluster_surfel   
-    for (auto const &target_surfel : cluster_surfel_array) {
+    //define basic features for every cluster_surfel, each surfel only writes its own neighbours and features
+    const int64_t num_cluster_surfels = cluster_surfel_array.size();
+    #pragma omp parallel for num_threads(num_threads_per_node()) if(num_threads_per_node() > 1) schedule(dynamic, 64)
+    for (int64_t cluster_surfel_index = 0; cluster_surfel_index < num_cluster_surfels; ++cluster_surfel_index) {
+        auto const &target_surfel = cluster_surfel_array[cluster_surfel_index];
         assign_locally_overlapping_neighbours(target_surfel, cluster_surfel_array);
         compute_overlap(target_surfel, false);
         compute_deviation(target_surfel);
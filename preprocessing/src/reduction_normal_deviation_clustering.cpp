@@ -10,6 +10,8 @@
 #include <lamure/pre/basic_algorithms.h>
 #include <lamure/utils.h>
 
+#include <array>
+#include <iterator>
 #include <queue>
 
 #if WIN32
@@ -22,7 +24,7 @@ namespace lamure {
 namespace pre {
 
 surfel reduction_normal_deviation_clustering::
-create_representative(const std::vector<surfel>& input)
+create_representative(const arena_list<surfel>& input)
 {
     assert(input.size() > 0);
 
@@ -86,10 +88,9 @@ compute_grid_dimensions(const std::vector<surfel_mem_array*>& input,
     locked_grid_dimensions[1] = false;
     locked_grid_dimensions[2] = false;
 
-    std::vector<value_index_pair> sorted_bb_dimensions;
-    sorted_bb_dimensions.push_back(std::make_pair(bb_dimensions[0], 0));
-    sorted_bb_dimensions.push_back(std::make_pair(bb_dimensions[1], 1));
-    sorted_bb_dimensions.push_back(std::make_pair(bb_dimensions[2], 2));
+    std::array<value_index_pair, 3> sorted_bb_dimensions = {{std::make_pair(bb_dimensions[0], 0),
+                                                             std::make_pair(bb_dimensions[1], 1),
+                                                             std::make_pair(bb_dimensions[2], 2)}};
 
     std::sort(sorted_bb_dimensions.begin(), sorted_bb_dimensions.end());
 
@@ -197,21 +198,9 @@ compute_grid_dimensions(const std::vector<surfel_mem_array*>& input,
                 break;
             }
 
-            // create grid
-            std::vector<std::vector<std::vector<bool>>> grid(grid_dimensions[0],
-                                                             std::vector<std::vector<bool>>(grid_dimensions[1], 
-                                                                                            std::vector<bool>(grid_dimensions[2])));
-
-            for (uint32_t i = 0; i < grid_dimensions[0]; ++i)
-            {
-                for (uint32_t j = 0; j < grid_dimensions[1]; ++j)
-                {
-                    for (uint32_t k = 0; k < grid_dimensions[2]; ++k)
-                    {
-                        grid[i][j][k] = false;
-                    }
-                }
-            }
+            // create grid, the grid of every attempt is released before the next one
+            arena_scope attempt_scope;
+            arena_vector<uint8_t> grid(size_t(grid_dimensions[0]) * grid_dimensions[1] * grid_dimensions[2], 0);
 
             // check which cell a surfel occupies
             vec3r cell_size = vec3r(fabs(bb_dimensions[0]/grid_dimensions[0]),
@@ -256,7 +245,7 @@ compute_grid_dimensions(const std::vector<surfel_mem_array*>& input,
                     if ((index[2] != 0) && (index[2] == grid_dimensions[2]))
                         index[2] = grid_dimensions[2]-1;
 
-                    grid[index[0]][index[1]][index[2]] = true;
+                    grid[(size_t(index[0]) * grid_dimensions[1] + index[1]) * grid_dimensions[2] + index[2]] = 1;
 
                 }
             }
@@ -264,16 +253,9 @@ compute_grid_dimensions(const std::vector<surfel_mem_array*>& input,
             // count occupied cells
             uint32_t occupied_cells = 0;
 
-            for (uint32_t i = 0; i < grid_dimensions[0]; ++i)
+            for (const uint8_t occupied : grid)
             {
-                for (uint32_t j = 0; j < grid_dimensions[1]; ++j)
-                {
-                    for (uint32_t k = 0; k < grid_dimensions[2]; ++k)
-                    {
-                        if (grid[i][j][k])
-                            ++occupied_cells;
-                    }
-                }
+                occupied_cells += occupied;
             }
 
             // check if finished
@@ -315,9 +297,8 @@ create_lod(real& reduction_error,
           const bvh& tree,
           const size_t start_node_id) const
 {
-    if (input[0]->has_provenance()) {
-      throw std::runtime_error("reduction_normal_deviation_clustering not supported for PROVENANCE");
-    }
+    // every temporary below is released when the scope closes
+    arena_scope scope;
 
     // compute bounding box for actual surfels
     bounding_box bbox = basic_algorithms::compute_aabb(*input[0], true);
@@ -335,19 +316,9 @@ create_lod(real& reduction_error,
     vec3ui grid_dimensions = grid_data.first;
     vec3b locked_grid_dimensions = grid_data.second;
 
-    // create grid
-    std::vector<std::vector<std::vector<std::list<surfel>*>>> grid(grid_dimensions[0],std::vector<std::vector<std::list<surfel>*>>(grid_dimensions[1], std::vector<std::list<surfel>*>(grid_dimensions[2])));
-
-    for (uint32_t i = 0; i < grid_dimensions[0]; ++i)
-    {
-        for (uint32_t j = 0; j < grid_dimensions[1]; ++j)
-        {
-            for (uint32_t k = 0; k < grid_dimensions[2]; ++k)
-            {
-                grid[i][j][k] = new std::list<surfel>;
-            }
-        }
-    }
+    // create grid, cell (i, j, k) is at (i * grid_dimensions[1] + j) * grid_dimensions[2] + k
+    const size_t num_cells = size_t(grid_dimensions[0]) * grid_dimensions[1] * grid_dimensions[2];
+    arena_vector<arena_list<surfel>> grid(num_cells);
 
     // sort surfels into grid
     vec3r cell_size = vec3r(fabs(bb_dimensions[0]/grid_dimensions[0]),fabs(bb_dimensions[1]/grid_dimensions[1]),fabs(bb_dimensions[2]/grid_dimensions[2]));
@@ -390,7 +361,7 @@ create_lod(real& reduction_error,
             if ((index[2] != 0) && (index[2] == grid_dimensions[2]))
                 index[2] = grid_dimensions[2]-1;
 
-            grid[index[0]][index[1]][index[2]]->push_back(input[i]->read_surfel_ref(j));
+            grid[(size_t(index[0]) * grid_dimensions[1] + index[1]) * grid_dimensions[2] + index[2]].push_back(input[i]->read_surfel_ref(j));
 
         }
     }
@@ -398,20 +369,16 @@ create_lod(real& reduction_error,
 
     // move grid cells into priority queue
 
-    std::priority_queue<surfel_cluster_with_error, std::vector<surfel_cluster_with_error>, order_by_size> cell_pq;
+    // a cluster is popped before the merged one is pushed, the queue never outgrows the cells
+    arena_vector<surfel_cluster_with_error> queued_cells;
+    queued_cells.reserve(num_cells);
+    std::priority_queue<surfel_cluster_with_error, arena_vector<surfel_cluster_with_error>, order_by_size> cell_pq(order_by_size(), std::move(queued_cells));
     uint32_t surfel_count = 0;
 
-    for (uint32_t i = 0; i < grid_dimensions[0]; ++i)
+    for (auto& cell : grid)
     {
-        for (uint32_t j = 0; j < grid_dimensions[1]; ++j)
-        {
-            for (uint32_t k = 0; k < grid_dimensions[2]; ++k)
-            {
-                cell_pq.push({grid[i][j][k], 0.1f});
-                surfel_count += grid[i][j][k]->size();
-                grid[i][j][k] = 0;
-            }
-        }
+        cell_pq.push({&cell, 0.1f});
+        surfel_count += cell.size();
     }
 
     size_t termination_ctr = 0;
@@ -427,7 +394,7 @@ create_lod(real& reduction_error,
             break;
         }
 
-        std::list<surfel>* input_cluster = cell_pq.top().cluster;
+        arena_list<surfel>* input_cluster = cell_pq.top().cluster;
         float merge_treshold = cell_pq.top().merge_treshold;
         cell_pq.pop();
 
@@ -450,16 +417,16 @@ create_lod(real& reduction_error,
 
         //real radius_range = max_radius - min_radius;
 
-        std::list<surfel>* output_cluster = new std::list<surfel>;
+        // surfels are spliced between the lists, the grid allocated every list node there is
+        arena_list<surfel> output_cluster;
+        arena_list<surfel> surfels_to_merge;
 
         while(input_cluster->size() != 0)
         {
 
-            std::vector<surfel> surfels_to_merge;
-            surfels_to_merge.push_back(input_cluster->front());
-            input_cluster->pop_front();
+            surfels_to_merge.splice(surfels_to_merge.end(), *input_cluster, input_cluster->begin());
 
-            std::list<surfel>::iterator surfel_to_compare = input_cluster->begin();
+            arena_list<surfel>::iterator surfel_to_compare = input_cluster->begin();
 
             while(surfel_to_compare != input_cluster->end())
             {
@@ -511,10 +478,11 @@ create_lod(real& reduction_error,
                         surfel_to_compare->normal() = surfel_to_compare->normal() * (-1.0);
                     }
 
-                    surfels_to_merge.push_back(*surfel_to_compare);
-                    surfel_to_compare = input_cluster->erase(surfel_to_compare);
+                    auto next_surfel = std::next(surfel_to_compare);
+                    surfels_to_merge.splice(surfels_to_merge.end(), *input_cluster, surfel_to_compare);
+                    surfel_to_compare = next_surfel;
 
-                    if (( surfel_count + input_cluster->size() + output_cluster->size() + 1) <= surfels_per_node) {
+                    if (( surfel_count + input_cluster->size() + output_cluster.size() + 1) <= surfels_per_node) {
                         early_termination = true;
                         break;
                     }
@@ -523,24 +491,27 @@ create_lod(real& reduction_error,
                     std::advance(surfel_to_compare,1);
                 }
             }
-            output_cluster->push_back(create_representative(surfels_to_merge));
+            // the representative takes the node of the first merged surfel
+            const surfel representative = create_representative(surfels_to_merge);
+            output_cluster.splice(output_cluster.end(), surfels_to_merge, surfels_to_merge.begin());
+            output_cluster.back() = representative;
+            surfels_to_merge.clear();
 
             if (early_termination) {
-                output_cluster->insert(output_cluster->end(), input_cluster->begin(), input_cluster->end());
+                output_cluster.splice(output_cluster.end(), *input_cluster);
                 break;
             }
 
         }
 
-        surfel_count += output_cluster->size();
+        surfel_count += output_cluster.size();
 
-        if (input_cluster_size == output_cluster->size()) {
+        if (input_cluster_size == output_cluster.size()) {
             merge_treshold += 0.1;
 
         }
 
-        delete input_cluster;
-        input_cluster = output_cluster;
+        input_cluster->swap(output_cluster);
         cell_pq.push({input_cluster, merge_treshold});
 
     }
@@ -549,15 +520,13 @@ create_lod(real& reduction_error,
 
     while (!cell_pq.empty())
     {
-        std::list<surfel>* cluster = cell_pq.top().cluster;
+        arena_list<surfel>* cluster = cell_pq.top().cluster;
         cell_pq.pop();
 
-        for(std::list<surfel>::iterator surfel = cluster->begin(); surfel != cluster->end(); ++surfel)
+        for(arena_list<surfel>::iterator surfel = cluster->begin(); surfel != cluster->end(); ++surfel)
         {
             mem_array.surfel_mem_data()->push_back(*surfel);
         }
-
-        delete cluster;
     }
 
     mem_array.set_length(mem_array.surfel_mem_data()->size());
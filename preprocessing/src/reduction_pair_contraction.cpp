@@ -7,8 +7,11 @@
 
 #ifdef CMAKE_OPTION_ENABLE_ALTERNATIVE_STRATEGIES
 
+#include <lamure/pre/attribute_channel.h>
+#include <lamure/pre/indexed_min_heap.h>
 #include <lamure/pre/reduction_pair_contraction.h>
 #include <lamure/pre/surfel.h>
+#include <lamure/pre/surfel_soa_array.h>
 #include <set>
 #include <functional>
 #include <queue>
@@ -123,11 +126,13 @@ bool operator<(const contraction &c1, const contraction &c2)
 
 struct contraction_op
 {
-    contraction_op(contraction *c)
-        : cont{c}
+    contraction_op(contraction *c, size_t i)
+        : cont{c}, id{i}
     {};
 
     contraction *cont;
+    // handle of the operation in the contraction heap
+    size_t id;
 };
 
 bool operator>(const contraction_op &c1, const contraction_op &c2)
@@ -238,10 +243,6 @@ create_lod(real &reduction_error,
            const bvh &tree,
            const size_t start_node_id) const
 {
-    if (input[0]->has_provenance()) {
-      throw std::runtime_error("reduction_pair_contraction not supported for PROVENANCE");
-    }
-
     const uint32_t fan_factor = input.size();
     size_t num_surfels = 0;
     size_t min_num_surfels = input[0]->length();
@@ -256,22 +257,31 @@ create_lod(real &reduction_error,
 
     std::map<surfel_id_t, quadric_t> quadrics{};
     std::vector<std::vector<surfel>> node_surfels{input.size() + 1, std::vector<surfel>{}};
+    // provenance follows the contractions, one accumulator next to every surfel
+    const bool provenance = input[0]->has_provenance();
+    const attribute_channel channel(prov_aggregation());
+    std::vector<std::vector<attribute_accumulator>> node_attributes{provenance ? input.size() + 1 : 0};
     std::set<edge_t> edges{};
+    // neighbour search runs over float positions relative to the node centre
+    surfel_soa_array soa_input(input, true);
+    size_t local_idx = 0;
     // accumulate edges and point quadrics
     for (node_id_type node_idx = 0; node_idx < fan_factor; ++node_idx) {
-        for (size_t surfel_idx = 0; surfel_idx < input[node_idx]->length(); ++surfel_idx) {
+        for (size_t surfel_idx = 0; surfel_idx < input[node_idx]->length(); ++surfel_idx, ++local_idx) {
 
             surfel curr_surfel = input[node_idx]->read_surfel(surfel_idx);
             // save surfel
             node_surfels[node_idx].push_back(curr_surfel);
+            if (provenance) {
+                node_attributes[node_idx].push_back(channel.source(*input[node_idx], surfel_idx));
+            }
             surfel_id_t curr_id = surfel_id_t{node_idx, surfel_idx};
 
             assert(node_idx < num_nodes_per_level && surfel_idx < num_surfels_per_node);
             // get and store neighbours
-            auto nearest_neighbours = get_local_nearest_neighbours(input, number_of_neighbours_, curr_id);
-            std::vector<surfel_id_t> neighbour_ids{};
-            for (const auto &pair : nearest_neighbours) {
-                neighbour_ids.push_back(pair.first);
+            std::vector<std::pair<surfel_id_t, real>> nearest_neighbours{};
+            for (const auto &pair : soa_input.nearest_neighbours(local_idx, number_of_neighbours_)) {
+                nearest_neighbours.emplace_back(soa_input.local_id(pair.first), pair.second);
             }
 
             quadric_t curr_quadric{};
@@ -292,6 +302,9 @@ create_lod(real &reduction_error,
 
     // allocate space for new surfels that will be created
     node_surfels.back() = std::vector<surfel>{num_surfels - surfels_per_node};
+    if (provenance) {
+        node_attributes.back() = std::vector<attribute_accumulator>(num_surfels - surfels_per_node);
+    }
 #ifdef DEBUG
     real error_min = std::numeric_limits<real>::max();
     real error_max = 0;
@@ -348,7 +361,7 @@ create_lod(real &reduction_error,
         assert(edge.a.node_idx < num_nodes_per_level && edge.a.surfel_idx < num_surfels_per_node);
         assert(edge.b.node_idx < num_nodes_per_level && edge.b.surfel_idx < num_surfels_per_node);
         // store contraction operation pointing to new contraction
-        contraction_op op{contractions.at(edge.a).at(edge.b).get()};
+        contraction_op op{contractions.at(edge.a).at(edge.b).get(), contraction_queue.size()};
         contraction_queue.push_back(std::make_shared<contraction_op>(op));
         // let contraction point to related contraction_op
         contractions.at(edge.a).at(edge.b)->cont_op = contraction_queue.back().get();
@@ -401,28 +414,29 @@ create_lod(real &reduction_error,
     std::cout << "doing contractions" << std::endl;
 #endif
 
-    auto sort_func = [](const std::shared_ptr<contraction_op> &a,
-                        const std::shared_ptr<contraction_op> &b)
-    {
-        return *a > *b;
-    };
+    // operations are addressed by id, keys follow the error of the contraction they point to
+    indexed_min_heap<real> contraction_heap(contraction_queue.size());
+    for (const auto &op : contraction_queue) {
+        contraction_heap.push(op->id, op->cont->error);
+    }
 
     // work off queue until target num of surfels is reached
     for (size_t i = 0; i < num_surfels - surfels_per_node; ++i) {
-        // update queue, cheapest contraction at the back
-        std::sort(contraction_queue.begin(), contraction_queue.end(), sort_func);
+        // invalidated operations are dropped lazily once they reach the top
+        while (!contraction_heap.empty() && contraction_queue[contraction_heap.top()]->cont == nullptr) {
+            contraction_heap.pop();
+        }
+        if (contraction_heap.empty()) {
+            break;
+        }
 
-        contraction curr_contraction = *(contraction_queue.back()->cont);
-        contraction_queue.pop_back();
+        contraction curr_contraction = *(contraction_queue[contraction_heap.top()]->cont);
+        contraction_heap.pop();
 
 #ifdef DEBUG
-        for (int i = contraction_queue.size() - 1; i >= 0; --i) {
-          if (curr_contraction.error > contraction_queue[i]->cont->error) {
-            std::cout << "size2 " << contraction_queue.size() << std::endl;
-            std::cout << contraction_queue[i-1]->cont->error << ", " << contraction_queue[i]->cont->error << ", " << contraction_queue[i+1]->cont->error << std::endl;
-            std::cout << "curr " << curr_contraction.error << ", smaller " << i << " with " << contraction_queue[i]->cont->error << std::endl;
-            throw std::runtime_error("curr " + std::to_string(curr_contraction.error) + ", smaller " + std::to_string(i) + " with " + std::to_string(contraction_queue[i]->cont->error));
-          }
+        if (!contraction_heap.empty() && contraction_queue[contraction_heap.top()]->cont != nullptr &&
+            curr_contraction.error > contraction_heap.top_key()) {
+            throw std::runtime_error("curr " + std::to_string(curr_contraction.error) + ", smaller " + std::to_string(contraction_heap.top_key()));
         }
 #endif
 
@@ -440,6 +454,11 @@ create_lod(real &reduction_error,
 
         const surfel_id_t &old_id_1 = curr_contraction.edge.a;
         const surfel_id_t &old_id_2 = curr_contraction.edge.b;
+        if (provenance) {
+            attribute_accumulator &new_attributes = node_attributes.back()[i];
+            new_attributes.merge(node_attributes[old_id_1.node_idx][old_id_1.surfel_idx]);
+            new_attributes.merge(node_attributes[old_id_2.node_idx][old_id_2.surfel_idx]);
+        }
         // invalidate old surfels
 #ifdef LEAF_REMOVAL
         if (old_id_1.node_idx < fan_factor) {
@@ -463,7 +482,7 @@ create_lod(real &reduction_error,
         quadrics.erase(curr_contraction.edge.a);
         quadrics.erase(curr_contraction.edge.b);
 
-        auto update_contraction = [&create_contraction, &contractions, &curr_contraction]
+        auto update_contraction = [&create_contraction, &contractions, &contraction_heap]
             (const surfel_id_t &new_id, const surfel_id_t &old_id, const std::pair<const surfel_id_t, std::shared_ptr<contraction>> &cont)
         {
             edge_t new_edge = edge_t{new_id, cont.first};
@@ -478,6 +497,7 @@ create_lod(real &reduction_error,
             // transfer contraction op
             contractions.at(new_id).at(cont.first)->cont_op = operation;
             operation->cont = contractions.at(new_id).at(cont.first).get();
+            contraction_heap.push(operation->id, operation->cont->error);
             // check for pointer correctness
             assert(contractions.at(new_edge.a).at(new_edge.b).get() == contractions.at(new_edge.a).at(new_edge.b).get()->cont_op->cont);
             assert(contractions.at(new_edge.a).at(new_edge.b).get() == contractions.at(new_edge.b).at(new_edge.a).get());
@@ -546,19 +566,21 @@ create_lod(real &reduction_error,
         // remove old mapping
         contractions.erase(old_id_1);
         contractions.erase(old_id_2);
-        //remove invalid contraction operations
-        contraction_queue.erase(std::remove_if(contraction_queue.begin(), contraction_queue.end(), [](const std::shared_ptr<contraction_op> &op)
-        { return op->cont == nullptr; }), contraction_queue.end());
     }
 #ifdef DEBUG
     std::cout << "neighbours min " << n_min << " max " << n_max << std::endl;
     std::cout << "copying surfels" << std::endl;
 #endif
     surfel_mem_array mem_array(std::make_shared<surfel_vector>(surfel_vector()), 0, 0);
-    for (auto &node : node_surfels) {
-        for (auto &surfel : node) {
+    std::vector<attribute_accumulator> output_attributes;
+    for (size_t node_idx = 0; node_idx < node_surfels.size(); ++node_idx) {
+        for (size_t surfel_idx = 0; surfel_idx < node_surfels[node_idx].size(); ++surfel_idx) {
+            const surfel &surfel = node_surfels[node_idx][surfel_idx];
             if (surfel.radius() > 0.0f) {
                 mem_array.surfel_mem_data()->push_back(surfel);
+                if (provenance) {
+                    output_attributes.push_back(std::move(node_attributes[node_idx][surfel_idx]));
+                }
             }
         }
     }
@@ -566,9 +588,20 @@ create_lod(real &reduction_error,
 
     reduction_error = 0.0;
 
+    if (provenance) {
+        return channel.attach(mem_array, output_attributes);
+    }
     return mem_array;
 }
 
+size_t reduction_pair_contraction::
+estimate_temporary_memory(const size_t num_input_surfels, const uint32_t surfels_per_node) const
+{
+    // surfel copies, quadrics and one contraction per neighbour edge
+    const size_t per_surfel = 2 * sizeof(surfel) + sizeof(quadric_t) + number_of_neighbours_ * (sizeof(contraction) + 2 * sizeof(void *));
+    return num_input_surfels * per_surfel + surfels_per_node * sizeof(surfel);
+}
+
 lamure::pre::quadric_t edge_quadric(const vec3f &normal_p1, const vec3f &normal_p2, const vec3r &p1, const vec3r &p2)
 {
     vec3r edge_dir = p2 - p1;
@@ -61,10 +61,6 @@ create_lod(real &reduction_error,
            const bvh &tree,
            const size_t start_node_id) const
 {
-    if (input[0]->has_provenance()) {
-      throw std::runtime_error("reduction_particle_simulation not supported for PROVENANCE");
-    }
-
     std::vector<surfel> original_surfels;
 
     //create output array
@@ -23,10 +23,6 @@ create_lod(real &reduction_error,
            const bvh &tree,
            const size_t start_node_id) const
 {
-    if (input[0]->has_provenance()) {
-      throw std::runtime_error("reduction_spatially_subdivided_random not supported for PROVENANCE");
-    }
-
     surfel_mem_array mem_array(std::make_shared<surfel_vector>(surfel_vector()), 0, 0);
 
     std::vector<surfel> already_picked_surfel;
@@ -7,12 +7,28 @@
 
 #include <lamure/pre/bvh.h>
 #include <lamure/pre/reduction_strategy.h>
+#include <lamure/pre/attribute_channel.h>
 
 namespace lamure
 {
 namespace pre
 {
 
+surfel_mem_array reduction_strategy::
+create_lod_with_provenance(real &reduction_error,
+                           const std::vector<surfel_mem_array *> &input,
+                           const uint32_t surfels_per_node,
+                           const bvh &tree,
+                           const size_t start_node_id) const
+{
+    surfel_mem_array result = create_lod(reduction_error, input, surfels_per_node, tree, start_node_id);
+
+    if (!result.has_provenance()) {
+        result = attribute_channel(prov_aggregation_).transfer(input, result);
+    }
+    return result;
+}
+
 void reduction_strategy::
 interpolate_approx_natural_neighbours(surfel &surfel_to_update,
                                       std::vector<surfel> const &input_surfels,
@@ -0,0 +1,227 @@
+// Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
+// This Software is distributed under the Modified BSD License, see license.txt.
+//
+// Virtual Reality and Visualization Research Group
+// Faculty of Media, Bauhaus-Universitaet Weimar
+// http://www.uni-weimar.de/medien/vr
+
+#include <lamure/pre/surfel_soa_array.h>
+
+#include <lamure/bounding_box.h>
+
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+
+namespace lamure
+{
+namespace pre
+{
+
+void surfel_soa_data::
+reserve(const size_t num_surfels)
+{
+    if (relative_positions) {
+        rel_pos_x.reserve(num_surfels);
+        rel_pos_y.reserve(num_surfels);
+        rel_pos_z.reserve(num_surfels);
+    }
+    else {
+        pos_x.reserve(num_surfels);
+        pos_y.reserve(num_surfels);
+        pos_z.reserve(num_surfels);
+    }
+    radius.reserve(num_surfels);
+}
+
+void surfel_soa_data::
+clear()
+{
+    pos_x.clear(); pos_y.clear(); pos_z.clear();
+    rel_pos_x.clear(); rel_pos_y.clear(); rel_pos_z.clear();
+    radius.clear();
+}
+
+vec3r surfel_soa_array::
+pos(const size_t index) const
+{
+    const surfel_soa_data &data = soa_data_;
+
+    if (data.relative_positions) {
+        return data.centre + vec3r(data.rel_pos_x[index], data.rel_pos_y[index], data.rel_pos_z[index]);
+    }
+    return vec3r(data.pos_x[index], data.pos_y[index], data.pos_z[index]);
+}
+
+surfel_id_t surfel_soa_array::
+local_id(const size_t index) const
+{
+    assert(index < length());
+
+    // input_offsets_ holds the first local index of every input array
+    auto it = std::upper_bound(input_offsets_.begin(), input_offsets_.end(), index);
+    const size_t node_idx = std::distance(input_offsets_.begin(), it) - 1;
+    return surfel_id_t(node_id_type(node_idx), index - input_offsets_[node_idx]);
+}
+
+void surfel_soa_array::
+compute_distances_sqr(const vec3r &point, std::vector<real> &distances) const
+{
+    distances.resize(length());
+    compute_distances_sqr(point, distances.data());
+}
+
+void surfel_soa_array::
+compute_distances_sqr(const vec3r &point, real *out) const
+{
+    const surfel_soa_data &data = soa_data_;
+    const size_t num_surfels = data.size();
+
+    if (data.relative_positions) {
+        // the query point is moved into the local frame once, the loop stays in float
+        const vec3r rel = point - data.centre;
+        const float px = float(rel.x), py = float(rel.y), pz = float(rel.z);
+        const float *x = data.rel_pos_x.data();
+        const float *y = data.rel_pos_y.data();
+        const float *z = data.rel_pos_z.data();
+
+        #pragma omp simd
+        for (size_t i = 0; i < num_surfels; ++i) {
+            const float dx = x[i] - px;
+            const float dy = y[i] - py;
+            const float dz = z[i] - pz;
+            out[i] = dx * dx + dy * dy + dz * dz;
+        }
+    }
+    else {
+        const real px = point.x, py = point.y, pz = point.z;
+        const real *x = data.pos_x.data();
+        const real *y = data.pos_y.data();
+        const real *z = data.pos_z.data();
+
+        #pragma omp simd
+        for (size_t i = 0; i < num_surfels; ++i) {
+            const real dx = x[i] - px;
+            const real dy = y[i] - py;
+            const real dz = z[i] - pz;
+            out[i] = dx * dx + dy * dy + dz * dz;
+        }
+    }
+}
+
+std::vector<std::pair<size_t, real>> surfel_soa_array::
+nearest_neighbours(const size_t index, const size_t num_neighbours) const
+{
+    std::vector<std::pair<size_t, real>> candidates;
+    const size_t num_surfels = length();
+    if (num_surfels < 2 || num_neighbours == 0) {
+        return candidates;
+    }
+
+    std::vector<real> distances;
+    compute_distances_sqr(pos(index), distances);
+
+    std::vector<size_t> order(num_surfels);
+    std::iota(order.begin(), order.end(), 0);
+    // the surfel itself must not become its own neighbour
+    std::swap(order[index], order.back());
+    order.pop_back();
+
+    const size_t k = std::min(num_neighbours, order.size());
+    auto by_distance = [&distances](size_t left, size_t right) {
+        return distances[left] < distances[right];
+    };
+    std::partial_sort(order.begin(), order.begin() + k, order.end(), by_distance);
+
+    candidates.reserve(k);
+    for (size_t i = 0; i < k; ++i) {
+        candidates.emplace_back(order[i], distances[order[i]]);
+    }
+    return candidates;
+}
+
+std::vector<size_t> surfel_soa_array::
+overlapping_candidates(const size_t index) const
+{
+    arena_scope scope;
+    arena_vector<size_t> candidates;
+    overlapping_candidates(index, candidates);
+    return std::vector<size_t>(candidates.begin(), candidates.end());
+}
+
+void surfel_soa_array::
+overlapping_candidates(const size_t index, arena_vector<size_t> &candidates) const
+{
+    const size_t num_surfels = length();
+
+    // reserved up front, so the vector never grows inside the scope below
+    candidates.clear();
+    candidates.reserve(num_surfels);
+
+    // scratch streams are released before returning
+    arena_scope scope;
+    arena_vector<real> distances(num_surfels);
+    compute_distances_sqr(pos(index), distances.data());
+
+    const real *radii = soa_data_.radius.data();
+    const real target_radius = radii[index];
+
+    arena_vector<uint8_t> overlaps(num_surfels);
+    uint8_t *flags = overlaps.data();
+
+    #pragma omp simd
+    for (size_t i = 0; i < num_surfels; ++i) {
+        const real reach = radii[i] + target_radius;
+        flags[i] = distances[i] <= reach * reach;
+    }
+
+    for (size_t i = 0; i < num_surfels; ++i) {
+        if (flags[i] && i != index) {
+            candidates.push_back(i);
+        }
+    }
+}
+
+void surfel_soa_array::
+reset(const std::vector<surfel_mem_array *> &input,
+      const bool relative_positions)
+{
+    surfel_soa_data &data = soa_data_;
+    data.clear();
+    data.relative_positions = relative_positions;
+
+    input_offsets_.clear();
+    size_t num_surfels = 0;
+    bounding_box input_bb;
+    for (const auto *array : input) {
+        input_offsets_.push_back(num_surfels);
+        num_surfels += array->length();
+        for (size_t i = 0; i < array->length(); ++i) {
+            input_bb.expand(array->read_surfel_ref(i).pos());
+        }
+    }
+
+    data.centre = input_bb.is_valid() ? input_bb.get_center() : vec3r(0.0);
+    data.reserve(num_surfels);
+
+    for (const auto *array : input) {
+        for (size_t i = 0; i < array->length(); ++i) {
+            const surfel &s = array->read_surfel_ref(i);
+            if (relative_positions) {
+                const vec3r rel = s.pos() - data.centre;
+                data.rel_pos_x.push_back(float(rel.x));
+                data.rel_pos_y.push_back(float(rel.y));
+                data.rel_pos_z.push_back(float(rel.z));
+            }
+            else {
+                data.pos_x.push_back(s.pos().x);
+                data.pos_y.push_back(s.pos().y);
+                data.pos_z.push_back(s.pos().z);
+            }
+            data.radius.push_back(s.radius());
+        }
+    }
+}
+
+} // namespace pre
+} // namespace lamure
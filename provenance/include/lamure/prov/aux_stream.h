@@ -617,7 +617,7 @@ protected:
       aux_vec3 max_;
       uint32_t idx_;
       uint32_t num_fotos_;
-      std::set<uint32_t> fotos_;
+      std::vector<uint32_t> fotos_;
     };
 
     
@@ -709,7 +709,7 @@ protected:
                 for (uint32_t j = 0; j < node.num_fotos_; ++j) {
                     uint32_t foto;
                     file.read((char*)&foto, 4);
-                    node.fotos_.insert(foto);
+                    node.fotos_.push_back(foto);
                 }
                 nodes_.push_back(node);
             }
@@ -90,6 +90,7 @@ public:
     const uint64_t      get_num_nodes() const;
 
     uint64_t            get_octree_query(const scm::math::vec3f& _pos);
+    void                get_octree_query(const std::vector<scm::math::vec3f>& _positions, std::vector<uint64_t>& _node_ids);
     const octree_node&  get_octree_node(uint64_t _node_id);
 
     const view&         get_view(uint32_t id) const;
@@ -0,0 +1,97 @@
+// Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
+// This Software is distributed under the Modified BSD License, see license.txt.
+//
+// Virtual Reality and Visualization Research Group
+// Faculty of Media, Bauhaus-Universitaet Weimar
+// http://www.uni-weimar.de/medien/vr
+
+#ifndef PROV_MORTON_H_
+#define PROV_MORTON_H_
+
+#include <scm/core/math.h>
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+
+namespace lamure {
+namespace prov {
+
+
+//number of bits per axis, enough to keep the nodes of a traversal coherent down to depth 10
+const uint32_t morton_bits_per_axis = 10;
+
+//spreads the lower 10 bits of a value to every third bit
+inline uint32_t spread_morton_bits(uint32_t _value) {
+  _value &= 0x3ff;
+  _value = (_value | _value << 16) & 0x30000ff;
+  _value = (_value | _value << 8) & 0x300f00f;
+  _value = (_value | _value << 4) & 0x30c30c3;
+  _value = (_value | _value << 2) & 0x9249249;
+  return _value;
+}
+
+//position within [_min, _max] quantized to 10 bits, positions outside are clamped
+inline uint32_t quantize_morton_axis(float _pos, float _min, float _max) {
+  const uint32_t max_cell = (1u << morton_bits_per_axis) - 1;
+  float extent = _max - _min;
+  float t = extent > 0.f ? (_pos - _min) / extent : 0.f;
+  if (!(t > 0.f)) return 0;
+  if (t >= 1.f) return max_cell;
+  return (uint32_t)(t * (float)max_cell);
+}
+
+//30 bit morton code of a position relative to the given bounds
+inline uint32_t get_morton_code(const scm::math::vec3f& _pos, const scm::math::vec3f& _min, const scm::math::vec3f& _max) {
+  return spread_morton_bits(quantize_morton_axis(_pos.x, _min.x, _max.x))
+    | spread_morton_bits(quantize_morton_axis(_pos.y, _min.y, _max.y)) << 1
+    | spread_morton_bits(quantize_morton_axis(_pos.z, _min.z, _max.z)) << 2;
+}
+
+//indices of the positions sorted along the morton curve through the given bounds,
+//processing a batch in this order keeps consecutive tree traversals on the same path
+inline std::vector<uint64_t> get_morton_order(const std::vector<scm::math::vec3f>& _positions,
+  const scm::math::vec3f& _min, const scm::math::vec3f& _max) {
+
+  typedef std::pair<uint32_t, uint64_t> morton_key;
+
+  std::vector<morton_key> keys(_positions.size());
+  std::vector<morton_key> sorted_keys(_positions.size());
+
+#pragma omp parallel for
+  for (int64_t i = 0; i < (int64_t)_positions.size(); ++i) {
+    keys[i] = morton_key(get_morton_code(_positions[i], _min, _max), (uint64_t)i);
+  }
+
+  //least significant digit radix sort, one pass per 10 bits of the code
+  const uint32_t radix_bits = morton_bits_per_axis;
+  const uint32_t num_buckets = 1u << radix_bits;
+
+  for (uint32_t shift = 0; shift < 3 * morton_bits_per_axis; shift += radix_bits) {
+    std::vector<uint64_t> bucket_offsets(num_buckets + 1, 0);
+    for (const auto& key : keys) {
+      ++bucket_offsets[((key.first >> shift) & (num_buckets - 1)) + 1];
+    }
+    for (uint32_t bucket = 0; bucket < num_buckets; ++bucket) {
+      bucket_offsets[bucket + 1] += bucket_offsets[bucket];
+    }
+    for (const auto& key : keys) {
+      sorted_keys[bucket_offsets[(key.first >> shift) & (num_buckets - 1)]++] = key;
+    }
+    keys.swap(sorted_keys);
+  }
+
+  std::vector<uint64_t> order(keys.size());
+  for (uint64_t i = 0; i < keys.size(); ++i) {
+    order[i] = keys[i].second;
+  }
+
+  return order;
+}
+
+
+} } // namespace lamure
+
+
+#endif // PROV_MORTON_H_
@@ -20,6 +20,7 @@
 #include <vector>
 #include <set>
 #include <map>
+#include <utility>
 
 
 namespace lamure {
@@ -31,8 +32,8 @@ public:
   octree_node()
     : idx_(0), child_mask_(0), child_idx_(0), min_(std::numeric_limits<float>::max()), max_(std::numeric_limits<float>::lowest()) {};
   octree_node(uint64_t _idx, uint32_t _child_mask, uint32_t _child_idx,
-    const scm::math::vec3f& _min, const scm::math::vec3f& _max, const std::set<uint32_t>& _fotos)
-    : idx_(_idx), child_mask_(_child_mask), child_idx_(_child_idx), min_(_min), max_(_max), fotos_(_fotos) {};
+    const scm::math::vec3f& _min, const scm::math::vec3f& _max, std::vector<uint32_t> _fotos)
+    : idx_(_idx), child_mask_(_child_mask), child_idx_(_child_idx), min_(_min), max_(_max), fotos_(std::move(_fotos)) {};
   ~octree_node() {};
 
   void set_idx(uint64_t _idx) { idx_ = _idx; };
@@ -47,8 +48,9 @@ public:
   void set_max(const scm::math::vec3f& _max) { max_ = _max; };
   const scm::math::vec3f& get_max() const { return max_; };
 
-  void set_fotos(const std::set<uint32_t>& _fotos) { fotos_ = _fotos; };
-  const std::set<uint32_t>& get_fotos() const { return fotos_; };
+  //ids of the cameras seeing the node, sorted ascending without duplicates
+  void set_fotos(const std::vector<uint32_t>& _fotos) { fotos_ = _fotos; };
+  const std::vector<uint32_t>& get_fotos() const { return fotos_; };
 
 
 protected:
@@ -57,7 +59,7 @@ protected:
   uint32_t child_idx_; //idx of first child
   scm::math::vec3f min_;
   scm::math::vec3f max_;
-  std::set<uint32_t> fotos_;
+  std::vector<uint32_t> fotos_;
 };
 
 class PROVENANCE_DLL octree {
@@ -67,6 +69,8 @@ public:
 
   void                create(std::vector<auxi::sparse_point>& _points);
   uint64_t            query(const scm::math::vec3f& _pos);
+  //answers a batch of queries at once, _node_ids[i] is the node query(_points[i]) would return
+  void                query(const std::vector<scm::math::vec3f>& _points, std::vector<uint64_t>& _node_ids);
 
   uint64_t            get_child_id(uint64_t node_id, uint32_t child_index);
   uint64_t            get_parent_id(uint64_t node_id);
@@ -79,8 +83,19 @@ public:
 
 protected:
 
+  //compact copy of the node bounds and child links, traversed by batched queries
+  struct query_node {
+    scm::math::vec3f min_;
+    scm::math::vec3f max_;
+    uint32_t child_mask_;
+    uint32_t child_idx_;
+  };
+
+  void                update_query_nodes();
+  uint64_t            query_flat(const scm::math::vec3f& _pos, std::vector<uint64_t>& _path) const;
 
   std::vector<octree_node> nodes_;
+  std::vector<query_node> query_nodes_;
   uint64_t min_num_points_per_node_;
   uint32_t depth_;
 
@@ -9,6 +9,7 @@
 #define LAMURE_SPARSEOCTREE_H
 
 #include <lamure/prov/dense_cache.h>
+#include <lamure/prov/morton.h>
 #include <lamure/prov/octree_node.h>
 #include <lamure/prov/partitionable.h>
 
@@ -143,6 +144,35 @@ class PROVENANCE_DLL SparseOctree : public OctreeNode
         return this;
     }
 
+    // Looks up a batch of positions at once. node_ids[i] identifies the node lookup_node_at_position(positions[i]) returns,
+    // see get_node_by_id. The lookup runs on a flat copy of the hierarchy, which is rebuilt when the tree was copied.
+    void lookup_nodes_at_positions(const vec<vec3f> &positions, vec<uint64_t> &node_ids)
+    {
+        node_ids.assign(positions.size(), 0);
+
+        update_lookup_nodes();
+
+        vec<uint64_t> order = get_morton_order(positions, this->_min, this->_max);
+
+#pragma omp parallel for schedule(static, 4096)
+        for(int64_t i = 0; i < (int64_t)order.size(); i++)
+        {
+            node_ids.at(order.at(i)) = lookup_node_id(positions.at(order.at(i)));
+        }
+    }
+
+    OctreeNode *get_node_by_id(uint64_t node_id)
+    {
+        update_lookup_nodes();
+        return _lookup_node_ptrs.at(node_id);
+    }
+
+    uint64_t get_num_nodes()
+    {
+        update_lookup_nodes();
+        return _lookup_node_ptrs.size();
+    }
+
     void debug_randomized_lookup(uint64_t num_probes)
     {
         for(uint64_t i = 0; i < num_probes; i++)
@@ -195,6 +225,84 @@ class PROVENANCE_DLL SparseOctree : public OctreeNode
     }
 
   private:
+    struct LookupNode
+    {
+        vec3f _min;
+        vec3f _max;
+        uint32_t _first_child;
+        uint32_t _num_children;
+    };
+
+    // Nodes in breadth first order, so the children of a node are stored next to each other.
+    vec<LookupNode> _lookup_nodes;
+    vec<OctreeNode *> _lookup_node_ptrs;
+    const SparseOctree *_lookup_root = nullptr;
+
+    void update_lookup_nodes()
+    {
+        if(_lookup_root == this && !_lookup_nodes.empty())
+        {
+            return;
+        }
+
+        _lookup_nodes.clear();
+        _lookup_node_ptrs.clear();
+        _lookup_node_ptrs.push_back(this);
+
+        for(uint64_t i = 0; i < _lookup_node_ptrs.size(); i++)
+        {
+            OctreeNode *node = _lookup_node_ptrs.at(i);
+
+            LookupNode lookup_node;
+            lookup_node._min = node->get_min();
+            lookup_node._max = node->get_max();
+            lookup_node._first_child = (uint32_t)_lookup_node_ptrs.size();
+            lookup_node._num_children = (uint32_t)node->get_partitions().size();
+            _lookup_nodes.push_back(lookup_node);
+
+            for(uint64_t k = 0; k < node->get_partitions().size(); k++)
+            {
+                _lookup_node_ptrs.push_back(&node->get_partitions().at(k));
+            }
+        }
+
+        _lookup_root = this;
+    }
+
+    uint64_t lookup_node_id(const vec3f &position) const
+    {
+        auto fits = [&position](const LookupNode &node) -> bool {
+            return !(position.x > node._max.x || position.x < node._min.x || position.y > node._max.y || position.y < node._min.y || position.z > node._max.z ||
+                     position.z < node._min.z);
+        };
+
+        // Same descent as lookup_node_at_position: the first child which contains the position is entered
+        uint64_t node_id = 0;
+        if(!fits(_lookup_nodes[0]))
+        {
+            return node_id;
+        }
+
+        bool found = true;
+        while(found)
+        {
+            const LookupNode &node = _lookup_nodes[node_id];
+
+            found = false;
+            for(uint32_t k = node._first_child; k < node._first_child + node._num_children; k++)
+            {
+                if(fits(_lookup_nodes[k]))
+                {
+                    node_id = k;
+                    found = true;
+                    break;
+                }
+            }
+        }
+
+        return node_id;
+    }
+
     float compare_metadata(const DenseMetaData &data, const DenseMetaData &ref_data)
     {
         float information_loss = 0;
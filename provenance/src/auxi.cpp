@@ -76,6 +76,11 @@ get_octree_query(const scm::math::vec3f& _pos){
   return octree_->query(_pos);
 }
 
+void auxi::
+get_octree_query(const std::vector<scm::math::vec3f>& _positions, std::vector<uint64_t>& _node_ids){
+  octree_->query(_positions, _node_ids);
+}
+
 const uint64_t auxi::
 get_num_nodes() const {
  return octree_->get_num_nodes();
@@ -7,18 +7,196 @@
 
 #include <lamure/prov/octree.h>
 #include <lamure/prov/auxi.h>
+#include <lamure/prov/morton.h>
 #include <lamure/bounding_box.h>
 
+#include <lamure/prov/3rd_party/pdqsort.h>
+
+#include <algorithm>
+#include <functional>
 #include <limits>
 #include <vector>
 #include <stack>
-#include <map>
+#include <utility>
 
 
 namespace lamure {
 namespace prov {
 
 
+namespace {
+
+//position of a sparse point and its index in the input
+struct build_point {
+  scm::math::vec3f pos_;
+  uint64_t point_id_;
+};
+
+struct build_node {
+  scm::math::vec3f min_;
+  scm::math::vec3f max_;
+  uint32_t depth_;
+  uint32_t child_mask_;
+  uint64_t children_[8]; //index of the child built from range i, within the same array
+  std::vector<uint32_t> fotos_;
+};
+
+//subtrees of fewer points are built by the task of their parent
+const uint64_t min_num_points_per_task = 1 << 16;
+
+float get_coordinate(const scm::math::vec3f& _pos, uint32_t _axis) {
+  return _axis == 0 ? _pos.x : (_axis == 1 ? _pos.y : _pos.z);
+}
+
+void sort_fotos(std::vector<uint32_t>& _fotos) {
+  pdqsort(_fotos.begin(), _fotos.end(), std::less<uint32_t>());
+  _fotos.erase(std::unique(_fotos.begin(), _fotos.end()), _fotos.end());
+  _fotos.shrink_to_fit();
+}
+
+struct tree_builder {
+  const std::vector<auxi::sparse_point>& sparse_points_;
+  std::vector<build_point>& points_;
+  uint32_t max_depth_;
+  uint64_t min_num_points_per_node_;
+
+  //moves the points between begin and end below the split value to the front,
+  //returns the first point not below the split value or begin if there is none
+  uint64_t split(uint64_t _begin, uint64_t _end, uint32_t _axis, float _split_value) {
+    auto mid = std::partition(points_.begin() + _begin, points_.begin() + _end, 
+      [&](const build_point& _p) -> bool {
+        return get_coordinate(_p.pos_, _axis) < _split_value;
+      }
+    );
+    uint64_t mid_id = mid - points_.begin();
+    return mid_id == _end ? _begin : mid_id;
+  }
+
+  void add_fotos(uint64_t _begin, uint64_t _end, std::vector<uint32_t>& _fotos) {
+    for (uint64_t i = _begin; i < _end; ++i) {
+      for (const auto& f : sparse_points_[points_[i].point_id_].features_) {
+        _fotos.push_back(f.camera_id_);
+      }
+    }
+  }
+
+  void build_subtree(uint64_t _begin, uint64_t _end, const scm::math::vec3f& _min, const scm::math::vec3f& _max,
+    uint32_t _depth, std::vector<build_node>& _nodes) {
+
+    uint64_t node_id = _nodes.size();
+    _nodes.push_back(build_node{_min, _max, _depth, 0, {}, {}});
+
+    //some termination criterion
+    if (_depth >= max_depth_ || _end-_begin <= min_num_points_per_node_) {
+      std::vector<uint32_t> fotos;
+      add_fotos(_begin, _end, fotos);
+      sort_fotos(fotos);
+      _nodes[node_id].fotos_ = std::move(fotos);
+      return;
+    }
+
+    auto mid_vertex = 0.5f*(_min+_max);
+
+    //split along x, then both halves along y, then all quarters along z
+    uint64_t mid_id_x = split(_begin, _end, 0, mid_vertex.x);
+    uint64_t mid_id_y0 = split(_begin, mid_id_x, 1, mid_vertex.y);
+    uint64_t mid_id_y1 = split(mid_id_x, _end, 1, mid_vertex.y);
+    uint64_t mid_id_z0 = split(_begin, mid_id_y0, 2, mid_vertex.z);
+    uint64_t mid_id_z1 = split(mid_id_y0, mid_id_x, 2, mid_vertex.z);
+    uint64_t mid_id_z2 = split(mid_id_x, mid_id_y1, 2, mid_vertex.z);
+    uint64_t mid_id_z3 = split(mid_id_y1, _end, 2, mid_vertex.z);
+
+    //range i contains the points of octant i (x: bit 0, y: bit 1, z: bit 2)
+    const uint64_t ranges[8][2] = {
+      {_begin, mid_id_z0}, {mid_id_x, mid_id_z2}, {mid_id_y0, mid_id_z1}, {mid_id_y1, mid_id_z3},
+      {mid_id_z0, mid_id_y0}, {mid_id_z2, mid_id_y1}, {mid_id_z1, mid_id_x}, {mid_id_z3, _end}
+    };
+
+    scm::math::vec3f child_min[8];
+    scm::math::vec3f child_max[8];
+    for (uint32_t j = 0; j < 8; ++j) {
+      child_min[j] = scm::math::vec3f((j & 1) ? mid_vertex.x : _min.x, (j & 2) ? mid_vertex.y : _min.y, (j & 4) ? mid_vertex.z : _min.z);
+      child_max[j] = scm::math::vec3f((j & 1) ? _max.x : mid_vertex.x, (j & 2) ? _max.y : mid_vertex.y, (j & 4) ? _max.z : mid_vertex.z);
+    }
+
+    uint32_t child_mask = 0;
+    std::vector<uint32_t> fotos;
+    std::vector<build_node> child_nodes[8];
+    bool is_task[8] = {false, false, false, false, false, false, false, false};
+
+    for (uint32_t i = 0; i < 8; ++i) {
+      uint64_t range_begin = ranges[i][0];
+      uint64_t range_end = ranges[i][1];
+      if (range_begin == range_end) {
+        continue;
+      }
+
+      //the child is the last octant containing the first point of the range
+      bool found = false;
+      uint32_t child_id = 0;
+      const auto& pos = points_[range_begin].pos_;
+      for (uint32_t j = 0; j < 8; ++j) {
+        if (child_min[j].x <= pos.x && child_max[j].x >= pos.x
+          && child_min[j].y <= pos.y && child_max[j].y >= pos.y
+          && child_min[j].z <= pos.z && child_max[j].z >= pos.z) {
+          found = true;
+          child_id = j;
+        }
+      }
+
+      if (!found) {
+        std::cout << "WARNINg! did not find range " << i << std::endl;
+        add_fotos(range_begin, range_end, fotos);
+        continue;
+      }
+
+      child_mask |= (1 << i);
+
+      if (range_end - range_begin >= min_num_points_per_task) {
+        is_task[i] = true;
+        #pragma omp task default(shared) firstprivate(i, range_begin, range_end, child_id)
+        build_subtree(range_begin, range_end, child_min[child_id], child_max[child_id], _depth+1, child_nodes[i]);
+      }
+      else {
+        _nodes[node_id].children_[i] = _nodes.size();
+        build_subtree(range_begin, range_end, child_min[child_id], child_max[child_id], _depth+1, _nodes);
+      }
+    }
+
+    #pragma omp taskwait
+
+    //append the subtrees built by other tasks and collect the fotos of all children
+    _nodes[node_id].child_mask_ = child_mask;
+
+    for (uint32_t i = 0; i < 8; ++i) {
+      if ((child_mask & (1 << i)) == 0) {
+        continue;
+      }
+
+      if (is_task[i]) {
+        uint64_t offset = _nodes.size();
+        _nodes[node_id].children_[i] = offset;
+
+        for (auto& child_node : child_nodes[i]) {
+          for (uint32_t k = 0; k < 8; ++k) {
+            child_node.children_[k] += offset;
+          }
+          _nodes.push_back(std::move(child_node));
+        }
+      }
+
+      const auto& child_fotos = _nodes[_nodes[node_id].children_[i]].fotos_;
+      fotos.insert(fotos.end(), child_fotos.begin(), child_fotos.end());
+    }
+
+    sort_fotos(fotos);
+    _nodes[node_id].fotos_ = std::move(fotos);
+  }
+};
+
+}
+
+
 octree::
 octree()
 : min_num_points_per_node_(16), 
@@ -36,21 +214,26 @@ octree::
 void octree::
 create(std::vector<auxi::sparse_point>& _points) {
   nodes_.clear(); 
+  query_nodes_.clear();
   depth_ = 0;
   min_num_points_per_node_ = 16;
   uint32_t max_depth = 12;
 
-  std::vector<auxi::sparse_point> points = _points;
-
-  uint64_t num_points = points.size();
+  uint64_t num_points = _points.size();
   if (num_points < min_num_points_per_node_) {
     std::cout << "Too few points " << std::endl; exit(0);
   }
 
+  //only positions and ids are partitioned, the feature lists of the points stay in place
+  std::vector<build_point> points(num_points);
+
   scm::math::vec3f tree_min(std::numeric_limits<float>::max());
   scm::math::vec3f tree_max(std::numeric_limits<float>::lowest());
 
-  for (const auto& point : points) {
+  for (uint64_t i = 0; i < num_points; ++i) {
+    const auto& point = _points[i];
+    points[i] = build_point{point.pos_, i};
+
     tree_min.x = std::min(tree_min.x, point.pos_.x);
     tree_min.y = std::min(tree_min.y, point.pos_.y);
     tree_min.z = std::min(tree_min.z, point.pos_.z);
@@ -67,267 +250,46 @@ create(std::vector<auxi::sparse_point>& _points) {
   
   std::cout << "tree min " << tree_min.x << " " << tree_min.y << " " << tree_min.z << std::endl;
   std::cout << "tree max " << tree_max.x << " " << tree_max.y << " " << tree_max.z << std::endl;
-  
-  struct auxiliary_node {
-    uint32_t idx_;
-    uint32_t depth_;
-    uint64_t begin_;
-    uint64_t end_;
-    scm::math::vec3f min_;
-    scm::math::vec3f max_;
-  };
 
-  uint32_t num_nodes = 0;
-  std::stack<auxiliary_node> nodes_todo;
-  nodes_todo.push(
-    auxiliary_node{
-      num_nodes++, 0, 0, num_points, tree_min, tree_max
-    });
+  //subtrees are built as parallel tasks, each large subtree into its own array
+  std::vector<build_node> build_nodes;
+  tree_builder builder{_points, points, max_depth, min_num_points_per_node_};
 
+  #pragma omp parallel
+  {
+    #pragma omp single
+    builder.build_subtree(0, num_points, tree_min, tree_max, 0, build_nodes);
+  }
+
+  //number the nodes in the order of the former depth-first build:
+  //the children of a node get consecutive ids when the node is visited, the last child is visited next
+  uint64_t num_nodes = 0;
+  nodes_.resize(build_nodes.size());
 
-  std::map<uint64_t, octree_node> node_idx_map;
+  std::stack<std::pair<uint64_t, uint64_t>> nodes_todo;
+  nodes_todo.push(std::make_pair(uint64_t(0), num_nodes++));
 
   while (!nodes_todo.empty()) {
-    auxiliary_node node = nodes_todo.top();
+    uint64_t build_id = nodes_todo.top().first;
+    uint64_t node_id = nodes_todo.top().second;
     nodes_todo.pop();
 
+    build_node& node = build_nodes[build_id];
     depth_ = std::max(depth_, node.depth_);
 
-    //some termination criterion
-    if (node.depth_ >= max_depth || node.end_-node.begin_ <= min_num_points_per_node_) {
-      std::set<uint32_t> fotos;
-      for (uint64_t i = node.begin_; i < node.end_; ++i) {
-        const auto& sp = points[i];
-        for (const auto& f : sp.features_) {
-          fotos.insert(f.camera_id_);
-        }
-        if (node.min_.x <= sp.pos_.x && node.max_.x >= sp.pos_.x
-          && node.min_.y <= sp.pos_.y && node.max_.y >= sp.pos_.y
-          && node.min_.z <= sp.pos_.z && node.max_.z >= sp.pos_.z) {
-
-        }
-        else {
-          std::cout << "e";
-        }
-      }
-      node_idx_map[node.idx_] = octree_node(node.idx_, 0, 0, node.min_, node.max_, fotos);
-      continue;
-    }
-
-    auto min_vertex = node.min_;
-    auto max_vertex = node.max_;
-    auto mid_vertex = 0.5f*(min_vertex+max_vertex);
-
-    //sort all points between begin and end along x-axis, find midpoint
-    std::sort(&points[node.begin_], &points[node.end_], 
-      [](const auxi::sparse_point& _l, const auxi::sparse_point& _r) -> bool {
-        return _l.pos_.x < _r.pos_.x; 
-      }
-    );
-    uint64_t mid_id_x = node.begin_;
-    for (uint64_t i = node.begin_; i < node.end_; ++i) {
-      if (points[i].pos_.x >= mid_vertex.x) { mid_id_x = i; break; }
-    }
-    
-    //sort all points between begin and end along y-axis, find midpoints
-    std::sort(&points[node.begin_], &points[mid_id_x], 
-      [](const auxi::sparse_point& _l, const auxi::sparse_point& _r) -> bool {
-        return _l.pos_.y < _r.pos_.y; 
-      }
-    );
-    uint64_t mid_id_y0 = node.begin_;
-    for (uint64_t i = node.begin_; i < mid_id_x; ++i) {
-      if (points[i].pos_.y >= mid_vertex.y) { mid_id_y0 = i; break; }
-    }
-
-    std::sort(&points[mid_id_x], &points[node.end_], 
-      [](const auxi::sparse_point& _l, const auxi::sparse_point& _r) -> bool {
-        return _l.pos_.y < _r.pos_.y; 
-      }
-    );
-    uint64_t mid_id_y1 = mid_id_x;
-    for (uint64_t i = mid_id_x; i < node.end_; ++i) {
-      if (points[i].pos_.y >= mid_vertex.y) { mid_id_y1 = i; break; }
-    }
-
-    //sort all points between begin and end along z-axis, find midpoints
-    std::sort(&points[node.begin_], &points[mid_id_y0], 
-      [](const auxi::sparse_point& _l, const auxi::sparse_point& _r) -> bool {
-        return _l.pos_.z < _r.pos_.z; 
-      }
-    );
-    uint64_t mid_id_z0 = node.begin_;
-    for (uint64_t i = node.begin_; i < mid_id_y0; ++i) {
-      if (points[i].pos_.z >= mid_vertex.z) { mid_id_z0 = i; break; }
-    }
-
-    std::sort(&points[mid_id_y0], &points[mid_id_x], 
-      [](const auxi::sparse_point& _l, const auxi::sparse_point& _r) -> bool {
-        return _l.pos_.z < _r.pos_.z; 
-      }
-    );
-    uint64_t mid_id_z1 = mid_id_y0;
-    for (uint64_t i = mid_id_y0; i < mid_id_x; ++i) {
-      if (points[i].pos_.z >= mid_vertex.z) { mid_id_z1 = i; break; }
-    }
-    
-    std::sort(&points[mid_id_x], &points[mid_id_y1], 
-      [](const auxi::sparse_point& _l, const auxi::sparse_point& _r) -> bool {
-        return _l.pos_.z < _r.pos_.z; 
-      }
-    );
-    uint64_t mid_id_z2 = mid_id_x;
-    for (uint64_t i = mid_id_x; i < mid_id_y1; ++i) {
-      if (points[i].pos_.z >= mid_vertex.z) { mid_id_z2 = i; break; }
-    }
-    
-    std::sort(&points[mid_id_y1], &points[node.end_], 
-      [](const auxi::sparse_point& _l, const auxi::sparse_point& _r) -> bool {
-        return _l.pos_.z < _r.pos_.z; 
-      }
-    );
-    uint64_t mid_id_z3 = mid_id_y1;
-    for (uint64_t i = mid_id_y1; i < node.end_; ++i) {
-      if (points[i].pos_.z >= mid_vertex.z) { mid_id_z3 = i; break; }
-    }
-
-    struct range {
-      uint64_t begin_;
-      uint64_t end_;
-    };
-    std::vector<range> ranges;
-    ranges.push_back({node.begin_, mid_id_z0});
-    ranges.push_back({mid_id_x, mid_id_z2});
-    ranges.push_back({mid_id_y0, mid_id_z1});
-    ranges.push_back({mid_id_y1, mid_id_z3});
-    ranges.push_back({mid_id_z0, mid_id_y0});
-    ranges.push_back({mid_id_z2, mid_id_y1});
-    ranges.push_back({mid_id_z1, mid_id_x});
-    ranges.push_back({mid_id_z3, node.end_});
-
-    std::vector<auxiliary_node> children;
-    children.push_back(
-      auxiliary_node{
-        0, node.depth_+1,
-        node.begin_, mid_id_z0,
-        min_vertex, 
-        mid_vertex,
-      });
-    children.push_back(
-      auxiliary_node{
-        0, node.depth_+1, 
-        mid_id_x, mid_id_z2,
-        scm::math::vec3f(mid_vertex.x, min_vertex.y, min_vertex.z),
-        scm::math::vec3f(max_vertex.x, mid_vertex.y, mid_vertex.z)
-      });
-    children.push_back(
-      auxiliary_node{
-        0, node.depth_+1, 
-        mid_id_y0, mid_id_z1,
-        scm::math::vec3f(min_vertex.x, mid_vertex.y, min_vertex.z),
-        scm::math::vec3f(mid_vertex.x, max_vertex.y, mid_vertex.z)
-      });
-    children.push_back(
-      auxiliary_node{
-        0, node.depth_+1, 
-        mid_id_y1, mid_id_z3,
-        scm::math::vec3f(mid_vertex.x, mid_vertex.y, min_vertex.z),
-        scm::math::vec3f(max_vertex.x, max_vertex.y, mid_vertex.z)
-      });
-    children.push_back(
-      auxiliary_node{
-        0, node.depth_+1, 
-        mid_id_z0, mid_id_y0,
-        scm::math::vec3f(min_vertex.x, min_vertex.y, mid_vertex.z),
-        scm::math::vec3f(mid_vertex.x, mid_vertex.y, max_vertex.z)
-      });
-    children.push_back(
-      auxiliary_node{
-        0, node.depth_+1, 
-        mid_id_z2, mid_id_y1,
-        scm::math::vec3f(mid_vertex.x, min_vertex.y, mid_vertex.z),
-        scm::math::vec3f(max_vertex.x, mid_vertex.y, max_vertex.z)
-      });
-    children.push_back(
-      auxiliary_node{
-        0, node.depth_+1, 
-        mid_id_z1, mid_id_x,
-        scm::math::vec3f(min_vertex.x, mid_vertex.y, mid_vertex.z),
-        scm::math::vec3f(mid_vertex.x, max_vertex.y, max_vertex.z)
-      });
-    children.push_back(
-      auxiliary_node{
-        0, node.depth_+1, 
-        mid_id_z3, node.end_,
-        mid_vertex,
-        max_vertex,
-      });
-    
-    uint32_t child_mask = 0;
     uint32_t child_idx = 0;
-
-    for (uint32_t i = 0; i < ranges.size(); ++i) {
-      const auto& range = ranges[i];
-      if (range.begin_ - range.end_ > 0) {
-        bool found = false;
-        uint32_t child_id = 0;
-        for (uint32_t j = 0; j < children.size(); ++j) {
-          auto& child = children[j];
-          const auto sp = points[range.begin_];
-          if (child.min_.x <= sp.pos_.x && child.max_.x >= sp.pos_.x
-            && child.min_.y <= sp.pos_.y && child.max_.y >= sp.pos_.y
-            && child.min_.z <= sp.pos_.z && child.max_.z >= sp.pos_.z) {
-            found = true;
-            child_id = j;
-          }
-        }
-        
-        if (found) {
-          auto& child = children[child_id];
-          child.begin_ = range.begin_;
-          child.end_ = range.end_;
-          child.idx_ = num_nodes;
-          //std::cout << "node " << num_nodes << " " << child.end_ - child.begin_ << " points " << std::endl;
-          //std::cout << "node " << num_nodes << " min " << child.min_.x << " " << child.min_.y << " " << child.min_.z << std::endl;
-          //std::cout << "node " << num_nodes << " max " << child.max_.x << " " << child.max_.y << " " << child.max_.z << std::endl;
-          nodes_todo.push(child);
-          child_mask |= (1 << i);
-          child_idx = child_idx == 0 ? num_nodes : child_idx;
-          ++num_nodes;
-        }
-        else {
-            std::cout << "WARNINg! did not find range " << i << std::endl;
-        }
-      }
-    }
-
-    std::set<uint32_t> fotos;
-    for (uint64_t i = node.begin_; i < node.end_; ++i) {
-      const auto& sp = points[i];
-      for (const auto& f : sp.features_) {
-        fotos.insert(f.camera_id_);
-      }
-      if (node.min_.x <= sp.pos_.x && node.max_.x >= sp.pos_.x
-        && node.min_.y <= sp.pos_.y && node.max_.y >= sp.pos_.y
-        && node.min_.z <= sp.pos_.z && node.max_.z >= sp.pos_.z) {
-
-      }
-      else {
-        std::cout << "e";
+    for (uint32_t i = 0; i < 8; ++i) {
+      if ((node.child_mask_ & (1 << i)) > 0) {
+        child_idx = child_idx == 0 ? num_nodes : child_idx;
+        nodes_todo.push(std::make_pair(node.children_[i], num_nodes++));
       }
-
     }
 
-    node_idx_map[node.idx_] = octree_node(node.idx_, child_mask, child_idx, node.min_, node.max_, fotos);
-
+    nodes_[node_id] = octree_node(node_id, node.child_mask_, child_idx, node.min_, node.max_, std::move(node.fotos_));
   }
 
   std::cout << "octree complete " << "depth: " << depth_ << " num nodes: " << num_nodes << std::endl;
 
-  for (uint64_t node_id = 0; node_id < num_nodes; ++node_id) {
-    nodes_.push_back(node_idx_map[node_id]);
-  }
-
 }
 
 uint64_t octree::
@@ -364,6 +326,83 @@ query(const scm::math::vec3f& _point) {
 
 }
 
+void octree::
+query(const std::vector<scm::math::vec3f>& _points, std::vector<uint64_t>& _node_ids) {
+
+  _node_ids.assign(_points.size(), 0);
+
+  if (nodes_.empty()) return;
+
+  update_query_nodes();
+
+  //neighbouring queries share most of their path, so each query continues from the path of the previous one
+  std::vector<uint64_t> order = get_morton_order(_points, query_nodes_[0].min_, query_nodes_[0].max_);
+
+#pragma omp parallel
+  {
+    std::vector<uint64_t> path(1, 0);
+
+#pragma omp for schedule(static, 4096)
+    for (int64_t i = 0; i < (int64_t)order.size(); ++i) {
+      uint64_t point_id = order[i];
+      _node_ids[point_id] = query_flat(_points[point_id], path);
+    }
+  }
+
+}
+
+void octree::
+update_query_nodes() {
+  if (query_nodes_.size() == nodes_.size()) return;
+
+  query_nodes_.resize(nodes_.size());
+  for (uint64_t node_id = 0; node_id < nodes_.size(); ++node_id) {
+    const auto& node = nodes_[node_id];
+    query_nodes_[node_id] = query_node{node.get_min(), node.get_max(), node.get_child_mask() & 0xff, node.get_child_idx()};
+  }
+}
+
+uint64_t octree::
+query_flat(const scm::math::vec3f& _point, std::vector<uint64_t>& _path) const {
+
+  auto contains = [&](const query_node& node) {
+    return node.min_.x <= _point.x && node.max_.x > _point.x
+      && node.min_.y <= _point.y && node.max_.y > _point.y
+      && node.min_.z <= _point.z && node.max_.z > _point.z;
+  };
+
+  //children split their parent into disjoint octants, so the deepest node of the
+  //previous path that still contains the point is also on the path of this point
+  while (_path.size() > 1 && !contains(query_nodes_[_path.back()])) {
+    _path.pop_back();
+  }
+
+  //same descent as query(), children of a node are stored consecutively
+  uint64_t current_node_id = _path.back();
+  while (query_nodes_[current_node_id].child_mask_ > 0) {
+    const auto& current_node = query_nodes_[current_node_id];
+    uint64_t child_id = current_node.child_idx_;
+    bool found = false;
+    for (uint32_t i = 0; i < 8; ++i) {
+      if ((current_node.child_mask_ & (1 << i)) > 0) {
+        if (contains(query_nodes_[child_id])) {
+          found = true;
+          break;
+        }
+        ++child_id;
+      }
+    }
+    if (!found) {
+      break;
+    }
+    current_node_id = child_id;
+    _path.push_back(current_node_id);
+  }
+
+  return current_node_id;
+
+}
+
 uint64_t octree::
 get_num_nodes() const {
   return nodes_.size();
@@ -53,6 +53,8 @@ public:
 
 	grid_octree_node* get_root_node();
 	
+	// Rebuilds the index and position lookups. Must be called after the octree structure changed.
+	// Position lookups don't lock the grid, so they must not run concurrently to this call.
 	void compute_index_access();
 
 protected:
@@ -68,6 +70,10 @@ protected:
 	grid_octree_node* find_cell_by_position_recursive(grid_octree_node* node, const scm::math::vec3d& position) const;
 	const grid_octree_node* find_cell_by_position_recursive_const(const grid_octree_node* node, const scm::math::vec3d& position) const;
 
+	void flatten_node_recursive(grid_octree_node* node, const size_t& flat_index, const size_t& depth);
+	void fill_morton_lookup_recursive(const size_t& flat_index, const size_t& depth, const uint64_t& morton_code);
+	bool find_cell_index_by_position(const scm::math::vec3d& position, size_t& cell_index) const;
+
 	// Grid is managed as an octree, ech node manages its 8 children. Each node is accessed (in)directly via the root node.
 	grid_octree_node* root_node_;
 	std::vector<node_t> ids_;
@@ -76,6 +82,24 @@ protected:
 
 	// Used to improve performance of get_cell_at_index().
 	std::vector<view_cell*> cells_by_indices_;
+
+	// Flat copy of the octree structure used by get_cell_at_position().
+	// The 8 children of a node are stored consecutively, ordered by their child index.
+	// Child indices are chosen so the child index of each level is a 3 bit digit of the Morton code of the position.
+	struct flat_node
+	{
+		uint32_t first_child;	// 0 if the node is a leaf.
+		uint32_t cell_index;	// Only valid for leafs.
+	};
+
+	std::vector<flat_node> flat_nodes_;
+
+	// Cell index of each cell on the deepest level, indexed by Morton code. Empty if the octree is too deep.
+	std::vector<uint32_t> cell_indices_by_morton_code_;
+
+	size_t max_depth_;
+	scm::math::vec3d lookup_min_vertex_;
+	double lookup_cell_size_;
 };
 
 }
@@ -10,6 +10,9 @@
 
 #include <lamure/pvs/pvs.h>
 #include "lamure/pvs/grid_octree.h"
+#include "lamure/pvs/pvs_file.h"
+
+#include <memory>
 
 namespace lamure
 {
@@ -35,7 +38,8 @@ public:
 	virtual bool load_cell_visibility_from_file(const std::string& file_path, const size_t& cell_index);
 
 protected:
-	std::vector<uint64_t> visibility_block_sizes_;
+	// Mapped visibility file, shared with loads in flight when it is replaced.
+	std::shared_ptr<const pvs_file> visibility_file_;
 };
 
 }
@@ -33,6 +33,7 @@ public:
 	static std::string get_cell_identifier();
 
 	virtual bool get_visibility(const model_t& object_id, const node_t& node_id) const;
+	virtual boost::dynamic_bitset<> get_bitset(const model_t& object_id) const;
 
 	virtual std::map<model_t, std::vector<node_t>> get_visible_indices() const;
 
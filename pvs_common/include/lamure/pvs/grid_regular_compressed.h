@@ -10,6 +10,12 @@
 
 #include <lamure/pvs/pvs.h>
 #include "lamure/pvs/grid_regular.h"
+#include "lamure/pvs/pvs_file.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
 
 namespace lamure
 {
@@ -34,10 +40,16 @@ public:
 
 	virtual bool load_cell_visibility_from_file(const std::string& file_path, const size_t& cell_index);
 
+	// Encodes the visibility of a grid with num_cells_per_axis^3 cells as blocks of a version 3 visibility file (see pvs_file).
+	// The uncompressed visibility of a cell is requested once, the cells of one cluster are requested in a row.
+	static void encode_visibility_blocks(const size_t& num_cells_per_axis, const std::function<std::string(const size_t&)>& read_cell_data,
+										 std::vector<std::string>& stored_blocks, std::vector<uint64_t>& reference_blocks);
+
 protected:
 	void create_grid(const size_t& num_cells, const double& cell_size, const scm::math::vec3d& position_center);
 
-	std::vector<uint64_t> visibility_block_sizes_;
+	// Mapped visibility file, shared with loads in flight when it is replaced.
+	std::shared_ptr<const pvs_file> visibility_file_;
 };
 
 }
@@ -8,6 +8,10 @@
 #ifndef LAMURE_PVS_PVS_DATABASE_H
 #define LAMURE_PVS_PVS_DATABASE_H
 
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <thread>
@@ -17,7 +21,6 @@
 
 #include <lamure/pvs/pvs.h>
 #include "lamure/pvs/grid.h"
-#include <lamure/semaphore.h>
 
 namespace lamure
 {
@@ -42,9 +45,21 @@ public:
 	virtual void set_viewer_position(const scm::math::vec3d& position);
 	virtual bool get_viewer_visibility(const model_t& model_id, const node_t node_id) const;
 
+	// Visibility of all nodes of a model from the viewer cell, allowing to test whole node ranges at once.
+	// Returns nullptr if the PVS has no answer, in which case every node must be considered visible.
+	std::shared_ptr<const boost::dynamic_bitset<>> get_viewer_visibility_bitset(const model_t& model_id) const;
+
 	void activate(const bool& act);
 	bool is_activated() const;
 
+	// Upper bound for visibility data kept in memory. Cells far from the viewer are released first.
+	void set_resident_budget(const size_t& num_bytes);
+	size_t get_resident_budget() const;
+	size_t get_resident_bytes() const;
+
+	// Cells the viewer is predicted to reach within this time are prefetched.
+	void set_prefetch_horizon(const double& seconds);
+
 	const grid* get_visibility_grid() const;
 	const grid* get_bounding_grid() const;
 	void clear_visibility_grid();
@@ -55,10 +70,36 @@ protected:
 	static pvs_database* instance_;
 
 private:
+	// Cells with the smallest estimated time until the viewer enters them are loaded first.
+	struct load_request
+	{
+		double time_to_enter;
+		size_t cell_index;
+
+		bool operator<(const load_request& other) const { return time_to_enter > other.time_to_enter; }
+	};
+
 	void loading_thread_loop();
-	void load_visibility_data_async(uint64_t cell_index);
-	std::queue<uint64_t> loading_queue_;
-	semaphore semaphore_;
+	void plan_prefetch(const scm::math::vec3d& position);
+	bool reserve_resident_bytes(const load_request& request);
+	void stop_loading();
+
+	std::priority_queue<load_request> loading_queue_;
+	std::condition_variable loading_condition_;
+	std::vector<std::thread> loading_threads_;
+
+	// Loaded cells and the priority they had when the prefetch was last planned.
+	std::map<size_t, double> resident_cells_;
+	std::set<size_t> cells_in_flight_;
+	size_t cell_bytes_;
+	size_t resident_bytes_;
+	size_t resident_budget_;
+
+	// Viewer motion used to predict the cells entered next.
+	scm::math::vec3d viewer_velocity_;
+	std::chrono::steady_clock::time_point last_position_time_;
+	std::chrono::steady_clock::time_point last_plan_time_;
+	double prefetch_horizon_;
 
 	// Grid storing the major visibility data of the scene.
 	grid* visibility_grid_;
@@ -70,6 +111,10 @@ private:
 	scm::math::vec3d position_viewer_;
 	const view_cell* viewer_cell_;
 
+	// Bitsets handed out by get_viewer_visibility_bitset(), valid as long as the viewer stays in the cell.
+	mutable const view_cell* viewer_bitsets_cell_;
+	mutable std::vector<std::shared_ptr<const boost::dynamic_bitset<>>> viewer_bitsets_;
+
 	// If the PVS is not activated, it will always return true on visibility requests.
 	bool activated_;
 
@@ -80,13 +125,11 @@ private:
 	std::string pvs_file_path_;
 
 	scm::math::vec3d smallest_cell_size_;
-	std::set<size_t> previously_loaded_cell_indices_;
-
-	std::thread visibility_data_loading_thread_;
 
 	// Used to achieve thread safety.
 	mutable std::mutex mutex_;
 	mutable std::mutex loading_mutex_;
+	mutable std::mutex bitset_mutex_;
 };
 
 }
@@ -0,0 +1,109 @@
+// Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
+// This Software is distributed under the Modified BSD License, see license.txt.
+//
+// Virtual Reality and Visualization Research Group 
+// Faculty of Media, Bauhaus-Universitaet Weimar
+// http://www.uni-weimar.de/medien/vr
+
+#ifndef LAMURE_PVS_PVS_FILE_H
+#define LAMURE_PVS_PVS_FILE_H
+
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <lamure/pvs/pvs.h>
+#include "lamure/pvs/view_cell.h"
+#include "lamure/types.h"
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+namespace lamure
+{
+namespace pvs
+{
+
+// Visibility file (.pvs) of the compressed grid types, one block per view cell.
+//
+// Version 2 layout:
+//   char[8]              magic "LMRPVS2" (zero terminated)
+//   uint64_t             number of blocks n
+//   uint64_t[n + 1]      absolute file offsets of the blocks, the last one is the file size
+//   n gzip compressed blocks
+//
+// Version 3 layout:
+//   char[8]              magic "LMRPVS3" (zero terminated)
+//   uint64_t             number of blocks n
+//   uint64_t[n + 1]      absolute file offsets of the blocks, the last one is the file size
+//   uint64_t[n]          reference block of each block
+//   n blocks
+// A block referencing itself is gzip compressed. Any other block is stored as delta to its
+// reference block, the reference block must reference itself. Delta blocks start with one byte
+// telling whether the following runs (see encode_delta()) are stored plain (0) or gzip compressed (1).
+//
+// Version 1 files only store the n block sizes in front of the blocks. They are
+// still read, the offsets are then prefix summed once when the file is opened.
+// The file is memory mapped, so once opened blocks can be read from any thread.
+class PVS_COMMON_DLL pvs_file
+{
+public:
+	pvs_file();
+	~pvs_file();
+
+	bool open(const std::string& file_path, const size_t& num_blocks);
+	void close();
+
+	bool is_open() const;
+	const std::string& get_file_path() const;
+	unsigned int get_version() const;
+	size_t get_block_count() const;
+
+	// Returns the decompressed data of a single block.
+	std::string read_block(const size_t& block_index) const;
+
+	// Writes version 2 files.
+	static void write(const std::string& file_path, const std::vector<std::string>& compressed_blocks);
+	// Writes version 3 files, blocks must be encoded according to their reference block.
+	static void write(const std::string& file_path, const std::vector<std::string>& stored_blocks, const std::vector<uint64_t>& reference_blocks);
+	// Writes the header of a version 2 file, the blocks must follow in the same order.
+	static void write_header(std::ostream& file_out, const std::vector<uint64_t>& block_sizes);
+	static unsigned int read_version(const std::string& file_path);
+
+	static std::string compress_block(const std::string& data);
+	static std::string decompress_block(const char* data, const size_t& size);
+
+	// Difference of two equally long bit strings. The xor of both is stored as alternating run lengths
+	// of equal and differing bits, starting with equal bits, as LEB128 varints. A trailing equal run is omitted.
+	static std::string encode_delta(const std::string& reference_data, const std::string& data);
+	static std::string apply_delta(const std::string& reference_data, const char* delta, const size_t& size);
+
+	// Stores the data as delta to the reference data if this is smaller than compressing it.
+	// Returns false if the data was compressed instead, it must then be stored as reference block.
+	static bool encode_block_with_reference(const std::string& data, const std::string& reference_data, std::string& stored_block);
+
+	// Bit lines of all models of a view cell, as stored in the blocks.
+	static std::string encode_cell_visibility(const view_cell* cell, const std::vector<node_t>& ids);
+	static void decode_cell_visibility(const std::string& data, view_cell* cell, const std::vector<node_t>& ids);
+
+private:
+	bool read_offsets(const size_t& num_blocks);
+	std::shared_ptr<const std::string> read_reference_block(const size_t& block_index) const;
+
+	boost::iostreams::mapped_file_source mapping_;
+	std::vector<uint64_t> block_offsets_;
+	std::vector<uint64_t> reference_blocks_;
+	unsigned int version_;
+	std::string file_path_;
+
+	// Recently decoded reference blocks. Neighbouring cells share references, so they are usually read in a row.
+	mutable std::mutex reference_cache_mutex_;
+	mutable std::vector<std::pair<uint64_t, std::shared_ptr<const std::string>>> reference_cache_;
+	mutable size_t next_reference_cache_slot_;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,95 @@
+// Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
+// This Software is distributed under the Modified BSD License, see license.txt.
+//
+// Virtual Reality and Visualization Research Group
+// Faculty of Media, Bauhaus-Universitaet Weimar
+// http://www.uni-weimar.de/medien/vr
+
+#ifndef LAMURE_PVS_PVS_STREAM_WRITER_H
+#define LAMURE_PVS_PVS_STREAM_WRITER_H
+
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <lamure/pvs/pvs.h>
+#include "lamure/pvs/grid.h"
+#include "lamure/types.h"
+
+namespace lamure
+{
+namespace pvs
+{
+
+// Writes the visibility file of a compressed grid while the visibility test is still running.
+// Finished view cells are compressed and appended to a checkpoint file next to the visibility file,
+// afterwards their visibility is released from the grid. Once all cells are written, the checkpoint
+// is turned into a regular visibility file (see pvs_file). Regular compressed grids get version 3
+// like grid_regular_compressed::save_visibility_to_file(), the stored blocks of all cells are then
+// kept in memory until the file is written. All other grids get version 2, copied block by block.
+//
+// Checkpoint layout:
+//   char[8]              magic "LMRPVSC" (zero terminated)
+//   uint64_t             number of cells
+//   double[6]            size and center of the grid
+//   uint64_t             number of models m
+//   uint64_t[m]          number of nodes of each model
+//   records of uint64_t cell index, uint64_t block size and the gzip compressed block
+// A checkpoint of a previous run on the same grid is continued, a record cut off by a crash is dropped.
+class PVS_COMMON_DLL pvs_stream_writer
+{
+public:
+	// Finished cells are kept in the grid until their visibility exceeds the memory budget.
+	pvs_stream_writer(grid* visibility_grid, const size_t& memory_budget_in_bytes);
+	~pvs_stream_writer();
+
+	bool open(const std::string& file_path);
+	void close();
+
+	bool is_cell_written(const size_t& cell_index) const;
+	size_t get_written_cell_count() const;
+
+	// Called once the visibility of the cell is final. May write all pending cells.
+	void add_finished_cell(const size_t& cell_index);
+	// Writes and releases all pending cells.
+	void flush();
+
+	// Writes the visibility file and removes the checkpoint. Fails if cells are still missing.
+	bool finish();
+
+	static std::string get_checkpoint_file_path(const std::string& file_path);
+
+private:
+	std::string create_checkpoint_header() const;
+	bool read_checkpoint(const std::string& checkpoint_header, uint64_t& valid_size);
+	bool rewrite_checkpoint(const uint64_t& valid_size);
+	std::string read_checkpoint_block(const size_t& cell_index);
+	bool write_blocks();
+	void write_delta_coded_blocks(const size_t& num_cells_per_axis);
+	void write_pending_cells();
+
+	grid* visibility_grid_;
+	size_t memory_budget_in_bytes_;
+	size_t bytes_per_cell_;
+	std::vector<node_t> ids_;
+
+	std::string file_path_;
+	std::fstream checkpoint_file_;
+	uint64_t checkpoint_size_;
+
+	// Position of the compressed block of each cell within the checkpoint.
+	std::vector<bool> cells_written_;
+	std::vector<uint64_t> block_offsets_;
+	std::vector<uint64_t> block_sizes_;
+	size_t num_written_cells_;
+
+	std::vector<size_t> pending_cells_;
+
+	mutable std::mutex mutex_;
+};
+
+}
+}
+
+#endif
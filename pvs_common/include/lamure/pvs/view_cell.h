@@ -17,6 +17,8 @@
 #include <lamure/pvs/pvs.h>
 #include <lamure/types.h>
 
+#include <boost/dynamic_bitset.hpp>
+
 namespace lamure
 {
 namespace pvs
@@ -35,6 +37,9 @@ public:
 	virtual void set_visibility(const model_t& object_id, const node_t& node_id, const bool& visible) = 0;
 	virtual bool get_visibility(const model_t& object_id, const node_t& node_id) const = 0;
 
+	// Visibility of all nodes of a model, bit i being the visibility of node i. Nodes beyond the size are invisible.
+	virtual boost::dynamic_bitset<> get_bitset(const model_t& object_id) const = 0;
+
 	virtual bool contains_visibility_data() const = 0;
 	virtual std::map<model_t, std::vector<node_t>> get_visible_indices() const = 0;
 	virtual void clear_visibility_data() = 0;
@@ -7,13 +7,10 @@
 
 #include "lamure/pvs/grid_irregular_compressed.h"
 
-#include <fstream>
-#include <sstream>
-#include <climits>
-
-#include <boost/iostreams/filtering_streambuf.hpp>
-#include <boost/iostreams/copy.hpp>
-#include <boost/iostreams/filter/gzip.hpp>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
 
 namespace lamure
 {
@@ -59,79 +56,18 @@ save_visibility_to_file(const std::string& file_path) const
 {
 	std::lock_guard<std::mutex> lock(mutex_);
 
-	std::fstream file_out;
-	file_out.open(file_path, std::ios::out | std::ios::binary);
-
-	if(!file_out.is_open())
-	{
-		throw std::invalid_argument("invalid file path: " + file_path);
-	}
-
+	size_t num_cells = cells_by_indices_.size();
 	std::vector<std::string> compressed_data_blocks;
+	compressed_data_blocks.reserve(num_cells);
 
-	// Iterate over view cells.
-	for(size_t cell_index = 0; cell_index < cells_by_indices_.size(); ++cell_index)
-	{
-		std::string current_cell_data = "";
-
-		// Iterate over models in the scene.
-		for(lamure::model_t model_id = 0; model_id < ids_.size(); ++model_id)
-		{
-			node_t num_nodes = ids_.at(model_id);
-			char current_byte = 0x00;
-
-			size_t line_length = num_nodes / CHAR_BIT + (num_nodes % CHAR_BIT == 0 ? 0 : 1);
-			size_t character_counter = 0;
-			std::string current_line_data(line_length, 0x00);
-
-			// Iterate over nodes in the model.
-			for(lamure::node_t node_id = 0; node_id < num_nodes; ++node_id)
-			{
-				if(cells_by_indices_[cell_index]->get_visibility(model_id, node_id))
-				{
-					current_byte |= 1 << (node_id % CHAR_BIT);
-				}
-
-				// Flush character if either 8 bits are written or if the node id is the last one.
-				if((node_id + 1) % CHAR_BIT == 0 || node_id == (num_nodes - 1))
-				{
-					current_line_data[character_counter] = current_byte;
-					character_counter++;
-
-					current_byte = 0x00;
-				}
-			}
-
-			current_cell_data = current_cell_data + current_line_data;
-		}
-
-		// Compression of binary data using boost gzip.
-		std::stringstream stream_uncompressed, stream_compressed;
-		stream_uncompressed << current_cell_data;
-
-		boost::iostreams::filtering_streambuf<boost::iostreams::input> in;
-		in.push(boost::iostreams::gzip_compressor());
-		in.push(stream_uncompressed);
-		boost::iostreams::copy(in, stream_compressed);
-
-		std::string output_string = stream_compressed.str();
-		compressed_data_blocks.push_back(output_string);
-	}
-
-	// Save sizes of compressed data blocks.
-	for(size_t current_block_index = 0; current_block_index < compressed_data_blocks.size(); ++current_block_index)
+	// Every view cell is compressed independently, so single cells can be loaded later on.
+	for(size_t cell_index = 0; cell_index < num_cells; ++cell_index)
 	{
-		uint64_t current_block_size = compressed_data_blocks[current_block_index].size();
-		file_out.write(reinterpret_cast<char*>(&current_block_size), sizeof(current_block_size));
+		std::string current_cell_data = pvs_file::encode_cell_visibility(cells_by_indices_[cell_index], ids_);
+		compressed_data_blocks.push_back(pvs_file::compress_block(current_cell_data));
 	}
 
-	// Save compressed data blocks.
-	for(size_t current_block_index = 0; current_block_index < compressed_data_blocks.size(); ++current_block_index)
-	{
-		file_out.write(compressed_data_blocks[current_block_index].c_str(), compressed_data_blocks[current_block_index].length());
-	}
-
-	file_out.close();
+	pvs_file::write(file_path, compressed_data_blocks);
 }
 
 bool grid_irregular_compressed::
@@ -145,162 +81,83 @@ load_visibility_from_file(const std::string& file_path)
 {
 	std::lock_guard<std::mutex> lock(mutex_);
 
-	std::fstream file_in;
-	file_in.open(file_path, std::ios::in | std::ios::binary);
+	size_t num_cells = cells_by_indices_.size();
 
-	if(!file_in.is_open())
+	pvs_file visibility_file;
+	if(!visibility_file.open(file_path, num_cells))
 	{
 		return false;
 	}
 
-	// Read access points to data blocks.
-	visibility_block_sizes_.clear();
-
-	for(size_t current_block_index = 0; current_block_index < this->get_cell_count(); ++current_block_index)
-	{
-		uint64_t block_size;
-		file_in.read(reinterpret_cast<char*>(&block_size), sizeof(block_size));
-		visibility_block_sizes_.push_back(block_size);
-	}
-
-	// Read compressed data blocks.
-	std::vector<std::string> compressed_data_blocks;
-
-	for(size_t current_block_index = 0; current_block_index < this->get_cell_count(); ++current_block_index)
-	{
-		size_t block_size = visibility_block_sizes_[current_block_index];
-
-    std::vector<char> current_block_data(block_size);
-		file_in.read(&current_block_data[0], block_size);
-
-		std::string current_block(&current_block_data[0], block_size);
-		compressed_data_blocks.push_back(current_block);
-	}
-
-	for(size_t cell_index = 0; cell_index < cells_by_indices_.size(); ++cell_index)
+	try
 	{
-		view_cell* current_cell = cells_by_indices_[cell_index];
-
-		// Decompress.
-		std::stringstream stream_uncompressed, stream_compressed;
-		stream_compressed << compressed_data_blocks[cell_index];
-
-		boost::iostreams::filtering_streambuf<boost::iostreams::input> inbuf;
-		inbuf.push(boost::iostreams::gzip_decompressor());
-		inbuf.push(stream_compressed);
-		boost::iostreams::copy(inbuf, stream_uncompressed);
-
-		// Apply visibility data.
-		for(model_t model_index = 0; model_index < ids_.size(); ++model_index)
+		for(size_t cell_index = 0; cell_index < num_cells; ++cell_index)
 		{
-			node_t num_nodes = ids_.at(model_index);
-			size_t line_length = num_nodes / CHAR_BIT + (num_nodes % CHAR_BIT == 0 ? 0 : 1);
-			std::vector<char> current_line_data(line_length);
-
-			stream_uncompressed.read(&current_line_data[0], line_length);
-
-			// Used to avoid continuing resize within visibility data.
-			current_cell->set_visibility(model_index, num_nodes - 1, false);
-
-			for(node_t character_index = 0; character_index < line_length; ++character_index)
-			{
-				char current_byte = current_line_data[character_index];
-				
-				for(unsigned short bit_index = 0; bit_index < CHAR_BIT; ++bit_index)
-				{
-					bool visible = ((current_byte >> bit_index) & 1) == 0x01;
-					current_cell->set_visibility(model_index, (character_index * CHAR_BIT) + bit_index, visible);
-				}
-			}
+			pvs_file::decode_cell_visibility(visibility_file.read_block(cell_index), cells_by_indices_[cell_index], ids_);
 		}
 	}
+	catch(const std::exception& e)
+	{
+		std::cerr << "Failed to read visibility file " << file_path << ": " << e.what() << std::endl;
+		return false;
+	}
 
-	file_in.close();
 	return true;
 }
 
 bool grid_irregular_compressed::
 load_cell_visibility_from_file(const std::string& file_path, const size_t& cell_index)
 {
-	//std::lock_guard<std::mutex> lock(mutex_);
-
-	view_cell* current_cell = cells_by_indices_[cell_index];
+	std::shared_ptr<const pvs_file> visibility_file;
 
-	// First check if visibility data is already loaded.
-	if(current_cell->contains_visibility_data())
 	{
-		return true;
-	}
-
-	// If no visibility data exists, open the file and load them.
-	std::fstream file_in;
-	file_in.open(file_path, std::ios::in | std::ios::binary);
+		std::lock_guard<std::mutex> lock(mutex_);
 
-	if(!file_in.is_open())
-	{
-		return false;
-	}
-
-	if(visibility_block_sizes_.size() == 0)
-	{
-		// Read access points to data blocks.
-		for(size_t current_block_index = 0; current_block_index < this->get_cell_count(); ++current_block_index)
+		// First check if visibility data is already loaded.
+		if(cells_by_indices_[cell_index]->contains_visibility_data())
 		{
-			uint64_t block_size;
-			file_in.read(reinterpret_cast<char*>(&block_size), sizeof(block_size));
-			visibility_block_sizes_.push_back(block_size);
+			return true;
 		}
-	}
 
-	// Read compressed data block.
-	size_t block_size = visibility_block_sizes_[cell_index];
-  std::vector<char> current_block_data(block_size);
+		// The file is mapped on the first request, afterwards a cell is a single offset lookup.
+		if(visibility_file_ == nullptr || visibility_file_->get_file_path() != file_path)
+		{
+			std::shared_ptr<pvs_file> new_visibility_file = std::make_shared<pvs_file>();
 
-	// Find proper position in file. First data is compresses block sizes (one 64 bit integer per view cell).
-	size_t file_position = visibility_block_sizes_.size() * sizeof(uint64_t);
-	for(size_t visibility_cell_index = 0; visibility_cell_index < cell_index; ++visibility_cell_index)
-	{
-		file_position += visibility_block_sizes_[visibility_cell_index];
-	}
+			if(!new_visibility_file->open(file_path, cells_by_indices_.size()))
+			{
+				return false;
+			}
 
-	file_in.seekg(file_position);
-	file_in.read(&current_block_data[0], block_size);
-	std::string compressed_data_block(&current_block_data[0], block_size);
+			visibility_file_ = new_visibility_file;
+		}
 
-	// Decompress.
-	std::stringstream stream_uncompressed, stream_compressed;
-	stream_compressed << compressed_data_block;
+		visibility_file = visibility_file_;
+	}
 
-	boost::iostreams::filtering_streambuf<boost::iostreams::input> inbuf;
-	inbuf.push(boost::iostreams::gzip_decompressor());
-	inbuf.push(stream_compressed);
-	boost::iostreams::copy(inbuf, stream_uncompressed);
+	// Decompression runs without holding the grid lock.
+	std::string current_cell_data;
 
-	// Apply visibility data.
-	for(model_t model_index = 0; model_index < ids_.size(); ++model_index)
+	try
+	{
+		current_cell_data = visibility_file->read_block(cell_index);
+	}
+	catch(const std::exception& e)
 	{
-		node_t num_nodes = ids_.at(model_index);
-		size_t line_length = num_nodes / CHAR_BIT + (num_nodes % CHAR_BIT == 0 ? 0 : 1);
-    std::vector<char> current_line_data(line_length);
+		std::cerr << "Failed to read view cell " << cell_index << " from visibility file " << file_path << ": " << e.what() << std::endl;
+		return false;
+	}
 
-		stream_uncompressed.read(&current_line_data[0], line_length);
+	std::lock_guard<std::mutex> lock(mutex_);
 
-		// Used to avoid continuing resize within visibility data.
-		current_cell->set_visibility(model_index, num_nodes - 1, false);
+	view_cell* current_cell = cells_by_indices_[cell_index];
 
-		for(node_t character_index = 0; character_index < line_length; ++character_index)
-		{
-			char current_byte = current_line_data[character_index];
-			
-			for(unsigned short bit_index = 0; bit_index < CHAR_BIT; ++bit_index)
-			{
-				bool visible = ((current_byte >> bit_index) & 1) == 0x01;
-				current_cell->set_visibility(model_index, (character_index * CHAR_BIT) + bit_index, visible);
-			}
-		}
+	// Another thread may have loaded the cell in the meantime.
+	if(!current_cell->contains_visibility_data())
+	{
+		pvs_file::decode_cell_visibility(current_cell_data, current_cell, ids_);
 	}
 
-	file_in.close();
 	return true;
 }
 
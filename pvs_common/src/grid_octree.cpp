@@ -6,6 +6,7 @@
 // http://www.uni-weimar.de/medien/vr
 
 #include <fstream>
+#include <algorithm>
 #include <climits>
 #include <deque>
 #include <iostream>
@@ -19,6 +20,26 @@ namespace lamure
 namespace pvs
 {
 
+namespace
+{
+
+// Deepest level covered by the Morton code lookup table (8^7 entries, 8 MiB).
+const size_t max_morton_lookup_depth = 7;
+
+// Spreads the lower 21 bits of the value so there are two zero bits between each of them.
+uint64_t spread_bits(uint64_t value)
+{
+	value &= 0x1fffff;
+	value = (value | value << 32) & 0x1f00000000ffff;
+	value = (value | value << 16) & 0x1f0000ff0000ff;
+	value = (value | value << 8) & 0x100f00f00f00f00f;
+	value = (value | value << 4) & 0x10c30c30c30c30c3;
+	value = (value | value << 2) & 0x1249249249249249;
+	return value;
+}
+
+}
+
 grid_octree::
 grid_octree() : grid_octree(1, 1.0, scm::math::vec3d(0.0, 0.0, 0.0), std::vector<node_t>())
 {
@@ -81,15 +102,64 @@ create_grid(grid_octree_node* node, size_t depth)
 void grid_octree::
 compute_index_access()
 {
-	size_t num_cells = cell_count_recursive(root_node_);
-	
 	cells_by_indices_.clear();
-	cells_by_indices_.resize(num_cells);
+	flat_nodes_.clear();
+	cell_indices_by_morton_code_.clear();
+	max_depth_ = 0;
 
-	for(size_t cell_index = 0; cell_index < num_cells; ++cell_index)
+	flat_nodes_.push_back(flat_node{0, 0});
+	flatten_node_recursive(root_node_, 0, 0);
+
+	if(max_depth_ <= max_morton_lookup_depth)
 	{
-		view_cell* cell_at_index = find_cell_by_index_recursive(root_node_, cell_index, 0);
-		cells_by_indices_[cell_index] = cell_at_index;
+		cell_indices_by_morton_code_.resize(size_t(1) << (3 * max_depth_));
+		fill_morton_lookup_recursive(0, 0, 0);
+	}
+
+	lookup_min_vertex_ = root_node_->get_position_center() - root_node_->get_size() * 0.5;
+	lookup_cell_size_ = root_node_->get_size().x / double(size_t(1) << max_depth_);
+}
+
+void grid_octree::
+flatten_node_recursive(grid_octree_node* node, const size_t& flat_index, const size_t& depth)
+{
+	max_depth_ = std::max(max_depth_, depth);
+
+	if(!node->has_children())
+	{
+		// Leafs are visited depth first in child order, which defines the cell indices.
+		flat_nodes_[flat_index].cell_index = cells_by_indices_.size();
+		cells_by_indices_.push_back(node);
+		return;
+	}
+
+	size_t first_child = flat_nodes_.size();
+	flat_nodes_[flat_index].first_child = first_child;
+	flat_nodes_.resize(first_child + 8, flat_node{0, 0});
+
+	for(size_t child_index = 0; child_index < 8; ++child_index)
+	{
+		flatten_node_recursive(node->get_child_at_index(child_index), first_child + child_index, depth + 1);
+	}
+}
+
+void grid_octree::
+fill_morton_lookup_recursive(const size_t& flat_index, const size_t& depth, const uint64_t& morton_code)
+{
+	const flat_node& node = flat_nodes_[flat_index];
+
+	if(node.first_child == 0)
+	{
+		// A leaf above the deepest level covers a continuous range of Morton codes.
+		size_t shift = 3 * (max_depth_ - depth);
+		auto range_begin = cell_indices_by_morton_code_.begin() + (morton_code << shift);
+		std::fill(range_begin, range_begin + (size_t(1) << shift), node.cell_index);
+		return;
+	}
+
+	for(size_t child_index = 0; child_index < 8; ++child_index)
+	{
+		fill_morton_lookup_recursive(node.first_child + child_index, depth + 1, (morton_code << 3) | child_index);
 	}
 }
 
@@ -189,33 +259,69 @@ find_cell_by_index_recursive_const(const grid_octree_node* node, const size_t& i
 const view_cell* grid_octree::
 get_cell_at_position(const scm::math::vec3d& position, size_t* cell_index) const
 {
-	std::lock_guard<std::mutex> lock(mutex_);
+	// No lock required, the lookup data is only written when the octree structure changes.
+	size_t found_cell_index;
 
-	vec3r min_vertex(root_node_->get_position_center() - root_node_->get_size() * 0.5);
-    vec3r max_vertex(root_node_->get_position_center() + root_node_->get_size() * 0.5);
-    bounding_box root_node_bb(min_vertex, max_vertex);
+	if(!find_cell_index_by_position(position, found_cell_index))
+	{
+		return nullptr;
+	}
 
-    const view_cell* result_view_cell = nullptr;
+	// Return the index of the view cell if required by caller.
+	if(cell_index != nullptr)
+	{
+		(*cell_index) = found_cell_index;
+	}
 
-    if(root_node_bb.contains(position))
-    {
-    	result_view_cell = this->find_cell_by_position_recursive_const(root_node_, position);
-
-    	// Look for the index of the view cell if required by caller.
-    	if(cell_index != nullptr)
-	    {
-	    	for(size_t tracked_cell_index = 0; tracked_cell_index < cells_by_indices_.size(); ++tracked_cell_index)
-	    	{
-	    		if(result_view_cell == cells_by_indices_[tracked_cell_index])
-	    		{
-	    			(*cell_index) = tracked_cell_index;
-	    			break;
-	    		}
-	    	}
-	    }
-    }
+	return cells_by_indices_[found_cell_index];
+}
+
+bool grid_octree::
+find_cell_index_by_position(const scm::math::vec3d& position, size_t& cell_index) const
+{
+	if(flat_nodes_.empty())
+	{
+		return false;
+	}
+
+	// Quantize the position to the deepest level of the octree.
+	double resolution = double(size_t(1) << max_depth_);
+	scm::math::vec3d relative_position = (position - lookup_min_vertex_) / lookup_cell_size_;
+
+	if(!(relative_position.x >= 0.0 && relative_position.x <= resolution &&
+		relative_position.y >= 0.0 && relative_position.y <= resolution &&
+		relative_position.z >= 0.0 && relative_position.z <= resolution))
+	{
+		return false;
+	}
+
+	uint64_t max_coordinate = (uint64_t(1) << max_depth_) - 1;
+	uint64_t x = std::min(uint64_t(relative_position.x), max_coordinate);
+	uint64_t y = std::min(uint64_t(relative_position.y), max_coordinate);
+	uint64_t z = std::min(uint64_t(relative_position.z), max_coordinate);
+
+	// Children with odd index lie in positive x direction, children with index 2, 3, 6 and 7 in negative z direction
+	// and children with index 4 to 7 in negative y direction (see grid_octree_node::split()).
+	uint64_t morton_code = spread_bits(x) | (spread_bits(max_coordinate - z) << 1) | (spread_bits(max_coordinate - y) << 2);
+
+	if(!cell_indices_by_morton_code_.empty())
+	{
+		cell_index = cell_indices_by_morton_code_[morton_code];
+		return true;
+	}
+
+	// Octree too deep for the lookup table, so walk down the flat nodes instead.
+	size_t flat_index = 0;
+	size_t shift = 3 * max_depth_;
+
+	while(flat_nodes_[flat_index].first_child != 0)
+	{
+		shift -= 3;
+		flat_index = flat_nodes_[flat_index].first_child + ((morton_code >> shift) & 7);
+	}
 
-	return result_view_cell;
+	cell_index = flat_nodes_[flat_index].cell_index;
+	return true;
 }
 
 grid_octree_node* grid_octree::
@@ -267,21 +373,12 @@ set_cell_visibility(const scm::math::vec3d& position, const model_t& model_id, c
 {
 	std::lock_guard<std::mutex> lock(mutex_);
 
-	vec3r min_vertex(root_node_->get_position_center() - root_node_->get_size() * 0.5);
-    vec3r max_vertex(root_node_->get_position_center() + root_node_->get_size() * 0.5);
-    bounding_box root_node_bb(min_vertex, max_vertex);
-
-    view_cell* result_view_cell = nullptr;
-
-    if(root_node_bb.contains(position))
-    {
-    	result_view_cell = find_cell_by_position_recursive(root_node_, position);
-    }
+	size_t cell_index;
 
-    if(result_view_cell != nullptr)
-    {
-    	result_view_cell->set_visibility(model_id, node_id, visibility);
-    }
+	if(find_cell_index_by_position(position, cell_index))
+	{
+		cells_by_indices_[cell_index]->set_visibility(model_id, node_id, visibility);
+	}
 }
 
 
@@ -613,13 +710,13 @@ load_cell_visibility_from_file(const std::string& file_path, const size_t& cell_
 void grid_octree::
 clear_cell_visibility(const size_t& cell_index)
 {
-	if(this->get_num_models() <= cell_index)
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if(cells_by_indices_.size() <= cell_index)
 	{
 		return;
 	}
 
-	std::lock_guard<std::mutex> lock(mutex_);
-
 	cells_by_indices_[cell_index]->clear_visibility_data();
 }
 
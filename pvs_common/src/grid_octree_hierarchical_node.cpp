@@ -57,6 +57,31 @@ get_visibility(const model_t& object_id, const node_t& node_id) const
 	return visible;
 }
 
+boost::dynamic_bitset<> grid_octree_hierarchical_node::
+get_bitset(const model_t& object_id) const
+{
+	boost::dynamic_bitset<> visibility = grid_octree_node::get_bitset(object_id);
+
+	// Add the visibility stored in the parent nodes.
+	if(hierarchical_storage_ && parent_ != nullptr)
+	{
+		boost::dynamic_bitset<> parent_visibility = parent_->get_bitset(object_id);
+
+		if(parent_visibility.size() > visibility.size())
+		{
+			visibility.resize(parent_visibility.size());
+		}
+		else
+		{
+			parent_visibility.resize(visibility.size());
+		}
+
+		visibility |= parent_visibility;
+	}
+
+	return visibility;
+}
+
 std::map<model_t, std::vector<node_t>> grid_octree_hierarchical_node::
 get_visible_indices() const
 {
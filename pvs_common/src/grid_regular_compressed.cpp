@@ -7,21 +7,27 @@
 
 #include "lamure/pvs/grid_regular_compressed.h"
 
-#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <memory>
 #include <stdexcept>
 #include <string>
-#include <climits>
-#include <sstream>
-
-#include <boost/iostreams/filtering_streambuf.hpp>
-#include <boost/iostreams/copy.hpp>
-#include <boost/iostreams/filter/gzip.hpp>
 
 namespace lamure
 {
 namespace pvs
 {
 
+namespace
+{
+
+// Edge length in view cells of the clusters sharing a reference cell in the visibility file.
+// With three cells every cell of a cluster is a direct neighbour of the center cell.
+const size_t delta_cluster_size = 3;
+
+}
+
 grid_regular_compressed::
 grid_regular_compressed() : grid_regular_compressed(1, 1.0, scm::math::vec3d(0.0, 0.0, 0.0), std::vector<node_t>())
 {
@@ -60,79 +66,69 @@ save_visibility_to_file(const std::string& file_path) const
 {
 	std::lock_guard<std::mutex> lock(mutex_);
 
-	std::fstream file_out;
-	file_out.open(file_path, std::ios::out | std::ios::binary);
+	size_t num_cells_per_axis = (size_t)std::round(size_.x / cell_size_);
 
-	if(!file_out.is_open())
-	{
-		throw std::invalid_argument("invalid file path: " + file_path);
-	}
+	std::vector<std::string> stored_blocks;
+	std::vector<uint64_t> reference_blocks;
 
-	std::vector<std::string> compressed_data_blocks;
-
-	// Iterate over view cells.
-	for(size_t cell_index = 0; cell_index < cells_.size(); ++cell_index)
+	encode_visibility_blocks(num_cells_per_axis, [this](const size_t& cell_index)
 	{
-		std::string current_cell_data = "";
+		return pvs_file::encode_cell_visibility(cells_[cell_index], ids_);
+	}, stored_blocks, reference_blocks);
 
-		// Iterate over models in the scene.
-		for(lamure::model_t model_id = 0; model_id < ids_.size(); ++model_id)
-		{
-			node_t num_nodes = ids_.at(model_id);
-			char current_byte = 0x00;
+	pvs_file::write(file_path, stored_blocks, reference_blocks);
+}
 
-			size_t line_length = num_nodes / CHAR_BIT + (num_nodes % CHAR_BIT == 0 ? 0 : 1);
-			size_t character_counter = 0;
-			std::string current_line_data(line_length, 0x00);
+void grid_regular_compressed::
+encode_visibility_blocks(const size_t& num_cells_per_axis, const std::function<std::string(const size_t&)>& read_cell_data,
+						 std::vector<std::string>& stored_blocks, std::vector<uint64_t>& reference_blocks)
+{
+	size_t num_cells = num_cells_per_axis * num_cells_per_axis * num_cells_per_axis;
 
-			// Iterate over nodes in the model.
-			for(lamure::node_t node_id = 0; node_id < num_nodes; ++node_id)
+	stored_blocks.assign(num_cells, std::string());
+	reference_blocks.assign(num_cells, 0);
+
+	// Neighbouring view cells see almost the same nodes. The cells are grouped into cubic clusters,
+	// the center cell of a cluster is compressed on its own and the other cells are stored as its delta.
+	// Single cells can still be loaded later on, at the cost of decoding the reference cell as well.
+	for(size_t cluster_z = 0; cluster_z < num_cells_per_axis; cluster_z += delta_cluster_size)
+	{
+		for(size_t cluster_y = 0; cluster_y < num_cells_per_axis; cluster_y += delta_cluster_size)
+		{
+			for(size_t cluster_x = 0; cluster_x < num_cells_per_axis; cluster_x += delta_cluster_size)
 			{
-				if(cells_[cell_index]->get_visibility(model_id, node_id))
-				{
-					current_byte |= 1 << (node_id % CHAR_BIT);
-				}
+				size_t end_x = std::min(cluster_x + delta_cluster_size, num_cells_per_axis);
+				size_t end_y = std::min(cluster_y + delta_cluster_size, num_cells_per_axis);
+				size_t end_z = std::min(cluster_z + delta_cluster_size, num_cells_per_axis);
 
-				// Flush character if either 8 bits are written or if the node id is the last one.
-				if((node_id + 1) % CHAR_BIT == 0 || node_id == (num_nodes - 1))
-				{
-					current_line_data[character_counter] = current_byte;
-					character_counter++;
+				size_t reference_index = (cluster_x + end_x) / 2 + ((cluster_y + end_y) / 2) * num_cells_per_axis + ((cluster_z + end_z) / 2) * num_cells_per_axis * num_cells_per_axis;
+				std::string reference_data = read_cell_data(reference_index);
 
-					current_byte = 0x00;
+				for(size_t index_z = cluster_z; index_z < end_z; ++index_z)
+				{
+					for(size_t index_y = cluster_y; index_y < end_y; ++index_y)
+					{
+						for(size_t index_x = cluster_x; index_x < end_x; ++index_x)
+						{
+							size_t cell_index = index_x + index_y * num_cells_per_axis + index_z * num_cells_per_axis * num_cells_per_axis;
+
+							if(cell_index == reference_index)
+							{
+								stored_blocks[cell_index] = pvs_file::compress_block(reference_data);
+								reference_blocks[cell_index] = cell_index;
+							}
+							else
+							{
+								std::string current_cell_data = read_cell_data(cell_index);
+								bool is_delta = pvs_file::encode_block_with_reference(current_cell_data, reference_data, stored_blocks[cell_index]);
+								reference_blocks[cell_index] = is_delta ? reference_index : cell_index;
+							}
+						}
+					}
 				}
 			}
-
-			current_cell_data = current_cell_data + current_line_data;
 		}
-
-		// Compression of binary data using boost gzip.
-		std::stringstream stream_uncompressed, stream_compressed;
-		stream_uncompressed << current_cell_data;
-
-		boost::iostreams::filtering_streambuf<boost::iostreams::input> in;
-		in.push(boost::iostreams::gzip_compressor());
-		in.push(stream_uncompressed);
-		boost::iostreams::copy(in, stream_compressed);
-
-		std::string output_string = stream_compressed.str();
-		compressed_data_blocks.push_back(output_string);
-	}
-
-	// Save sizes of compressed data blocks.
-	for(size_t current_block_index = 0; current_block_index < compressed_data_blocks.size(); ++current_block_index)
-	{
-		uint64_t current_block_size = compressed_data_blocks[current_block_index].size();
-		file_out.write(reinterpret_cast<char*>(&current_block_size), sizeof(current_block_size));
-	}
-
-	// Save compressed data blocks.
-	for(size_t current_block_index = 0; current_block_index < compressed_data_blocks.size(); ++current_block_index)
-	{
-		file_out.write(compressed_data_blocks[current_block_index].c_str(), compressed_data_blocks[current_block_index].length());
 	}
-
-	file_out.close();
 }
 
 bool grid_regular_compressed::
@@ -147,160 +143,83 @@ load_visibility_from_file(const std::string& file_path)
 {
 	std::lock_guard<std::mutex> lock(mutex_);
 
-	std::fstream file_in;
-	file_in.open(file_path, std::ios::in | std::ios::binary);
+	size_t num_cells = cells_.size();
 
-	if(!file_in.is_open())
+	pvs_file visibility_file;
+	if(!visibility_file.open(file_path, num_cells))
 	{
 		return false;
 	}
 
-	// Read access points to data blocks.
-	visibility_block_sizes_.clear();
-
-	for(size_t current_block_index = 0; current_block_index < this->get_cell_count(); ++current_block_index)
+	try
 	{
-		uint64_t block_size;
-		file_in.read(reinterpret_cast<char*>(&block_size), sizeof(block_size));
-		visibility_block_sizes_.push_back(block_size);
-	}
-
-	// Read compressed data blocks.
-	std::vector<std::string> compressed_data_blocks;
-
-	for(size_t current_block_index = 0; current_block_index < this->get_cell_count(); ++current_block_index)
-	{
-		size_t block_size = visibility_block_sizes_[current_block_index];
-    std::vector<char> current_block_data(block_size);
-		file_in.read(&current_block_data[0], block_size);
-
-		std::string current_block(&current_block_data[0], block_size);
-		compressed_data_blocks.push_back(current_block);
-	}
-
-	for(size_t cell_index = 0; cell_index < cells_.size(); ++cell_index)
-	{
-		view_cell* current_cell = cells_[cell_index];
-		
-		// Decompress.
-		std::stringstream stream_uncompressed, stream_compressed;
-		stream_compressed << compressed_data_blocks[cell_index];
-
-		boost::iostreams::filtering_streambuf<boost::iostreams::input> inbuf;
-		inbuf.push(boost::iostreams::gzip_decompressor());
-		inbuf.push(stream_compressed);
-		boost::iostreams::copy(inbuf, stream_uncompressed);
-
-		// Apply visibility data.
-		for(model_t model_index = 0; model_index < ids_.size(); ++model_index)
+		for(size_t cell_index = 0; cell_index < num_cells; ++cell_index)
 		{
-			node_t num_nodes = ids_.at(model_index);
-			size_t line_length = num_nodes / CHAR_BIT + (num_nodes % CHAR_BIT == 0 ? 0 : 1);
-      std::vector<char> current_line_data(line_length);
-			stream_uncompressed.read(&current_line_data[0], line_length);
-
-			// Used to avoid continuing resize within visibility data.
-			current_cell->set_visibility(model_index, num_nodes - 1, false);
-
-			for(node_t character_index = 0; character_index < line_length; ++character_index)
-			{
-				char current_byte = current_line_data[character_index];
-				
-				for(unsigned short bit_index = 0; bit_index < CHAR_BIT; ++bit_index)
-				{
-					bool visible = ((current_byte >> bit_index) & 1) == 0x01;
-					current_cell->set_visibility(model_index, (character_index * CHAR_BIT) + bit_index, visible);
-				}
-			}
+			pvs_file::decode_cell_visibility(visibility_file.read_block(cell_index), cells_[cell_index], ids_);
 		}
 	}
+	catch(const std::exception& e)
+	{
+		std::cerr << "Failed to read visibility file " << file_path << ": " << e.what() << std::endl;
+		return false;
+	}
 
-	file_in.close();
 	return true;
 }
 
 bool grid_regular_compressed::
 load_cell_visibility_from_file(const std::string& file_path, const size_t& cell_index)
 {
-	std::lock_guard<std::mutex> lock(mutex_);
-
-	view_cell* current_cell = cells_[cell_index];
+	std::shared_ptr<const pvs_file> visibility_file;
 
-	// First check if visibility data is already loaded.
-	if(current_cell->contains_visibility_data())
 	{
-		return true;
-	}
-
-	// If no visibility data exists, open the file and load them.
-	std::fstream file_in;
-	file_in.open(file_path, std::ios::in | std::ios::binary);
+		std::lock_guard<std::mutex> lock(mutex_);
 
-	if(!file_in.is_open())
-	{
-		return false;
-	}
+		// First check if visibility data is already loaded.
+		if(cells_[cell_index]->contains_visibility_data())
+		{
+			return true;
+		}
 
-	if(visibility_block_sizes_.size() == 0)
-	{
-		// Read access points to data blocks.
-		for(size_t current_block_index = 0; current_block_index < this->get_cell_count(); ++current_block_index)
+		// The file is mapped on the first request, afterwards a cell is a single offset lookup.
+		if(visibility_file_ == nullptr || visibility_file_->get_file_path() != file_path)
 		{
-			uint64_t block_size;
-			file_in.read(reinterpret_cast<char*>(&block_size), sizeof(block_size));
-			visibility_block_sizes_.push_back(block_size);
+			std::shared_ptr<pvs_file> new_visibility_file = std::make_shared<pvs_file>();
+
+			if(!new_visibility_file->open(file_path, cells_.size()))
+			{
+				return false;
+			}
+
+			visibility_file_ = new_visibility_file;
 		}
+
+		visibility_file = visibility_file_;
 	}
 
-	// Read compressed data block.
-	size_t block_size = visibility_block_sizes_[cell_index];
-  std::vector<char> current_block_data(block_size);
+	// Decompression runs without holding the grid lock.
+	std::string current_cell_data;
 
-	// Find proper position in file. First data is compresses block sizes (one 64 bit integer per view cell).
-	size_t file_position = visibility_block_sizes_.size() * sizeof(uint64_t);
-	for(size_t visibility_cell_index = 0; visibility_cell_index < cell_index; ++visibility_cell_index)
+	try
 	{
-		file_position += visibility_block_sizes_[visibility_cell_index];
+		current_cell_data = visibility_file->read_block(cell_index);
+	}
+	catch(const std::exception& e)
+	{
+		std::cerr << "Failed to read view cell " << cell_index << " from visibility file " << file_path << ": " << e.what() << std::endl;
+		return false;
 	}
 
-	file_in.seekg(file_position);
-	file_in.read(&current_block_data[0], block_size);
-	std::string compressed_data_block(&current_block_data[0], block_size);
-
-	// Decompress.
-	std::stringstream stream_uncompressed, stream_compressed;
-	stream_compressed << compressed_data_block;
+	std::lock_guard<std::mutex> lock(mutex_);
 
-	boost::iostreams::filtering_streambuf<boost::iostreams::input> inbuf;
-	inbuf.push(boost::iostreams::gzip_decompressor());
-	inbuf.push(stream_compressed);
-	boost::iostreams::copy(inbuf, stream_uncompressed);
+	view_cell* current_cell = cells_[cell_index];
 
-	// Apply visibility data.
-	for(model_t model_index = 0; model_index < ids_.size(); ++model_index)
+	// Another thread may have loaded the cell in the meantime.
+	if(!current_cell->contains_visibility_data())
 	{
-		node_t num_nodes = ids_.at(model_index);
-		size_t line_length = num_nodes / CHAR_BIT + (num_nodes % CHAR_BIT == 0 ? 0 : 1);
-    std::vector<char> current_line_data(line_length);
-    
-		stream_uncompressed.read(&current_line_data[0], line_length);
-
-		// Used to avoid continuing resize within visibility data.
-		current_cell->set_visibility(model_index, num_nodes - 1, false);
-
-		for(node_t character_index = 0; character_index < line_length; ++character_index)
-		{
-			char current_byte = current_line_data[character_index];
-			
-			for(unsigned short bit_index = 0; bit_index < CHAR_BIT; ++bit_index)
-			{
-				bool visible = ((current_byte >> bit_index) & 1) == 0x01;
-				current_cell->set_visibility(model_index, (character_index * CHAR_BIT) + bit_index, visible);
-			}
-		}
+		pvs_file::decode_cell_visibility(current_cell_data, current_cell, ids_);
 	}
 
-	file_in.close();
 	return true;
 }
 
@@ -5,7 +5,9 @@
 // Faculty of Media, Bauhaus-Universitaet Weimar
 // http://www.uni-weimar.de/medien/vr
 
+#include <algorithm>
 #include <fstream>
+#include <limits>
 #include <string>
 
 #include "lamure/pvs/pvs_database.h"
@@ -35,27 +37,42 @@ pvs_database()
 	visibility_grid_ = nullptr;
 	bounding_grid_ = nullptr;
 	viewer_cell_ = nullptr;
+	viewer_bitsets_cell_ = nullptr;
 	activated_ = true;
 	do_preload_ = false;
 	shutdown_ = false;
-	
-	//configure semaphore
-  semaphore_.set_min_signal_count(1);
-  semaphore_.set_max_signal_count(std::numeric_limits<size_t>::max());
-	
-	visibility_data_loading_thread_ = std::thread(&pvs_database::loading_thread_loop, this);
-	
+
+	cell_bytes_ = 0;
+	resident_bytes_ = 0;
+	resident_budget_ = 256 * 1024 * 1024;
+
+	viewer_velocity_ = scm::math::vec3d(0.0, 0.0, 0.0);
+	prefetch_horizon_ = 1.0;
+
+	// Several workers, so a fast viewer does not wait for cells decoded one after another.
+	size_t num_loading_threads = std::max(1u, std::min(4u, std::thread::hardware_concurrency() / 2));
+
+	for(size_t thread_index = 0; thread_index < num_loading_threads; ++thread_index)
+	{
+		loading_threads_.push_back(std::thread(&pvs_database::loading_thread_loop, this));
+	}
 }
 
 pvs_database::
 ~pvs_database()
 {
-  shutdown_ = true;
-  semaphore_.shutdown();
+	{
+		std::lock_guard<std::mutex> lock(loading_mutex_);
+		shutdown_ = true;
+	}
+	loading_condition_.notify_all();
 
-	if(visibility_data_loading_thread_.joinable())
+	for(std::thread& loading_thread : loading_threads_)
 	{
-		visibility_data_loading_thread_.join();
+		if(loading_thread.joinable())
+		{
+			loading_thread.join();
+		}
 	}
 	
 	if(visibility_grid_ != nullptr)
@@ -80,6 +97,15 @@ load_pvs_from_file(const std::string& grid_file_path, const std::string& pvs_fil
 {
 	std::lock_guard<std::mutex> lock(mutex_);
 
+	// Cells of a previously loaded grid are no longer tracked.
+	stop_loading();
+
+	{
+		std::lock_guard<std::mutex> bitset_lock(bitset_mutex_);
+		viewer_bitsets_cell_ = nullptr;
+		viewer_bitsets_.clear();
+	}
+
 	do_preload_ = do_preload;
 	visibility_grid_ = load_grid_from_file(grid_file_path);
 
@@ -92,6 +118,13 @@ load_pvs_from_file(const std::string& grid_file_path, const std::string& pvs_fil
 	// Calculate smallest cell size in the grid;
 	smallest_cell_size_ = scm::math::vec3d(visibility_grid_->get_cell_at_index(0)->get_size());
 
+	// Every cell stores one bit per node of every model.
+	cell_bytes_ = 0;
+	for(model_t model_index = 0; model_index < visibility_grid_->get_num_models(); ++model_index)
+	{
+		cell_bytes_ += (visibility_grid_->get_num_nodes(model_index) + 7) / 8;
+	}
+
 	for(size_t grid_cell_index = 1; grid_cell_index < visibility_grid_->get_cell_count(); ++grid_cell_index)
 	{
 		scm::math::vec3d cell_size = visibility_grid_->get_cell_at_index(grid_cell_index)->get_size();
@@ -300,31 +333,77 @@ create_grid_by_type(const std::string& grid_type, const size_t& num_cells_x, con
 }
 
 void pvs_database::
-loading_thread_loop() {
-
-  while (true) {
-  
-    semaphore_.wait();
-    
-    if (shutdown_) {
-      break;
-    }
-    
-    int64_t cell_index = -1;
-    if (loading_queue_.size() > 0) {
-      loading_mutex_.lock();
-      if (loading_queue_.size() > 0) {
-        cell_index = loading_queue_.front();
-        loading_queue_.pop();
-      }
-      loading_mutex_.unlock();
-    }
-    
-    if (cell_index >= 0) {
-      load_visibility_data_async(cell_index);
-    }
-  }
+loading_thread_loop()
+{
+	while(true)
+	{
+		load_request request;
+
+		{
+			std::unique_lock<std::mutex> lock(loading_mutex_);
+			loading_condition_.wait(lock, [this]{ return shutdown_ || !loading_queue_.empty(); });
+
+			if(shutdown_)
+			{
+				break;
+			}
+
+			request = loading_queue_.top();
+			loading_queue_.pop();
+
+			if(resident_cells_.count(request.cell_index) > 0 || cells_in_flight_.count(request.cell_index) > 0 ||
+				!reserve_resident_bytes(request))
+			{
+				continue;
+			}
+
+			cells_in_flight_.insert(request.cell_index);
+		}
+
+		// Decoding runs without any database lock held.
+		bool loaded = visibility_grid_->load_cell_visibility_from_file(pvs_file_path_, request.cell_index);
 
+		{
+			std::lock_guard<std::mutex> lock(loading_mutex_);
+			cells_in_flight_.erase(request.cell_index);
+
+			if(loaded)
+			{
+				resident_cells_[request.cell_index] = request.time_to_enter;
+			}
+			else
+			{
+				resident_bytes_ -= cell_bytes_;
+			}
+		}
+		loading_condition_.notify_all();
+	}
+}
+
+bool pvs_database::
+reserve_resident_bytes(const load_request& request)
+{
+	while(resident_budget_ > 0 && resident_bytes_ + cell_bytes_ > resident_budget_)
+	{
+		// Release the cell the viewer will need last, but never one needed before the requested cell.
+		auto release_candidate = std::max_element(resident_cells_.begin(), resident_cells_.end(),
+			[](const std::pair<const size_t, double>& left, const std::pair<const size_t, double>& right)
+			{
+				return left.second < right.second;
+			});
+
+		if(release_candidate == resident_cells_.end() || release_candidate->second <= request.time_to_enter)
+		{
+			return false;
+		}
+
+		visibility_grid_->clear_cell_visibility(release_candidate->first);
+		resident_cells_.erase(release_candidate);
+		resident_bytes_ -= cell_bytes_;
+	}
+
+	resident_bytes_ += cell_bytes_;
+	return true;
 }
 
 void pvs_database::
@@ -336,6 +415,20 @@ set_viewer_position(const scm::math::vec3d& position)
 	{
 		if(position != position_viewer_)
 		{
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			double elapsed_seconds = std::chrono::duration<double>(now - last_position_time_).count();
+
+			// Smoothed viewer velocity. Long pauses between updates (e.g. jumps) do not count as motion.
+			if(elapsed_seconds > 0.0 && elapsed_seconds < 0.5)
+			{
+				viewer_velocity_ = 0.5 * viewer_velocity_ + 0.5 * ((position - position_viewer_) / elapsed_seconds);
+			}
+			else
+			{
+				viewer_velocity_ = scm::math::vec3d(0.0, 0.0, 0.0);
+			}
+
+			last_position_time_ = now;
 			position_viewer_ = position;
 			size_t cell_index = 0;
 			const view_cell* view_cell_at_position = visibility_grid_->get_cell_at_position(position, &cell_index);
@@ -343,22 +436,15 @@ set_viewer_position(const scm::math::vec3d& position)
 			// Position is outside of major grid. Use bounding grid instead.
 			if(view_cell_at_position != nullptr)
 			{
-				// Only set viewer cell if it changed.
-				if(view_cell_at_position != viewer_cell_)
-				{
-					viewer_cell_ = view_cell_at_position;
+				bool viewer_cell_changed = view_cell_at_position != viewer_cell_;
+				viewer_cell_ = view_cell_at_position;
 
-					// If the view cell changed and the visibility data is not preloaded, it should be loaded now.
-					if(!do_preload_)
-					{
-					
-            loading_mutex_.lock();
-            loading_queue_.push(cell_index);
-            //std::cout << "add cell " << cell_index << std::endl;
-						loading_mutex_.unlock();
-						semaphore_.signal(1);
-						
-					}
+				// If the visibility data is not preloaded, cells around the viewer and along its predicted path are loaded.
+				// The plan is refreshed on cell changes and regularly while moving, since the prediction follows the velocity.
+				if(!do_preload_ && (viewer_cell_changed || std::chrono::duration<double>(now - last_plan_time_).count() > 0.1))
+				{
+					plan_prefetch(position);
+					last_plan_time_ = now;
 				}
 			}
 			else
@@ -379,59 +465,107 @@ set_viewer_position(const scm::math::vec3d& position)
 }
 
 void pvs_database::
-load_visibility_data_async(uint64_t cell_index)
+plan_prefetch(const scm::math::vec3d& position)
 {
-  const view_cell* cell = visibility_grid_->get_cell_at_index(cell_index);
-  //
-  if (cell != viewer_cell_) {
-    return;
-  }
-  
-  //std::cout << "loading cell " << cell_index << std::endl;
-  
-	scm::math::vec3d center = cell->get_position_center();
-
-	std::set<size_t> cell_indices_to_load;
+	const double speed = scm::math::length(viewer_velocity_);
 
+	double prefetch_horizon = 0.0;
+	{
+		std::lock_guard<std::mutex> lock(loading_mutex_);
+		prefetch_horizon = prefetch_horizon_;
+	}
+
+	// A resting viewer still gets its neighbourhood ordered by distance, as if it moved one cell per second.
+	const double reference_speed = std::max(speed, scm::math::length(smallest_cell_size_));
+
+	std::map<size_t, double> desired_cells;
+
+	auto request_cell = [&](const scm::math::vec3d& cell_position, const double& time_to_enter)
+	{
+		size_t cell_index = 0;
+
+		if(visibility_grid_->get_cell_at_position(cell_position, &cell_index) != nullptr)
+		{
+			auto desired_cell = desired_cells.find(cell_index);
+
+			if(desired_cell == desired_cells.end() || time_to_enter < desired_cell->second)
+			{
+				desired_cells[cell_index] = time_to_enter;
+			}
+		}
+	};
+
+	// Direct neighbourhood of the viewer.
 	for(double z = -1.0; z < 1.5; z += 1.0)
 	{
 		for(double y = -1.0; y < 1.5; y += 1.0)
 		{
 			for(double x = -1.0; x < 1.5; x += 1.0)
 			{
-				size_t local_cell_index = 0;
 				scm::math::vec3d direction = smallest_cell_size_ * scm::math::vec3d(x, y, z);
-				const view_cell* local_view_cell_at_position = visibility_grid_->get_cell_at_position(center + direction, &local_cell_index);
-
-				if(local_view_cell_at_position != nullptr)
-				{
-					cell_indices_to_load.insert(local_cell_index);
-				}
+				request_cell(position + direction, scm::math::length(direction) / reference_speed);
 			}
 		}
 	}
-  
-  std::lock_guard<std::mutex> lock(mutex_);
 
-	// Load required visibility data which is not yet loaded.
-	for (std::set<size_t>::iterator iter = cell_indices_to_load.begin(); iter != cell_indices_to_load.end(); ++iter)
+	// Predicted path and the cells next to it, sampled twice per cell.
+	if(speed > 0.0)
 	{
-		if(previously_loaded_cell_indices_.find(*iter) == previously_loaded_cell_indices_.end())
+		const double smallest_extent = std::min(smallest_cell_size_.x, std::min(smallest_cell_size_.y, smallest_cell_size_.z));
+		const double time_step = std::max(0.5 * smallest_extent / speed, prefetch_horizon / 256.0);
+
+		for(double time = time_step; time <= prefetch_horizon; time += time_step)
 		{
-			visibility_grid_->load_cell_visibility_from_file(pvs_file_path_, *iter);
+			scm::math::vec3d predicted_position = position + viewer_velocity_ * time;
+			request_cell(predicted_position, time);
+
+			for(int axis = 0; axis < 3; ++axis)
+			{
+				scm::math::vec3d direction(0.0, 0.0, 0.0);
+				direction[axis] = smallest_cell_size_[axis];
+
+				request_cell(predicted_position + direction, time + smallest_cell_size_[axis] / reference_speed);
+				request_cell(predicted_position - direction, time + smallest_cell_size_[axis] / reference_speed);
+			}
 		}
 	}
 
-	// Release visibility data not within current neighbourhood.
-	for (std::set<size_t>::iterator iter = previously_loaded_cell_indices_.begin(); iter != previously_loaded_cell_indices_.end(); ++iter)
 	{
-		if(cell_indices_to_load.find(*iter) == cell_indices_to_load.end())
+		std::lock_guard<std::mutex> lock(loading_mutex_);
+
+		// Resident cells off the plan are released first once the budget is used up.
+		for(auto& resident_cell : resident_cells_)
 		{
-			visibility_grid_->clear_cell_visibility(*iter);
+			auto desired_cell = desired_cells.find(resident_cell.first);
+			resident_cell.second = desired_cell != desired_cells.end() ? desired_cell->second : std::numeric_limits<double>::max();
 		}
+
+		// Requests of the previous plan are dropped.
+		std::priority_queue<load_request> loading_queue;
+
+		for(const auto& desired_cell : desired_cells)
+		{
+			if(resident_cells_.count(desired_cell.first) == 0 && cells_in_flight_.count(desired_cell.first) == 0)
+			{
+				loading_queue.push(load_request{desired_cell.second, desired_cell.first});
+			}
+		}
+
+		loading_queue_.swap(loading_queue);
 	}
+	loading_condition_.notify_all();
+}
+
+void pvs_database::
+stop_loading()
+{
+	std::unique_lock<std::mutex> lock(loading_mutex_);
+
+	loading_queue_ = std::priority_queue<load_request>();
+	loading_condition_.wait(lock, [this]{ return cells_in_flight_.empty(); });
 
-	previously_loaded_cell_indices_ = std::set<size_t>(cell_indices_to_load);
+	resident_cells_.clear();
+	resident_bytes_ = 0;
 }
 
 bool pvs_database::
@@ -447,6 +581,38 @@ get_viewer_visibility(const model_t& model_id, const node_t node_id) const
 	}
 }
 
+std::shared_ptr<const boost::dynamic_bitset<>> pvs_database::
+get_viewer_visibility_bitset(const model_t& model_id) const
+{
+	const view_cell* current_viewer_cell = viewer_cell_;
+
+	if(!activated_ || current_viewer_cell == nullptr || !current_viewer_cell->contains_visibility_data())
+	{
+		return nullptr;
+	}
+
+	std::lock_guard<std::mutex> lock(bitset_mutex_);
+
+	// The bitsets are copied once per viewer cell, so callers may keep them while the cell data is unloaded.
+	if(viewer_bitsets_cell_ != current_viewer_cell)
+	{
+		viewer_bitsets_.clear();
+		viewer_bitsets_cell_ = current_viewer_cell;
+	}
+
+	if(viewer_bitsets_.size() <= model_id)
+	{
+		viewer_bitsets_.resize(model_id + 1);
+	}
+
+	if(viewer_bitsets_[model_id] == nullptr)
+	{
+		viewer_bitsets_[model_id] = std::make_shared<const boost::dynamic_bitset<>>(current_viewer_cell->get_bitset(model_id));
+	}
+
+	return viewer_bitsets_[model_id];
+}
+
 void pvs_database::
 activate(const bool& act)
 {
@@ -461,6 +627,38 @@ is_activated() const
 	return activated_;
 }
 
+void pvs_database::
+set_resident_budget(const size_t& num_bytes)
+{
+	std::lock_guard<std::mutex> lock(loading_mutex_);
+
+	resident_budget_ = num_bytes;
+}
+
+size_t pvs_database::
+get_resident_budget() const
+{
+	std::lock_guard<std::mutex> lock(loading_mutex_);
+
+	return resident_budget_;
+}
+
+size_t pvs_database::
+get_resident_bytes() const
+{
+	std::lock_guard<std::mutex> lock(loading_mutex_);
+
+	return resident_bytes_;
+}
+
+void pvs_database::
+set_prefetch_horizon(const double& seconds)
+{
+	std::lock_guard<std::mutex> lock(loading_mutex_);
+
+	prefetch_horizon_ = std::max(0.0, seconds);
+}
+
 const grid* pvs_database::
 get_visibility_grid() const
 {
@@ -478,8 +676,17 @@ clear_visibility_grid()
 {
 	std::lock_guard<std::mutex> lock(mutex_);
 
+	// Workers must be done with the grid before it is deleted.
+	stop_loading();
+
 	viewer_cell_ = nullptr;
 
+	{
+		std::lock_guard<std::mutex> bitset_lock(bitset_mutex_);
+		viewer_bitsets_cell_ = nullptr;
+		viewer_bitsets_.clear();
+	}
+
 	delete visibility_grid_;
 	visibility_grid_ = nullptr;
 }
@@ -0,0 +1,644 @@
+// Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
+// This Software is distributed under the Modified BSD License, see license.txt.
+//
+// Virtual Reality and Visualization Research Group 
+// Faculty of Media, Bauhaus-Universitaet Weimar
+// http://www.uni-weimar.de/medien/vr
+
+#include "lamure/pvs/pvs_file.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+
+#include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+namespace lamure
+{
+namespace pvs
+{
+
+namespace
+{
+
+const char pvs_file_magic[8] = "LMRPVS2";
+const char pvs_delta_file_magic[8] = "LMRPVS3";
+
+// Number of decoded reference blocks kept per file.
+const size_t reference_cache_size = 8;
+
+// First byte of a delta block, tells whether the run lengths are compressed.
+const char delta_runs = 0;
+const char delta_runs_compressed = 1;
+
+// Deltas this small are always kept, even if compression would be slightly smaller.
+const size_t min_compared_delta_size = 64;
+
+uint64_t read_uint64(const char* data)
+{
+	uint64_t value;
+	std::memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+void write_varint(std::string& data, uint64_t value)
+{
+	while(value >= 0x80)
+	{
+		data.push_back(char((value & 0x7F) | 0x80));
+		value >>= 7;
+	}
+	data.push_back(char(value));
+}
+
+uint64_t read_varint(const char* data, const size_t& size, size_t& position)
+{
+	uint64_t value = 0;
+
+	for(unsigned int shift = 0; shift < 64; shift += 7)
+	{
+		if(position >= size)
+		{
+			throw std::runtime_error("visibility delta truncated");
+		}
+
+		const uint8_t current_byte = data[position++];
+		value |= uint64_t(current_byte & 0x7F) << shift;
+
+		if((current_byte & 0x80) == 0)
+		{
+			return value;
+		}
+	}
+
+	throw std::runtime_error("invalid visibility delta");
+}
+
+// Inverts the bits [first_bit, last_bit) of the data.
+void flip_bits(std::string& data, const uint64_t& first_bit, const uint64_t& last_bit)
+{
+	uint64_t bit = first_bit;
+
+	while(bit < last_bit && bit % CHAR_BIT != 0)
+	{
+		data[bit / CHAR_BIT] ^= 1 << (bit % CHAR_BIT);
+		++bit;
+	}
+
+	for(; bit + CHAR_BIT <= last_bit; bit += CHAR_BIT)
+	{
+		data[bit / CHAR_BIT] = ~data[bit / CHAR_BIT];
+	}
+
+	for(; bit < last_bit; ++bit)
+	{
+		data[bit / CHAR_BIT] ^= 1 << (bit % CHAR_BIT);
+	}
+}
+
+}
+
+pvs_file::
+pvs_file() : version_(0), next_reference_cache_slot_(0)
+{
+}
+
+pvs_file::
+~pvs_file()
+{
+	close();
+}
+
+bool pvs_file::
+open(const std::string& file_path, const size_t& num_blocks)
+{
+	close();
+
+	try
+	{
+		mapping_.open(file_path);
+	}
+	catch(const std::exception&)
+	{
+		return false;
+	}
+
+	if(!mapping_.is_open() || !read_offsets(num_blocks))
+	{
+		close();
+		return false;
+	}
+
+	file_path_ = file_path;
+	return true;
+}
+
+bool pvs_file::
+read_offsets(const size_t& num_blocks)
+{
+	const char* data = mapping_.data();
+	const uint64_t file_size = mapping_.size();
+
+	block_offsets_.clear();
+	reference_blocks_.clear();
+
+	const bool has_header = file_size >= sizeof(pvs_file_magic) + sizeof(uint64_t);
+
+	if(has_header && (std::memcmp(data, pvs_file_magic, sizeof(pvs_file_magic)) == 0 || std::memcmp(data, pvs_delta_file_magic, sizeof(pvs_delta_file_magic)) == 0))
+	{
+		version_ = std::memcmp(data, pvs_file_magic, sizeof(pvs_file_magic)) == 0 ? 2 : 3;
+
+		const uint64_t stored_num_blocks = read_uint64(data + sizeof(pvs_file_magic));
+		const uint64_t table_offset = sizeof(pvs_file_magic) + sizeof(uint64_t);
+		const uint64_t num_table_entries = (version_ == 2) ? num_blocks + 1 : 2 * num_blocks + 1;
+
+		if(stored_num_blocks != num_blocks || table_offset + num_table_entries * sizeof(uint64_t) > file_size)
+		{
+			return false;
+		}
+
+		block_offsets_.resize(num_blocks + 1);
+		std::memcpy(block_offsets_.data(), data + table_offset, block_offsets_.size() * sizeof(uint64_t));
+
+		if(version_ == 3)
+		{
+			reference_blocks_.resize(num_blocks);
+			std::memcpy(reference_blocks_.data(), data + table_offset + block_offsets_.size() * sizeof(uint64_t), reference_blocks_.size() * sizeof(uint64_t));
+
+			// Deltas are only allowed against blocks which are stored on their own.
+			for(size_t block_index = 0; block_index < num_blocks; ++block_index)
+			{
+				const uint64_t reference_index = reference_blocks_[block_index];
+
+				if(reference_index >= num_blocks || reference_blocks_[reference_index] != reference_index)
+				{
+					return false;
+				}
+			}
+		}
+	}
+	else
+	{
+		version_ = 1;
+
+		// Block sizes are summed up once, afterwards every block is a single lookup.
+		uint64_t offset = num_blocks * sizeof(uint64_t);
+
+		if(offset > file_size)
+		{
+			return false;
+		}
+
+		block_offsets_.reserve(num_blocks + 1);
+		for(size_t block_index = 0; block_index < num_blocks; ++block_index)
+		{
+			block_offsets_.push_back(offset);
+			offset += read_uint64(data + block_index * sizeof(uint64_t));
+		}
+		block_offsets_.push_back(offset);
+	}
+
+	for(size_t block_index = 0; block_index < num_blocks; ++block_index)
+	{
+		if(block_offsets_[block_index] > block_offsets_[block_index + 1])
+		{
+			return false;
+		}
+	}
+
+	return block_offsets_.back() <= file_size;
+}
+
+void pvs_file::
+close()
+{
+	if(mapping_.is_open())
+	{
+		mapping_.close();
+	}
+
+	block_offsets_.clear();
+	reference_blocks_.clear();
+	version_ = 0;
+	file_path_ = "";
+
+	std::lock_guard<std::mutex> lock(reference_cache_mutex_);
+	reference_cache_.clear();
+	next_reference_cache_slot_ = 0;
+}
+
+bool pvs_file::
+is_open() const
+{
+	return mapping_.is_open();
+}
+
+const std::string& pvs_file::
+get_file_path() const
+{
+	return file_path_;
+}
+
+unsigned int pvs_file::
+get_version() const
+{
+	return version_;
+}
+
+size_t pvs_file::
+get_block_count() const
+{
+	return block_offsets_.empty() ? 0 : block_offsets_.size() - 1;
+}
+
+std::string pvs_file::
+read_block(const size_t& block_index) const
+{
+	if(block_index >= get_block_count())
+	{
+		throw std::out_of_range("invalid visibility block index: " + std::to_string(block_index));
+	}
+
+	const uint64_t offset = block_offsets_[block_index];
+	const uint64_t size = block_offsets_[block_index + 1] - offset;
+
+	if(version_ == 3 && reference_blocks_[block_index] != block_index)
+	{
+		if(size == 0)
+		{
+			throw std::runtime_error("empty visibility delta block");
+		}
+
+		std::shared_ptr<const std::string> reference_data = read_reference_block(reference_blocks_[block_index]);
+		const char* delta_block = mapping_.data() + offset;
+
+		if(delta_block[0] == delta_runs_compressed)
+		{
+			std::string delta = decompress_block(delta_block + 1, size - 1);
+			return apply_delta(*reference_data, delta.data(), delta.size());
+		}
+
+		return apply_delta(*reference_data, delta_block + 1, size - 1);
+	}
+
+	return decompress_block(mapping_.data() + offset, size);
+}
+
+std::shared_ptr<const std::string> pvs_file::
+read_reference_block(const size_t& block_index) const
+{
+	{
+		std::lock_guard<std::mutex> lock(reference_cache_mutex_);
+
+		for(const auto& cache_entry : reference_cache_)
+		{
+			if(cache_entry.first == block_index)
+			{
+				return cache_entry.second;
+			}
+		}
+	}
+
+	// Decompression runs without holding the cache lock, concurrent misses on the same block are harmless.
+	const uint64_t offset = block_offsets_[block_index];
+	std::shared_ptr<const std::string> reference_data = std::make_shared<const std::string>(decompress_block(mapping_.data() + offset, block_offsets_[block_index + 1] - offset));
+
+	std::lock_guard<std::mutex> lock(reference_cache_mutex_);
+
+	if(reference_cache_.size() < reference_cache_size)
+	{
+		reference_cache_.emplace_back(block_index, reference_data);
+	}
+	else
+	{
+		reference_cache_[next_reference_cache_slot_] = std::make_pair(uint64_t(block_index), reference_data);
+		next_reference_cache_slot_ = (next_reference_cache_slot_ + 1) % reference_cache_size;
+	}
+
+	return reference_data;
+}
+
+void pvs_file::
+write(const std::string& file_path, const std::vector<std::string>& compressed_blocks)
+{
+	std::fstream file_out;
+	file_out.open(file_path, std::ios::out | std::ios::binary);
+
+	if(!file_out.is_open())
+	{
+		throw std::invalid_argument("invalid file path: " + file_path);
+	}
+
+	std::vector<uint64_t> block_sizes;
+	block_sizes.reserve(compressed_blocks.size());
+
+	for(const std::string& block : compressed_blocks)
+	{
+		block_sizes.push_back(block.size());
+	}
+
+	write_header(file_out, block_sizes);
+
+	for(const std::string& block : compressed_blocks)
+	{
+		file_out.write(block.data(), block.size());
+	}
+
+	file_out.close();
+}
+
+void pvs_file::
+write_header(std::ostream& file_out, const std::vector<uint64_t>& block_sizes)
+{
+	uint64_t num_blocks = block_sizes.size();
+
+	// Offsets are prefix sums of the block sizes, starting behind the header.
+	std::vector<uint64_t> block_offsets;
+	block_offsets.reserve(num_blocks + 1);
+
+	uint64_t offset = sizeof(pvs_file_magic) + sizeof(uint64_t) + (num_blocks + 1) * sizeof(uint64_t);
+	for(const uint64_t& block_size : block_sizes)
+	{
+		block_offsets.push_back(offset);
+		offset += block_size;
+	}
+	block_offsets.push_back(offset);
+
+	file_out.write(pvs_file_magic, sizeof(pvs_file_magic));
+	file_out.write(reinterpret_cast<char*>(&num_blocks), sizeof(num_blocks));
+	file_out.write(reinterpret_cast<char*>(block_offsets.data()), block_offsets.size() * sizeof(uint64_t));
+}
+
+void pvs_file::
+write(const std::string& file_path, const std::vector<std::string>& stored_blocks, const std::vector<uint64_t>& reference_blocks)
+{
+	if(stored_blocks.size() != reference_blocks.size())
+	{
+		throw std::invalid_argument("number of reference blocks does not match number of blocks");
+	}
+
+	std::fstream file_out;
+	file_out.open(file_path, std::ios::out | std::ios::binary);
+
+	if(!file_out.is_open())
+	{
+		throw std::invalid_argument("invalid file path: " + file_path);
+	}
+
+	uint64_t num_blocks = stored_blocks.size();
+
+	std::vector<uint64_t> block_offsets;
+	block_offsets.reserve(num_blocks + 1);
+
+	uint64_t offset = sizeof(pvs_delta_file_magic) + sizeof(uint64_t) + (2 * num_blocks + 1) * sizeof(uint64_t);
+	for(const std::string& block : stored_blocks)
+	{
+		block_offsets.push_back(offset);
+		offset += block.size();
+	}
+	block_offsets.push_back(offset);
+
+	file_out.write(pvs_delta_file_magic, sizeof(pvs_delta_file_magic));
+	file_out.write(reinterpret_cast<char*>(&num_blocks), sizeof(num_blocks));
+	file_out.write(reinterpret_cast<char*>(block_offsets.data()), block_offsets.size() * sizeof(uint64_t));
+	file_out.write(reinterpret_cast<const char*>(reference_blocks.data()), reference_blocks.size() * sizeof(uint64_t));
+
+	for(const std::string& block : stored_blocks)
+	{
+		file_out.write(block.data(), block.size());
+	}
+
+	file_out.close();
+}
+
+unsigned int pvs_file::
+read_version(const std::string& file_path)
+{
+	std::fstream file_in;
+	file_in.open(file_path, std::ios::in | std::ios::binary);
+
+	if(!file_in.is_open())
+	{
+		return 0;
+	}
+
+	char magic[sizeof(pvs_file_magic)] = {};
+	file_in.read(magic, sizeof(magic));
+
+	if(file_in.gcount() == sizeof(magic) && std::memcmp(magic, pvs_file_magic, sizeof(magic)) == 0)
+	{
+		return 2;
+	}
+
+	return (file_in.gcount() == sizeof(magic) && std::memcmp(magic, pvs_delta_file_magic, sizeof(magic)) == 0) ? 3 : 1;
+}
+
+std::string pvs_file::
+compress_block(const std::string& data)
+{
+	std::string compressed_data;
+
+	boost::iostreams::filtering_ostream out;
+	out.push(boost::iostreams::gzip_compressor());
+	out.push(boost::iostreams::back_inserter(compressed_data));
+	out.write(data.data(), data.size());
+	out.reset();
+
+	return compressed_data;
+}
+
+std::string pvs_file::
+decompress_block(const char* data, const size_t& size)
+{
+	std::string uncompressed_data;
+
+	if(size == 0)
+	{
+		return uncompressed_data;
+	}
+
+	boost::iostreams::filtering_istream in;
+	in.push(boost::iostreams::gzip_decompressor());
+	in.push(boost::iostreams::array_source(data, size));
+	boost::iostreams::copy(in, boost::iostreams::back_inserter(uncompressed_data));
+
+	return uncompressed_data;
+}
+
+std::string pvs_file::
+encode_delta(const std::string& reference_data, const std::string& data)
+{
+	if(reference_data.size() != data.size())
+	{
+		throw std::invalid_argument("delta coded blocks differ in size");
+	}
+
+	std::string delta;
+
+	uint64_t run_start = 0;
+	bool differing = false;
+
+	for(size_t byte_index = 0; byte_index < data.size(); ++byte_index)
+	{
+		const uint8_t difference = uint8_t(reference_data[byte_index] ^ data[byte_index]);
+
+		// Bytes which continue the current run are skipped as a whole.
+		if(difference == (differing ? 0xFF : 0x00))
+		{
+			continue;
+		}
+
+		for(unsigned int bit = 0; bit < CHAR_BIT; ++bit)
+		{
+			if(((difference >> bit) & 1) != differing)
+			{
+				const uint64_t bit_position = uint64_t(byte_index) * CHAR_BIT + bit;
+				write_varint(delta, bit_position - run_start);
+				run_start = bit_position;
+				differing = !differing;
+			}
+		}
+	}
+
+	if(differing)
+	{
+		write_varint(delta, uint64_t(data.size()) * CHAR_BIT - run_start);
+	}
+
+	return delta;
+}
+
+std::string pvs_file::
+apply_delta(const std::string& reference_data, const char* delta, const size_t& size)
+{
+	std::string data(reference_data);
+
+	const uint64_t num_bits = uint64_t(data.size()) * CHAR_BIT;
+	uint64_t bit_position = 0;
+	bool differing = false;
+	size_t delta_position = 0;
+
+	while(delta_position < size)
+	{
+		const uint64_t run_length = read_varint(delta, size, delta_position);
+
+		if(run_length > num_bits - bit_position)
+		{
+			throw std::runtime_error("visibility delta exceeds block");
+		}
+
+		if(differing)
+		{
+			flip_bits(data, bit_position, bit_position + run_length);
+		}
+
+		bit_position += run_length;
+		differing = !differing;
+	}
+
+	return data;
+}
+
+bool pvs_file::
+encode_block_with_reference(const std::string& data, const std::string& reference_data, std::string& stored_block)
+{
+	std::string delta = encode_delta(reference_data, data);
+
+	if(delta.size() < min_compared_delta_size)
+	{
+		stored_block = delta_runs + delta;
+		return true;
+	}
+
+	// Dense differences still compress well, so the smallest of all three variants is kept.
+	std::string compressed_delta = compress_block(delta);
+	std::string compressed_data = compress_block(data);
+
+	if(compressed_data.size() <= std::min(delta.size(), compressed_delta.size()) + 1)
+	{
+		stored_block = std::move(compressed_data);
+		return false;
+	}
+
+	if(compressed_delta.size() < delta.size())
+	{
+		stored_block = delta_runs_compressed + compressed_delta;
+	}
+	else
+	{
+		stored_block = delta_runs + delta;
+	}
+
+	return true;
+}
+
+std::string pvs_file::
+encode_cell_visibility(const view_cell* cell, const std::vector<node_t>& ids)
+{
+	std::string cell_data;
+
+	// Iterate over models in the scene.
+	for(model_t model_id = 0; model_id < ids.size(); ++model_id)
+	{
+		node_t num_nodes = ids[model_id];
+		size_t line_length = num_nodes / CHAR_BIT + (num_nodes % CHAR_BIT == 0 ? 0 : 1);
+		std::string current_line_data(line_length, 0x00);
+
+		// Iterate over nodes in the model.
+		for(node_t node_id = 0; node_id < num_nodes; ++node_id)
+		{
+			if(cell->get_visibility(model_id, node_id))
+			{
+				current_line_data[node_id / CHAR_BIT] |= 1 << (node_id % CHAR_BIT);
+			}
+		}
+
+		cell_data += current_line_data;
+	}
+
+	return cell_data;
+}
+
+void pvs_file::
+decode_cell_visibility(const std::string& data, view_cell* cell, const std::vector<node_t>& ids)
+{
+	size_t data_position = 0;
+
+	for(model_t model_id = 0; model_id < ids.size(); ++model_id)
+	{
+		node_t num_nodes = ids[model_id];
+		size_t line_length = num_nodes / CHAR_BIT + (num_nodes % CHAR_BIT == 0 ? 0 : 1);
+
+		if(num_nodes == 0)
+		{
+			continue;
+		}
+
+		if(data_position + line_length > data.size())
+		{
+			throw std::runtime_error("visibility block too short");
+		}
+
+		// Used to avoid continuing resize within visibility data.
+		cell->set_visibility(model_id, num_nodes - 1, false);
+
+		for(node_t node_id = 0; node_id < num_nodes; ++node_id)
+		{
+			char current_byte = data[data_position + node_id / CHAR_BIT];
+			bool visible = ((current_byte >> (node_id % CHAR_BIT)) & 1) == 0x01;
+			cell->set_visibility(model_id, node_id, visible);
+		}
+
+		data_position += line_length;
+	}
+}
+
+}
+}
@@ -0,0 +1,469 @@
+// Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
+// This Software is distributed under the Modified BSD License, see license.txt.
+//
+// Virtual Reality and Visualization Research Group
+// Faculty of Media, Bauhaus-Universitaet Weimar
+// http://www.uni-weimar.de/medien/vr
+
+#include "lamure/pvs/pvs_stream_writer.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include "lamure/pvs/grid_regular_compressed.h"
+#include "lamure/pvs/pvs_file.h"
+
+namespace lamure
+{
+namespace pvs
+{
+
+namespace
+{
+
+const char pvs_checkpoint_magic[8] = "LMRPVSC";
+
+// Cell index and block size in front of each block.
+const uint64_t record_header_size = 2 * sizeof(uint64_t);
+
+// Chunk size used to copy the valid part of a damaged checkpoint.
+const size_t copy_buffer_size = 1024 * 1024;
+
+void append_uint64(std::string& data, const uint64_t& value)
+{
+	data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void append_double(std::string& data, const double& value)
+{
+	data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+}
+
+pvs_stream_writer::
+pvs_stream_writer(grid* visibility_grid, const size_t& memory_budget_in_bytes)
+	: visibility_grid_(visibility_grid), memory_budget_in_bytes_(memory_budget_in_bytes), bytes_per_cell_(0), checkpoint_size_(0), num_written_cells_(0)
+{
+	for(model_t model_index = 0; model_index < visibility_grid_->get_num_models(); ++model_index)
+	{
+		node_t num_nodes = visibility_grid_->get_num_nodes(model_index);
+
+		ids_.push_back(num_nodes);
+		bytes_per_cell_ += num_nodes / CHAR_BIT + (num_nodes % CHAR_BIT == 0 ? 0 : 1);
+	}
+}
+
+pvs_stream_writer::
+~pvs_stream_writer()
+{
+	try
+	{
+		close();
+	}
+	catch(const std::exception& e)
+	{
+		std::cerr << "Failed to write pending view cells: " << e.what() << std::endl;
+	}
+}
+
+std::string pvs_stream_writer::
+get_checkpoint_file_path(const std::string& file_path)
+{
+	return file_path + ".checkpoint";
+}
+
+bool pvs_stream_writer::
+open(const std::string& file_path)
+{
+	close();
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	size_t num_cells = visibility_grid_->get_cell_count();
+
+	file_path_ = file_path;
+	cells_written_.assign(num_cells, false);
+	block_offsets_.assign(num_cells, 0);
+	block_sizes_.assign(num_cells, 0);
+	num_written_cells_ = 0;
+
+	std::string checkpoint_header = create_checkpoint_header();
+	std::string checkpoint_file_path = get_checkpoint_file_path(file_path);
+
+	if(read_checkpoint(checkpoint_header, checkpoint_size_))
+	{
+		checkpoint_file_.open(checkpoint_file_path, std::ios::in | std::ios::out | std::ios::binary);
+		checkpoint_file_.seekp(checkpoint_size_);
+	}
+	else
+	{
+		cells_written_.assign(num_cells, false);
+		num_written_cells_ = 0;
+
+		checkpoint_file_.open(checkpoint_file_path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+		checkpoint_file_.write(checkpoint_header.data(), checkpoint_header.size());
+		checkpoint_file_.flush();
+		checkpoint_size_ = checkpoint_header.size();
+	}
+
+	if(!checkpoint_file_.is_open() || !checkpoint_file_.good())
+	{
+		checkpoint_file_.close();
+		return false;
+	}
+
+	return true;
+}
+
+void pvs_stream_writer::
+close()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if(checkpoint_file_.is_open())
+	{
+		write_pending_cells();
+		checkpoint_file_.close();
+	}
+
+	pending_cells_.clear();
+}
+
+std::string pvs_stream_writer::
+create_checkpoint_header() const
+{
+	std::string checkpoint_header(pvs_checkpoint_magic, sizeof(pvs_checkpoint_magic));
+
+	// Grid dimensions are stored as well, so a checkpoint of a different scene with the same cell count is not continued.
+	append_uint64(checkpoint_header, visibility_grid_->get_cell_count());
+	append_double(checkpoint_header, visibility_grid_->get_size().x);
+	append_double(checkpoint_header, visibility_grid_->get_size().y);
+	append_double(checkpoint_header, visibility_grid_->get_size().z);
+	append_double(checkpoint_header, visibility_grid_->get_position_center().x);
+	append_double(checkpoint_header, visibility_grid_->get_position_center().y);
+	append_double(checkpoint_header, visibility_grid_->get_position_center().z);
+	append_uint64(checkpoint_header, ids_.size());
+
+	for(const node_t& num_nodes : ids_)
+	{
+		append_uint64(checkpoint_header, num_nodes);
+	}
+
+	return checkpoint_header;
+}
+
+bool pvs_stream_writer::
+read_checkpoint(const std::string& checkpoint_header, uint64_t& valid_size)
+{
+	std::string checkpoint_file_path = get_checkpoint_file_path(file_path_);
+
+	std::ifstream file_in(checkpoint_file_path, std::ios::in | std::ios::binary);
+
+	if(!file_in.is_open())
+	{
+		return false;
+	}
+
+	file_in.seekg(0, std::ios::end);
+	const uint64_t file_size = file_in.tellg();
+	file_in.seekg(0, std::ios::beg);
+
+	std::string stored_header(checkpoint_header.size(), 0);
+	file_in.read(&stored_header[0], stored_header.size());
+
+	if(!file_in || stored_header != checkpoint_header)
+	{
+		std::cout << "Checkpoint " << checkpoint_file_path << " belongs to a different grid and is replaced." << std::endl;
+		return false;
+	}
+
+	valid_size = checkpoint_header.size();
+
+	// Records are only taken over if they were written completely.
+	while(valid_size + record_header_size <= file_size)
+	{
+		uint64_t record_header[2];
+		file_in.seekg(valid_size);
+		file_in.read(reinterpret_cast<char*>(record_header), sizeof(record_header));
+
+		const uint64_t cell_index = record_header[0];
+		const uint64_t block_size = record_header[1];
+
+		if(!file_in || cell_index >= cells_written_.size() || block_size > file_size - valid_size - record_header_size)
+		{
+			break;
+		}
+
+		if(!cells_written_[cell_index])
+		{
+			cells_written_[cell_index] = true;
+			++num_written_cells_;
+		}
+
+		block_offsets_[cell_index] = valid_size + record_header_size;
+		block_sizes_[cell_index] = block_size;
+
+		valid_size += record_header_size + block_size;
+	}
+
+	file_in.close();
+
+	std::cout << "Continuing checkpoint " << checkpoint_file_path << " with " << num_written_cells_ << " of " << cells_written_.size() << " view cells written." << std::endl;
+
+	// Drop the remains of a record cut off by a crash, new records would otherwise follow them.
+	if(valid_size < file_size)
+	{
+		return rewrite_checkpoint(valid_size);
+	}
+
+	return true;
+}
+
+bool pvs_stream_writer::
+rewrite_checkpoint(const uint64_t& valid_size)
+{
+	std::string checkpoint_file_path = get_checkpoint_file_path(file_path_);
+	std::string temporary_file_path = checkpoint_file_path + ".tmp";
+
+	{
+		std::ifstream file_in(checkpoint_file_path, std::ios::in | std::ios::binary);
+		std::ofstream file_out(temporary_file_path, std::ios::out | std::ios::binary | std::ios::trunc);
+
+		if(!file_in.is_open() || !file_out.is_open())
+		{
+			return false;
+		}
+
+		std::vector<char> buffer(copy_buffer_size);
+
+		for(uint64_t position = 0; position < valid_size; position += buffer.size())
+		{
+			size_t chunk_size = std::min<uint64_t>(buffer.size(), valid_size - position);
+			file_in.read(buffer.data(), chunk_size);
+			file_out.write(buffer.data(), chunk_size);
+		}
+
+		if(!file_in || !file_out)
+		{
+			return false;
+		}
+	}
+
+	std::remove(checkpoint_file_path.c_str());
+	return std::rename(temporary_file_path.c_str(), checkpoint_file_path.c_str()) == 0;
+}
+
+bool pvs_stream_writer::
+is_cell_written(const size_t& cell_index) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	return cell_index < cells_written_.size() && cells_written_[cell_index];
+}
+
+size_t pvs_stream_writer::
+get_written_cell_count() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	return num_written_cells_;
+}
+
+void pvs_stream_writer::
+add_finished_cell(const size_t& cell_index)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if(cell_index >= cells_written_.size() || cells_written_[cell_index])
+	{
+		return;
+	}
+
+	pending_cells_.push_back(cell_index);
+
+	if(pending_cells_.size() * bytes_per_cell_ > memory_budget_in_bytes_)
+	{
+		write_pending_cells();
+	}
+}
+
+void pvs_stream_writer::
+flush()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	write_pending_cells();
+}
+
+void pvs_stream_writer::
+write_pending_cells()
+{
+	if(pending_cells_.empty() || !checkpoint_file_.is_open())
+	{
+		return;
+	}
+
+	// Compression of the cells is independent, writing happens in order afterwards.
+	std::vector<std::string> compressed_blocks(pending_cells_.size());
+
+	#pragma omp parallel for schedule(dynamic)
+	for(long pending_index = 0; pending_index < (long)pending_cells_.size(); ++pending_index)
+	{
+		const view_cell* current_cell = visibility_grid_->get_cell_at_index(pending_cells_[pending_index]);
+		compressed_blocks[pending_index] = pvs_file::compress_block(pvs_file::encode_cell_visibility(current_cell, ids_));
+	}
+
+	checkpoint_file_.seekp(checkpoint_size_);
+
+	for(size_t pending_index = 0; pending_index < pending_cells_.size(); ++pending_index)
+	{
+		uint64_t record_header[2] = {pending_cells_[pending_index], compressed_blocks[pending_index].size()};
+
+		checkpoint_file_.write(reinterpret_cast<const char*>(record_header), sizeof(record_header));
+		checkpoint_file_.write(compressed_blocks[pending_index].data(), compressed_blocks[pending_index].size());
+	}
+
+	// Cells only count as written once they reached the file, so a crash never loses released visibility.
+	checkpoint_file_.flush();
+
+	if(!checkpoint_file_.good())
+	{
+		throw std::runtime_error("failed to write visibility checkpoint: " + get_checkpoint_file_path(file_path_));
+	}
+
+	for(size_t pending_index = 0; pending_index < pending_cells_.size(); ++pending_index)
+	{
+		size_t cell_index = pending_cells_[pending_index];
+
+		if(!cells_written_[cell_index])
+		{
+			cells_written_[cell_index] = true;
+			++num_written_cells_;
+		}
+
+		block_offsets_[cell_index] = checkpoint_size_ + record_header_size;
+		block_sizes_[cell_index] = compressed_blocks[pending_index].size();
+		checkpoint_size_ += record_header_size + compressed_blocks[pending_index].size();
+
+		visibility_grid_->clear_cell_visibility(cell_index);
+	}
+
+	pending_cells_.clear();
+}
+
+bool pvs_stream_writer::
+finish()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if(!checkpoint_file_.is_open())
+	{
+		return false;
+	}
+
+	write_pending_cells();
+
+	if(num_written_cells_ != cells_written_.size())
+	{
+		return false;
+	}
+
+	// Regular grids are delta coded like grid_regular_compressed::save_visibility_to_file() does.
+	const size_t num_cells = cells_written_.size();
+	const size_t num_cells_per_axis = (size_t)std::round(std::cbrt(double(num_cells)));
+	const bool is_delta_coded = visibility_grid_->get_grid_type() == grid_regular_compressed::get_grid_identifier()
+		&& num_cells_per_axis * num_cells_per_axis * num_cells_per_axis == num_cells;
+
+	try
+	{
+		if(is_delta_coded)
+		{
+			write_delta_coded_blocks(num_cells_per_axis);
+		}
+		else if(!write_blocks())
+		{
+			return false;
+		}
+	}
+	catch(const std::exception& e)
+	{
+		std::cerr << "Failed to write visibility file " << file_path_ << ": " << e.what() << std::endl;
+		return false;
+	}
+
+	checkpoint_file_.close();
+
+	std::remove(get_checkpoint_file_path(file_path_).c_str());
+	return true;
+}
+
+bool pvs_stream_writer::
+write_blocks()
+{
+	std::ofstream file_out(file_path_, std::ios::out | std::ios::binary | std::ios::trunc);
+
+	if(!file_out.is_open())
+	{
+		return false;
+	}
+
+	// Blocks are copied one by one, so the visibility of the whole grid is never in memory at once.
+	pvs_file::write_header(file_out, block_sizes_);
+
+	std::vector<char> buffer;
+
+	for(size_t cell_index = 0; cell_index < cells_written_.size(); ++cell_index)
+	{
+		buffer.resize(block_sizes_[cell_index]);
+
+		checkpoint_file_.seekg(block_offsets_[cell_index]);
+		checkpoint_file_.read(buffer.data(), buffer.size());
+		file_out.write(buffer.data(), buffer.size());
+	}
+
+	if(!checkpoint_file_ || !file_out)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+std::string pvs_stream_writer::
+read_checkpoint_block(const size_t& cell_index)
+{
+	std::string compressed_block(block_sizes_[cell_index], 0);
+
+	checkpoint_file_.seekg(block_offsets_[cell_index]);
+	checkpoint_file_.read(&compressed_block[0], compressed_block.size());
+
+	if(!checkpoint_file_)
+	{
+		throw std::runtime_error("failed to read visibility checkpoint: " + get_checkpoint_file_path(file_path_));
+	}
+
+	return pvs_file::decompress_block(compressed_block.data(), compressed_block.size());
+}
+
+void pvs_stream_writer::
+write_delta_coded_blocks(const size_t& num_cells_per_axis)
+{
+	std::vector<std::string> stored_blocks;
+	std::vector<uint64_t> reference_blocks;
+
+	grid_regular_compressed::encode_visibility_blocks(num_cells_per_axis, [this](const size_t& cell_index)
+	{
+		return read_checkpoint_block(cell_index);
+	}, stored_blocks, reference_blocks);
+
+	pvs_file::write(file_path_, stored_blocks, reference_blocks);
+}
+
+}
+}
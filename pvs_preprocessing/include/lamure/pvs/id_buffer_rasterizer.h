@@ -0,0 +1,110 @@
+// Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
+// This Software is distributed under the Modified BSD License, see license.txt.
+//
+// Virtual Reality and Visualization Research Group
+// Faculty of Media, Bauhaus-Universitaet Weimar
+// http://www.uni-weimar.de/medien/vr
+
+#ifndef LAMURE_PVS_ID_BUFFER_RASTERIZER_H
+#define LAMURE_PVS_ID_BUFFER_RASTERIZER_H
+
+#include <vector>
+#include <cstdint>
+
+#include <lamure/pvs/pvs_preprocessing.h>
+#include <lamure/types.h>
+#include <lamure/pvs/id_histogram.h>
+#include <lamure/ren/dataset.h>
+
+#include <scm/core/math.h>
+#include <scm/gl_core/primitives/box.h>
+
+namespace lamure
+{
+namespace pvs
+{
+
+// Software replacement for the id rendering pass of the GPU visibility tests.
+// Surfels are drawn as screen aligned disks of constant depth into an id buffer using the same
+// pixel encoding as the GPU renderer, so the resulting id histogram can be evaluated identically.
+// The screen is split into square tiles which are rasterized independently by one thread each.
+class PVS_PREPROCESSING_DLL id_buffer_rasterizer
+{
+public:
+	id_buffer_rasterizer(const size_t& width, const size_t& height);
+	~id_buffer_rasterizer();
+
+	// Sets up a perspective view like a look-at camera with the given vertical opening angle in degrees.
+	void set_view(const scm::math::vec3d& position, const scm::math::vec3d& look_dir, const scm::math::vec3d& up_dir,
+				const double& opening_angle, const double& near_plane, const double& far_plane);
+
+	// Removes all queued surfels, must be called before the surfels of a new view are added.
+	void clear();
+
+	// Conservative test whether the box transformed by the model matrix may overlap the view frustum.
+	bool is_box_in_view(const scm::gl::boxf& box, const scm::math::mat4f& model_matrix) const;
+
+	// Queues the surfels of a node. The data must stay valid until rasterize() returns.
+	void add_surfels(const model_t& model_id, const node_t& node_id, const lamure::ren::dataset::serialized_surfel* surfels,
+					const size_t& num_surfels, const scm::math::mat4f& model_matrix, const float& radius_scale);
+
+	// Projects and rasterizes all queued surfels into the id buffer.
+	void rasterize();
+
+	id_histogram create_node_id_histogram() const;
+	const std::vector<uint32_t>& get_id_buffer() const;
+
+	size_t get_width() const;
+	size_t get_height() const;
+
+private:
+	struct surfel_batch
+	{
+		const lamure::ren::dataset::serialized_surfel* surfels;
+		size_t num_surfels;
+		size_t first_splat;
+		scm::math::mat4f model_matrix;
+		float radius_scale;
+		uint32_t id;
+	};
+
+	struct splat
+	{
+		float x;
+		float y;
+		float radius;
+		float depth;
+		uint32_t id;
+	};
+
+	// Projects a batch into screen space and sorts the resulting splats into the tile bins of the calling thread.
+	void project_batch(const surfel_batch& batch, std::vector<std::vector<uint32_t>>& tile_bins);
+	void rasterize_tile(const size_t& tile_index, std::vector<float>& depth_buffer);
+
+	size_t width_;
+	size_t height_;
+
+	size_t num_tiles_x_;
+	size_t num_tiles_y_;
+
+	scm::math::vec3d position_;
+	scm::math::vec3d right_dir_;
+	scm::math::vec3d up_dir_;
+	scm::math::vec3d look_dir_;
+	double focal_length_;
+	double near_plane_;
+	double far_plane_;
+
+	std::vector<surfel_batch> batches_;
+	std::vector<splat> splats_;
+
+	// Splat indices per thread and tile, kept between views to avoid reallocation.
+	std::vector<std::vector<std::vector<uint32_t>>> thread_tile_bins_;
+
+	std::vector<uint32_t> id_buffer_;
+};
+
+}
+}
+
+#endif
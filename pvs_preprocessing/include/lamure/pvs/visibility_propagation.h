@@ -0,0 +1,49 @@
+// Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
+// This Software is distributed under the Modified BSD License, see license.txt.
+//
+// Virtual Reality and Visualization Research Group
+// Faculty of Media, Bauhaus-Universitaet Weimar
+// http://www.uni-weimar.de/medien/vr
+
+#ifndef LAMURE_PVS_VISIBILITY_PROPAGATION_H
+#define LAMURE_PVS_VISIBILITY_PROPAGATION_H
+
+#include <vector>
+
+#include <boost/dynamic_bitset.hpp>
+
+#include <lamure/pvs/pvs_preprocessing.h>
+#include <lamure/types.h>
+#include "lamure/pvs/grid.h"
+
+#include <lamure/ren/bvh.h>
+
+namespace lamure
+{
+namespace pvs
+{
+
+// Post processing of the visibility test results which is shared by all visibility tests.
+// Works on the models currently loaded into the model database.
+class PVS_PREPROCESSING_DLL visibility_propagation
+{
+public:
+	// Marks the nodes of the average cut depth which intersect a view cell as visible within this cell.
+	// Both containers are indexed by model id and grid cell id.
+	static void check_for_nodes_within_cells(grid* visibility_grid, const std::vector<std::vector<size_t>>& total_depths, const std::vector<std::vector<size_t>>& total_nums);
+	// Same for a single cell, both containers are indexed by model id.
+	static void check_for_nodes_within_cell(grid* visibility_grid, const size_t& cell_index, const std::vector<size_t>& total_depths, const std::vector<size_t>& total_nums);
+
+	// Advances node visibility downwards and upwards in the LOD-hierarchy. Cells are processed in parallel.
+	static void emit_node_visibility(grid* visibility_grid);
+	static void emit_node_visibility(grid* visibility_grid, const size_t& cell_index);
+
+private:
+	// Returns the rendered nodes together with all of their descendants and ancestors in the given hierarchy.
+	static boost::dynamic_bitset<> propagate_node_visibility(const lamure::ren::bvh* bvh, const boost::dynamic_bitset<>& rendered_nodes);
+};
+
+}
+}
+
+#endif
@@ -11,6 +11,7 @@
 #include <lamure/pvs/pvs_preprocessing.h>
 #include "lamure/bounding_box.h"
 #include "lamure/pvs/grid.h"
+#include "lamure/pvs/pvs_stream_writer.h"
 
 namespace lamure
 {
@@ -24,6 +25,9 @@ public:
 
 	virtual int initialize(int& argc, char** argv) = 0;
 	virtual void test_visibility(grid* visibility_grid) = 0;
+	// Hands every finished cell to the writer instead of keeping the visibility of the whole grid in memory.
+	// Cells already contained in the writer are skipped. Returns false if the test does not support streaming.
+	virtual bool test_visibility_streamed(grid* visibility_grid, pvs_stream_writer* writer) { return false; }
 	virtual void shutdown() = 0;
 
 	virtual bounding_box get_scene_bounds() const = 0;
@@ -0,0 +1,84 @@
+// Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
+// This Software is distributed under the Modified BSD License, see license.txt.
+//
+// Virtual Reality and Visualization Research Group
+// Faculty of Media, Bauhaus-Universitaet Weimar
+// http://www.uni-weimar.de/medien/vr
+
+#ifndef LAMURE_PVS_VISIBILITY_TEST_ID_HISTOGRAM_RASTERIZER_H
+#define LAMURE_PVS_VISIBILITY_TEST_ID_HISTOGRAM_RASTERIZER_H
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <lamure/pvs/pvs_preprocessing.h>
+#include "lamure/pvs/visibility_test.h"
+#include "lamure/pvs/id_buffer_rasterizer.h"
+#include "lamure/pvs/grid.h"
+
+#include <lamure/ren/dataset.h>
+#include <lamure/ren/lod_stream.h>
+
+namespace lamure
+{
+namespace pvs
+{
+
+// Headless counterpart of visibility_test_id_histogram_renderer.
+// Selects an LOD cut per view on the CPU and rasterizes the surfels of the cut into an id buffer,
+// so no window or graphics context is required. Supports point cloud models only.
+class PVS_PREPROCESSING_DLL visibility_test_id_histogram_rasterizer : public visibility_test
+{
+public:
+	visibility_test_id_histogram_rasterizer();
+	virtual ~visibility_test_id_histogram_rasterizer();
+
+	virtual int initialize(int& argc, char** argv);
+	virtual void test_visibility(grid* visibility_grid);
+	virtual bool test_visibility_streamed(grid* visibility_grid, pvs_stream_writer* writer);
+	virtual void shutdown();
+
+	virtual bounding_box get_scene_bounds() const;
+
+private:
+	// Renders the six views of a cell and marks the visible nodes. Depth and number of the cut nodes are returned per model.
+	void test_cell_visibility(grid* visibility_grid, const size_t& cell_index, id_buffer_rasterizer& rasterizer,
+								std::vector<size_t>& total_depths, std::vector<size_t>& total_nums);
+
+	// Traverses the LOD-hierarchy of a model down to the nodes which satisfy the error threshold in the current view.
+	// Visible cut nodes are added to the rasterizer, the depth of all cut nodes is accumulated.
+	void add_cut_to_rasterizer(const model_t& model_id, const scm::math::vec3d& position, const scm::math::vec3d& look_dir, const double& opening_angle,
+								id_buffer_rasterizer& rasterizer, size_t& total_depth, size_t& total_num);
+
+	const std::vector<lamure::ren::dataset::serialized_surfel>& load_node(const model_t& model_id, const node_t& node_id);
+
+	int resolution_x_;
+	int resolution_y_;
+	unsigned int main_memory_budget_;
+
+	float error_threshold_;
+	float visibility_threshold_;
+	float importance_;
+	float far_plane_;
+
+	bool initialized_;
+
+	std::vector<scm::math::mat4f> model_transformations_;
+	std::set<lamure::model_t> invisible_set_;
+	std::vector<std::unique_ptr<lamure::ren::lod_stream>> lod_streams_;
+
+	// Surfels of the nodes loaded from the lod files, flushed between views once the main memory budget is exceeded.
+	std::map<std::pair<model_t, node_t>, std::vector<lamure::ren::dataset::serialized_surfel>> node_cache_;
+	size_t node_cache_size_in_bytes_;
+
+	bounding_box scene_bounds_;
+};
+
+}
+}
+
+#endif
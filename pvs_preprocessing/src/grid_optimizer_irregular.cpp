@@ -8,6 +8,9 @@
 #include <iostream>
 #include <queue>
 #include <utility>
+#include <vector>
+
+#include <boost/dynamic_bitset.hpp>
 
 #include "lamure/pvs/grid_optimizer_irregular.h"
 #include "lamure/pvs/grid_irregular.h"
@@ -22,49 +25,75 @@ optimize_grid(grid* input_grid, const float& equality_threshold)
 {
 	grid_irregular* irr_grid = (grid_irregular*)input_grid;
 
+	// Number of nodes is constant, so the normalization of the equality measure can be computed once.
+	size_t total_nodes = 0;
+
+	for(model_t model_index = 0; model_index < irr_grid->get_num_models(); ++model_index)
+	{
+		total_nodes += input_grid->get_num_nodes(model_index);
+	}
+
 	for(long current_cell_index = 0; current_cell_index < irr_grid->get_cell_count(); ++current_cell_index)
 	{
 		bool is_original_cell = irr_grid->is_cell_at_index_original(current_cell_index);
 		const view_cell* current_cell = irr_grid->get_cell_at_index(current_cell_index);
 
+		// Visibility of the current cell is compared to all other cells, so it is only collected once.
+		std::vector<boost::dynamic_bitset<>> current_bitsets(irr_grid->get_num_models());
+
+		for(model_t model_index = 0; model_index < irr_grid->get_num_models(); ++model_index)
+		{
+			current_bitsets[model_index] = current_cell->get_bitset(model_index);
+			current_bitsets[model_index].resize(input_grid->get_num_nodes(model_index));
+		}
+
 		std::priority_queue<std::pair<float, size_t>, std::vector<std::pair<float, size_t>>, std::greater<std::pair<float, size_t>>> merge_options;
+		const long num_cells = irr_grid->get_cell_count();
 
-		for(long compare_cell_index = 0; compare_cell_index < irr_grid->get_cell_count(); ++compare_cell_index)
+		// Comparisons only read visibility data, so they are distributed over all threads.
+		// Merge options are ordered by error and index, so the order of insertion does not change the result.
+		#pragma omp parallel
 		{
-			if(compare_cell_index == current_cell_index)
+			std::vector<std::pair<float, size_t>> thread_merge_options;
+
+			#pragma omp for schedule(dynamic, 64) nowait
+			for(long compare_cell_index = 0; compare_cell_index < num_cells; ++compare_cell_index)
 			{
-				continue;
-			}
+				if(compare_cell_index == current_cell_index)
+				{
+					continue;
+				}
 
-			const view_cell* compare_cell = irr_grid->get_cell_at_index(compare_cell_index);
+				const view_cell* compare_cell = irr_grid->get_cell_at_index(compare_cell_index);
 
-			// Check equality.
-			size_t equality_counter = 0;
-			size_t total_nodes = 0;
+				// Check equality by counting the nodes visible in both cells.
+				size_t equality_counter = 0;
 
-			view_cell_regular* current_view_cell_regular = (view_cell_regular*)current_cell;
-			view_cell_regular* compare_view_cell_regular = (view_cell_regular*)compare_cell;
+				for(model_t model_index = 0; model_index < irr_grid->get_num_models(); ++model_index)
+				{
+					boost::dynamic_bitset<> common_bits = compare_cell->get_bitset(model_index);
+					common_bits.resize(input_grid->get_num_nodes(model_index));
+					common_bits &= current_bitsets[model_index];
 
-			for(model_t model_index = 0; model_index < irr_grid->get_num_models(); ++model_index)
-			{
-				boost::dynamic_bitset<> bitset_one = boost::dynamic_bitset<>(current_view_cell_regular->get_bitset(model_index));
-				bitset_one.resize(input_grid->get_num_nodes(model_index));
-				boost::dynamic_bitset<> bitset_two = boost::dynamic_bitset<>(compare_view_cell_regular->get_bitset(model_index));
-				bitset_two.resize(input_grid->get_num_nodes(model_index));
+					equality_counter += common_bits.count();
+				}
 
-				boost::dynamic_bitset<> common_bits = bitset_one & bitset_two;
+				float equality = (float)equality_counter / (float)total_nodes;
+				float error = 1.0f - equality;
 
-				equality_counter += common_bits.count();
-				total_nodes += common_bits.size();
+				// This test will already cancel some unecessary tests, yet a further threshold test will be done within join_cells.
+				if(equality >= equality_threshold)
+				{
+					thread_merge_options.push_back(std::pair<float, size_t>(error, compare_cell_index));
+				}
 			}
 
-			float equality = (float)equality_counter / (float)total_nodes;
-			float error = 1.0f - equality;
-
-			// This test will already cancel some unecessary tests, yet a further threshold test will be done within join_cells.
-			if(equality >= equality_threshold)
+			#pragma omp critical
 			{
-				merge_options.push(std::pair<float, size_t>(error, compare_cell_index));
+				for(const std::pair<float, size_t>& merge_option : thread_merge_options)
+				{
+					merge_options.push(merge_option);
+				}
 			}
 		}
 
@@ -7,6 +7,10 @@
 
 #include "lamure/pvs/grid_optimizer_octree.h"
 
+#include <vector>
+
+#include <boost/dynamic_bitset.hpp>
+
 namespace lamure
 {
 namespace pvs
@@ -17,7 +21,12 @@ optimize_grid(grid* input_grid, const float& equality_threshold)
 {
 	grid_octree* oct_grid = (grid_octree*)input_grid;
 
-	check_and_optimize_node(oct_grid->get_root_node(), input_grid, equality_threshold);
+	// Sibling subtrees are independent of each other, so they are optimized as parallel tasks.
+	#pragma omp parallel
+	{
+		#pragma omp single
+		check_and_optimize_node(oct_grid->get_root_node(), input_grid, equality_threshold);
+	}
 
 	// Grid was most likely changed, so update the indices for fast access.
 	oct_grid->compute_index_access();
@@ -43,10 +52,21 @@ check_and_optimize_node(grid_octree_node* node, grid* input_grid, const float& e
 		if(node_children_have_children > 0)
 		{
 			// If one of the nodes has children, go one level deeper and try to find optimization entry point there.
+			bool child_changes_detected[8] = {false, false, false, false, false, false, false, false};
+
 			for(int child_index = 0; child_index < 8; ++child_index)
 			{
 				grid_octree_node* child_node = node->get_child_at_index(child_index);
-				change_detected |= check_and_optimize_node(child_node, input_grid, equality_threshold);
+
+				#pragma omp task shared(child_changes_detected) firstprivate(child_node, child_index)
+				child_changes_detected[child_index] = check_and_optimize_node(child_node, input_grid, equality_threshold);
+			}
+
+			#pragma omp taskwait
+
+			for(int child_index = 0; child_index < 8; ++child_index)
+			{
+				change_detected |= child_changes_detected[child_index];
 			}
 
 			if(change_detected)
@@ -84,32 +104,27 @@ try_collapse_node(grid_octree_node* node, grid* input_grid, const float& equalit
 {
 	if(node->has_children())
 	{
-		grid_octree_node tmp_node;
+		// Collect visibility data of all child nodes as the union of their bitsets.
+		std::vector<boost::dynamic_bitset<>> collected_bitsets(input_grid->get_num_models());
+		size_t num_visible_nodes_children[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+		size_t num_visible_nodes = 0;
 
-		// Collect visibility data of all child nodes.
-		for(int child_index = 0; child_index < 8; ++child_index)
+		for(model_t model_index = 0; model_index < input_grid->get_num_models(); ++model_index)
 		{
-			grid_octree_node* child_node = node->get_child_at_index(child_index);
+			boost::dynamic_bitset<>& collected_bitset = collected_bitsets[model_index];
+			collected_bitset.resize(input_grid->get_num_nodes(model_index));
 
-			for(model_t model_index = 0; model_index < input_grid->get_num_models(); ++model_index)
+			for(int child_index = 0; child_index < 8; ++child_index)
 			{
-				for(node_t node_index = 0; node_index < input_grid->get_num_nodes(model_index); ++node_index)
-				{
-					if(child_node->get_visibility(model_index, node_index))
-					{
-						tmp_node.set_visibility(model_index, node_index, true);
-					}
-				}
-			}
-		}
+				boost::dynamic_bitset<> child_bitset = node->get_child_at_index(child_index)->get_bitset(model_index);
+				child_bitset.resize(input_grid->get_num_nodes(model_index));
 
-		// Count entries of collected visibility.
-		std::map<model_t, std::vector<node_t>> tmp_visibility = tmp_node.get_visible_indices();
-		size_t num_visible_nodes = 0;
+				num_visible_nodes_children[child_index] += child_bitset.count();
+				collected_bitset |= child_bitset;
+			}
 
-		for(model_t model_index = 0; model_index < input_grid->get_num_models(); ++model_index)
-		{
-			num_visible_nodes += tmp_visibility[model_index].size();
+			// Count entries of collected visibility.
+			num_visible_nodes += collected_bitset.count();
 		}
 
 		bool collapse = true;
@@ -117,17 +132,8 @@ try_collapse_node(grid_octree_node* node, grid* input_grid, const float& equalit
 		// Compare to each of the children.
 		for(int child_index = 0; child_index < 8; ++child_index)
 		{
-			grid_octree_node* child_node = node->get_child_at_index(child_index);
-			std::map<model_t, std::vector<node_t>> child_visibility = child_node->get_visible_indices();
-
-			size_t num_visible_nodes_child = 0;
-			for(model_t model_index = 0; model_index < input_grid->get_num_models(); ++model_index)
-			{
-				num_visible_nodes_child += child_visibility[model_index].size();
-			}
-
 			// Check if difference of visible nodes is within threshold.
-			if((float)num_visible_nodes_child / (float)num_visible_nodes < equality_threshold)
+			if((float)num_visible_nodes_children[child_index] / (float)num_visible_nodes < equality_threshold)
 			{
 				collapse = false;
 				break;
@@ -141,13 +147,7 @@ try_collapse_node(grid_octree_node* node, grid* input_grid, const float& equalit
 			// Propagate visibility of child nodes to parent.
 			for(model_t model_index = 0; model_index < input_grid->get_num_models(); ++model_index)
 			{
-				// Performance improving hack. Instantly allocates memory.
-				node->set_visibility(model_index, input_grid->get_num_nodes(model_index)-1, false);
-
-				for(node_t node_index = 0; node_index < input_grid->get_num_nodes(model_index); ++node_index)
-				{
-					node->set_visibility(model_index, node_index, tmp_node.get_visibility(model_index, node_index));
-				}
+				node->set_bitset(model_index, collected_bitsets[model_index]);
 			}
 
 			return true;
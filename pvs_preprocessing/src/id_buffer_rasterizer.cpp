@@ -0,0 +1,334 @@
+// Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
+// This Software is distributed under the Modified BSD License, see license.txt.
+//
+// Virtual Reality and Visualization Research Group
+// Faculty of Media, Bauhaus-Universitaet Weimar
+// http://www.uni-weimar.de/medien/vr
+
+#include "lamure/pvs/id_buffer_rasterizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <omp.h>
+
+namespace lamure
+{
+namespace pvs
+{
+
+namespace
+{
+
+// Edge length of the square screen tiles in pixels.
+const size_t tile_size = 64;
+
+// A splat always covers the center of the pixel it is located in, like the smallest point sprite on the GPU.
+const float min_splat_radius = 0.70711f;
+
+}
+
+id_buffer_rasterizer::
+id_buffer_rasterizer(const size_t& width, const size_t& height)
+{
+	width_ = width;
+	height_ = height;
+
+	num_tiles_x_ = (width_ + tile_size - 1) / tile_size;
+	num_tiles_y_ = (height_ + tile_size - 1) / tile_size;
+
+	position_ = scm::math::vec3d(0.0, 0.0, 0.0);
+	right_dir_ = scm::math::vec3d(1.0, 0.0, 0.0);
+	up_dir_ = scm::math::vec3d(0.0, 1.0, 0.0);
+	look_dir_ = scm::math::vec3d(0.0, 0.0, -1.0);
+	focal_length_ = 1.0;
+	near_plane_ = 0.01;
+	far_plane_ = 1000.0;
+
+	thread_tile_bins_.resize(omp_get_max_threads(), std::vector<std::vector<uint32_t>>(num_tiles_x_ * num_tiles_y_));
+	id_buffer_.resize(width_ * height_, 0);
+}
+
+id_buffer_rasterizer::
+~id_buffer_rasterizer()
+{
+}
+
+void id_buffer_rasterizer::
+set_view(const scm::math::vec3d& position, const scm::math::vec3d& look_dir, const scm::math::vec3d& up_dir,
+		const double& opening_angle, const double& near_plane, const double& far_plane)
+{
+	// Same camera basis as produced by a look-at matrix.
+	position_ = position;
+	look_dir_ = scm::math::normalize(look_dir);
+	right_dir_ = scm::math::normalize(scm::math::cross(look_dir_, up_dir));
+	up_dir_ = scm::math::cross(right_dir_, look_dir_);
+
+	focal_length_ = 1.0 / std::tan(opening_angle * 0.5 * M_PI / 180.0);
+	near_plane_ = near_plane;
+	far_plane_ = far_plane;
+}
+
+void id_buffer_rasterizer::
+clear()
+{
+	batches_.clear();
+}
+
+bool id_buffer_rasterizer::
+is_box_in_view(const scm::gl::boxf& box, const scm::math::mat4f& model_matrix) const
+{
+	const double tan_half_x = double(width_) / (double(height_) * focal_length_);
+	const double tan_half_y = 1.0 / focal_length_;
+
+	// Count corners outside of each frustum plane, the box is culled if all corners are outside of the same plane.
+	size_t outside[6] = {0, 0, 0, 0, 0, 0};
+
+	for(size_t corner_index = 0; corner_index < 8; ++corner_index)
+	{
+		const scm::math::vec4f corner((corner_index & 1) ? box.max_vertex().x : box.min_vertex().x,
+									(corner_index & 2) ? box.max_vertex().y : box.min_vertex().y,
+									(corner_index & 4) ? box.max_vertex().z : box.min_vertex().z,
+									1.0f);
+		const scm::math::vec4f world_corner = model_matrix * corner;
+		const scm::math::vec3d offset = scm::math::vec3d(world_corner.x, world_corner.y, world_corner.z) - position_;
+
+		const double x = scm::math::dot(offset, right_dir_);
+		const double y = scm::math::dot(offset, up_dir_);
+		const double z = scm::math::dot(offset, look_dir_);
+
+		outside[0] += z < near_plane_;
+		outside[1] += z > far_plane_;
+		outside[2] += x < -z * tan_half_x;
+		outside[3] += x > z * tan_half_x;
+		outside[4] += y < -z * tan_half_y;
+		outside[5] += y > z * tan_half_y;
+	}
+
+	for(size_t plane_index = 0; plane_index < 6; ++plane_index)
+	{
+		if(outside[plane_index] == 8)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void id_buffer_rasterizer::
+add_surfels(const model_t& model_id, const node_t& node_id, const lamure::ren::dataset::serialized_surfel* surfels,
+			const size_t& num_surfels, const scm::math::mat4f& model_matrix, const float& radius_scale)
+{
+	surfel_batch batch;
+	batch.surfels = surfels;
+	batch.num_surfels = num_surfels;
+	batch.first_splat = batches_.empty() ? 0 : batches_.back().first_splat + batches_.back().num_surfels;
+	batch.model_matrix = model_matrix;
+	batch.radius_scale = radius_scale;
+
+	// Same encoding the GPU renderer writes into its id texture, see id_histogram::create().
+	batch.id = ((255 - uint32_t(model_id)) << 24) | (uint32_t(node_id) & 0xFFFFFF);
+
+	batches_.push_back(batch);
+}
+
+void id_buffer_rasterizer::
+rasterize()
+{
+	size_t num_splats = batches_.empty() ? 0 : batches_.back().first_splat + batches_.back().num_surfels;
+	splats_.resize(num_splats);
+
+	if(thread_tile_bins_.size() < size_t(omp_get_max_threads()))
+	{
+		thread_tile_bins_.resize(omp_get_max_threads(), std::vector<std::vector<uint32_t>>(num_tiles_x_ * num_tiles_y_));
+	}
+	for(std::vector<std::vector<uint32_t>>& tile_bins : thread_tile_bins_)
+	{
+		for(std::vector<uint32_t>& bin : tile_bins)
+		{
+			bin.clear();
+		}
+	}
+
+	// Project and bin the surfels. Static scheduling keeps the splat order within each tile deterministic.
+	#pragma omp parallel
+	{
+		std::vector<std::vector<uint32_t>>& tile_bins = thread_tile_bins_[omp_get_thread_num()];
+
+		#pragma omp for schedule(static)
+		for(size_t batch_index = 0; batch_index < batches_.size(); ++batch_index)
+		{
+			project_batch(batches_[batch_index], tile_bins);
+		}
+	}
+
+	// One tile per thread, tiles write to disjoint parts of the id buffer.
+	#pragma omp parallel
+	{
+		std::vector<float> depth_buffer(tile_size * tile_size);
+
+		#pragma omp for schedule(dynamic)
+		for(size_t tile_index = 0; tile_index < num_tiles_x_ * num_tiles_y_; ++tile_index)
+		{
+			rasterize_tile(tile_index, depth_buffer);
+		}
+	}
+}
+
+void id_buffer_rasterizer::
+project_batch(const surfel_batch& batch, std::vector<std::vector<uint32_t>>& tile_bins)
+{
+	// Combine model and view transformation into one affine 3x4 matrix.
+	const scm::math::vec4f origin = batch.model_matrix * scm::math::vec4f(0.0f, 0.0f, 0.0f, 1.0f);
+	const scm::math::vec4f axes[3] = {batch.model_matrix * scm::math::vec4f(1.0f, 0.0f, 0.0f, 0.0f),
+									batch.model_matrix * scm::math::vec4f(0.0f, 1.0f, 0.0f, 0.0f),
+									batch.model_matrix * scm::math::vec4f(0.0f, 0.0f, 1.0f, 0.0f)};
+	const scm::math::vec3d view_axes[3] = {right_dir_, up_dir_, look_dir_};
+	const scm::math::vec3d offset = scm::math::vec3d(origin.x, origin.y, origin.z) - position_;
+
+	float view_matrix[3][4];
+	for(size_t row = 0; row < 3; ++row)
+	{
+		for(size_t column = 0; column < 3; ++column)
+		{
+			view_matrix[row][column] = float(scm::math::dot(view_axes[row], scm::math::vec3d(axes[column].x, axes[column].y, axes[column].z)));
+		}
+		view_matrix[row][3] = float(scm::math::dot(view_axes[row], offset));
+	}
+
+	const float radius_scale = batch.radius_scale * scm::math::length(scm::math::vec3f(axes[0].x, axes[0].y, axes[0].z));
+	const float pixel_scale = float(focal_length_ * 0.5 * height_);
+	const float half_width = 0.5f * float(width_);
+	const float half_height = 0.5f * float(height_);
+	const float near_plane = float(near_plane_);
+	const float far_plane = float(far_plane_);
+
+	for(size_t surfel_index = 0; surfel_index < batch.num_surfels; ++surfel_index)
+	{
+		const lamure::ren::dataset::serialized_surfel& surfel = batch.surfels[surfel_index];
+		if(surfel.size <= 0.0f)
+		{
+			continue;
+		}
+
+		const float x = view_matrix[0][0] * surfel.x + view_matrix[0][1] * surfel.y + view_matrix[0][2] * surfel.z + view_matrix[0][3];
+		const float y = view_matrix[1][0] * surfel.x + view_matrix[1][1] * surfel.y + view_matrix[1][2] * surfel.z + view_matrix[1][3];
+		const float z = view_matrix[2][0] * surfel.x + view_matrix[2][1] * surfel.y + view_matrix[2][2] * surfel.z + view_matrix[2][3];
+
+		if(z < near_plane || z > far_plane)
+		{
+			continue;
+		}
+
+		const float scale = pixel_scale / z;
+		splat current_splat;
+		current_splat.x = half_width + x * scale;
+		current_splat.y = half_height + y * scale;
+		current_splat.radius = std::max(surfel.size * radius_scale * scale, min_splat_radius);
+		current_splat.depth = z;
+		current_splat.id = batch.id;
+
+		if(current_splat.x + current_splat.radius < 0.0f || current_splat.x - current_splat.radius >= float(width_) ||
+			current_splat.y + current_splat.radius < 0.0f || current_splat.y - current_splat.radius >= float(height_))
+		{
+			continue;
+		}
+
+		const uint32_t splat_index = uint32_t(batch.first_splat + surfel_index);
+		splats_[splat_index] = current_splat;
+
+		const size_t first_tile_x = size_t(std::max(0.0f, current_splat.x - current_splat.radius)) / tile_size;
+		const size_t first_tile_y = size_t(std::max(0.0f, current_splat.y - current_splat.radius)) / tile_size;
+		const size_t last_tile_x = std::min(size_t(current_splat.x + current_splat.radius) / tile_size, num_tiles_x_ - 1);
+		const size_t last_tile_y = std::min(size_t(current_splat.y + current_splat.radius) / tile_size, num_tiles_y_ - 1);
+
+		for(size_t tile_y = first_tile_y; tile_y <= last_tile_y; ++tile_y)
+		{
+			for(size_t tile_x = first_tile_x; tile_x <= last_tile_x; ++tile_x)
+			{
+				tile_bins[tile_y * num_tiles_x_ + tile_x].push_back(splat_index);
+			}
+		}
+	}
+}
+
+void id_buffer_rasterizer::
+rasterize_tile(const size_t& tile_index, std::vector<float>& depth_buffer)
+{
+	const size_t tile_min_x = (tile_index % num_tiles_x_) * tile_size;
+	const size_t tile_min_y = (tile_index / num_tiles_x_) * tile_size;
+	const size_t tile_width = std::min(tile_size, width_ - tile_min_x);
+	const size_t tile_height = std::min(tile_size, height_ - tile_min_y);
+
+	std::fill(depth_buffer.begin(), depth_buffer.end(), std::numeric_limits<float>::max());
+	for(size_t row = 0; row < tile_height; ++row)
+	{
+		uint32_t* id_row = &id_buffer_[(tile_min_y + row) * width_ + tile_min_x];
+		std::fill(id_row, id_row + tile_width, 0);
+	}
+
+	for(const std::vector<std::vector<uint32_t>>& tile_bins : thread_tile_bins_)
+	{
+		for(uint32_t splat_index : tile_bins[tile_index])
+		{
+			const splat& current_splat = splats_[splat_index];
+			const float radius_sqr = current_splat.radius * current_splat.radius;
+
+			// Covered pixel range in tile coordinates.
+			const float local_x = current_splat.x - float(tile_min_x);
+			const float local_y = current_splat.y - float(tile_min_y);
+			const int first_x = std::max(int(std::floor(local_x - current_splat.radius)), 0);
+			const int first_y = std::max(int(std::floor(local_y - current_splat.radius)), 0);
+			const int last_x = std::min(int(std::ceil(local_x + current_splat.radius)), int(tile_width) - 1);
+			const int last_y = std::min(int(std::ceil(local_y + current_splat.radius)), int(tile_height) - 1);
+
+			for(int y = first_y; y <= last_y; ++y)
+			{
+				const float delta_y = (float(y) + 0.5f) - local_y;
+				const float delta_y_sqr = delta_y * delta_y;
+				float* depth_row = &depth_buffer[y * tile_size];
+				uint32_t* id_row = &id_buffer_[(tile_min_y + y) * width_ + tile_min_x];
+
+				// Branchless so the compiler can vectorize the depth test over the row.
+				for(int x = first_x; x <= last_x; ++x)
+				{
+					const float delta_x = (float(x) + 0.5f) - local_x;
+					const bool covered = (delta_x * delta_x + delta_y_sqr <= radius_sqr) & (current_splat.depth < depth_row[x]);
+					depth_row[x] = covered ? current_splat.depth : depth_row[x];
+					id_row[x] = covered ? current_splat.id : id_row[x];
+				}
+			}
+		}
+	}
+}
+
+id_histogram id_buffer_rasterizer::
+create_node_id_histogram() const
+{
+	id_histogram hist;
+	hist.create(id_buffer_.data(), id_buffer_.size());
+	return hist;
+}
+
+const std::vector<uint32_t>& id_buffer_rasterizer::
+get_id_buffer() const
+{
+	return id_buffer_;
+}
+
+size_t id_buffer_rasterizer::
+get_width() const
+{
+	return width_;
+}
+
+size_t id_buffer_rasterizer::
+get_height() const
+{
+	return height_;
+}
+
+}
+}
@@ -0,0 +1,193 @@
+// Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
+// This Software is distributed under the Modified BSD License, see license.txt.
+//
+// Virtual Reality and Visualization Research Group
+// Faculty of Media, Bauhaus-Universitaet Weimar
+// http://www.uni-weimar.de/medien/vr
+
+#include "lamure/pvs/visibility_propagation.h"
+
+#include <iostream>
+
+#include <boost/dynamic_bitset.hpp>
+
+#include <lamure/bounding_box.h>
+#include <lamure/ren/bvh.h>
+#include <lamure/ren/model_database.h>
+
+namespace lamure
+{
+namespace pvs
+{
+
+void visibility_propagation::
+check_for_nodes_within_cells(grid* visibility_grid, const std::vector<std::vector<size_t>>& total_depths, const std::vector<std::vector<size_t>>& total_nums)
+{
+    const model_t num_models = total_depths.size();
+    const long num_cells = visibility_grid->get_cell_count();
+
+    // Cells are independent of each other and only write their own visibility data.
+    #pragma omp parallel for schedule(dynamic, 16)
+    for(long cell_index = 0; cell_index < num_cells; ++cell_index)
+    {
+        std::vector<size_t> cell_total_depths(num_models);
+        std::vector<size_t> cell_total_nums(num_models);
+
+        for(model_t model_index = 0; model_index < num_models; ++model_index)
+        {
+            cell_total_depths[model_index] = total_depths[model_index][cell_index];
+            cell_total_nums[model_index] = total_nums[model_index][cell_index];
+        }
+
+        check_for_nodes_within_cell(visibility_grid, cell_index, cell_total_depths, cell_total_nums);
+    }
+}
+
+void visibility_propagation::
+check_for_nodes_within_cell(grid* visibility_grid, const size_t& cell_index, const std::vector<size_t>& total_depths, const std::vector<size_t>& total_nums)
+{
+    lamure::ren::model_database* database = lamure::ren::model_database::get_instance();
+
+    // Create bounding box of view cell.
+    const view_cell* current_cell = visibility_grid->get_cell_at_index(cell_index);
+
+    vec3r min_vertex(current_cell->get_position_center() - (current_cell->get_size() * 0.5f));
+    vec3r max_vertex(current_cell->get_position_center() + (current_cell->get_size() * 0.5f));
+    bounding_box cell_bounds(min_vertex, max_vertex);
+
+    for(model_t model_index = 0; model_index < database->num_models(); ++model_index)
+    {
+        const lamure::ren::bvh* bvh = database->get_model(model_index)->get_bvh();
+
+        // We can get the first and last index of the nodes on a certain depth inside the bvh.
+        unsigned int average_depth = total_depths[model_index] / total_nums[model_index];
+
+        node_t start_index = bvh->get_first_node_id_of_depth(average_depth);
+        node_t end_index = start_index + bvh->get_length_of_depth(average_depth);
+
+        for(node_t node_index = start_index; node_index < end_index; ++node_index)
+        {
+            // Create bounding box of node.
+            const scm::gl::boxf& node_bounding_box = bvh->get_bounding_boxes()[node_index];
+            vec3r min_vertex = vec3r(node_bounding_box.min_vertex()) + bvh->get_translation();
+            vec3r max_vertex = vec3r(node_bounding_box.max_vertex()) + bvh->get_translation();
+            bounding_box node_bounds(min_vertex, max_vertex);
+
+            // check if the bounding boxes collide.
+            if(cell_bounds.intersects(node_bounds))
+            {
+                visibility_grid->set_cell_visibility(cell_index, model_index, node_index, true);
+            }
+        }
+    }
+}
+
+void visibility_propagation::
+emit_node_visibility(grid* visibility_grid)
+{
+    const long num_cells = visibility_grid->get_cell_count();
+
+    long cells_finished = 0;
+
+    // Advance node visibility downwards and upwards in the LOD-hierarchy.
+    // Since only a single LOD-level was rendered in the visibility test, this is necessary to produce a complete PVS.
+    #pragma omp parallel for schedule(dynamic, 16)
+    for(long cell_index = 0; cell_index < num_cells; ++cell_index)
+    {
+        emit_node_visibility(visibility_grid, cell_index);
+
+        long current_cells_finished;
+
+        #pragma omp atomic capture
+        current_cells_finished = ++cells_finished;
+
+        // Calculate current node propagation state so user gets visual feedback on the preprocessing progress.
+        if(current_cells_finished % 256 == 0 || current_cells_finished == num_cells)
+        {
+            #pragma omp critical
+            {
+                float current_percentage_done = ((float)current_cells_finished / (float)num_cells) * 100.0f;
+                std::cout << "\rvisibility propagation in progress [" << current_percentage_done << "]       " << std::flush;
+            }
+        }
+    }
+
+    std::cout << std::endl;
+}
+
+void visibility_propagation::
+emit_node_visibility(grid* visibility_grid, const size_t& cell_index)
+{
+    lamure::ren::model_database* database = lamure::ren::model_database::get_instance();
+    const view_cell* current_cell = visibility_grid->get_cell_at_index(cell_index);
+
+    // The propagation works on a copy of the visibility bitset of each model, so only the newly visible nodes are written back to the grid.
+    for(model_t model_index = 0; model_index < database->num_models(); ++model_index)
+    {
+        const lamure::ren::bvh* bvh = database->get_model(model_index)->get_bvh();
+        const node_t num_nodes = bvh->get_num_nodes();
+
+        boost::dynamic_bitset<> rendered_nodes = current_cell->get_bitset(model_index);
+        rendered_nodes.resize(num_nodes);
+
+        if(rendered_nodes.none())
+        {
+            continue;
+        }
+
+        boost::dynamic_bitset<> visible_nodes = propagate_node_visibility(bvh, rendered_nodes);
+        boost::dynamic_bitset<> new_nodes = visible_nodes - rendered_nodes;
+
+        if(new_nodes.none())
+        {
+            continue;
+        }
+
+        // Performance improving hack. Instantly allocates memory.
+        visibility_grid->set_cell_visibility(cell_index, model_index, num_nodes - 1, visible_nodes[num_nodes - 1]);
+
+        for(size_t node_index = new_nodes.find_first(); node_index != boost::dynamic_bitset<>::npos; node_index = new_nodes.find_next(node_index))
+        {
+            visibility_grid->set_cell_visibility(cell_index, model_index, node_index, true);
+        }
+    }
+}
+
+boost::dynamic_bitset<> visibility_propagation::
+propagate_node_visibility(const lamure::ren::bvh* bvh, const boost::dynamic_bitset<>& rendered_nodes)
+{
+    const node_t num_nodes = rendered_nodes.size();
+    const uint32_t fan_factor = bvh->get_fan_factor();
+
+    boost::dynamic_bitset<> visible_nodes(rendered_nodes);
+
+    // Set children of visible nodes visible, too.
+    // Children always have larger ids than their parents, so a single ascending pass reaches all descendants.
+    for(size_t node_index = visible_nodes.find_first(); node_index != boost::dynamic_bitset<>::npos; node_index = visible_nodes.find_next(node_index))
+    {
+        node_t first_child_id = bvh->get_child_id(node_index, 0);
+
+        for(node_t child_id = first_child_id; child_id < first_child_id + fan_factor && child_id < num_nodes; ++child_id)
+        {
+            visible_nodes.set(child_id);
+        }
+    }
+
+    // Set parents of rendered nodes visible, too.
+    // Walking up stops at the first visible parent, since all of its ancestors were already set by then.
+    for(size_t node_index = rendered_nodes.find_first(); node_index != boost::dynamic_bitset<>::npos; node_index = rendered_nodes.find_next(node_index))
+    {
+        node_t parent_id = bvh->get_parent_id(node_index);
+
+        while(parent_id != lamure::invalid_node_t && !visible_nodes[parent_id])
+        {
+            visible_nodes.set(parent_id);
+            parent_id = bvh->get_parent_id(parent_id);
+        }
+    }
+
+    return visible_nodes;
+}
+
+}
+}
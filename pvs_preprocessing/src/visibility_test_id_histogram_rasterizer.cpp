@@ -0,0 +1,498 @@
+// Copyright (c) 2014-2018 Bauhaus-Universitaet Weimar
+// This Software is distributed under the Modified BSD License, see license.txt.
+//
+// Virtual Reality and Visualization Research Group
+// Faculty of Media, Bauhaus-Universitaet Weimar
+// http://www.uni-weimar.de/medien/vr
+
+#include "lamure/pvs/visibility_test_id_histogram_rasterizer.h"
+#include "lamure/pvs/visibility_propagation.h"
+#include "lamure/pvs/utils.h"
+#include "lamure/pvs/pvs_database.h"
+
+#include <lamure/ren/config.h>
+#include <lamure/ren/bvh.h>
+#include <lamure/ren/model_database.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+
+namespace lamure
+{
+namespace pvs
+{
+
+visibility_test_id_histogram_rasterizer::
+visibility_test_id_histogram_rasterizer()
+{
+	resolution_x_ = 1024;
+	resolution_y_ = 1024;
+	main_memory_budget_ = 4096;
+
+	error_threshold_ = LAMURE_DEFAULT_THRESHOLD;
+	visibility_threshold_ = 0.0001f;
+	importance_ = 1.0f;
+	far_plane_ = 1000.0f;
+
+	initialized_ = false;
+	node_cache_size_in_bytes_ = 0;
+}
+
+visibility_test_id_histogram_rasterizer::
+~visibility_test_id_histogram_rasterizer()
+{
+	shutdown();
+}
+
+int visibility_test_id_histogram_rasterizer::
+initialize(int& argc, char** argv)
+{
+	namespace po = boost::program_options;
+	namespace fs = boost::filesystem;
+
+	const std::string exec_name = (argc > 0) ? fs::basename(argv[0]) : "";
+
+	std::string resource_file_path = "";
+
+	// These value are read, but not used. Yet ignoring them in the terminal parameters would lead to misinterpretation.
+	std::string pvs_output_file_path = "";
+	std::string visibility_test_type = "";
+	std::string grid_type = "";
+	unsigned int grid_size = 1;
+	unsigned int num_steps = 11;
+	double oversize_factor = 1.5;
+	float optimization_threshold = 1.0f;
+	unsigned int video_memory_budget = 2048;
+	unsigned int max_upload_budget = 64;
+
+	po::options_description desc("Usage: " + exec_name + " [OPTION]... INPUT\n\n"
+								"Allowed Options");
+	desc.add_options()
+		("help", "print help message")
+		("width,w", po::value<int>(&resolution_x_)->default_value(1024), "specify id buffer width (default=1024)")
+		("height,h", po::value<int>(&resolution_y_)->default_value(1024), "specify id buffer height (default=1024)")
+		("resource-file,f", po::value<std::string>(&resource_file_path), "specify resource input-file")
+		("mem,m", po::value<unsigned>(&main_memory_budget_)->default_value(4096), "specify main memory budget for surfel data in MB (default=4096)")
+	// Only used by the GPU visibility tests, accepted so the same command lines can be used for all tests.
+		("vram,v", po::value<unsigned>(&video_memory_budget)->default_value(2048), "ignored by this visibility test")
+		("upload,u", po::value<unsigned>(&max_upload_budget)->default_value(64), "ignored by this visibility test")
+	// The following parameters are used by the main app only, yet must be identified nonetheless since otherwise they are dealt with as file paths.
+		("pvs-file,p", po::value<std::string>(&pvs_output_file_path), "specify output file of calculated pvs data")
+		("vistest", po::value<std::string>(&visibility_test_type)->default_value("cpu"), "specify type of visibility test to be used.")
+		("gridtype", po::value<std::string>(&grid_type)->default_value("octree"), "specify type of grid to store visibility data ('regular', 'octree', 'hierarchical')")
+		("gridsize", po::value<unsigned int>(&grid_size)->default_value(1), "specify size/depth of the grid used for the visibility test (depends on chosen grid type)")
+		("oversize", po::value<double>(&oversize_factor)->default_value(1.5), "factor the grid bounds will be scaled by, default is 1.5 (grid bounds will exceed scene bounds by factor of 1.5)")
+		("optithresh", po::value<float>(&optimization_threshold)->default_value(1.0f), "specify the threshold at which common data are converged. Default is 1.0, which means data must be 100 percent equal.")
+		("numsteps,n", po::value<unsigned int>(&num_steps)->default_value(11), "specify the number of intervals the occlusion values will be split into (visibility analysis only)");
+		;
+
+	po::variables_map vm;
+
+	try
+	{
+		auto parsed_options = po::command_line_parser(argc, argv).options(desc).allow_unregistered().run();
+		po::store(parsed_options, vm);
+		po::notify(vm);
+
+		std::vector<std::string> to_pass_further = po::collect_unrecognized(parsed_options.options, po::include_positional);
+		bool no_input = !vm.count("input") && to_pass_further.empty();
+
+		if (resource_file_path == "")
+		{
+			if (vm.count("help") || no_input)
+			{
+				std::cout << desc;
+				return 0;
+			}
+		}
+
+		// no explicit input -> use unknown options
+		if (!vm.count("input") && resource_file_path == "")
+		{
+			resource_file_path = "auto_generated.rsc";
+			std::fstream ofstr(resource_file_path, std::ios::out);
+			if (ofstr.good())
+			{
+				for (auto argument : to_pass_further)
+				{
+					ofstr << argument << std::endl;
+				}
+			}
+			else
+			{
+				throw std::runtime_error("Cannot open file");
+			}
+			ofstr.close();
+		}
+	}
+	catch (std::exception& e)
+	{
+		std::cout << "Warning: No input file specified. \n" << desc;
+		return 0;
+	}
+
+	std::pair< std::vector<std::string>, std::vector<scm::math::mat4f> > model_attributes;
+	std::set<lamure::model_t> visible_set;
+	model_attributes = read_model_string(resource_file_path, &visible_set, &invisible_set_);
+
+	model_transformations_ = model_attributes.second;
+	std::vector<std::string> const& model_filenames = model_attributes.first;
+
+	lamure::pvs::pvs_database::get_instance()->activate(false);
+
+	lamure::ren::model_database* database = lamure::ren::model_database::get_instance();
+	for (lamure::model_t model_index = 0; model_index < model_filenames.size(); ++model_index)
+	{
+		database->add_model(model_filenames[model_index], std::to_string(model_index));
+	}
+
+	float scene_diameter = far_plane_;
+	for (lamure::model_t model_id = 0; model_id < database->num_models(); ++model_id)
+	{
+		const lamure::ren::bvh* bvh = database->get_model(model_id)->get_bvh();
+		const auto& bb = bvh->get_bounding_boxes()[0];
+		scene_diameter = std::max(scm::math::length(bb.max_vertex()-bb.min_vertex()), scene_diameter);
+		model_transformations_[model_id] = model_transformations_[model_id] * scm::math::make_translation(bvh->get_translation());
+
+		if (bvh->get_primitive() != lamure::ren::bvh::primitive_type::POINTCLOUD)
+		{
+			std::cout << "Warning: model " << model_filenames[model_id] << " is no point cloud and will be ignored by the visibility test." << std::endl;
+			invisible_set_.insert(model_id);
+		}
+
+		// Surfel data is read from the lod file next to the bvh file.
+		std::string bvh_filename = bvh->get_filename();
+		std::string base_name = bvh_filename.substr(0, bvh_filename.find_last_of(".") + 1);
+		std::string file_extension = bvh_filename.substr(base_name.size());
+		std::string bvh_suffix = file_extension.substr(3);
+
+		lod_streams_.emplace_back(new lamure::ren::lod_stream());
+		lod_streams_.back()->open(base_name + "lod" + bvh_suffix);
+	}
+	far_plane_ = 2.0f * scene_diameter;
+
+	// Calculate bounding box of whole scene.
+	for(lamure::model_t model_id = 0; model_id < database->num_models(); ++model_id)
+	{
+		// Cast required from boxf to bounding_box.
+		const scm::gl::boxf& box_model_root = database->get_model(model_id)->get_bvh()->get_bounding_boxes()[0];
+		vec3r min_vertex(box_model_root.min_vertex() + database->get_model(model_id)->get_bvh()->get_translation());
+		vec3r max_vertex(box_model_root.max_vertex() + database->get_model(model_id)->get_bvh()->get_translation());
+		bounding_box model_root_box(min_vertex, max_vertex);
+
+		if(model_id == 0)
+		{
+			scene_bounds_ = bounding_box(model_root_box);
+		}
+		else
+		{
+			scene_bounds_.expand(model_root_box);
+		}
+	}
+
+	initialized_ = true;
+	return 0;
+}
+
+void visibility_test_id_histogram_rasterizer::
+test_visibility(grid* visibility_grid)
+{
+	if(!initialized_)
+	{
+		return;
+	}
+
+	const model_t num_models = lamure::ren::model_database::get_instance()->num_models();
+	const size_t num_cells = visibility_grid->get_cell_count();
+
+	// Used to identify the depth of nodes for the check which nodes are inside the grid cells. (model id<grid cell id<data>>)
+	std::vector<std::vector<size_t>> total_depths(num_models, std::vector<size_t>(num_cells, 0));
+	std::vector<std::vector<size_t>> total_nums(num_models, std::vector<size_t>(num_cells, 0));
+
+	id_buffer_rasterizer rasterizer(resolution_x_, resolution_y_);
+	std::vector<size_t> cell_total_depths(num_models);
+	std::vector<size_t> cell_total_nums(num_models);
+
+	for(size_t cell_index = 0; cell_index < num_cells; ++cell_index)
+	{
+		test_cell_visibility(visibility_grid, cell_index, rasterizer, cell_total_depths, cell_total_nums);
+
+		for(model_t model_id = 0; model_id < num_models; ++model_id)
+		{
+			total_depths[model_id][cell_index] = cell_total_depths[model_id];
+			total_nums[model_id][cell_index] = cell_total_nums[model_id];
+		}
+
+		// Calculate current rendering state so user gets visual feedback on the preprocessing progress.
+		float current_percentage_done = ((float)(cell_index + 1) / (float)num_cells) * 100.0f;
+		std::cout << "\rrasterization in progress [" << current_percentage_done << "]       " << std::flush;
+	}
+	std::cout << std::endl;
+
+	node_cache_.clear();
+	node_cache_size_in_bytes_ = 0;
+
+	// Calculate which nodes are inside the view cells based on the average depth of the nodes inside the cuts.
+	std::cout << "start check for nodes inside grid cells..." << std::endl;
+	visibility_propagation::check_for_nodes_within_cells(visibility_grid, total_depths, total_nums);
+	std::cout << "node check finished" << std::endl;
+
+	// Hardcoded heresy. This grid type applies visibility propagation at runtime.
+	if(visibility_grid->get_grid_type() != "octree_hierarchical_v3")
+	{
+		// Set visibility of LOD-trees based on rendered nodes.
+		std::cout << "start visibility propagation..." << std::endl;
+		visibility_propagation::emit_node_visibility(visibility_grid);
+		std::cout << "visibility propagation finished" << std::endl;
+	}
+}
+
+bool visibility_test_id_histogram_rasterizer::
+test_visibility_streamed(grid* visibility_grid, pvs_stream_writer* writer)
+{
+	if(!initialized_)
+	{
+		return false;
+	}
+
+	const model_t num_models = lamure::ren::model_database::get_instance()->num_models();
+	const size_t num_cells = visibility_grid->get_cell_count();
+
+	id_buffer_rasterizer rasterizer(resolution_x_, resolution_y_);
+	std::vector<size_t> cell_total_depths(num_models);
+	std::vector<size_t> cell_total_nums(num_models);
+
+	// Each cell is completed including node check and propagation before it is handed to the writer.
+	for(size_t cell_index = 0; cell_index < num_cells; ++cell_index)
+	{
+		if(writer->is_cell_written(cell_index))
+		{
+			continue;
+		}
+
+		test_cell_visibility(visibility_grid, cell_index, rasterizer, cell_total_depths, cell_total_nums);
+		visibility_propagation::check_for_nodes_within_cell(visibility_grid, cell_index, cell_total_depths, cell_total_nums);
+
+		// Hardcoded heresy. This grid type applies visibility propagation at runtime.
+		if(visibility_grid->get_grid_type() != "octree_hierarchical_v3")
+		{
+			visibility_propagation::emit_node_visibility(visibility_grid, cell_index);
+		}
+
+		writer->add_finished_cell(cell_index);
+
+		// Calculate current rendering state so user gets visual feedback on the preprocessing progress.
+		float current_percentage_done = ((float)(cell_index + 1) / (float)num_cells) * 100.0f;
+		std::cout << "\rrasterization in progress [" << current_percentage_done << "]       " << std::flush;
+	}
+	std::cout << std::endl;
+
+	node_cache_.clear();
+	node_cache_size_in_bytes_ = 0;
+
+	writer->flush();
+	return true;
+}
+
+void visibility_test_id_histogram_rasterizer::
+test_cell_visibility(grid* visibility_grid, const size_t& cell_index, id_buffer_rasterizer& rasterizer, std::vector<size_t>& total_depths, std::vector<size_t>& total_nums)
+{
+	const model_t num_models = lamure::ren::model_database::get_instance()->num_models();
+	const view_cell* current_cell = visibility_grid->get_cell_at_index(cell_index);
+
+	const double opening_angle = 90.0;
+	const size_t cache_budget_in_bytes = size_t(main_memory_budget_) * 1024 * 1024;
+
+	std::fill(total_depths.begin(), total_depths.end(), 0);
+	std::fill(total_nums.begin(), total_nums.end(), 0);
+
+	// Same six views as used by the GPU visibility test.
+	for(unsigned short direction_index = 0; direction_index < 6; ++direction_index)
+	{
+		scm::math::vec3d look_dir;
+		scm::math::vec3d up_dir(0.0, 1.0, 0.0);
+		double near_plane = 0.01;
+
+		switch(direction_index)
+		{
+			case 0:
+				look_dir = scm::math::vec3d(1.0, 0.0, 0.0);
+				near_plane = current_cell->get_size().x * 0.5;
+				break;
+
+			case 1:
+				look_dir = scm::math::vec3d(-1.0, 0.0, 0.0);
+				near_plane = current_cell->get_size().x * 0.5;
+				break;
+
+			case 2:
+				look_dir = scm::math::vec3d(0.0, 1.0, 0.0);
+				up_dir = scm::math::vec3d(0.0, 0.0, 1.0);
+				near_plane = current_cell->get_size().y * 0.5;
+				break;
+
+			case 3:
+				look_dir = scm::math::vec3d(0.0, -1.0, 0.0);
+				up_dir = scm::math::vec3d(0.0, 0.0, 1.0);
+				near_plane = current_cell->get_size().y * 0.5;
+				break;
+
+			case 4:
+				look_dir = scm::math::vec3d(0.0, 0.0, 1.0);
+				near_plane = current_cell->get_size().z * 0.5;
+				break;
+
+			case 5:
+				look_dir = scm::math::vec3d(0.0, 0.0, -1.0);
+				near_plane = current_cell->get_size().z * 0.5;
+				break;
+
+			default:
+				break;
+		}
+
+		rasterizer.set_view(current_cell->get_position_center(), look_dir, up_dir, opening_angle, near_plane, far_plane_);
+
+		// Cached surfels are referenced by the rasterizer until the view is done, so only flush in between views.
+		if(node_cache_size_in_bytes_ > cache_budget_in_bytes)
+		{
+			node_cache_.clear();
+			node_cache_size_in_bytes_ = 0;
+		}
+
+		rasterizer.clear();
+		for(model_t model_id = 0; model_id < num_models; ++model_id)
+		{
+			add_cut_to_rasterizer(model_id, current_cell->get_position_center(), look_dir, opening_angle, rasterizer,
+								total_depths[model_id], total_nums[model_id]);
+		}
+		rasterizer.rasterize();
+
+		id_histogram hist = rasterizer.create_node_id_histogram();
+		std::map<model_t, std::vector<node_t>> visible_ids = hist.get_visible_nodes(resolution_x_ * resolution_y_, visibility_threshold_);
+
+		for(std::map<model_t, std::vector<node_t>>::iterator iter = visible_ids.begin(); iter != visible_ids.end(); ++iter)
+		{
+			for(node_t node_id : iter->second)
+			{
+				visibility_grid->set_cell_visibility(cell_index, iter->first, node_id, true);
+			}
+		}
+	}
+}
+
+void visibility_test_id_histogram_rasterizer::
+add_cut_to_rasterizer(const model_t& model_id, const scm::math::vec3d& position, const scm::math::vec3d& look_dir, const double& opening_angle,
+						id_buffer_rasterizer& rasterizer, size_t& total_depth, size_t& total_num)
+{
+	const lamure::ren::bvh* bvh = lamure::ren::model_database::get_instance()->get_model(model_id)->get_bvh();
+	const scm::math::mat4f& model_matrix = model_transformations_[model_id];
+	const bool rasterize_model = invisible_set_.find(model_id) == invisible_set_.end();
+
+	// Same screen space error as used by the cut update, see cut_update_pool::calculate_node_error().
+	const scm::math::vec4f x_axis = model_matrix * scm::math::vec4f(1.0f, 0.0f, 0.0f, 0.0f);
+	const double radius_scaling = scm::math::length(scm::math::vec3d(x_axis.x, x_axis.y, x_axis.z));
+	const double pixels_per_unit_at_unit_depth = double(resolution_y_) / std::tan(opening_angle * 0.5 * M_PI / 180.0);
+	const double error_threshold = error_threshold_ / importance_;
+
+	std::vector<node_t> node_stack(1, 0);
+	while(!node_stack.empty())
+	{
+		const node_t node_id = node_stack.back();
+		node_stack.pop_back();
+
+		const bool in_view = rasterizer.is_box_in_view(bvh->get_bounding_box(node_id), model_matrix);
+		const node_t first_child_id = bvh->get_child_id(node_id, 0);
+
+		if(in_view && first_child_id < bvh->get_num_nodes())
+		{
+			double node_error = std::numeric_limits<double>::max();
+
+			if(bvh->get_depth_of_node(node_id) > bvh->get_min_lod_depth())
+			{
+				const scm::math::vec3f& centroid = bvh->get_centroid(node_id);
+				const scm::math::vec4f world_centroid = model_matrix * scm::math::vec4f(centroid.x, centroid.y, centroid.z, 1.0f);
+				const double view_depth = std::abs(scm::math::dot(scm::math::vec3d(world_centroid.x, world_centroid.y, world_centroid.z) - position, look_dir));
+
+				if(view_depth > 0.0)
+				{
+					node_error = bvh->get_avg_primitive_extent(node_id) * radius_scaling * pixels_per_unit_at_unit_depth / view_depth;
+				}
+			}
+
+			if(node_error > error_threshold)
+			{
+				for(uint32_t child_index = 0; child_index < bvh->get_fan_factor(); ++child_index)
+				{
+					node_stack.push_back(first_child_id + child_index);
+				}
+				continue;
+			}
+		}
+
+		// Node is part of the cut.
+		total_depth += bvh->get_depth_of_node(node_id);
+		++total_num;
+
+		if(in_view && rasterize_model)
+		{
+			const std::vector<lamure::ren::dataset::serialized_surfel>& surfels = load_node(model_id, node_id);
+			rasterizer.add_surfels(model_id, node_id, surfels.data(), surfels.size(), model_matrix, importance_);
+		}
+	}
+}
+
+const std::vector<lamure::ren::dataset::serialized_surfel>& visibility_test_id_histogram_rasterizer::
+load_node(const model_t& model_id, const node_t& node_id)
+{
+	std::pair<model_t, node_t> key(model_id, node_id);
+	auto cache_iter = node_cache_.find(key);
+
+	if(cache_iter != node_cache_.end())
+	{
+		return cache_iter->second;
+	}
+
+	const size_t node_size_in_bytes = lamure::ren::model_database::get_instance()->get_node_size(model_id);
+
+	std::vector<lamure::ren::dataset::serialized_surfel>& surfels = node_cache_[key];
+	surfels.resize(node_size_in_bytes / sizeof(lamure::ren::dataset::serialized_surfel));
+	lod_streams_[model_id]->read((char*)surfels.data(), node_id * node_size_in_bytes, node_size_in_bytes);
+
+	node_cache_size_in_bytes_ += node_size_in_bytes;
+	return surfels;
+}
+
+void visibility_test_id_histogram_rasterizer::
+shutdown()
+{
+	if (initialized_)
+	{
+		for(auto& stream : lod_streams_)
+		{
+			stream->close();
+		}
+		lod_streams_.clear();
+		node_cache_.clear();
+		node_cache_size_in_bytes_ = 0;
+
+		delete lamure::pvs::pvs_database::get_instance();
+		delete lamure::ren::model_database::get_instance();
+
+		initialized_ = false;
+	}
+}
+
+bounding_box visibility_test_id_histogram_rasterizer::
+get_scene_bounds() const
+{
+	return scene_bounds_;
+}
+
+}
+}
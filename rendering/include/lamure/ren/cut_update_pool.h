@@ -13,6 +13,7 @@
 #include <lamure/semaphore.h>
 
 #include <lamure/utils.h>
+#include <tuple>
 #include <vector>
 
 #include <lamure/ren/cut_database.h>
@@ -27,6 +28,8 @@
 #include <lamure/ren/gpu_cache.h>
 #include <lamure/ren/ooc_cache.h>
 
+#include <boost/dynamic_bitset.hpp>
+
 namespace lamure
 {
 namespace ren
@@ -55,6 +58,13 @@ class cut_update_pool
     const bool is_node_in_frustum(const view_t view_id, const model_t model_id, const node_t node_id, const scm::gl::frustum &frustum);
     const bool is_no_node_in_frustum(const view_t view_id, const model_t model_id, const std::vector<node_t> &node_ids, const scm::gl::frustum &frustum);
 
+    // pvs visibility is meant to be hierarchical (parents of visible nodes are visible), subtree collapses do not rely on it
+    const bool is_node_visible_in_pvs(const boost::dynamic_bitset<> *pvs_visibility, const node_t node_id) const;
+    const bool is_any_node_visible_in_pvs(const boost::dynamic_bitset<> *pvs_visibility, const node_t first_node_id, const size_t num_nodes) const;
+    const bool is_any_descendant_visible_in_pvs(const model_t model_id, const boost::dynamic_bitset<> *pvs_visibility, const node_t node_id) const;
+    // hidden_subtrees caches per analysis whether a node and all of its descendants are invisible
+    const node_t find_invisible_subtree_root(const model_t model_id, const boost::dynamic_bitset<> *pvs_visibility, const node_t node_id, std::map<node_t, bool> &hidden_subtrees) const;
+
     const float calculate_node_error(const view_t view_id, const model_t model_id, const node_t node_id);
 
     /*virtual*/ void run();
@@ -128,6 +138,9 @@ class cut_update_pool
     boost::timer::nanosecond_type last_frame_elapsed_;
 #endif
 
+    // cut nodes below the root of an invisible subtree, released when the root is collapsed
+    std::map<std::tuple<view_t, model_t, node_t>, std::vector<node_t>> invisible_subtree_cuts_;
+
     semaphore master_semaphore_;
     bool master_dispatched_;
 };
@@ -347,6 +347,11 @@ void cut_update_pool::cut_master()
         // swap cut index
         index_->swap_cuts();
 
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            invisible_subtree_cuts_.clear();
+        }
+
         assert(semaphore_.num_signals() == 0);
         assert(master_semaphore_.num_signals() == 0);
 
@@ -477,6 +482,13 @@ cut_analysis(view_t view_id, model_t model_id) {
     float min_error_threshold = model_thresholds_[model_id] - 0.1f;
     float max_error_threshold = model_thresholds_[model_id] + 0.1f;
 
+    // one copy of the pvs per analysis, nullptr if all nodes are to be treated visible
+    std::shared_ptr<const boost::dynamic_bitset<>> pvs_visibility_data = pvs->get_viewer_visibility_bitset(model_id);
+    const boost::dynamic_bitset<> *pvs_visibility = pvs_visibility_data.get();
+
+    std::map<node_t, std::vector<node_t>> invisible_subtree_cuts;
+    std::map<node_t, bool> hidden_subtrees;
+
     // cut analysis
     std::set<node_t>::iterator cut_it;
     for(cut_it = old_cut.begin(); cut_it != old_cut.end(); ++cut_it)
@@ -494,6 +506,26 @@ cut_analysis(view_t view_id, model_t model_id) {
         assert(node_id != invalid_node_t);
         assert(node_id < index_->num_nodes(model_id));
 
+        // cut nodes of an invisible subtree are collapsed to its root at once, regardless of error and frustum
+        if (node_id > 0 && !is_node_visible_in_pvs(pvs_visibility, node_id))
+        {
+            node_t subtree_root_id = find_invisible_subtree_root(model_id, pvs_visibility, node_id, hidden_subtrees);
+
+            if (subtree_root_id != node_id)
+            {
+                auto subtree_it = invisible_subtree_cuts.find(subtree_root_id);
+                if (subtree_it == invisible_subtree_cuts.end())
+                {
+                    float subtree_root_error = calculate_node_error(view_id, model_id, subtree_root_id);
+                    index_->push_action(cut_update_index::action(cut_update_index::queue_t::MUST_COLLAPSE, view_id, model_id, subtree_root_id, subtree_root_error), false);
+
+                    subtree_it = invisible_subtree_cuts.insert(std::make_pair(subtree_root_id, std::vector<node_t>())).first;
+                }
+
+                subtree_it->second.push_back(node_id);
+                continue;
+            }
+        }
 
         if (node_id > 0 && node_id < index_->num_nodes(model_id))
         {
@@ -505,15 +537,8 @@ cut_analysis(view_t view_id, model_t model_id) {
             all_siblings_in_cut = is_all_nodes_in_cut(model_id, siblings, old_cut);
             no_sibling_in_frustum = !is_node_in_frustum(view_id, model_id, parent_id, frustum);
 
-            // Check if no sibling is visible via PVS.
-            for(node_t sibling_id : siblings)
-            {
-                if(pvs->get_viewer_visibility(model_id, sibling_id))
-                {
-                    no_sibling_visible_in_pvs = false;
-                    break;
-                }
-            }
+            // Check if no sibling is visible via PVS, siblings have consecutive ids.
+            no_sibling_visible_in_pvs = !is_any_node_visible_in_pvs(pvs_visibility, siblings.front(), siblings.size());
         }
 
         if (!all_siblings_in_cut)
@@ -521,7 +546,7 @@ cut_analysis(view_t view_id, model_t model_id) {
             float node_error = calculate_node_error(view_id, model_id, node_id);
             bool node_in_frustum = is_node_in_frustum(view_id, model_id, node_id, frustum);
 
-            if (node_in_frustum && node_error > max_error_threshold && pvs->get_viewer_visibility(model_id, node_id))
+            if (node_in_frustum && node_error > max_error_threshold && is_node_visible_in_pvs(pvs_visibility, node_id))
             {
                 //only split if the predicted error of children does not require collapsing
                 bool split = true;
@@ -597,7 +622,7 @@ cut_analysis(view_t view_id, model_t model_id) {
                     float sibling_error = calculate_node_error(view_id, model_id, sibling_id);
                     bool sibling_in_frustum = is_node_in_frustum(view_id, model_id, sibling_id, frustum);
 
-                    if (sibling_error > max_error_threshold && sibling_in_frustum && pvs->get_viewer_visibility(model_id, sibling_id))
+                    if (sibling_error > max_error_threshold && sibling_in_frustum && is_node_visible_in_pvs(pvs_visibility, sibling_id))
                     {
                         //only split if the predicted error of children does not require collapsing
                         bool split = true;
@@ -670,6 +695,15 @@ cut_analysis(view_t view_id, model_t model_id) {
         }
     }
 
+    if (!invisible_subtree_cuts.empty())
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto &subtree : invisible_subtree_cuts)
+        {
+            invisible_subtree_cuts_[std::make_tuple(view_id, model_id, subtree.first)] = std::move(subtree.second);
+        }
+    }
+
     master_semaphore_.signal(1);
 }
 
@@ -1288,16 +1322,44 @@ void cut_update_pool::split_node(const cut_update_index::action &action)
 
 void cut_update_pool::collapse_node(const cut_update_index::action &action)
 {
+    // the root of an invisible subtree replaces the cut nodes below it, which may be several levels deeper
+    std::vector<node_t> subtree_cut_ids;
+    bool collapse_subtree = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto subtree_it = invisible_subtree_cuts_.find(std::make_tuple(action.view_id_, action.model_id_, action.node_id_));
+        if(subtree_it != invisible_subtree_cuts_.end())
+        {
+            subtree_cut_ids.swap(subtree_it->second);
+            invisible_subtree_cuts_.erase(subtree_it);
+            collapse_subtree = true;
+        }
+    }
+
+    // a rejected subtree collapse keeps the previous cut nodes instead of the children of the root
+    auto reject = [&]()
+    {
+        if(!collapse_subtree)
+        {
+            index_->reject_action(action);
+            return;
+        }
+        for(const auto &cut_id : subtree_cut_ids)
+        {
+            index_->approve_action(cut_update_index::action(cut_update_index::queue_t::KEEP, action.view_id_, action.model_id_, cut_id, action.error_));
+        }
+    };
+
 #ifdef LAMURE_MESH_MIN_DEPTH_ENABLE
     //prevent collapsing in shallow parts
     const auto bvh = model_database::get_instance()->get_model(action.model_id_)->get_bvh();
     if (bvh->get_primitive() == bvh::primitive_type::TRIMESH) {
       if (bvh->get_min_lod_depth() > 0 && bvh->get_depth_of_node(action.node_id_) <= bvh->get_min_lod_depth()) {
-        index_->reject_action(action);
+        reject();
         return;
       }
       else if (bvh->get_depth_of_node(action.node_id_) <= LAMURE_MESH_MIN_DEPTH) {
-        index_->reject_action(action);
+        reject();
         return;
       }
   }
@@ -1305,24 +1367,111 @@ void cut_update_pool::collapse_node(const cut_update_index::action &action)
     // return if parent is invalid node id
     if(action.node_id_ < 1 || action.node_id_ == invalid_node_t)
     {
-        index_->reject_action(action);
+        reject();
         return;
     }
 
-    std::vector<node_t> child_ids;
-    index_->get_all_children(action.model_id_, action.node_id_, child_ids);
+    std::set<node_t> released_ids;
+    if(collapse_subtree)
+    {
+        // every node between the root and the cut nodes was acquired by a split, all of them are released
+        for(const auto &cut_id : subtree_cut_ids)
+        {
+            node_t node_id = cut_id;
+            while(node_id != invalid_node_t && node_id != action.node_id_ && released_ids.insert(node_id).second)
+            {
+                node_id = index_->get_parent_id(action.model_id_, node_id);
+            }
+        }
+    }
+    else
+    {
+        std::vector<node_t> child_ids;
+        index_->get_all_children(action.model_id_, action.node_id_, child_ids);
+        released_ids.insert(child_ids.begin(), child_ids.end());
+    }
 
     ooc_cache *ooc_cache = ooc_cache::get_instance();
 
-    for(const auto &child_id : child_ids)
+    for(const auto &released_id : released_ids)
     {
-        gpu_cache_->release_node(context_id_, action.view_id_, action.model_id_, child_id);
-        ooc_cache->release_node(context_id_, action.view_id_, action.model_id_, child_id);
+        gpu_cache_->release_node(context_id_, action.view_id_, action.model_id_, released_id);
+        ooc_cache->release_node(context_id_, action.view_id_, action.model_id_, released_id);
     }
 
     index_->approve_action(action);
 }
 
+const bool cut_update_pool::is_node_visible_in_pvs(const boost::dynamic_bitset<> *pvs_visibility, const node_t node_id) const
+{
+    if(pvs_visibility == nullptr)
+        return true;
+
+    return node_id < pvs_visibility->size() && pvs_visibility->test(node_id);
+}
+
+const bool cut_update_pool::is_any_node_visible_in_pvs(const boost::dynamic_bitset<> *pvs_visibility, const node_t first_node_id, const size_t num_nodes) const
+{
+    if(pvs_visibility == nullptr)
+        return true;
+
+    if(first_node_id >= pvs_visibility->size())
+        return false;
+
+    if(pvs_visibility->test(first_node_id))
+        return true;
+
+    // scans whole blocks instead of single bits
+    return pvs_visibility->find_next(first_node_id) < (size_t)first_node_id + num_nodes;
+}
+
+const bool cut_update_pool::is_any_descendant_visible_in_pvs(const model_t model_id, const boost::dynamic_bitset<> *pvs_visibility, const node_t node_id) const
+{
+    if(pvs_visibility == nullptr)
+        return true;
+
+    // the descendants of a node on one level have consecutive ids
+    const size_t fan_factor = index_->fan_factor(model_id);
+    node_t first_node_id = index_->get_child_id(model_id, node_id, 0);
+    size_t num_nodes = fan_factor;
+
+    while(first_node_id != invalid_node_t)
+    {
+        if(is_any_node_visible_in_pvs(pvs_visibility, first_node_id, num_nodes))
+            return true;
+
+        first_node_id = index_->get_child_id(model_id, first_node_id, 0);
+        num_nodes *= fan_factor;
+    }
+
+    return false;
+}
+
+const node_t cut_update_pool::find_invisible_subtree_root(const model_t model_id, const boost::dynamic_bitset<> *pvs_visibility, const node_t node_id, std::map<node_t, bool> &hidden_subtrees) const
+{
+    // highest invisible ancestor without visible descendants, the root node itself is never collapsed.
+    // a visible node below the root would remain in the cut underneath the collapsed root
+    node_t subtree_root_id = node_id;
+    node_t parent_id = index_->get_parent_id(model_id, node_id);
+
+    while(parent_id != invalid_node_t && parent_id > 0)
+    {
+        auto hidden_it = hidden_subtrees.find(parent_id);
+        if(hidden_it == hidden_subtrees.end())
+        {
+            const bool hidden = !is_node_visible_in_pvs(pvs_visibility, parent_id) && !is_any_descendant_visible_in_pvs(model_id, pvs_visibility, parent_id);
+            hidden_it = hidden_subtrees.insert(std::make_pair(parent_id, hidden)).first;
+        }
+        if(!hidden_it->second)
+            break;
+
+        subtree_root_id = parent_id;
+        parent_id = index_->get_parent_id(model_id, parent_id);
+    }
+
+    return subtree_root_id;
+}
+
 const bool cut_update_pool::is_all_nodes_in_cut(const model_t model_id, const std::vector<node_t> &node_ids, const std::set<node_t> &cut)
 {
     for(node_t i = 0; i < node_ids.size(); ++i)